@@ -0,0 +1,91 @@
+#include "Animation.h"
+
+#include <algorithm>
+
+
+// Index of the last key at or before time and the blend factor towards the next one
+static size_t findKey(const std::vector<float>& times, float time, float* factor)
+{
+	auto next = std::upper_bound(times.begin(), times.end(), time);
+	if (next == times.begin())
+	{
+		*factor = 0.0f;
+		return 0;
+	}
+	if (next == times.end())
+	{
+		*factor = 0.0f;
+		return times.size() - 1;
+	}
+
+	const size_t key = static_cast<size_t>(next - times.begin()) - 1;
+	const float span = times[key + 1] - times[key];
+	*factor = span > 0.0f ? (time - times[key]) / span : 0.0f;
+
+	return key;
+}
+
+static glm::vec3 sampleVector(const std::vector<float>& times, const std::vector<glm::vec3>& values, float time, const glm::vec3& identity)
+{
+	if (values.empty())
+	{
+		return identity;
+	}
+
+	float factor;
+	const size_t key = findKey(times, time, &factor);
+	if (factor == 0.0f)
+	{
+		return values[key];
+	}
+
+	return glm::mix(values[key], values[key + 1], factor);
+}
+
+static glm::quat sampleRotation(const std::vector<float>& times, const std::vector<glm::quat>& values, float time)
+{
+	if (values.empty())
+	{
+		return glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	}
+
+	float factor;
+	const size_t key = findKey(times, time, &factor);
+	if (factor == 0.0f)
+	{
+		return values[key];
+	}
+
+	return glm::slerp(values[key], values[key + 1], factor);
+}
+
+
+void sampleAnimation(const AnimationClip& clip, float time, SceneGraph& nodes)
+{
+	for (const AnimationChannel& channel : clip.channels)
+	{
+		const glm::vec3 position = sampleVector(channel.positionTimes, channel.positions, time, glm::vec3(0.0f));
+		const glm::quat rotation = sampleRotation(channel.rotationTimes, channel.rotations, time);
+		const glm::vec3 scale = sampleVector(channel.scaleTimes, channel.scales, time, glm::vec3(1.0f));
+
+		glm::mat4 localTransform = glm::mat4_cast(rotation);
+		localTransform[0] *= scale.x;
+		localTransform[1] *= scale.y;
+		localTransform[2] *= scale.z;
+		localTransform[3] = glm::vec4(position, 1.0f);
+
+		nodes.SetLocalTransform(channel.node, localTransform);
+	}
+}
+
+void computeSkinPalette(const Skin& skin, const SceneGraph& nodes, int meshNode, glm::mat4* palette)
+{
+	// Skinned vertices are kept in mesh node space, the mesh node transform is applied when drawing
+	const glm::mat4 worldToMesh = glm::inverse(nodes.GetWorldTransform(meshNode));
+
+	for (size_t i = 0; i < skin.jointNodes.size(); i++)
+	{
+		const int jointNode = skin.jointNodes[i];
+		palette[i] = jointNode < 0 ? glm::mat4(1.0f) : worldToMesh * nodes.GetWorldTransform(jointNode) * skin.inverseBindMatrices[i];
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "SceneGraph.h"
+
+
+// Keyframes of one node, times in seconds. Components without keys keep their identity value.
+struct AnimationChannel
+{
+	int node;
+	std::vector<float> positionTimes;
+	std::vector<glm::vec3> positions;
+	std::vector<float> rotationTimes;
+	std::vector<glm::quat> rotations;
+	std::vector<float> scaleTimes;
+	std::vector<glm::vec3> scales;
+};
+
+struct AnimationClip
+{
+	std::string name;
+	float duration; // Seconds
+	std::vector<AnimationChannel> channels;
+};
+
+// Joints of a skinned mesh, joint i of a vertex refers to jointNodes[i]
+struct Skin
+{
+	std::vector<std::string> jointNames; // Resolved to nodes once the whole hierarchy is loaded
+	std::vector<int> jointNodes;
+	std::vector<glm::mat4> inverseBindMatrices;
+};
+
+
+// Writes the clip pose at time into the local transforms of the animated nodes
+void sampleAnimation(const AnimationClip& clip, float time, SceneGraph& nodes);
+
+// Joint matrices relative to the mesh node, world transforms have to be up to date
+void computeSkinPalette(const Skin& skin, const SceneGraph& nodes, int meshNode, glm::mat4* palette);
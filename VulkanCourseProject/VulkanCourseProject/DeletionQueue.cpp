@@ -0,0 +1,57 @@
+#include "DeletionQueue.h"
+
+#include <limits>
+
+
+void DeletionQueue::Push(std::function<void()> deleter)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// Frame in recording may already reference the resource, it's submitted as the next one
+	deletions_.push_back(Deletion{ .frame = submittedFrame_ + 1, .deleter = std::move(deleter) });
+}
+
+uint64_t DeletionQueue::SubmitFrame()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return ++submittedFrame_;
+}
+
+void DeletionQueue::Collect(uint64_t completedFrame)
+{
+	// Deleters run without the lock, they may take locks of their own
+	std::function<void()> deleter;
+	while (PopDue(completedFrame, deleter))
+	{
+		deleter();
+	}
+}
+
+void DeletionQueue::Flush()
+{
+	Collect(std::numeric_limits<uint64_t>::max());
+}
+
+size_t DeletionQueue::GetPendingCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return deletions_.size();
+}
+
+
+bool DeletionQueue::PopDue(uint64_t completedFrame, std::function<void()>& deleter)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (deletions_.empty() || deletions_.front().frame > completedFrame)
+	{
+		return false;
+	}
+
+	deleter = std::move(deletions_.front().deleter);
+	deletions_.pop_front();
+
+	return true;
+}
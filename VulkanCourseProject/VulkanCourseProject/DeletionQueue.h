@@ -0,0 +1,37 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+
+
+// Defers releasing resources until the GPU is done with every frame that could still use them, so nothing has to wait for the device.
+// Frames are numbered by submission starting at 1, a deletion is tagged with the frame being recorded when it's pushed
+// and runs once that frame's fence has signalled. Thread-safe.
+class DeletionQueue
+{
+public:
+	void Push(std::function<void()> deleter);
+
+	// Called right after a frame is submitted, returns its number
+	uint64_t SubmitFrame();
+	// Runs deletions of frames up to completedFrame, fences signal in submission order so earlier frames are finished as well
+	void Collect(uint64_t completedFrame);
+	// Runs everything, only after vkDeviceWaitIdle
+	void Flush();
+
+	size_t GetPendingCount() const;
+
+private:
+	struct Deletion
+	{
+		uint64_t frame;
+		std::function<void()> deleter;
+	};
+
+	mutable std::mutex mutex_;
+	std::deque<Deletion> deletions_; // In frame order
+	uint64_t submittedFrame_ = 0;
+
+	bool PopDue(uint64_t completedFrame, std::function<void()>& deleter);
+};
@@ -0,0 +1,55 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+DynamicResolution::DynamicResolution(double targetFrameTime) :
+	targetFrameTime_(targetFrameTime), scale_(MAX_RENDER_SCALE), framesWithinBudget_(0)
+{
+}
+
+void DynamicResolution::SetTargetFrameTime(double targetFrameTime)
+{
+	targetFrameTime_ = targetFrameTime;
+	framesWithinBudget_ = 0;
+}
+
+void DynamicResolution::Reset(float scale)
+{
+	scale_ = std::clamp(scale, MIN_RENDER_SCALE, MAX_RENDER_SCALE);
+	framesWithinBudget_ = 0;
+}
+
+float DynamicResolution::Update(double frameTime, float frameScale)
+{
+	if (frameTime <= 0.0 || targetFrameTime_ <= 0.0)
+	{
+		return scale_;
+	}
+
+	// Shading cost grows with the pixel count, which is the square of the scale
+	if (frameTime > targetFrameTime_)
+	{
+		const float idealScale = frameScale * static_cast<float>(std::sqrt(targetFrameTime_ / frameTime));
+
+		// Frames recorded since the measurement may have already lowered the scale further
+		scale_ = std::clamp(std::min(scale_, idealScale), MIN_RENDER_SCALE, MAX_RENDER_SCALE);
+		framesWithinBudget_ = 0;
+		return scale_;
+	}
+
+	framesWithinBudget_++;
+	if (framesWithinBudget_ < INCREASE_DELAY_FRAMES)
+	{
+		return scale_;
+	}
+
+	const float idealScale = frameScale * static_cast<float>(std::sqrt(targetFrameTime_ * HEADROOM / frameTime));
+	if (idealScale > scale_)
+	{
+		scale_ = std::clamp(scale_ + (idealScale - scale_) * INCREASE_RATE, MIN_RENDER_SCALE, MAX_RENDER_SCALE);
+	}
+
+	return scale_;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+
+// Render scale is the fraction of the output width and height the scene is rendered at before the composite upscales it
+const float MIN_RENDER_SCALE = 0.5f;
+const float MAX_RENDER_SCALE = 1.0f;
+
+// Picks the render scale from measured GPU frame times so the frame time stays at the target.
+// Over budget frames lower the scale at once, the scale is only raised again after a run of frames within budget.
+class DynamicResolution
+{
+public:
+	static const int INCREASE_DELAY_FRAMES = 30;
+	static constexpr float INCREASE_RATE = 0.1f; // Fraction of the way to the ideal scale taken per frame
+	static constexpr double HEADROOM = 0.9; // Scale is raised towards this fraction of the target only
+
+	explicit DynamicResolution(double targetFrameTime);
+
+	void SetTargetFrameTime(double targetFrameTime); // Milliseconds
+	double GetTargetFrameTime() const;
+	float GetScale() const;
+	void Reset(float scale);
+
+	// Frame time in milliseconds and the scale the measured frame was rendered at, measurements arrive frames late
+	float Update(double frameTime, float frameScale);
+
+private:
+	double targetFrameTime_;
+	float scale_;
+	int framesWithinBudget_;
+};
+
+
+inline double DynamicResolution::GetTargetFrameTime() const
+{
+	return targetFrameTime_;
+}
+
+inline float DynamicResolution::GetScale() const
+{
+	return scale_;
+}
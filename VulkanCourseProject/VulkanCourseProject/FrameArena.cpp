@@ -0,0 +1,175 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+
+namespace
+{
+	std::atomic<size_t> heapAllocationCount = 0;
+}
+
+
+FrameArena::FrameArena(size_t capacity) :
+	buffer_(new std::byte[capacity]), capacity_(capacity), offset_(0), overflowSize_(0), peakUsage_(0)
+{
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+	// Heap blocks are only aligned for the fundamental types
+	if (alignment > alignof(std::max_align_t) || (alignment & (alignment - 1)) != 0)
+	{
+		throw std::runtime_error("Unsupported frame arena alignment.");
+	}
+
+	const size_t offset = (offset_ + alignment - 1) & ~(alignment - 1);
+	if (offset + size <= capacity_)
+	{
+		offset_ = offset + size;
+		return buffer_.get() + offset;
+	}
+
+	overflowBlocks_.emplace_back(new std::byte[size]);
+	overflowSize_ += size + alignment;
+
+	return overflowBlocks_.back().get();
+}
+
+void FrameArena::Reset()
+{
+	const size_t usage = offset_ + overflowSize_;
+	peakUsage_ = std::max(peakUsage_, usage);
+
+	// Overflow means the frame didn't fit, next time it will with some room to spare
+	if (overflowBlocks_.empty() == false)
+	{
+		capacity_ = usage + usage / 2;
+		buffer_.reset(new std::byte[capacity_]);
+		overflowBlocks_.clear();
+		overflowSize_ = 0;
+	}
+
+	offset_ = 0;
+}
+
+
+size_t getHeapAllocationCount()
+{
+	return heapAllocationCount.load(std::memory_order_relaxed);
+}
+
+
+// Replacements of the global allocation functions. Every form is replaced, so each heap path is counted the same way and memory
+// is freed by the matching function. The nothrow forms aren't, their defaults call the forms below.
+namespace
+{
+	void* allocate(size_t size)
+	{
+		heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+		void* pointer = std::malloc(size > 0 ? size : 1);
+		if (pointer == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+
+		return pointer;
+	}
+
+	void* allocateAligned(size_t size, std::align_val_t alignment)
+	{
+		heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+		// aligned_alloc wants a multiple of the alignment, MSVC doesn't have it
+		const size_t alignmentSize = static_cast<size_t>(alignment);
+		const size_t alignedSize = (std::max<size_t>(size, 1) + alignmentSize - 1) & ~(alignmentSize - 1);
+#ifdef _WIN32
+		void* pointer = _aligned_malloc(alignedSize, alignmentSize);
+#else
+		void* pointer = std::aligned_alloc(alignmentSize, alignedSize);
+#endif
+		if (pointer == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+
+		return pointer;
+	}
+
+	void freeAligned(void* pointer)
+	{
+#ifdef _WIN32
+		_aligned_free(pointer);
+#else
+		std::free(pointer);
+#endif
+	}
+}
+
+void* operator new(size_t size)
+{
+	return allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+	return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return allocateAligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+	freeAligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+	freeAligned(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept
+{
+	freeAligned(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept
+{
+	freeAligned(pointer);
+}
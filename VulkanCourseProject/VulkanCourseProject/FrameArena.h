@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+
+
+// Bump allocator for CPU-side data of one frame in flight, everything is released at once by Reset when the frame's fence signals.
+// Allocations which don't fit go to extra heap blocks, Reset then grows the main block so later frames of the same size never reach the heap.
+// Used by one thread at a time, jobs may write into arena memory but must not allocate from it.
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t capacity);
+
+	void* Allocate(size_t size, size_t alignment);
+	void Reset();
+
+	size_t GetCapacity() const;
+	size_t GetPeakUsage() const; // Largest frame since creation, overflow included
+
+private:
+	std::unique_ptr<std::byte[]> buffer_;
+	size_t capacity_;
+	size_t offset_;
+	std::vector<std::unique_ptr<std::byte[]>> overflowBlocks_;
+	size_t overflowSize_;
+	size_t peakUsage_;
+};
+
+// Lets standard containers allocate from a FrameArena, deallocation is a no-op until the arena is reset
+template <typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	explicit ArenaAllocator(FrameArena& arena) noexcept;
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept;
+
+	T* allocate(size_t count);
+	void deallocate(T* pointer, size_t count) noexcept;
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const noexcept;
+
+private:
+	template <typename U>
+	friend class ArenaAllocator;
+
+	FrameArena* arena_;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+// Reserves the expected size up front, memory a vector outgrows stays used until the arena is reset
+template <typename T>
+FrameVector<T> makeFrameVector(FrameArena& arena, size_t capacity);
+
+// Calls of the global operator new since start on all threads, to check that drawing a frame doesn't reach the heap
+size_t getHeapAllocationCount();
+
+
+inline size_t FrameArena::GetCapacity() const
+{
+	return capacity_;
+}
+
+inline size_t FrameArena::GetPeakUsage() const
+{
+	return peakUsage_;
+}
+
+template <typename T>
+inline ArenaAllocator<T>::ArenaAllocator(FrameArena& arena) noexcept :
+	arena_(&arena)
+{
+}
+
+template <typename T>
+template <typename U>
+inline ArenaAllocator<T>::ArenaAllocator(const ArenaAllocator<U>& other) noexcept :
+	arena_(other.arena_)
+{
+}
+
+template <typename T>
+inline T* ArenaAllocator<T>::allocate(size_t count)
+{
+	return static_cast<T*>(arena_->Allocate(count * sizeof(T), alignof(T)));
+}
+
+template <typename T>
+inline void ArenaAllocator<T>::deallocate(T* pointer, size_t count) noexcept
+{
+}
+
+template <typename T>
+template <typename U>
+inline bool ArenaAllocator<T>::operator==(const ArenaAllocator<U>& other) const noexcept
+{
+	return arena_ == other.arena_;
+}
+
+template <typename T>
+inline FrameVector<T> makeFrameVector(FrameArena& arena, size_t capacity)
+{
+	FrameVector<T> vector{ ArenaAllocator<T>(arena) };
+	vector.reserve(capacity);
+
+	return vector;
+}
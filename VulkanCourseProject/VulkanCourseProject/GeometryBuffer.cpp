@@ -0,0 +1,223 @@
+#include "GeometryBuffer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+
+RangeAllocator::RangeAllocator(VkDeviceSize capacity) :
+	capacity_(capacity),
+	usedSize_(0)
+{
+	freeRanges_[0] = capacity;
+}
+
+bool RangeAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+	for (auto freeRange = freeRanges_.begin(); freeRange != freeRanges_.end(); freeRange++)
+	{
+		const VkDeviceSize rangeOffset = freeRange->first;
+		const VkDeviceSize rangeSize = freeRange->second;
+
+		const VkDeviceSize alignedOffset = (rangeOffset + alignment - 1) / alignment * alignment;
+		const VkDeviceSize padding = alignedOffset - rangeOffset;
+		if (rangeSize < padding + size)
+		{
+			continue;
+		}
+
+		freeRanges_.erase(freeRange);
+
+		// Alignment padding in front and the rest behind stay free
+		if (padding > 0)
+		{
+			freeRanges_[rangeOffset] = padding;
+		}
+		if (rangeSize > padding + size)
+		{
+			freeRanges_[alignedOffset + size] = rangeSize - padding - size;
+		}
+
+		usedSize_ += size;
+		*offset = alignedOffset;
+
+		return true;
+	}
+
+	return false;
+}
+
+void RangeAllocator::Free(VkDeviceSize offset, VkDeviceSize size)
+{
+	usedSize_ -= size;
+
+	auto next = freeRanges_.lower_bound(offset);
+
+	if (next != freeRanges_.end() && offset + size == next->first)
+	{
+		size += next->second;
+		next = freeRanges_.erase(next);
+	}
+
+	if (next != freeRanges_.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset)
+		{
+			previous->second += size;
+			return;
+		}
+	}
+
+	freeRanges_[offset] = size;
+}
+
+
+GeometryBuffer::GeometryBuffer(VkPhysicalDevice physicalDevice, VkDevice device, DeletionQueue& deletionQueue, VkDeviceSize vertexCapacity,
+	VkDeviceSize positionCapacity, VkDeviceSize indexCapacity, VkDeviceSize skinVertexCapacity) :
+	physicalDevice_(physicalDevice),
+	device_(device),
+	deletionQueue_(deletionQueue),
+	vertexAllocator_(vertexCapacity),
+	positionAllocator_(positionCapacity),
+	indexAllocator_(indexCapacity),
+	skinVertexAllocator_(skinVertexCapacity)
+{
+	VkBuffer buffer;
+	VkDeviceMemory bufferMemory;
+
+	createBuffer(physicalDevice_, device_, vertexCapacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Meshes, &buffer, &bufferMemory);
+	vertexBufferMemory_ = UniqueDeviceMemory(device_, bufferMemory);
+	vertexBuffer_ = UniqueBuffer(device_, buffer);
+
+	createBuffer(physicalDevice_, device_, positionCapacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Meshes, &buffer, &bufferMemory);
+	positionBufferMemory_ = UniqueDeviceMemory(device_, bufferMemory);
+	positionBuffer_ = UniqueBuffer(device_, buffer);
+
+	createBuffer(physicalDevice_, device_, indexCapacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Meshes, &buffer, &bufferMemory);
+	indexBufferMemory_ = UniqueDeviceMemory(device_, bufferMemory);
+	indexBuffer_ = UniqueBuffer(device_, buffer);
+
+	createBuffer(physicalDevice_, device_, skinVertexCapacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Meshes, &buffer, &bufferMemory);
+	skinVertexBufferMemory_ = UniqueDeviceMemory(device_, bufferMemory);
+	skinVertexBuffer_ = UniqueBuffer(device_, buffer);
+}
+
+
+GeometryRange GeometryBuffer::UploadVertices(const void* data, VkDeviceSize size, VkDeviceSize stride, VkQueue transferQueue, VkCommandPool transferCommandPool)
+{
+	return Upload(vertexAllocator_, vertexBuffer_.Get(), data, size, stride, transferQueue, transferCommandPool);
+}
+
+GeometryRange GeometryBuffer::UploadPositions(const void* data, VkDeviceSize size, VkDeviceSize stride, VkQueue transferQueue, VkCommandPool transferCommandPool)
+{
+	return Upload(positionAllocator_, positionBuffer_.Get(), data, size, stride, transferQueue, transferCommandPool);
+}
+
+GeometryRange GeometryBuffer::UploadIndices(const void* data, VkDeviceSize size, VkDeviceSize indexSize, VkQueue transferQueue, VkCommandPool transferCommandPool)
+{
+	// Same buffer is bound with both index types, 4 byte alignment keeps both kinds of offsets whole
+	return Upload(indexAllocator_, indexBuffer_.Get(), data, size, std::max<VkDeviceSize>(indexSize, 4), transferQueue, transferCommandPool);
+}
+
+GeometryRange GeometryBuffer::UploadSkinVertices(const void* data, VkDeviceSize size, VkDeviceSize stride, VkQueue transferQueue, VkCommandPool transferCommandPool)
+{
+	return Upload(skinVertexAllocator_, skinVertexBuffer_.Get(), data, size, stride, transferQueue, transferCommandPool);
+}
+
+GeometryRange GeometryBuffer::AllocateVertices(VkDeviceSize size, VkDeviceSize stride)
+{
+	return Allocate(vertexAllocator_, size, stride);
+}
+
+GeometryRange GeometryBuffer::AllocatePositions(VkDeviceSize size, VkDeviceSize stride)
+{
+	return Allocate(positionAllocator_, size, stride);
+}
+
+void GeometryBuffer::FreeVertices(const GeometryRange& range)
+{
+	Free(vertexAllocator_, range);
+}
+
+void GeometryBuffer::FreePositions(const GeometryRange& range)
+{
+	Free(positionAllocator_, range);
+}
+
+void GeometryBuffer::FreeIndices(const GeometryRange& range)
+{
+	Free(indexAllocator_, range);
+}
+
+void GeometryBuffer::FreeSkinVertices(const GeometryRange& range)
+{
+	Free(skinVertexAllocator_, range);
+}
+
+VkDeviceSize GeometryBuffer::GetUsedSize() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return vertexAllocator_.GetUsedSize() + positionAllocator_.GetUsedSize() + indexAllocator_.GetUsedSize();
+}
+
+
+GeometryRange GeometryBuffer::Allocate(RangeAllocator& allocator, VkDeviceSize size, VkDeviceSize alignment)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	GeometryRange range{ 0, size };
+	if (allocator.Allocate(size, alignment, &range.offset) == false)
+	{
+		throw std::runtime_error("Geometry buffer is full.");
+	}
+
+	return range;
+}
+
+void GeometryBuffer::Free(RangeAllocator& allocator, const GeometryRange& range)
+{
+	deletionQueue_.Push([this, &allocator, range]()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		allocator.Free(range.offset, range.size);
+	});
+}
+
+
+GeometryRange GeometryBuffer::Upload(RangeAllocator& allocator, VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize alignment,
+	VkQueue transferQueue, VkCommandPool transferCommandPool)
+{
+	GeometryRange range = Allocate(allocator, size, alignment);
+
+	try
+	{
+		VkBuffer rawStagingBuffer;
+		VkDeviceMemory rawStagingBufferMemory;
+		createBuffer(physicalDevice_, device_, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging, &rawStagingBuffer, &rawStagingBufferMemory);
+
+		UniqueDeviceMemory stagingBufferMemory(device_, rawStagingBufferMemory);
+		UniqueBuffer stagingBuffer(device_, rawStagingBuffer);
+
+		void* mappedData;
+		vkMapMemory(device_, stagingBufferMemory.Get(), 0, size, 0, &mappedData);
+		memcpy(mappedData, data, static_cast<size_t>(size));
+		vkUnmapMemory(device_, stagingBufferMemory.Get());
+
+		copyBuffer(device_, transferQueue, transferCommandPool, stagingBuffer.Get(), buffer, size, range.offset);
+	}
+	catch (...)
+	{
+		Free(allocator, range);
+		throw;
+	}
+
+	return range;
+}
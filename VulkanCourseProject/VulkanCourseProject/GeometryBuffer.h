@@ -0,0 +1,128 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "UniqueHandle.h"
+#include "DeletionQueue.h"
+
+
+// First-fit allocator of ranges inside a fixed size region, freed neighbours are merged back
+class RangeAllocator
+{
+public:
+	explicit RangeAllocator(VkDeviceSize capacity);
+
+	// Returns false if there is no free range big enough
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+	void Free(VkDeviceSize offset, VkDeviceSize size);
+
+	VkDeviceSize GetCapacity() const;
+	VkDeviceSize GetUsedSize() const;
+
+private:
+	std::map<VkDeviceSize, VkDeviceSize> freeRanges_; // Offset to size
+	VkDeviceSize capacity_;
+	VkDeviceSize usedSize_;
+};
+
+
+struct GeometryRange
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+};
+
+// All mesh vertices and indices live in one vertex storage buffer and one index buffer,
+// so the whole scene is drawn without rebinding geometry. Position-only copies of the vertices
+// for depth-only passes are kept in a third buffer, bind pose input of skinned meshes in a fourth.
+// Allocation and upload are thread-safe. Freed ranges go through the deletion queue, frames in flight may still read them.
+class GeometryBuffer
+{
+public:
+	GeometryBuffer(VkPhysicalDevice physicalDevice, VkDevice device, DeletionQueue& deletionQueue, VkDeviceSize vertexCapacity,
+		VkDeviceSize positionCapacity, VkDeviceSize indexCapacity, VkDeviceSize skinVertexCapacity);
+
+	GeometryBuffer(const GeometryBuffer&) = delete;
+	GeometryBuffer& operator=(const GeometryBuffer&) = delete;
+
+	// Vertex ranges are aligned to the vertex stride so their offset can be used as a base vertex
+	GeometryRange UploadVertices(const void* data, VkDeviceSize size, VkDeviceSize stride, VkQueue transferQueue, VkCommandPool transferCommandPool);
+	GeometryRange UploadPositions(const void* data, VkDeviceSize size, VkDeviceSize stride, VkQueue transferQueue, VkCommandPool transferCommandPool);
+	GeometryRange UploadIndices(const void* data, VkDeviceSize size, VkDeviceSize indexSize, VkQueue transferQueue, VkCommandPool transferCommandPool);
+	GeometryRange UploadSkinVertices(const void* data, VkDeviceSize size, VkDeviceSize stride, VkQueue transferQueue, VkCommandPool transferCommandPool);
+	// Ranges filled on the GPU, e.g. skinning output
+	GeometryRange AllocateVertices(VkDeviceSize size, VkDeviceSize stride);
+	GeometryRange AllocatePositions(VkDeviceSize size, VkDeviceSize stride);
+	void FreeVertices(const GeometryRange& range);
+	void FreePositions(const GeometryRange& range);
+	void FreeIndices(const GeometryRange& range);
+	void FreeSkinVertices(const GeometryRange& range);
+	// Bytes allocated in the vertex, position and index buffers, freed ranges count until the deletion queue releases them
+	VkDeviceSize GetUsedSize() const;
+
+	VkBuffer GetVertexBuffer() const;
+	VkBuffer GetPositionBuffer() const;
+	VkBuffer GetIndexBuffer() const;
+	VkBuffer GetSkinVertexBuffer() const;
+
+private:
+	VkPhysicalDevice physicalDevice_;
+	VkDevice device_;
+	DeletionQueue& deletionQueue_;
+
+	UniqueDeviceMemory vertexBufferMemory_;
+	UniqueBuffer vertexBuffer_;
+	UniqueDeviceMemory positionBufferMemory_;
+	UniqueBuffer positionBuffer_;
+	UniqueDeviceMemory indexBufferMemory_;
+	UniqueBuffer indexBuffer_;
+	UniqueDeviceMemory skinVertexBufferMemory_;
+	UniqueBuffer skinVertexBuffer_;
+
+	RangeAllocator vertexAllocator_;
+	RangeAllocator positionAllocator_;
+	RangeAllocator indexAllocator_;
+	RangeAllocator skinVertexAllocator_;
+	mutable std::mutex mutex_; // Guards allocators
+
+	GeometryRange Allocate(RangeAllocator& allocator, VkDeviceSize size, VkDeviceSize alignment);
+	void Free(RangeAllocator& allocator, const GeometryRange& range);
+	GeometryRange Upload(RangeAllocator& allocator, VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize alignment,
+		VkQueue transferQueue, VkCommandPool transferCommandPool);
+};
+
+
+inline VkDeviceSize RangeAllocator::GetCapacity() const
+{
+	return capacity_;
+}
+
+inline VkDeviceSize RangeAllocator::GetUsedSize() const
+{
+	return usedSize_;
+}
+
+
+inline VkBuffer GeometryBuffer::GetVertexBuffer() const
+{
+	return vertexBuffer_.Get();
+}
+
+inline VkBuffer GeometryBuffer::GetPositionBuffer() const
+{
+	return positionBuffer_.Get();
+}
+
+inline VkBuffer GeometryBuffer::GetIndexBuffer() const
+{
+	return indexBuffer_.Get();
+}
+
+inline VkBuffer GeometryBuffer::GetSkinVertexBuffer() const
+{
+	return skinVertexBuffer_.Get();
+}
@@ -0,0 +1,281 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <exception>
+
+#include "Profiler.h"
+
+
+namespace
+{
+	const size_t INITIAL_QUEUE_CAPACITY = 256;
+
+	// Set on worker threads only, any other thread uses the shared queue
+	thread_local const JobSystem* currentJobSystem = nullptr;
+	thread_local size_t currentWorkerIndex = 0;
+}
+
+
+JobSystem::JobSystem(size_t workerCount) :
+	workerCount_(workerCount)
+{
+	for (size_t i = 0; i <= workerCount; i++)
+	{
+		queues_.push_back(std::make_unique<WorkQueue>());
+	}
+
+	for (size_t i = 0; i < workerCount; i++)
+	{
+		workers_.emplace_back([this, i]() { WorkerLoop(i); });
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> sleepLock(sleepMutex_);
+		stopping_ = true;
+	}
+	sleepCondition_.notify_all();
+
+	for (std::thread& worker : workers_)
+	{
+		worker.join();
+	}
+}
+
+void JobSystem::Run(std::function<void()> job, JobCounter& counter)
+{
+	counter.remaining_.fetch_add(1, std::memory_order_relaxed);
+
+	// Counted before it's pushed, so the count never drops below zero when a thief is quicker than this thread
+	queuedJobs_.fetch_add(1);
+
+	WorkQueue& queue = *queues_[GetQueueIndex()];
+	{
+		std::lock_guard<std::mutex> queueLock(queue.mutex);
+		queue.PushBack(Job{ .function = std::move(job), .counter = &counter });
+	}
+
+	// Sleeping workers check the queued count under the sleep lock after announcing themselves, so either they see the job or they get notified
+	if (sleepingWorkers_.load() > 0)
+	{
+		{
+			std::lock_guard<std::mutex> sleepLock(sleepMutex_);
+		}
+		sleepCondition_.notify_one();
+	}
+}
+
+void JobSystem::Wait(JobCounter& counter)
+{
+	// Outside threads only help with their own jobs, a frame shouldn't end up decoding a texture another thread asked for
+	const size_t queueIndex = GetQueueIndex();
+	const JobCounter* ownCounter = queueIndex == workerCount_ ? &counter : nullptr;
+
+	while (counter.IsDone() == false)
+	{
+		if (TryRunJob(queueIndex, ownCounter) == false)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::ParallelForBatches(size_t count, size_t batchSize, BatchFunction function, const void* context)
+{
+	batchSize = std::max<size_t>(batchSize, 1);
+	const size_t batchCount = (count + batchSize - 1) / batchSize;
+	if (batchCount <= 1 || workerCount_ == 0)
+	{
+		if (count > 0)
+		{
+			function(context, 0, count);
+		}
+		return;
+	}
+
+	JobCounter counter;
+	std::mutex errorMutex;
+	std::exception_ptr error;
+	auto runBatch = [&](size_t batch)
+	{
+		try
+		{
+			function(context, batch * batchSize, std::min(count, (batch + 1) * batchSize));
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> errorLock(errorMutex);
+			if (!error)
+			{
+				error = std::current_exception();
+			}
+		}
+	};
+
+	for (size_t batch = 1; batch < batchCount; batch++)
+	{
+		Run([&runBatch, batch]() { runBatch(batch); }, counter);
+	}
+	runBatch(0);
+	Wait(counter);
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+
+size_t JobSystem::GetQueueIndex() const
+{
+	return currentJobSystem == this ? currentWorkerIndex : workerCount_;
+}
+
+bool JobSystem::TryPop(size_t queueIndex, const JobCounter* ownCounter, Job& job)
+{
+	const size_t sharedIndex = workerCount_;
+
+	if (ownCounter != nullptr)
+	{
+		WorkQueue& queue = *queues_[sharedIndex];
+		std::lock_guard<std::mutex> queueLock(queue.mutex);
+
+		return queue.TakeFirst(ownCounter, job);
+	}
+
+	// Newest own job first while its data is still in cache
+	{
+		WorkQueue& queue = *queues_[queueIndex];
+		std::lock_guard<std::mutex> queueLock(queue.mutex);
+		if (queue.count > 0)
+		{
+			job = queue.PopBack();
+			return true;
+		}
+	}
+
+	// Then the oldest job of the shared queue and of the other workers, starting with the next one so thieves spread out
+	for (size_t i = 1; i < queues_.size(); i++)
+	{
+		WorkQueue& queue = *queues_[(queueIndex + i) % queues_.size()];
+		std::lock_guard<std::mutex> queueLock(queue.mutex);
+		if (queue.count > 0)
+		{
+			job = queue.PopFront();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool JobSystem::TryRunJob(size_t queueIndex, const JobCounter* ownCounter)
+{
+	Job job;
+	if (TryPop(queueIndex, ownCounter, job) == false)
+	{
+		return false;
+	}
+	queuedJobs_.fetch_sub(1);
+
+	job.function();
+	job.counter->remaining_.fetch_sub(1, std::memory_order_release);
+
+	return true;
+}
+
+void JobSystem::WorkerLoop(size_t index)
+{
+	currentJobSystem = this;
+	currentWorkerIndex = index;
+	PROFILE_THREAD_NAME("Job worker");
+
+	while (true)
+	{
+		if (TryRunJob(index, nullptr))
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> sleepLock(sleepMutex_);
+		sleepingWorkers_.fetch_add(1);
+		sleepCondition_.wait(sleepLock, [this]() { return stopping_ || queuedJobs_.load() > 0; });
+		sleepingWorkers_.fetch_sub(1);
+
+		if (stopping_)
+		{
+			return;
+		}
+	}
+}
+
+
+JobSystem::WorkQueue::WorkQueue() :
+	jobs(INITIAL_QUEUE_CAPACITY)
+{
+}
+
+void JobSystem::WorkQueue::PushBack(Job&& job)
+{
+	if (count == jobs.size())
+	{
+		std::vector<Job> grownJobs(jobs.size() * 2);
+		for (size_t i = 0; i < count; i++)
+		{
+			grownJobs[i] = std::move(jobs[(head + i) % jobs.size()]);
+		}
+		jobs = std::move(grownJobs);
+		head = 0;
+	}
+
+	jobs[(head + count) % jobs.size()] = std::move(job);
+	count++;
+}
+
+JobSystem::Job JobSystem::WorkQueue::PopBack()
+{
+	count--;
+	return std::move(jobs[(head + count) % jobs.size()]);
+}
+
+JobSystem::Job JobSystem::WorkQueue::PopFront()
+{
+	Job job = std::move(jobs[head]);
+	head = (head + 1) % jobs.size();
+	count--;
+
+	return job;
+}
+
+bool JobSystem::WorkQueue::TakeFirst(const JobCounter* counter, Job& job)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		if (jobs[(head + i) % jobs.size()].counter != counter)
+		{
+			continue;
+		}
+
+		// Later jobs move up to close the gap, the order of the queue stays the same
+		job = std::move(jobs[(head + i) % jobs.size()]);
+		for (size_t j = i + 1; j < count; j++)
+		{
+			jobs[(head + j - 1) % jobs.size()] = std::move(jobs[(head + j) % jobs.size()]);
+		}
+		count--;
+
+		return true;
+	}
+
+	return false;
+}
+
+
+JobSystem& getJobSystem()
+{
+	static JobSystem jobSystem(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+	return jobSystem;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+
+// Jobs of one group which are not finished yet, every Run increments it and JobSystem::Wait returns once it's back to zero
+class JobCounter
+{
+public:
+	bool IsDone() const;
+
+private:
+	friend class JobSystem;
+
+	std::atomic<size_t> remaining_ = 0;
+};
+
+// Work-stealing thread pool. Every worker owns a deque, runs its own newest jobs first and steals the oldest jobs of others once it runs dry.
+// Threads outside the pool push to a shared queue and take part by running their own jobs while they wait.
+class JobSystem
+{
+public:
+	explicit JobSystem(size_t workerCount);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	size_t GetThreadCount() const; // Workers and the waiting thread
+
+	// Job must not throw, ParallelFor is the way to run code that can fail
+	void Run(std::function<void()> job, JobCounter& counter);
+	void Wait(JobCounter& counter);
+
+	// Splits [0, count) into batches of batchSize and calls function(begin, end) for each, the calling thread runs the first one.
+	// Rethrows the first exception thrown by a batch
+	template <typename Function>
+	void ParallelFor(size_t count, size_t batchSize, const Function& function);
+
+private:
+	struct Job
+	{
+		std::function<void()> function;
+		JobCounter* counter;
+	};
+
+	// Ring of jobs on its own cache line, workers lock only their own queue unless they steal.
+	// Grows only when full, so pushing and popping in steady state never allocates
+	struct alignas(64) WorkQueue
+	{
+		std::mutex mutex;
+		std::vector<Job> jobs;
+		size_t head = 0;
+		size_t count = 0;
+
+		WorkQueue();
+
+		void PushBack(Job&& job);
+		Job PopBack();
+		Job PopFront();
+		bool TakeFirst(const JobCounter* counter, Job& job); // Oldest job of the counter
+	};
+
+	using BatchFunction = void (*)(const void* context, size_t begin, size_t end);
+
+	const size_t workerCount_; // Read by the workers while workers_ is still being filled
+	std::vector<std::unique_ptr<WorkQueue>> queues_; // One per worker and the shared one last
+	std::vector<std::thread> workers_;
+
+	std::atomic<size_t> queuedJobs_ = 0;
+	std::atomic<size_t> sleepingWorkers_ = 0;
+	std::mutex sleepMutex_;
+	std::condition_variable sleepCondition_;
+	bool stopping_ = false;
+
+	size_t GetQueueIndex() const;
+	bool TryPop(size_t queueIndex, const JobCounter* ownCounter, Job& job);
+	bool TryRunJob(size_t queueIndex, const JobCounter* ownCounter);
+	void WorkerLoop(size_t index);
+	void ParallelForBatches(size_t count, size_t batchSize, BatchFunction function, const void* context);
+};
+
+// Shared by loading, animation and command recording, one worker less than there are cores since the waiting thread works too
+JobSystem& getJobSystem();
+
+
+inline bool JobCounter::IsDone() const
+{
+	return remaining_.load(std::memory_order_acquire) == 0;
+}
+
+inline size_t JobSystem::GetThreadCount() const
+{
+	return workerCount_ + 1;
+}
+
+template <typename Function>
+inline void JobSystem::ParallelFor(size_t count, size_t batchSize, const Function& function)
+{
+	// Called through a plain function pointer, a capturing lambda wrapped into std::function may allocate on every call
+	ParallelForBatches(count, batchSize, [](const void* context, size_t begin, size_t end)
+	{
+		(*static_cast<const Function*>(context))(begin, end);
+	}, &function);
+}
@@ -0,0 +1,22 @@
+#include "Lighting.h"
+
+
+Light makePointLight(const glm::vec3& position, float range, const glm::vec3& color)
+{
+	return Light
+	{
+		.position = glm::vec4(position, range),
+		.color = glm::vec4(color, -1.0f),
+		.direction = glm::vec4(0.0f, 0.0f, -1.0f, -2.0f)
+	};
+}
+
+Light makeSpotLight(const glm::vec3& position, const glm::vec3& direction, float range, float innerAngle, float outerAngle, const glm::vec3& color)
+{
+	return Light
+	{
+		.position = glm::vec4(position, range),
+		.color = glm::vec4(color, glm::cos(innerAngle)),
+		.direction = glm::vec4(glm::normalize(direction), glm::cos(outerAngle))
+	};
+}
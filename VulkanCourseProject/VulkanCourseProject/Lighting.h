@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Shadow.h"
+
+
+// View frustum is split into CLUSTER_COUNT_X * CLUSTER_COUNT_Y screen tiles and CLUSTER_COUNT_Z exponential depth slices,
+// light_culling.comp lists the lights touching every cluster and shader.frag only shades with its own cluster's list
+const uint32_t CLUSTER_COUNT_X = 16;
+const uint32_t CLUSTER_COUNT_Y = 9;
+const uint32_t CLUSTER_COUNT_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z;
+const uint32_t MAX_CLUSTER_LIGHTS = 128; // Further lights touching a cluster are dropped
+const uint32_t MAX_LIGHTS = 16384;
+
+const uint32_t LIGHT_CULLING_GROUP_SIZE = 128; // local_size_x of light_culling.comp, one invocation per cluster
+
+// Point or spot light, layout matches std430 Light in light_culling.comp and shader.frag
+struct Light
+{
+	glm::vec4 position;  // World space, w is the range
+	glm::vec4 color;     // Radiance, w is cosine of the inner cone angle
+	glm::vec4 direction; // Spot direction, w is cosine of the outer cone angle
+};
+
+// Per frame lighting constants, layout matches std140 LightingData
+struct LightingData
+{
+	glm::vec4 ambientColor;
+	glm::vec4 sunDirection; // Towards the sun
+	glm::vec4 sunColor;
+	glm::vec4 viewport;     // Width, height, near and far plane
+	uint32_t lightCount;
+	uint32_t padding[3];
+	glm::mat4 cascadeViewProjections[SHADOW_CASCADE_COUNT]; // World to shadow map, also read by shadow.vert
+	glm::vec4 cascadeSplits;
+};
+
+
+// Point lights cover the whole sphere, the cone test always passes
+Light makePointLight(const glm::vec3& position, float range, const glm::vec3& color);
+Light makeSpotLight(const glm::vec3& position, const glm::vec3& direction, float range, float innerAngle, float outerAngle, const glm::vec3& color);
@@ -0,0 +1,122 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+#include "Utilities.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filePath) :
+	data_(nullptr), size_(0), file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+{
+	file_ = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to open a file for mapping.");
+	}
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file_, &fileSize) == FALSE || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file_);
+		throw std::runtime_error("Failed to map an empty file.");
+	}
+	size_ = static_cast<size_t>(fileSize.QuadPart);
+
+	mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_ != nullptr)
+	{
+		data_ = static_cast<const std::byte*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (data_ == nullptr)
+	{
+		if (mapping_ != nullptr)
+		{
+			CloseHandle(mapping_);
+		}
+		CloseHandle(file_);
+		throw std::runtime_error("Failed to map a file.");
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	UnmapViewOfFile(data_);
+	CloseHandle(mapping_);
+	CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filePath) :
+	data_(nullptr), size_(0)
+{
+	const int file = open(filePath.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		throw std::runtime_error("Failed to open a file for mapping.");
+	}
+
+	struct stat fileStatus;
+	if (fstat(file, &fileStatus) != 0 || fileStatus.st_size == 0)
+	{
+		close(file);
+		throw std::runtime_error("Failed to map an empty file.");
+	}
+	size_ = static_cast<size_t>(fileStatus.st_size);
+
+	// Mapping stays valid after the descriptor is closed
+	void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED)
+	{
+		throw std::runtime_error("Failed to map a file.");
+	}
+	data_ = static_cast<const std::byte*>(data);
+}
+
+MappedFile::~MappedFile()
+{
+	munmap(const_cast<std::byte*>(data_), size_);
+}
+
+#endif
+
+
+bool isCacheFileCurrent(const std::string& sourcePath, const std::string& cachePath)
+{
+	std::error_code sourceError;
+	std::error_code cacheError;
+	const auto sourceTime = std::filesystem::last_write_time(sourcePath, sourceError);
+	const auto cacheTime = std::filesystem::last_write_time(cachePath, cacheError);
+
+	return !sourceError && !cacheError && cacheTime >= sourceTime;
+}
+
+void writeCacheFile(const std::string& cachePath, const std::vector<char>& fileData)
+{
+	const std::string temporaryPath = cachePath + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+	writeBinaryFile(temporaryPath, fileData);
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, cachePath, error);
+	if (error)
+	{
+		std::filesystem::remove(temporaryPath, error);
+	}
+}
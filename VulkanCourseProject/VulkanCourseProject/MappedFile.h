@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+
+// Read-only mapping of a whole file, pages are read from disk when first touched
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& filePath);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const std::byte* GetData() const;
+	size_t GetSize() const;
+
+private:
+	const std::byte* data_;
+	size_t size_;
+#ifdef _WIN32
+	void* file_;
+	void* mapping_;
+#endif
+};
+
+
+inline const std::byte* MappedFile::GetData() const
+{
+	return data_;
+}
+
+inline size_t MappedFile::GetSize() const
+{
+	return size_;
+}
+
+
+// Files baked from a source file next to it and mapped by the mesh and mip caches
+
+// Cache file exists and isn't older than the source file
+bool isCacheFileCurrent(const std::string& sourcePath, const std::string& cachePath);
+// Written aside and renamed, so concurrent loaders never map a half written file. Renaming fails on some systems while another loader
+// has the file mapped, that loader baked the same data.
+void writeCacheFile(const std::string& cachePath, const std::vector<char>& fileData);
+
+// Returns open(), which throws std::runtime_error for a file it can't use. A missing, older or unusable cache file is replaced with
+// the content bake() returns first. Safe to call for the same file from several loader threads.
+template<typename Open, typename Bake>
+auto openCacheFile(const std::string& sourcePath, const std::string& cachePath, Open open, Bake bake)
+{
+	if (isCacheFileCurrent(sourcePath, cachePath))
+	{
+		try
+		{
+			return open();
+		}
+		catch (const std::runtime_error&)
+		{
+			// Stale or from another build, baked again below
+		}
+	}
+
+	writeCacheFile(cachePath, bake());
+
+	return open();
+}
@@ -0,0 +1,190 @@
+#include "MemoryTracker.h"
+
+#include <algorithm>
+
+
+void MemoryTracker::Init(VkPhysicalDevice physicalDevice, bool budgetExtensionEnabled)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	physicalDevice_ = physicalDevice;
+	budgetExtensionEnabled_ = budgetExtensionEnabled;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice_, &memoryProperties_);
+	QueryBudget();
+}
+
+void MemoryTracker::OnAllocate(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex, MemoryCategory category)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	const uint32_t heapIndex = memoryProperties_.memoryTypes[memoryTypeIndex].heapIndex;
+	allocations_[memory] = Allocation{ .size = size, .heapIndex = heapIndex, .category = category };
+	categoryUsage_[static_cast<size_t>(category)] += size;
+	trackedHeapUsage_[heapIndex] += size;
+}
+
+void MemoryTracker::OnFree(VkDeviceMemory memory)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto allocation = allocations_.find(memory);
+	if (allocation == allocations_.end())
+	{
+		return;
+	}
+
+	categoryUsage_[static_cast<size_t>(allocation->second.category)] -= allocation->second.size;
+	trackedHeapUsage_[allocation->second.heapIndex] -= allocation->second.size;
+	pendingEvictions_[allocation->second.heapIndex] -= std::min(pendingEvictions_[allocation->second.heapIndex], allocation->second.size);
+	allocations_.erase(allocation);
+}
+
+void MemoryTracker::Update()
+{
+	// Memory promised by earlier callbacks isn't asked for again, it may still be waiting in the deletion queue
+	VkDeviceSize excess[VK_MAX_MEMORY_HEAPS] = {};
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		QueryBudget();
+		for (uint32_t i = 0; i < memoryProperties_.memoryHeapCount; i++)
+		{
+			const VkDeviceSize threshold = static_cast<VkDeviceSize>(heapBudget_[i] * EVICTION_THRESHOLD);
+			const VkDeviceSize usage = GetUsage(i);
+			if ((memoryProperties_.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && usage > threshold + pendingEvictions_[i])
+			{
+				excess[i] = usage - threshold - pendingEvictions_[i];
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> callbackLock(callbackMutex_);
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++)
+	{
+		for (auto callback = evictionCallbacks_.begin(); callback != evictionCallbacks_.end() && excess[i] > 0; callback++)
+		{
+			const VkDeviceSize freed = std::min(callback->second(i, excess[i]), excess[i]);
+			excess[i] -= freed;
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			pendingEvictions_[i] += freed;
+		}
+	}
+}
+
+int MemoryTracker::AddEvictionCallback(EvictionCallback callback)
+{
+	std::lock_guard<std::mutex> callbackLock(callbackMutex_);
+
+	const int id = nextCallbackId_++;
+	evictionCallbacks_.emplace_back(id, std::move(callback));
+
+	return id;
+}
+
+void MemoryTracker::RemoveEvictionCallback(int id)
+{
+	std::lock_guard<std::mutex> callbackLock(callbackMutex_);
+
+	std::erase_if(evictionCallbacks_, [id](const std::pair<int, EvictionCallback>& callback) { return callback.first == id; });
+}
+
+bool MemoryTracker::IsHeapOverBudget(uint32_t memoryTypeIndex) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	const uint32_t heapIndex = memoryProperties_.memoryTypes[memoryTypeIndex].heapIndex;
+	return heapBudget_[heapIndex] > 0 && GetUsage(heapIndex) >= heapBudget_[heapIndex];
+}
+
+VkDeviceSize MemoryTracker::GetCategoryUsage(MemoryCategory category) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return categoryUsage_[static_cast<size_t>(category)];
+}
+
+uint32_t MemoryTracker::GetHeapCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return memoryProperties_.memoryHeapCount;
+}
+
+MemoryHeapBudget MemoryTracker::GetHeapBudget(uint32_t heapIndex) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return MemoryHeapBudget
+	{
+		.size = memoryProperties_.memoryHeaps[heapIndex].size,
+		.budget = heapBudget_[heapIndex],
+		.usage = GetUsage(heapIndex),
+		.trackedUsage = trackedHeapUsage_[heapIndex],
+		.deviceLocal = (memoryProperties_.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0
+	};
+}
+
+
+void MemoryTracker::QueryBudget()
+{
+	if (budgetExtensionEnabled_ == false)
+	{
+		for (uint32_t i = 0; i < memoryProperties_.memoryHeapCount; i++)
+		{
+			heapBudget_[i] = static_cast<VkDeviceSize>(memoryProperties_.memoryHeaps[i].size * FALLBACK_BUDGET);
+		}
+		return;
+	}
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT
+	};
+	VkPhysicalDeviceMemoryProperties2 memoryProperties
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+		.pNext = &budgetProperties
+	};
+	vkGetPhysicalDeviceMemoryProperties2(physicalDevice_, &memoryProperties);
+
+	for (uint32_t i = 0; i < memoryProperties_.memoryHeapCount; i++)
+	{
+		heapBudget_[i] = budgetProperties.heapBudget[i];
+		heapUsage_[i] = budgetProperties.heapUsage[i];
+	}
+}
+
+VkDeviceSize MemoryTracker::GetUsage(uint32_t heapIndex) const
+{
+	// Driver usage is only as recent as the last query, allocations since then are tracked
+	return budgetExtensionEnabled_ ? std::max(heapUsage_[heapIndex], trackedHeapUsage_[heapIndex]) : trackedHeapUsage_[heapIndex];
+}
+
+
+MemoryTracker& getMemoryTracker()
+{
+	static MemoryTracker memoryTracker;
+
+	return memoryTracker;
+}
+
+VkResult allocateDeviceMemory(VkDevice device, const VkMemoryAllocateInfo& allocateInfo, MemoryCategory category, VkDeviceMemory* memory)
+{
+	VkResult result = vkAllocateMemory(device, &allocateInfo, nullptr, memory);
+	if (result == VK_SUCCESS)
+	{
+		getMemoryTracker().OnAllocate(*memory, allocateInfo.allocationSize, allocateInfo.memoryTypeIndex, category);
+	}
+
+	return result;
+}
+
+void freeDeviceMemory(VkDevice device, VkDeviceMemory memory, const VkAllocationCallbacks* allocator)
+{
+	if (memory != VK_NULL_HANDLE)
+	{
+		getMemoryTracker().OnFree(memory);
+	}
+	vkFreeMemory(device, memory, allocator);
+}
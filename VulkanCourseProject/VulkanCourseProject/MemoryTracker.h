@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+
+// What a device memory allocation is used for
+enum class MemoryCategory
+{
+	Meshes,      // Geometry buffer
+	Textures,
+	Attachments, // Scene targets and shadow maps
+	Staging,     // Upload buffers, only alive while copying
+	Uniforms,    // Per swapchain image uniform and storage buffers
+	Count
+};
+
+struct MemoryHeapBudget
+{
+	VkDeviceSize size;
+	VkDeviceSize budget; // Reported by VK_EXT_memory_budget, otherwise a fixed share of the size
+	VkDeviceSize usage;  // Whole process as reported by VK_EXT_memory_budget, otherwise the tracked allocations
+	VkDeviceSize trackedUsage;
+	bool deviceLocal;
+};
+
+// Accounts every device memory allocation by category and heap and keeps the heap budgets up to date.
+// When a device local heap gets close to its budget the eviction callbacks are asked to free memory, residency managers register one each.
+// Thread-safe, loader threads allocate as well.
+class MemoryTracker
+{
+public:
+	static constexpr double EVICTION_THRESHOLD = 0.9; // Share of a heap's budget from which the eviction callbacks run
+	static constexpr double FALLBACK_BUDGET = 0.8; // Share of a heap's size used as budget without VK_EXT_memory_budget
+
+	// Gets the heap and how many bytes to free, returns how many it will free, memory released through the deletion queue counts as well.
+	// Runs on the thread calling Update, must not allocate or free through the tracker itself
+	using EvictionCallback = std::function<VkDeviceSize(uint32_t heapIndex, VkDeviceSize bytes)>;
+
+	void Init(VkPhysicalDevice physicalDevice, bool budgetExtensionEnabled);
+
+	void OnAllocate(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex, MemoryCategory category);
+	void OnFree(VkDeviceMemory memory);
+
+	// Queries the heap budgets and runs the eviction callbacks for heaps over the threshold, once per frame
+	void Update();
+
+	int AddEvictionCallback(EvictionCallback callback);
+	void RemoveEvictionCallback(int id);
+
+	bool IsBudgetExtensionEnabled() const;
+	bool IsHeapOverBudget(uint32_t memoryTypeIndex) const; // Heap of the memory type
+	VkDeviceSize GetCategoryUsage(MemoryCategory category) const; // Bytes
+	uint32_t GetHeapCount() const;
+	MemoryHeapBudget GetHeapBudget(uint32_t heapIndex) const;
+
+private:
+	struct Allocation
+	{
+		VkDeviceSize size;
+		uint32_t heapIndex;
+		MemoryCategory category;
+	};
+
+	mutable std::mutex mutex_; // Guards everything below but the callbacks, which are run without it
+	VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
+	bool budgetExtensionEnabled_ = false;
+	VkPhysicalDeviceMemoryProperties memoryProperties_{};
+	std::unordered_map<VkDeviceMemory, Allocation> allocations_;
+	VkDeviceSize categoryUsage_[static_cast<size_t>(MemoryCategory::Count)] = {};
+	VkDeviceSize trackedHeapUsage_[VK_MAX_MEMORY_HEAPS] = {};
+	VkDeviceSize heapBudget_[VK_MAX_MEMORY_HEAPS] = {};
+	VkDeviceSize heapUsage_[VK_MAX_MEMORY_HEAPS] = {};
+	VkDeviceSize pendingEvictions_[VK_MAX_MEMORY_HEAPS] = {}; // Promised by callbacks and not freed yet
+
+	std::mutex callbackMutex_;
+	std::vector<std::pair<int, EvictionCallback>> evictionCallbacks_;
+	int nextCallbackId_ = 0;
+
+	void QueryBudget();
+	VkDeviceSize GetUsage(uint32_t heapIndex) const;
+};
+
+MemoryTracker& getMemoryTracker();
+
+// vkAllocateMemory and vkFreeMemory through the tracker, every device memory allocation goes through these
+VkResult allocateDeviceMemory(VkDevice device, const VkMemoryAllocateInfo& allocateInfo, MemoryCategory category, VkDeviceMemory* memory);
+void freeDeviceMemory(VkDevice device, VkDeviceMemory memory, const VkAllocationCallbacks* allocator);
+
+
+inline bool MemoryTracker::IsBudgetExtensionEnabled() const
+{
+	return budgetExtensionEnabled_;
+}
@@ -1,71 +1,225 @@
 #include "Mesh.h"
 
-Mesh::Mesh(const VkPhysicalDevice physicalDevice, const VkDevice& device, const VkQueue& transferQueue, 
-	const VkCommandPool& transferCommandPool, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int textureId) :
+#include <limits>
+#include <utility>
+
+Mesh::Mesh(GeometryBuffer* geometryBuffer, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool,
+	const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int textureId, int normalTextureId, bool skinned) :
 	model_({ glm::mat4(1.0f) }),
 	textureId_(textureId),
-	physicalDevice_(physicalDevice),
-	device_(device),
+	normalTextureId_(normalTextureId),
+	vertexQuantization_(skinned ? VertexQuantization{ glm::vec4(1.0f), glm::vec4(0.0f) } : computeVertexQuantization(vertices)),
+	geometryBuffer_(geometryBuffer),
+	streamer_(nullptr),
+	streamId_(-1),
+	skinned_(skinned),
+	vertexRange_({ 0, 0 }),
+	positionRange_({ 0, 0 }),
+	skinVertexRange_({ 0, 0 }),
 	vertexCount_(vertices.size()),
-	indexCount_(indices.size())
+	indexRange_({ 0, 0 }),
+	indexCount_(indices.size()),
+	indexType_(VK_INDEX_TYPE_UINT32)
 {
-	CreateVertexBuffer(vertices, transferQueue, transferCommandPool);
-	CreateIndexBuffer(indices, transferQueue, transferCommandPool);
+	try
+	{
+		UploadVertices(vertices, transferQueue, transferCommandPool);
+		UploadIndices(indices, transferQueue, transferCommandPool);
+	}
+	catch (...)
+	{
+		Free();
+		throw;
+	}
 }
 
-
-void Mesh::Destroy()
+Mesh::Mesh(GeometryBuffer* geometryBuffer, MeshStreamer* streamer, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool,
+	const std::shared_ptr<const MeshCache>& cache, size_t meshIndex, int textureId, int normalTextureId) :
+	model_({ glm::mat4(1.0f) }),
+	textureId_(textureId),
+	normalTextureId_(normalTextureId),
+	vertexQuantization_(cache->GetEntry(meshIndex).quantization),
+	geometryBuffer_(geometryBuffer),
+	streamer_(nullptr),
+	streamId_(-1),
+	skinned_(false),
+	vertexRange_({ 0, 0 }),
+	positionRange_({ 0, 0 }),
+	skinVertexRange_({ 0, 0 }),
+	vertexCount_(0),
+	indexRange_({ 0, 0 }),
+	indexCount_(0),
+	indexType_(VK_INDEX_TYPE_UINT32)
 {
-	vkDestroyBuffer(device_, vertexBuffer_, nullptr);
-	vkFreeMemory(device_, vertexBufferMemory_, nullptr);
+	const MeshCacheEntry& entry = cache->GetEntry(meshIndex);
+	const MeshCacheLod& lod = entry.lods[MESH_LOD_COARSE];
+
+	vertexCount_ = lod.vertexCount;
+	indexCount_ = lod.indexCount;
+	indexType_ = entry.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	try
+	{
+		if (lod.vertexCount > 0)
+		{
+			vertexRange_ = geometryBuffer_->UploadVertices(cache->GetData(lod.vertexOffset), sizeof(GpuVertex) * lod.vertexCount, sizeof(GpuVertex),
+				transferQueue, transferCommandPool);
+			positionRange_ = geometryBuffer_->UploadPositions(cache->GetData(lod.positionOffset), sizeof(GpuPosition) * lod.vertexCount,
+				sizeof(GpuPosition), transferQueue, transferCommandPool);
+		}
+		if (lod.indexCount > 0)
+		{
+			indexRange_ = geometryBuffer_->UploadIndices(cache->GetData(lod.indexOffset), VkDeviceSize(entry.indexSize) * lod.indexCount,
+				entry.indexSize, transferQueue, transferCommandPool);
+		}
+	}
+	catch (...)
+	{
+		Free();
+		throw;
+	}
+
+	streamer_ = streamer;
+	streamId_ = streamer_->Register(cache, meshIndex);
+}
 
-	vkDestroyBuffer(device_, indexBuffer_, nullptr);
-	vkFreeMemory(device_, indexBufferMemory_, nullptr);
+Mesh::Mesh(Mesh&& other) noexcept :
+	model_(other.model_),
+	textureId_(other.textureId_),
+	normalTextureId_(other.normalTextureId_),
+	vertexQuantization_(other.vertexQuantization_),
+	geometryBuffer_(std::exchange(other.geometryBuffer_, nullptr)),
+	streamer_(std::exchange(other.streamer_, nullptr)),
+	streamId_(std::exchange(other.streamId_, -1)),
+	skinned_(other.skinned_),
+	vertexRange_(other.vertexRange_),
+	positionRange_(other.positionRange_),
+	skinVertexRange_(other.skinVertexRange_),
+	vertexCount_(other.vertexCount_),
+	indexRange_(other.indexRange_),
+	indexCount_(other.indexCount_),
+	indexType_(other.indexType_)
+{
 }
 
+Mesh::~Mesh()
+{
+	Free();
+}
 
-void Mesh::CreateVertexBuffer(const std::vector<Vertex>& vertices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool)
+Mesh& Mesh::operator=(Mesh&& other) noexcept
 {
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices.size();
+	if (this != &other)
+	{
+		Free();
+
+		model_ = other.model_;
+		textureId_ = other.textureId_;
+		normalTextureId_ = other.normalTextureId_;
+		vertexQuantization_ = other.vertexQuantization_;
+		geometryBuffer_ = std::exchange(other.geometryBuffer_, nullptr);
+		streamer_ = std::exchange(other.streamer_, nullptr);
+		streamId_ = std::exchange(other.streamId_, -1);
+		skinned_ = other.skinned_;
+		vertexRange_ = other.vertexRange_;
+		positionRange_ = other.positionRange_;
+		skinVertexRange_ = other.skinVertexRange_;
+		vertexCount_ = other.vertexCount_;
+		indexRange_ = other.indexRange_;
+		indexCount_ = other.indexCount_;
+		indexType_ = other.indexType_;
+	}
+
+	return *this;
+}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice_, device_, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
 
-	void* data;
-	vkMapMemory(device_, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), static_cast<size_t>(bufferSize));
-	vkUnmapMemory(device_, stagingBufferMemory);
+void Mesh::UploadVertices(const std::vector<Vertex>& vertices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool)
+{
+	if (vertices.empty())
+	{
+		return;
+	}
 
-	createBuffer(physicalDevice_, device_, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer_, &vertexBufferMemory_);
+	if (skinned_)
+	{
+		std::vector<SkinVertex> skinVertices = encodeSkinVertices(vertices);
 
-	copyBuffer(device_, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer_, bufferSize);
+		skinVertexRange_ = geometryBuffer_->UploadSkinVertices(skinVertices.data(), sizeof(SkinVertex) * skinVertices.size(), sizeof(SkinVertex),
+			transferQueue, transferCommandPool);
+		vertexRange_ = geometryBuffer_->AllocateVertices(FULL_VERTEX_STRIDE * vertices.size(), FULL_VERTEX_STRIDE);
+		positionRange_ = geometryBuffer_->AllocatePositions(FULL_POSITION_STRIDE * vertices.size(), FULL_POSITION_STRIDE);
 
-	vkDestroyBuffer(device_, stagingBuffer, nullptr);
-	vkFreeMemory(device_, stagingBufferMemory, nullptr);
-}
+		return;
+	}
 
-void Mesh::CreateIndexBuffer(const std::vector<uint32_t>& indices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool)
-{
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices.size();
+	std::vector<GpuVertex> gpuVertices = encodeVertices(vertices, vertexQuantization_);
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice_, device_, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
+	vertexRange_ = geometryBuffer_->UploadVertices(gpuVertices.data(), sizeof(GpuVertex) * gpuVertices.size(), sizeof(GpuVertex),
+		transferQueue, transferCommandPool);
 
-	void* data;
-	vkMapMemory(device_, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), static_cast<size_t>(bufferSize));
-	vkUnmapMemory(device_, stagingBufferMemory);
+	std::vector<GpuPosition> gpuPositions = extractPositions(gpuVertices);
 
-	createBuffer(physicalDevice_, device_, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer_, &indexBufferMemory_);
+	positionRange_ = geometryBuffer_->UploadPositions(gpuPositions.data(), sizeof(GpuPosition) * gpuPositions.size(), sizeof(GpuPosition),
+		transferQueue, transferCommandPool);
+}
 
-	copyBuffer(device_, transferQueue, transferCommandPool, stagingBuffer, indexBuffer_, bufferSize);
+void Mesh::UploadIndices(const std::vector<uint32_t>& indices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool)
+{
+	// Every index fits into 16 bits, halve the index data
+	if (vertexCount_ <= std::numeric_limits<uint16_t>::max())
+	{
+		indexType_ = VK_INDEX_TYPE_UINT16;
+	}
+
+	if (indices.empty())
+	{
+		return;
+	}
+
+	if (indexType_ == VK_INDEX_TYPE_UINT16)
+	{
+		std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+		indexRange_ = geometryBuffer_->UploadIndices(shortIndices.data(), sizeof(uint16_t) * shortIndices.size(), sizeof(uint16_t),
+			transferQueue, transferCommandPool);
+	}
+	else
+	{
+		indexRange_ = geometryBuffer_->UploadIndices(indices.data(), sizeof(uint32_t) * indices.size(), sizeof(uint32_t),
+			transferQueue, transferCommandPool);
+	}
+}
 
-	vkDestroyBuffer(device_, stagingBuffer, nullptr);
-	vkFreeMemory(device_, stagingBufferMemory, nullptr);
+void Mesh::Free()
+{
+	if (streamer_ != nullptr)
+	{
+		streamer_->Unregister(streamId_);
+		streamer_ = nullptr;
+		streamId_ = -1;
+	}
+
+	if (geometryBuffer_ == nullptr)
+	{
+		return;
+	}
+
+	if (vertexRange_.size > 0)
+	{
+		geometryBuffer_->FreeVertices(vertexRange_);
+	}
+	if (positionRange_.size > 0)
+	{
+		geometryBuffer_->FreePositions(positionRange_);
+	}
+	if (skinVertexRange_.size > 0)
+	{
+		geometryBuffer_->FreeSkinVertices(skinVertexRange_);
+	}
+	if (indexRange_.size > 0)
+	{
+		geometryBuffer_->FreeIndices(indexRange_);
+	}
+
+	geometryBuffer_ = nullptr;
 }
@@ -6,6 +6,9 @@
 #include <GLFW/glfw3.h>
 
 #include "Utilities.h"
+#include "VertexFormat.h"
+#include "GeometryBuffer.h"
+#include "MeshStreamer.h"
 
 
 struct Model
@@ -13,40 +16,93 @@ struct Model
 	glm::mat4 model;
 };
 
+// Per-draw entry of the object storage buffer, layout matches std430 ObjectData in shader.vert
+struct ObjectData
+{
+	glm::mat4 model;
+	VertexQuantization quantization;
+	uint32_t textureIndex;
+	uint32_t normalTextureIndex; // NO_TEXTURE_INDEX shades with the vertex normal
+	uint32_t vertexFormat;
+	uint32_t padding;
+};
+
+const uint32_t NO_TEXTURE_INDEX = 0xFFFFFFFF;
+
+// Push constant of one skinning dispatch, offsets are in elements of the bound buffers, layout matches skinning.comp
+struct SkinningDispatch
+{
+	uint32_t paletteOffset;
+	uint32_t sourceOffset;
+	uint32_t vertexOffset;
+	uint32_t positionOffset;
+	uint32_t vertexCount;
+};
+
 class Mesh
 {
 public:
-	Mesh(const VkPhysicalDevice physicalDevice, const VkDevice& device, const VkQueue& transferQueue, 
-		const VkCommandPool& transferCommandPool, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int textureId);
+	Mesh(GeometryBuffer* geometryBuffer, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool,
+		const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int textureId, int normalTextureId, bool skinned = false);
+	// Streamed mesh, the coarse level of detail is uploaded from the cache and stays, the full one is paged in by the streamer
+	Mesh(GeometryBuffer* geometryBuffer, MeshStreamer* streamer, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool,
+		const std::shared_ptr<const MeshCache>& cache, size_t meshIndex, int textureId, int normalTextureId);
+	Mesh(Mesh&& other) noexcept;
+	~Mesh();
+
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh& operator=(Mesh&& other) noexcept;
 
 	void SetModel(const Model& model);
 	const Model& GetModel() const;
 	const int GetTextureId() const;
+	int GetNormalTextureId() const; // -1 if the material has no normal map
+	const VertexQuantization& GetVertexQuantization() const;
+	uint32_t GetVertexFormat() const;
 
-	VkBuffer GetVertexBuffer() const;
 	size_t GetVertexCount() const;
-	VkBuffer GetIndexBuffer() const;
 	size_t GetIndexCount() const;
+	VkIndexType GetIndexType() const;
+
+	// Position of the mesh inside the geometry buffer, in vertices and in indices of its index type
+	int32_t GetVertexOffset() const;
+	int32_t GetPositionOffset() const;
+	uint32_t GetFirstIndex() const;
 
-	void Destroy();
+	// Resident level of detail, the coarse one for streamed meshes
+	MeshDrawRange GetDrawRange() const;
+	// -1 if the mesh isn't streamed
+	int GetStreamId() const;
+
+	// Skinned meshes keep their bind pose in the skin vertex buffer, vertex and position ranges are written by the skinning shader
+	bool IsSkinned() const;
+	uint32_t GetSkinVertexOffset() const;
 
 private:
 	Model model_;
 	int textureId_;
-
-	VkPhysicalDevice physicalDevice_;
-	VkDevice device_;
-
-	VkBuffer vertexBuffer_;
-	VkDeviceMemory vertexBufferMemory_;
+	int normalTextureId_;
+	VertexQuantization vertexQuantization_;
+
+	// Null once moved from, ranges are only freed by the owning mesh
+	GeometryBuffer* geometryBuffer_;
+	MeshStreamer* streamer_;
+	int streamId_;
+
+	bool skinned_;
+	GeometryRange vertexRange_;
+	GeometryRange positionRange_;
+	GeometryRange skinVertexRange_;
 	size_t vertexCount_;
 
-	VkBuffer indexBuffer_;
-	VkDeviceMemory indexBufferMemory_;
+	GeometryRange indexRange_;
 	size_t indexCount_;
+	VkIndexType indexType_;
 
-	void CreateVertexBuffer(const std::vector<Vertex>& vertices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool);
-	void CreateIndexBuffer(const std::vector<uint32_t>& indices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool);
+	void UploadVertices(const std::vector<Vertex>& vertices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool);
+	void UploadIndices(const std::vector<uint32_t>& indices, const VkQueue& transferQueue, const VkCommandPool& transferCommandPool);
+	void Free();
 };
 
 
@@ -65,23 +121,75 @@ inline const int Mesh::GetTextureId() const
 	return textureId_;
 }
 
+inline int Mesh::GetNormalTextureId() const
+{
+	return normalTextureId_;
+}
 
-inline VkBuffer Mesh::GetVertexBuffer() const
+inline const VertexQuantization& Mesh::GetVertexQuantization() const
 {
-	return vertexBuffer_;
+	return vertexQuantization_;
 }
 
+
 inline size_t Mesh::GetVertexCount() const
 {
 	return vertexCount_;
 }
 
-inline VkBuffer Mesh::GetIndexBuffer() const
+inline size_t Mesh::GetIndexCount() const
 {
-	return indexBuffer_;
+	return indexCount_;
 }
 
-inline size_t Mesh::GetIndexCount() const
+inline VkIndexType Mesh::GetIndexType() const
 {
-	return indexCount_;
+	return indexType_;
+}
+
+inline uint32_t Mesh::GetVertexFormat() const
+{
+	return skinned_ ? FULL_VERTEX_FORMAT : GPU_VERTEX_FORMAT;
+}
+
+inline int32_t Mesh::GetVertexOffset() const
+{
+	return static_cast<int32_t>(vertexRange_.offset / (skinned_ ? FULL_VERTEX_STRIDE : sizeof(GpuVertex)));
+}
+
+inline int32_t Mesh::GetPositionOffset() const
+{
+	return static_cast<int32_t>(positionRange_.offset / (skinned_ ? FULL_POSITION_STRIDE : sizeof(GpuPosition)));
+}
+
+inline MeshDrawRange Mesh::GetDrawRange() const
+{
+	return MeshDrawRange
+	{
+		.indexCount = static_cast<uint32_t>(indexCount_),
+		.firstIndex = GetFirstIndex(),
+		.vertexOffset = GetVertexOffset(),
+		.positionOffset = GetPositionOffset()
+	};
+}
+
+inline int Mesh::GetStreamId() const
+{
+	return streamId_;
+}
+
+inline bool Mesh::IsSkinned() const
+{
+	return skinned_;
+}
+
+inline uint32_t Mesh::GetSkinVertexOffset() const
+{
+	return static_cast<uint32_t>(skinVertexRange_.offset / sizeof(SkinVertex));
+}
+
+inline uint32_t Mesh::GetFirstIndex() const
+{
+	const VkDeviceSize indexSize = indexType_ == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	return static_cast<uint32_t>(indexRange_.offset / indexSize);
 }
@@ -0,0 +1,175 @@
+#include "MeshCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "MeshModel.h"
+#include "MeshOptimizer.h"
+#include "Utilities.h"
+
+
+namespace
+{
+	const uint32_t MESH_CACHE_MAGIC = 0x4348534D; // "MSHC"
+	const uint32_t MESH_CACHE_VERSION = 1;
+	const size_t MESH_CACHE_ALIGNMENT = 16; // Of every array in the file
+
+	struct MeshCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertexFormat; // GPU_VERTEX_FORMAT the file was baked with
+		uint32_t vertexStride;
+		uint64_t meshCount;
+	};
+
+	// Appends an array to the file, returns its offset
+	uint64_t appendData(std::vector<char>& fileData, const void* data, size_t size)
+	{
+		const size_t offset = (fileData.size() + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+		fileData.resize(offset + size);
+		if (size > 0)
+		{
+			memcpy(fileData.data() + offset, data, size);
+		}
+
+		return offset;
+	}
+
+	MeshCacheLod appendLod(std::vector<char>& fileData, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+		const VertexQuantization& quantization, uint32_t indexSize)
+	{
+		std::vector<GpuVertex> gpuVertices = encodeVertices(vertices, quantization);
+		std::vector<GpuPosition> gpuPositions = extractPositions(gpuVertices);
+
+		MeshCacheLod lod
+		{
+			.vertexOffset = appendData(fileData, gpuVertices.data(), sizeof(GpuVertex) * gpuVertices.size()),
+			.positionOffset = appendData(fileData, gpuPositions.data(), sizeof(GpuPosition) * gpuPositions.size()),
+			.indexOffset = 0,
+			.vertexCount = static_cast<uint32_t>(vertices.size()),
+			.indexCount = static_cast<uint32_t>(indices.size())
+		};
+
+		if (indexSize == sizeof(uint16_t))
+		{
+			std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+			lod.indexOffset = appendData(fileData, shortIndices.data(), sizeof(uint16_t) * shortIndices.size());
+		}
+		else
+		{
+			lod.indexOffset = appendData(fileData, indices.data(), sizeof(uint32_t) * indices.size());
+		}
+
+		return lod;
+	}
+
+	bool isLodInFile(const MeshCacheLod& lod, uint32_t indexSize, size_t fileSize)
+	{
+		return lod.vertexOffset + uint64_t(lod.vertexCount) * sizeof(GpuVertex) <= fileSize &&
+			lod.positionOffset + uint64_t(lod.vertexCount) * sizeof(GpuPosition) <= fileSize &&
+			lod.indexOffset + uint64_t(lod.indexCount) * indexSize <= fileSize;
+	}
+}
+
+
+std::shared_ptr<MeshCache> MeshCache::Open(const std::string& sourcePath, const std::vector<MeshData>& meshes)
+{
+	const std::string filePath = sourcePath + ".meshcache";
+
+	return openCacheFile(sourcePath, filePath, [&]() { return std::make_shared<MeshCache>(filePath, meshes.size()); }, [&]() { return Bake(meshes); });
+}
+
+MeshCache::MeshCache(const std::string& filePath, size_t meshCount) :
+	file_(filePath), entries_(nullptr), meshCount_(meshCount)
+{
+	const size_t entriesOffset = sizeof(MeshCacheHeader);
+	if (file_.GetSize() < entriesOffset + sizeof(MeshCacheEntry) * meshCount)
+	{
+		throw std::runtime_error("Mesh cache is truncated.");
+	}
+
+	const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(file_.GetData());
+	if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION || header->vertexFormat != GPU_VERTEX_FORMAT ||
+		header->vertexStride != sizeof(GpuVertex) || header->meshCount != meshCount)
+	{
+		throw std::runtime_error("Mesh cache doesn't match the model.");
+	}
+
+	entries_ = reinterpret_cast<const MeshCacheEntry*>(file_.GetData() + entriesOffset);
+	for (size_t i = 0; i < meshCount_; i++)
+	{
+		const MeshCacheEntry& entry = entries_[i];
+		if (entry.streamed == 0)
+		{
+			continue;
+		}
+
+		for (const MeshCacheLod& lod : entry.lods)
+		{
+			if (isLodInFile(lod, entry.indexSize, file_.GetSize()) == false)
+			{
+				throw std::runtime_error("Mesh cache is truncated.");
+			}
+		}
+	}
+}
+
+
+std::vector<char> MeshCache::Bake(const std::vector<MeshData>& meshes)
+{
+	std::vector<char> fileData(sizeof(MeshCacheHeader) + sizeof(MeshCacheEntry) * meshes.size(), 0);
+	std::vector<MeshCacheEntry> entries(meshes.size(), MeshCacheEntry{});
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		const MeshData& meshData = meshes[i];
+		if (meshData.skin >= 0 || meshData.vertices.empty() || meshData.indices.empty())
+		{
+			continue;
+		}
+
+		MeshCacheEntry& entry = entries[i];
+		entry.streamed = 1;
+		entry.quantization = computeVertexQuantization(meshData.vertices);
+		entry.indexSize = meshData.vertices.size() <= std::numeric_limits<uint16_t>::max() ? sizeof(uint16_t) : sizeof(uint32_t);
+
+		glm::vec3 boundsMin = meshData.vertices[0].position;
+		glm::vec3 boundsMax = meshData.vertices[0].position;
+		for (const Vertex& vertex : meshData.vertices)
+		{
+			boundsMin = glm::min(boundsMin, vertex.position);
+			boundsMax = glm::max(boundsMax, vertex.position);
+		}
+		const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		float radius = 0.0f;
+		for (const Vertex& vertex : meshData.vertices)
+		{
+			radius = std::max(radius, glm::length(vertex.position - center));
+		}
+		entry.bounds = glm::vec4(center, radius);
+
+		std::vector<Vertex> coarseVertices;
+		std::vector<uint32_t> coarseIndices;
+		simplifyMesh(meshData.vertices, meshData.indices, COARSE_LOD_GRID_SIZE, coarseVertices, coarseIndices);
+		optimizeMesh(coarseVertices, coarseIndices);
+
+		entry.lods[MESH_LOD_FULL] = appendLod(fileData, meshData.vertices, meshData.indices, entry.quantization, entry.indexSize);
+		entry.lods[MESH_LOD_COARSE] = appendLod(fileData, coarseVertices, coarseIndices, entry.quantization, entry.indexSize);
+	}
+
+	const MeshCacheHeader header
+	{
+		.magic = MESH_CACHE_MAGIC,
+		.version = MESH_CACHE_VERSION,
+		.vertexFormat = GPU_VERTEX_FORMAT,
+		.vertexStride = sizeof(GpuVertex),
+		.meshCount = meshes.size()
+	};
+	memcpy(fileData.data(), &header, sizeof(header));
+	memcpy(fileData.data() + sizeof(header), entries.data(), sizeof(MeshCacheEntry) * entries.size());
+
+	return fileData;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "MappedFile.h"
+#include "VertexFormat.h"
+
+
+struct MeshData;
+
+const uint32_t MESH_LOD_FULL = 0;
+const uint32_t MESH_LOD_COARSE = 1;
+const uint32_t MESH_LOD_COUNT = 2;
+
+const uint32_t COARSE_LOD_GRID_SIZE = 16; // Cells along the longest side of a mesh, see simplifyMesh
+
+// Where one level of detail of a mesh is in the cache file, offsets are in bytes from the start of the file
+struct MeshCacheLod
+{
+	uint64_t vertexOffset;   // GpuVertex array
+	uint64_t positionOffset; // GpuPosition array
+	uint64_t indexOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+};
+
+struct MeshCacheEntry
+{
+	VertexQuantization quantization; // Shared by both levels of detail
+	glm::vec4 bounds;                // Bounding sphere in mesh space, center and radius
+	uint32_t streamed;               // 0 for meshes which are always resident, e.g. skinned ones, their levels of detail are empty
+	uint32_t indexSize;              // 2 or 4 bytes, chosen by the full level of detail's vertex count
+	MeshCacheLod lods[MESH_LOD_COUNT];
+};
+
+// Baked geometry of a model's static meshes, already encoded the way the geometry buffer holds it.
+// The file sits next to the model and is mapped, so only the meshes which are streamed in are ever read from disk.
+class MeshCache
+{
+public:
+	// Maps <sourcePath>.meshcache, bakes it first if it's missing, older than the model file or doesn't match the meshes.
+	// Safe to call for the same model from several loader threads.
+	static std::shared_ptr<MeshCache> Open(const std::string& sourcePath, const std::vector<MeshData>& meshes);
+
+	MeshCache(const std::string& filePath, size_t meshCount);
+
+	const MeshCacheEntry& GetEntry(size_t meshIndex) const;
+	const std::byte* GetData(uint64_t offset) const;
+
+private:
+	MappedFile file_;
+	const MeshCacheEntry* entries_;
+	size_t meshCount_;
+
+	static std::vector<char> Bake(const std::vector<MeshData>& meshes); // File content
+};
+
+
+inline const MeshCacheEntry& MeshCache::GetEntry(size_t meshIndex) const
+{
+	return entries_[meshIndex];
+}
+
+inline const std::byte* MeshCache::GetData(uint64_t offset) const
+{
+	return file_.GetData() + offset;
+}
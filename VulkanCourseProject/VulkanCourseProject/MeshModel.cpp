@@ -1,24 +1,112 @@
 #include "MeshModel.h"
 
+#include <cmath>
+
+#include <glm/gtc/type_ptr.hpp>
+
 #include "VulkanRenderer.h"
+#include "MeshOptimizer.h"
+#include "Profiler.h"
+
+
+std::atomic<bool> MeshModel::showOptimizationStatistics_ = false;
+
+
+MeshModel::MeshModel(std::vector<Mesh>&& meshes, std::vector<int>&& meshNodes, std::vector<int>&& textureIds, SceneGraph&& nodes,
+	std::vector<int>&& meshSkins, std::vector<Skin>&& skins, std::vector<AnimationClip>&& animations) :
+	meshes_(std::move(meshes)), meshNodes_(std::move(meshNodes)), textureIds_(std::move(textureIds)), nodes_(std::move(nodes)),
+	meshSkins_(std::move(meshSkins)), skins_(std::move(skins)), animations_(std::move(animations)),
+	currentAnimation_(-1), animationTime_(0.0f), animationLoop_(false), static_(false)
+{
+	if (nodes_.GetNodeCount() == 0)
+	{
+		nodes_.AddNode(SceneGraph::NO_PARENT, glm::mat4(1.0f), "");
+	}
+
+	meshSkins_.resize(meshes_.size(), -1);
+	meshPaletteOffsets_.resize(meshes_.size(), 0);
+	size_t paletteSize = 0;
+	for (size_t i = 0; i < meshes_.size(); i++)
+	{
+		if (meshSkins_[i] >= 0)
+		{
+			meshPaletteOffsets_[i] = paletteSize;
+			paletteSize += skins_[meshSkins_[i]].jointNodes.size();
+		}
+	}
+	skinPalettes_.resize(paletteSize, glm::mat4(1.0f));
+
+	UpdateTransforms();
+}
 
 
-MeshModel::MeshModel(const std::vector<Mesh>& meshes, glm::mat4 model) : meshes_(meshes), model_(model)
+void MeshModel::PlayAnimation(int animation, bool loop)
 {
+	if (animation >= static_cast<int>(animations_.size()))
+	{
+		throw std::runtime_error("Attempted to play invalid animation index.");
+	}
+
+	currentAnimation_ = animation;
+	animationTime_ = 0.0f;
+	animationLoop_ = loop;
 }
 
+void MeshModel::UpdateAnimation(float deltaTime)
+{
+	if (currentAnimation_ < 0)
+	{
+		return;
+	}
+
+	const AnimationClip& clip = animations_[currentAnimation_];
+
+	animationTime_ += deltaTime;
+	if (animationTime_ >= clip.duration)
+	{
+		if (animationLoop_ && clip.duration > 0.0f)
+		{
+			animationTime_ = std::fmod(animationTime_, clip.duration);
+		}
+		else
+		{
+			// Last pose stays
+			animationTime_ = clip.duration;
+			currentAnimation_ = -1;
+		}
+	}
+
+	sampleAnimation(clip, animationTime_, nodes_);
+}
 
-void MeshModel::Destroy()
+bool MeshModel::UpdateTransforms()
 {
-	for (Mesh& mesh : meshes_)
+	if (nodes_.UpdateWorldTransforms() == false)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < meshes_.size(); i++)
 	{
-		mesh.Destroy();
+		if (meshSkins_[i] >= 0)
+		{
+			computeSkinPalette(skins_[meshSkins_[i]], nodes_, meshNodes_[i], skinPalettes_.data() + meshPaletteOffsets_[i]);
+		}
 	}
+
+	return true;
 }
 
 
 MeshModel MeshModel::LoadModel(const std::string& directory, const std::string& fileName, VulkanRenderer* renderer)
 {
+	return CreateModel(ImportModel(directory, fileName), renderer, renderer->graphicsCommandPool_);
+}
+
+ModelData MeshModel::ImportModel(const std::string& directory, const std::string& fileName)
+{
+	PROFILE_SCOPE("ImportModel");
+
 	//const std::string base_filename = fileName.substr(fileName.find_last_of("/\\") + 1);
 	//std::string::size_type const p(base_filename.find_last_of('.'));
 	//const std::string file_without_extension = base_filename.substr(0, p);
@@ -27,35 +115,181 @@ MeshModel MeshModel::LoadModel(const std::string& directory, const std::string&
 
 	Assimp::Importer importer;
 
-	const aiScene* scene = importer.ReadFile(filePath, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+	// Skinning shader blends up to 4 joints per vertex
+	const aiScene* scene = importer.ReadFile(filePath, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace |
+		aiProcess_JoinIdenticalVertices | aiProcess_LimitBoneWeights);
 	if (!scene)
 	{
 		throw std::runtime_error("Failed to load model.");
 	}
 
-	std::vector<std::string> textureNames = LoadMaterials(scene);
+	ModelData modelData;
+	modelData.sourcePath = filePath;
+
+	modelData.texturePaths = LoadMaterials(scene, aiTextureType_DIFFUSE);
+	modelData.normalTexturePaths = LoadMaterials(scene, aiTextureType_NORMALS);
+	for (std::vector<std::string>* texturePaths : { &modelData.texturePaths, &modelData.normalTexturePaths })
+	{
+		for (std::string& texturePath : *texturePaths)
+		{
+			if (texturePath.empty() == false)
+			{
+				texturePath = "../models/" + directory + "/" + texturePath;
+			}
+		}
+	}
+
+	// Root node holds the model matrix, file hierarchy goes below it
+	int root = modelData.nodes.AddNode(SceneGraph::NO_PARENT, glm::mat4(1.0f), "");
+	LoadNode(scene->mRootNode, scene, root, modelData);
+	LoadSkins(modelData);
+	LoadAnimations(scene, modelData);
+
+	OptimizeMeshes(modelData, filePath);
+
+	return modelData;
+}
+
+MeshModel MeshModel::CreateModel(const ModelData& modelData, VulkanRenderer* renderer, VkCommandPool commandPool)
+{
+	PROFILE_SCOPE("CreateModel");
+
+	std::vector<int> matToTex(modelData.texturePaths.size(), renderer->placeholderTextureId_);
+	std::vector<int> matToNormalTex(modelData.normalTexturePaths.size(), -1);
 
-	std::vector<int> matToTex(textureNames.size());
+	// Textures are decoded by the job system, each batch records its uploads into its own pool
+	getJobSystem().ParallelFor(matToTex.size(), 1, [&](size_t begin, size_t end)
+	{
+		VkCommandPool batchCommandPool = renderer->CreateUploadCommandPool();
+		try
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				if (modelData.texturePaths[i].empty() == false)
+				{
+					matToTex[i] = renderer->AcquireTexture(modelData.texturePaths[i], batchCommandPool);
+				}
+				if (modelData.normalTexturePaths[i].empty() == false)
+				{
+					matToNormalTex[i] = renderer->AcquireTexture(modelData.normalTexturePaths[i], batchCommandPool);
+				}
+			}
+		}
+		catch (...)
+		{
+			vkDestroyCommandPool(renderer->mainDevice.logicalDevice, batchCommandPool, nullptr);
+			throw;
+		}
+		vkDestroyCommandPool(renderer->mainDevice.logicalDevice, batchCommandPool, nullptr);
+	});
+
+	std::vector<int> textureIds;
 	for (size_t i = 0; i < matToTex.size(); i++)
 	{
-		if (textureNames[i].empty())
+		if (modelData.texturePaths[i].empty() == false)
 		{
-			matToTex[i] = 0;
+			textureIds.push_back(matToTex[i]);
+		}
+		if (matToNormalTex[i] >= 0)
+		{
+			textureIds.push_back(matToNormalTex[i]);
+		}
+	}
+
+	// Baked after optimization, so a cache is only valid for the same import settings and optimizer
+	std::shared_ptr<const MeshCache> meshCache;
+	if (renderer->meshStreamingBudget_ > 0)
+	{
+		PROFILE_SCOPE("OpenMeshCache");
+		meshCache = MeshCache::Open(modelData.sourcePath, modelData.meshes);
+	}
+
+	std::vector<Mesh> meshes;
+	std::vector<int> meshNodes;
+	std::vector<int> meshSkins;
+	meshes.reserve(modelData.meshes.size());
+	meshNodes.reserve(modelData.meshes.size());
+	meshSkins.reserve(modelData.meshes.size());
+	for (size_t i = 0; i < modelData.meshes.size(); i++)
+	{
+		const MeshData& meshData = modelData.meshes[i];
+		if (meshCache && meshCache->GetEntry(i).streamed != 0)
+		{
+			meshes.emplace_back(renderer->geometryBuffer_.get(), renderer->meshStreamer_.get(), renderer->graphicsQueue_, commandPool,
+				meshCache, i, matToTex[meshData.materialIndex], matToNormalTex[meshData.materialIndex]);
 		}
 		else
 		{
-			const std::string texturePath = "../models/" + directory + "/" + textureNames[i];
-			matToTex[i] = renderer->CreateTexture(texturePath, false);
+			meshes.emplace_back(renderer->geometryBuffer_.get(), renderer->graphicsQueue_, commandPool,
+				meshData.vertices, meshData.indices, matToTex[meshData.materialIndex], matToNormalTex[meshData.materialIndex], meshData.skin >= 0);
 		}
+		meshNodes.push_back(meshData.node);
+		meshSkins.push_back(meshData.skin);
 	}
 
-	std::vector<Mesh> meshes = LoadNode(scene->mRootNode, scene, matToTex, renderer);
+	SceneGraph nodes = modelData.nodes;
+	std::vector<Skin> skins = modelData.skins;
+	std::vector<AnimationClip> animations = modelData.animations;
+	return MeshModel(std::move(meshes), std::move(meshNodes), std::move(textureIds), std::move(nodes),
+		std::move(meshSkins), std::move(skins), std::move(animations));
+}
+
 
-	return MeshModel(meshes, glm::mat4(1.0f));
+void MeshModel::SetShowOptimizationStatistics(bool show)
+{
+	showOptimizationStatistics_ = show;
 }
 
+void MeshModel::OptimizeMeshes(ModelData& modelData, const std::string& name)
+{
+	PROFILE_SCOPE("OptimizeMeshes");
+
+	// Meshes are optimized independently, each job keeps its own statistics
+	const bool showStatistics = showOptimizationStatistics_;
+	std::vector<VertexCacheStatistics> meshesBefore(modelData.meshes.size());
+	std::vector<VertexCacheStatistics> meshesAfter(modelData.meshes.size());
+	getJobSystem().ParallelFor(modelData.meshes.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			MeshData& meshData = modelData.meshes[i];
+			if (showStatistics)
+			{
+				meshesBefore[i] = analyzeVertexCache(meshData.indices, meshData.vertices.size());
+			}
+			optimizeMesh(meshData.vertices, meshData.indices);
+			if (showStatistics)
+			{
+				meshesAfter[i] = analyzeVertexCache(meshData.indices, meshData.vertices.size());
+			}
+		}
+	});
+
+	if (showStatistics == false)
+	{
+		return;
+	}
+
+	VertexCacheStatistics before{ 0, 0, 0 };
+	VertexCacheStatistics after{ 0, 0, 0 };
+	for (size_t i = 0; i < modelData.meshes.size(); i++)
+	{
+		const VertexCacheStatistics& meshBefore = meshesBefore[i];
+		const VertexCacheStatistics& meshAfter = meshesAfter[i];
+
+		before.transformedVertices += meshBefore.transformedVertices;
+		before.triangleCount += meshBefore.triangleCount;
+		before.vertexCount += meshBefore.vertexCount;
+		after.transformedVertices += meshAfter.transformedVertices;
+		after.triangleCount += meshAfter.triangleCount;
+		after.vertexCount += meshAfter.vertexCount;
+	}
+
+	printf("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name.c_str(), before.GetAcmr(), after.GetAcmr(), before.GetAtvr(), after.GetAtvr());
+}
 
-std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
+
+std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene, aiTextureType textureType)
 {
 	std::vector<std::string> textures(scene->mNumMaterials);
 
@@ -64,10 +298,10 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
 		textures[i] = "";
 
 		const aiMaterial* material = scene->mMaterials[i];
-		if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+		if (material->GetTextureCount(textureType) > 0)
 		{
 			aiString path;
-			if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == aiReturn_SUCCESS)
+			if (material->GetTexture(textureType, 0, &path) == aiReturn_SUCCESS)
 			{
 				const std::string fullPath = std::string(path.data);
 				const std::string fileName = fullPath.substr(fullPath.rfind("\\") + 1);
@@ -80,28 +314,29 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
 	return textures;
 }
 
-std::vector<Mesh> MeshModel::LoadNode(const aiNode* node, const aiScene* scene, std::vector<int> matToTex, VulkanRenderer* renderer)
+void MeshModel::LoadNode(const aiNode* node, const aiScene* scene, int parent, ModelData& modelData)
 {
-	std::vector<Mesh> meshes;
+	// Assimp matrices are row-major
+	const glm::mat4 localTransform = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+	const int sceneNode = modelData.nodes.AddNode(parent, localTransform, node->mName.C_Str());
 
 	for (size_t i = 0; i < node->mNumMeshes; i++)
 	{
-		meshes.push_back(LoadMesh(scene->mMeshes[node->mMeshes[i]], scene, matToTex, renderer));
+		modelData.meshes.push_back(LoadMesh(scene->mMeshes[node->mMeshes[i]], scene, modelData));
+		modelData.meshes.back().node = sceneNode;
 	}
 
 	for (size_t i = 0; i < node->mNumChildren; i++)
 	{
-		std::vector<Mesh> childMeshes = LoadNode(node->mChildren[i], scene, matToTex, renderer);
-		meshes.insert(meshes.end(), childMeshes.begin(), childMeshes.end());
+		LoadNode(node->mChildren[i], scene, sceneNode, modelData);
 	}
-
-	return meshes;
 }
 
-Mesh MeshModel::LoadMesh(const aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex, VulkanRenderer* renderer)
+MeshData MeshModel::LoadMesh(const aiMesh* mesh, const aiScene* scene, ModelData& modelData)
 {
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
+	indices.reserve(mesh->mNumFaces * 3);
 
 	vertices.resize(mesh->mNumVertices);
 	for (size_t i = 0; i < vertices.size(); i++)
@@ -112,7 +347,18 @@ Mesh MeshModel::LoadMesh(const aiMesh* mesh, const aiScene* scene, std::vector<i
 			mesh->mVertices[i].z
 		);
 
-		vertices[i].color = glm::vec3(1.0f);
+		if (mesh->mNormals)
+		{
+			vertices[i].normal = glm::vec3(
+				mesh->mNormals[i].x,
+				mesh->mNormals[i].y,
+				mesh->mNormals[i].z
+			);
+		}
+		else
+		{
+			vertices[i].normal = glm::vec3(0.0f, 0.0f, 1.0f);
+		}
 
 		if (mesh->mTextureCoords[0])
 		{
@@ -125,6 +371,20 @@ Mesh MeshModel::LoadMesh(const aiMesh* mesh, const aiScene* scene, std::vector<i
 		{
 			vertices[i].texCoords = glm::vec2(0.0f);
 		}
+
+		// Bitangent is rebuilt in the shaders from normal, tangent and its sign
+		if (mesh->mTangents && mesh->mBitangents)
+		{
+			const glm::vec3 tangent(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+			const glm::vec3 bitangent(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+			const float sign = glm::dot(glm::cross(vertices[i].normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+
+			vertices[i].tangent = glm::vec4(tangent, sign);
+		}
+		else
+		{
+			vertices[i].tangent = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+		}
 	}
 
 	for (size_t i = 0; i < mesh->mNumFaces; i++)
@@ -137,6 +397,111 @@ Mesh MeshModel::LoadMesh(const aiMesh* mesh, const aiScene* scene, std::vector<i
 		}
 	}
 
-	return Mesh(renderer->mainDevice.physicalDevice, renderer->mainDevice.logicalDevice, renderer->graphicsQueue_, 
-		renderer->graphicsCommandPool_, vertices, indices, matToTex[mesh->mMaterialIndex]);
+	int skin = -1;
+	if (mesh->HasBones())
+	{
+		Skin meshSkin;
+		std::vector<uint32_t> influenceCounts(vertices.size(), 0);
+
+		for (size_t i = 0; i < mesh->mNumBones; i++)
+		{
+			const aiBone* bone = mesh->mBones[i];
+			meshSkin.jointNames.push_back(bone->mName.C_Str());
+			meshSkin.inverseBindMatrices.push_back(glm::transpose(glm::make_mat4(&bone->mOffsetMatrix.a1)));
+
+			for (size_t j = 0; j < bone->mNumWeights; j++)
+			{
+				const aiVertexWeight& weight = bone->mWeights[j];
+				uint32_t& influenceCount = influenceCounts[weight.mVertexId];
+				if (influenceCount < 4)
+				{
+					vertices[weight.mVertexId].joints[influenceCount] = static_cast<uint32_t>(i);
+					vertices[weight.mVertexId].weights[influenceCount] = weight.mWeight;
+					influenceCount++;
+				}
+			}
+		}
+
+		for (Vertex& vertex : vertices)
+		{
+			const float weightSum = vertex.weights.x + vertex.weights.y + vertex.weights.z + vertex.weights.w;
+			vertex.weights = weightSum > 0.0f ? vertex.weights / weightSum : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+		}
+
+		skin = static_cast<int>(modelData.skins.size());
+		modelData.skins.push_back(std::move(meshSkin));
+	}
+
+	return MeshData
+	{
+		.vertices = std::move(vertices),
+		.indices = std::move(indices),
+		.materialIndex = mesh->mMaterialIndex,
+		.node = 0,
+		.skin = skin
+	};
+}
+
+void MeshModel::LoadSkins(ModelData& modelData)
+{
+	for (Skin& skin : modelData.skins)
+	{
+		skin.jointNodes.resize(skin.jointNames.size());
+		for (size_t i = 0; i < skin.jointNames.size(); i++)
+		{
+			skin.jointNodes[i] = modelData.nodes.FindNode(skin.jointNames[i]);
+		}
+	}
+}
+
+void MeshModel::LoadAnimations(const aiScene* scene, ModelData& modelData)
+{
+	for (size_t i = 0; i < scene->mNumAnimations; i++)
+	{
+		const aiAnimation* animation = scene->mAnimations[i];
+
+		// Key times are in ticks, 0 ticks per second means unspecified
+		const double ticksPerSecond = animation->mTicksPerSecond != 0.0 ? animation->mTicksPerSecond : 25.0;
+
+		AnimationClip clip
+		{
+			.name = animation->mName.C_Str(),
+			.duration = static_cast<float>(animation->mDuration / ticksPerSecond)
+		};
+
+		for (size_t j = 0; j < animation->mNumChannels; j++)
+		{
+			const aiNodeAnim* nodeAnimation = animation->mChannels[j];
+
+			const int node = modelData.nodes.FindNode(nodeAnimation->mNodeName.C_Str());
+			if (node < 0)
+			{
+				continue;
+			}
+
+			AnimationChannel channel{ .node = node };
+			for (size_t k = 0; k < nodeAnimation->mNumPositionKeys; k++)
+			{
+				const aiVectorKey& key = nodeAnimation->mPositionKeys[k];
+				channel.positionTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+				channel.positions.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+			}
+			for (size_t k = 0; k < nodeAnimation->mNumRotationKeys; k++)
+			{
+				const aiQuatKey& key = nodeAnimation->mRotationKeys[k];
+				channel.rotationTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+				channel.rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+			}
+			for (size_t k = 0; k < nodeAnimation->mNumScalingKeys; k++)
+			{
+				const aiVectorKey& key = nodeAnimation->mScalingKeys[k];
+				channel.scaleTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+				channel.scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+			}
+
+			clip.channels.push_back(std::move(channel));
+		}
+
+		modelData.animations.push_back(std::move(clip));
+	}
 }
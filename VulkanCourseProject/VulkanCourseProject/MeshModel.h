@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
 
 #include <glm/glm.hpp>
 #include "assimp/Importer.hpp"
@@ -9,32 +10,107 @@
 #include "assimp/postprocess.h"
 
 #include "Mesh.h"
+#include "SceneGraph.h"
+#include "Animation.h"
 
 
 class VulkanRenderer;
 
+// CPU side model data, produced without touching the GPU so it can be imported on any thread
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	unsigned int materialIndex;
+	int node; // Scene graph node the mesh is attached to
+	int skin; // -1 if the mesh isn't skinned
+};
+
+struct ModelData
+{
+	std::string sourcePath; // Model file, the mesh cache of streamed meshes is baked next to it
+	std::vector<MeshData> meshes;
+	std::vector<std::string> texturePaths; // One per material, empty if material has no diffuse texture
+	std::vector<std::string> normalTexturePaths; // One per material, empty if material has no normal map
+	SceneGraph nodes;
+	std::vector<Skin> skins;
+	std::vector<AnimationClip> animations;
+};
+
 class MeshModel
 {
 public:
-	MeshModel(const std::vector<Mesh>& meshes, glm::mat4 model);
+	// Node 0 is the model root, it's added if the graph is empty
+	MeshModel(std::vector<Mesh>&& meshes, std::vector<int>&& meshNodes, std::vector<int>&& textureIds, SceneGraph&& nodes,
+		std::vector<int>&& meshSkins = {}, std::vector<Skin>&& skins = {}, std::vector<AnimationClip>&& animations = {});
+	MeshModel(MeshModel&& other) noexcept = default;
+	MeshModel& operator=(MeshModel&& other) noexcept = default;
+
+	MeshModel(const MeshModel&) = delete;
+	MeshModel& operator=(const MeshModel&) = delete;
 
 	size_t GetMeshCount() const;
 	const Mesh& GetMesh(size_t index) const;
-	const glm::mat4& GetModel() const;
+	const std::vector<int>& GetTextureIds() const;
+	const glm::mat4& GetMeshTransform(size_t index) const;
 
+	// Model matrix is the local transform of the root node
+	const glm::mat4& GetModel() const;
 	void SetModel(const glm::mat4& model);
 
-	void Destroy();
+	SceneGraph& GetNodes();
+	const SceneGraph& GetNodes() const;
+	bool UpdateTransforms(); // False if no node moved
+
+	// Static models are expected not to move, their meshes are kept in the cached shadow maps
+	bool IsStatic() const;
+	void SetStatic(bool isStatic);
+
+	size_t GetAnimationCount() const;
+	const AnimationClip& GetAnimation(size_t index) const;
+	// -1 stops playback and leaves the nodes in the current pose
+	void PlayAnimation(int animation, bool loop);
+	// Samples the playing clip into the nodes, world transforms are recomputed by UpdateTransforms
+	void UpdateAnimation(float deltaTime);
+
+	// Joint matrices of skinned meshes, refreshed by UpdateTransforms
+	bool IsMeshSkinned(size_t index) const;
+	const glm::mat4* GetSkinPalette(size_t index) const;
+	uint32_t GetSkinJointCount(size_t index) const;
 
 	static MeshModel LoadModel(const std::string& directory, const std::string& fileName, VulkanRenderer* renderer);
+	static ModelData ImportModel(const std::string& directory, const std::string& fileName);
+	static MeshModel CreateModel(const ModelData& modelData, VulkanRenderer* renderer, VkCommandPool commandPool);
+
+	// Vertex cache efficiency before and after optimization is printed for every imported model, off by default
+	static void SetShowOptimizationStatistics(bool show);
 
 private:
-	std::vector<Mesh> meshes_;
-	glm::mat4 model_;
+	static std::atomic<bool> showOptimizationStatistics_;
 
-	static std::vector<std::string> LoadMaterials(const aiScene* scene);
-	static std::vector<Mesh> LoadNode(const aiNode* node, const aiScene* scene, std::vector<int> matToTex, VulkanRenderer* renderer);
-	static Mesh LoadMesh(const aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex, VulkanRenderer* renderer);
+	std::vector<Mesh> meshes_;
+	std::vector<int> meshNodes_; // Per mesh
+	std::vector<int> textureIds_;
+	SceneGraph nodes_;
+
+	std::vector<int> meshSkins_; // Per mesh, -1 if not skinned
+	std::vector<Skin> skins_;
+	std::vector<glm::mat4> skinPalettes_; // Joint matrices of all skinned meshes
+	std::vector<size_t> meshPaletteOffsets_; // Per mesh, into skinPalettes_
+
+	std::vector<AnimationClip> animations_;
+	int currentAnimation_;
+	float animationTime_;
+	bool animationLoop_;
+
+	bool static_;
+
+	static std::vector<std::string> LoadMaterials(const aiScene* scene, aiTextureType textureType);
+	static void LoadNode(const aiNode* node, const aiScene* scene, int parent, ModelData& modelData);
+	static MeshData LoadMesh(const aiMesh* mesh, const aiScene* scene, ModelData& modelData);
+	static void LoadSkins(ModelData& modelData);
+	static void LoadAnimations(const aiScene* scene, ModelData& modelData);
+	static void OptimizeMeshes(ModelData& modelData, const std::string& name);
 };
 
 
@@ -53,13 +129,73 @@ inline const Mesh& MeshModel::GetMesh(size_t index) const
 	return meshes_[index];
 }
 
+inline const std::vector<int>& MeshModel::GetTextureIds() const
+{
+	return textureIds_;
+}
+
+inline const glm::mat4& MeshModel::GetMeshTransform(size_t index) const
+{
+	return nodes_.GetWorldTransform(meshNodes_[index]);
+}
+
 inline const glm::mat4& MeshModel::GetModel() const
 {
-	return model_;
+	return nodes_.GetLocalTransform(0);
 }
 
 
 inline void MeshModel::SetModel(const glm::mat4& model)
 {
-	model_ = model;
+	nodes_.SetLocalTransform(0, model);
+}
+
+inline SceneGraph& MeshModel::GetNodes()
+{
+	return nodes_;
+}
+
+inline const SceneGraph& MeshModel::GetNodes() const
+{
+	return nodes_;
+}
+
+inline bool MeshModel::IsStatic() const
+{
+	return static_;
+}
+
+inline void MeshModel::SetStatic(bool isStatic)
+{
+	static_ = isStatic;
+}
+
+inline size_t MeshModel::GetAnimationCount() const
+{
+	return animations_.size();
+}
+
+inline const AnimationClip& MeshModel::GetAnimation(size_t index) const
+{
+	if (index >= animations_.size())
+	{
+		throw std::runtime_error("Attempted to access invalid animation index.");
+	}
+
+	return animations_[index];
+}
+
+inline bool MeshModel::IsMeshSkinned(size_t index) const
+{
+	return meshSkins_[index] >= 0;
+}
+
+inline const glm::mat4* MeshModel::GetSkinPalette(size_t index) const
+{
+	return skinPalettes_.data() + meshPaletteOffsets_[index];
+}
+
+inline uint32_t MeshModel::GetSkinJointCount(size_t index) const
+{
+	return static_cast<uint32_t>(skins_[meshSkins_[index]].jointNodes.size());
 }
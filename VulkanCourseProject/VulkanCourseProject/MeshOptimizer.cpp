@@ -0,0 +1,425 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+
+// Cluster may be split once its own ACMR, starting with a cold cache, gets this close to the whole mesh ACMR
+const float CLUSTER_ACMR_THRESHOLD = 1.05f;
+
+
+float VertexCacheStatistics::GetAcmr() const
+{
+	return triangleCount > 0 ? static_cast<float>(transformedVertices) / triangleCount : 0.0f;
+}
+
+float VertexCacheStatistics::GetAtvr() const
+{
+	return vertexCount > 0 ? static_cast<float>(transformedVertices) / vertexCount : 0.0f;
+}
+
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize)
+{
+	VertexCacheStatistics statistics
+	{
+		.transformedVertices = 0,
+		.triangleCount = indices.size() / 3,
+		.vertexCount = 0
+	};
+
+	// FIFO cache, vertex is cached if fewer than cacheSize vertices were transformed after it
+	std::vector<size_t> cacheTimestamps(vertexCount, 0);
+	size_t timestamp = cacheSize + 1;
+
+	std::vector<bool> referenced(vertexCount, false);
+
+	for (uint32_t index : indices)
+	{
+		if (timestamp - cacheTimestamps[index] > cacheSize)
+		{
+			cacheTimestamps[index] = timestamp++;
+			statistics.transformedVertices++;
+		}
+
+		if (referenced[index] == false)
+		{
+			referenced[index] = true;
+			statistics.vertexCount++;
+		}
+	}
+
+	return statistics;
+}
+
+
+std::vector<size_t> optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return {};
+	}
+
+	// Triangles adjacent to every vertex
+	std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (uint32_t index : indices)
+	{
+		adjacencyOffsets[index + 1]++;
+	}
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+	}
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<size_t> adjacencyCursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		adjacency[adjacencyCursors[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	// Not yet emitted triangles per vertex
+	std::vector<size_t> liveTriangles(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		liveTriangles[i] = adjacencyOffsets[i + 1] - adjacencyOffsets[i];
+	}
+
+	std::vector<size_t> cacheTimestamps(vertexCount, 0);
+	size_t timestamp = cacheSize + 1;
+
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+
+	std::vector<uint32_t> optimizedIndices;
+	optimizedIndices.reserve(indices.size());
+
+	// Hard boundaries, places where fanning had to restart from a vertex which is not in cache
+	std::vector<size_t> hardBoundaries = { 0 };
+
+	size_t scanCursor = 0;
+	int64_t fanningVertex = indices[0];
+
+	while (fanningVertex >= 0)
+	{
+		candidates.clear();
+
+		for (size_t i = adjacencyOffsets[fanningVertex]; i < adjacencyOffsets[fanningVertex + 1]; i++)
+		{
+			const uint32_t triangle = adjacency[i];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+
+			for (size_t j = 0; j < 3; j++)
+			{
+				const uint32_t vertex = indices[triangle * 3 + j];
+
+				optimizedIndices.push_back(vertex);
+				deadEnd.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+
+				if (timestamp - cacheTimestamps[vertex] > cacheSize)
+				{
+					cacheTimestamps[vertex] = timestamp++;
+				}
+			}
+
+			emitted[triangle] = true;
+		}
+
+		// Prefer the oldest candidate which will still be in cache after its fan is emitted
+		int64_t nextVertex = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t candidate : candidates)
+		{
+			if (liveTriangles[candidate] == 0)
+			{
+				continue;
+			}
+
+			int64_t priority = 0;
+			if (timestamp - cacheTimestamps[candidate] + 2 * liveTriangles[candidate] <= cacheSize)
+			{
+				priority = static_cast<int64_t>(timestamp - cacheTimestamps[candidate]);
+			}
+
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				nextVertex = candidate;
+			}
+		}
+
+		if (nextVertex < 0)
+		{
+			while (deadEnd.empty() == false)
+			{
+				const uint32_t vertex = deadEnd.back();
+				deadEnd.pop_back();
+
+				if (liveTriangles[vertex] > 0)
+				{
+					nextVertex = vertex;
+					break;
+				}
+			}
+		}
+
+		if (nextVertex < 0)
+		{
+			while (scanCursor < vertexCount && liveTriangles[scanCursor] == 0)
+			{
+				scanCursor++;
+			}
+
+			if (scanCursor < vertexCount)
+			{
+				nextVertex = static_cast<int64_t>(scanCursor);
+				hardBoundaries.push_back(optimizedIndices.size() / 3);
+			}
+		}
+
+		fanningVertex = nextVertex;
+	}
+
+	indices = std::move(optimizedIndices);
+
+	// Soft boundaries, split hard clusters where a cache flush costs little
+	const float targetAcmr = analyzeVertexCache(indices, vertexCount, cacheSize).GetAcmr() * CLUSTER_ACMR_THRESHOLD;
+
+	std::vector<size_t> clusters;
+	std::fill(cacheTimestamps.begin(), cacheTimestamps.end(), 0);
+	timestamp = cacheSize + 1;
+
+	for (size_t i = 0; i < hardBoundaries.size(); i++)
+	{
+		const size_t clusterEnd = i + 1 < hardBoundaries.size() ? hardBoundaries[i + 1] : triangleCount;
+
+		size_t clusterStart = hardBoundaries[i];
+		size_t transformedVertices = 0;
+		timestamp += cacheSize + 1;
+		clusters.push_back(clusterStart);
+
+		for (size_t triangle = clusterStart; triangle < clusterEnd; triangle++)
+		{
+			for (size_t j = 0; j < 3; j++)
+			{
+				const uint32_t vertex = indices[triangle * 3 + j];
+				if (timestamp - cacheTimestamps[vertex] > cacheSize)
+				{
+					cacheTimestamps[vertex] = timestamp++;
+					transformedVertices++;
+				}
+			}
+
+			const size_t clusterTriangles = triangle + 1 - clusterStart;
+			if (triangle + 1 < clusterEnd && transformedVertices <= targetAcmr * clusterTriangles)
+			{
+				clusterStart = triangle + 1;
+				transformedVertices = 0;
+				timestamp += cacheSize + 1;
+				clusters.push_back(clusterStart);
+			}
+		}
+	}
+
+	return clusters;
+}
+
+
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, const std::vector<size_t>& clusters)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (clusters.size() < 2)
+	{
+		return;
+	}
+
+	struct Cluster
+	{
+		size_t begin;
+		size_t end;
+		glm::vec3 centroid;
+		glm::vec3 normal;
+		float area;
+		float sortKey;
+	};
+
+	std::vector<Cluster> sortedClusters(clusters.size());
+
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	for (size_t i = 0; i < clusters.size(); i++)
+	{
+		Cluster& cluster = sortedClusters[i];
+		cluster.begin = clusters[i];
+		cluster.end = i + 1 < clusters.size() ? clusters[i + 1] : triangleCount;
+		cluster.centroid = glm::vec3(0.0f);
+		cluster.normal = glm::vec3(0.0f);
+		cluster.area = 0.0f;
+
+		for (size_t triangle = cluster.begin; triangle < cluster.end; triangle++)
+		{
+			const glm::vec3& a = vertices[indices[triangle * 3 + 0]].position;
+			const glm::vec3& b = vertices[indices[triangle * 3 + 1]].position;
+			const glm::vec3& c = vertices[indices[triangle * 3 + 2]].position;
+
+			// Cross product length is twice the triangle area, weights cancel out
+			const glm::vec3 normal = glm::cross(b - a, c - a);
+			const float area = glm::length(normal);
+
+			cluster.centroid += (a + b + c) * (area / 3.0f);
+			cluster.normal += normal;
+			cluster.area += area;
+		}
+
+		meshCentroid += cluster.centroid;
+		meshArea += cluster.area;
+
+		if (cluster.area > 0.0f)
+		{
+			cluster.centroid /= cluster.area;
+		}
+	}
+
+	if (meshArea > 0.0f)
+	{
+		meshCentroid /= meshArea;
+	}
+
+	for (Cluster& cluster : sortedClusters)
+	{
+		const float normalLength = glm::length(cluster.normal);
+		cluster.sortKey = normalLength > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / normalLength) : 0.0f;
+	}
+
+	std::stable_sort(sortedClusters.begin(), sortedClusters.end(), [](const Cluster& a, const Cluster& b)
+	{
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<uint32_t> sortedIndices;
+	sortedIndices.reserve(indices.size());
+	for (const Cluster& cluster : sortedClusters)
+	{
+		sortedIndices.insert(sortedIndices.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+	}
+
+	indices = std::move(sortedIndices);
+}
+
+
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	const uint32_t unused = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> remap(vertices.size(), unused);
+
+	std::vector<Vertex> remappedVertices;
+	remappedVertices.reserve(vertices.size());
+
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = static_cast<uint32_t>(remappedVertices.size());
+			remappedVertices.push_back(vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	vertices = std::move(remappedVertices);
+}
+
+
+void optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	if (indices.size() < 3)
+	{
+		return;
+	}
+
+	std::vector<size_t> clusters = optimizeVertexCache(indices, vertices.size());
+	optimizeOverdraw(indices, vertices, clusters);
+	optimizeVertexFetch(vertices, indices);
+}
+
+
+void simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t gridSize,
+	std::vector<Vertex>& simplifiedVertices, std::vector<uint32_t>& simplifiedIndices)
+{
+	simplifiedVertices.clear();
+	simplifiedIndices.clear();
+	if (vertices.empty() || indices.size() < 3 || gridSize == 0)
+	{
+		return;
+	}
+
+	glm::vec3 boundsMin = vertices[0].position;
+	glm::vec3 boundsMax = vertices[0].position;
+	for (const Vertex& vertex : vertices)
+	{
+		boundsMin = glm::min(boundsMin, vertex.position);
+		boundsMax = glm::max(boundsMax, vertex.position);
+	}
+
+	// Cells are cubes, flat meshes don't get slivers along their thin side
+	const glm::vec3 extent = boundsMax - boundsMin;
+	const float cellSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, std::numeric_limits<float>::min())) / gridSize;
+
+	struct Cell
+	{
+		glm::vec3 positionSum;
+		uint32_t vertexCount;
+		uint32_t representative;
+		float representativeDistance;
+	};
+
+	std::vector<uint64_t> vertexCells(vertices.size());
+	std::unordered_map<uint64_t, Cell> cells;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const glm::uvec3 cell = glm::min(glm::uvec3((vertices[i].position - boundsMin) / cellSize), glm::uvec3(gridSize - 1));
+		vertexCells[i] = (static_cast<uint64_t>(cell.z) * gridSize + cell.y) * gridSize + cell.x;
+
+		Cell& vertexCell = cells.try_emplace(vertexCells[i], Cell{ glm::vec3(0.0f), 0, 0, std::numeric_limits<float>::max() }).first->second;
+		vertexCell.positionSum += vertices[i].position;
+		vertexCell.vertexCount++;
+	}
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		Cell& cell = cells[vertexCells[i]];
+		const glm::vec3 offset = vertices[i].position - cell.positionSum / static_cast<float>(cell.vertexCount);
+		const float distance = glm::dot(offset, offset);
+		if (distance < cell.representativeDistance)
+		{
+			cell.representative = static_cast<uint32_t>(i);
+			cell.representativeDistance = distance;
+		}
+	}
+
+	std::vector<uint32_t> collapsedIndices;
+	collapsedIndices.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const uint32_t a = cells[vertexCells[indices[i]]].representative;
+		const uint32_t b = cells[vertexCells[indices[i + 1]]].representative;
+		const uint32_t c = cells[vertexCells[indices[i + 2]]].representative;
+		if (a != b && b != c && a != c)
+		{
+			collapsedIndices.insert(collapsedIndices.end(), { a, b, c });
+		}
+	}
+
+	simplifiedVertices = vertices;
+	simplifiedIndices = std::move(collapsedIndices);
+	optimizeVertexFetch(simplifiedVertices, simplifiedIndices);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "VertexFormat.h"
+
+
+// Post-transform cache size the import-time optimizations and statistics assume
+const size_t VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStatistics
+{
+	size_t transformedVertices; // Cache misses
+	size_t triangleCount;
+	size_t vertexCount;         // Referenced vertices
+
+	float GetAcmr() const;      // Average cache miss ratio, transformed vertices per triangle
+	float GetAtvr() const;      // Average transformed to vertex ratio, 1.0 is optimal
+};
+
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tipsify triangle order, returns first triangle of every cluster which can be reordered without hurting the cache much
+std::vector<size_t> optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize = VERTEX_CACHE_SIZE);
+// View-independent cluster sort, clusters facing away from the mesh center are drawn first
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, const std::vector<size_t>& clusters);
+// Vertices are reordered by first use, unreferenced vertices are dropped
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// All of the above in order
+void optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Vertex clustering, vertices are snapped to a grid of gridSize cells along the longest side of the bounds and every cell keeps the vertex
+// closest to the cell's average, triangles collapsing into a line or point are dropped. Kept vertices are copies of input vertices,
+// so the result encodes with the input's quantization.
+void simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t gridSize,
+	std::vector<Vertex>& simplifiedVertices, std::vector<uint32_t>& simplifiedIndices);
@@ -0,0 +1,444 @@
+#include "MeshStreamer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+#include "Profiler.h"
+
+
+MeshStreamer::MeshStreamer(GeometryBuffer* geometryBuffer, VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
+	VkDeviceSize budget) :
+	geometryBuffer_(geometryBuffer), device_(device), transferQueue_(transferQueue), transferCommandPool_(transferCommandPool),
+	budget_(budget), pressureBudget_(VK_WHOLE_SIZE), geometryUsedSize_(0), residentBytes_(0), loadingBytes_(0), residentCount_(0), streamedCount_(0),
+	uploadedBytes_(0), residencyChanged_(false), frame_(0), frustumPlanes_{}, cameraPosition_(0.0f), stopping_(false)
+{
+	loaderThread_ = std::thread([this]() { RunLoader(); });
+}
+
+MeshStreamer::~MeshStreamer()
+{
+	{
+		std::lock_guard<std::mutex> loadLock(loadMutex_);
+		stopping_ = true;
+	}
+	loadCondition_.notify_one();
+	loaderThread_.join();
+
+	for (const Load& load : finishedLoads_)
+	{
+		if (load.succeeded)
+		{
+			FreeRanges(load.vertexRange, load.positionRange, load.indexRange);
+		}
+	}
+	for (const Entry& entry : entries_)
+	{
+		if (entry.state == State::Resident)
+		{
+			FreeRanges(entry.vertexRange, entry.positionRange, entry.indexRange);
+		}
+	}
+
+	vkDestroyCommandPool(device_, transferCommandPool_, nullptr);
+}
+
+
+int MeshStreamer::Register(const std::shared_ptr<const MeshCache>& cache, size_t meshIndex)
+{
+	const MeshCacheEntry& cacheEntry = cache->GetEntry(meshIndex);
+	const MeshCacheLod& lod = cacheEntry.lods[MESH_LOD_FULL];
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	int id;
+	if (freeEntries_.empty())
+	{
+		id = static_cast<int>(entries_.size());
+		entries_.emplace_back();
+	}
+	else
+	{
+		id = freeEntries_.back();
+		freeEntries_.pop_back();
+	}
+
+	entries_[id] = Entry
+	{
+		.cache = cache,
+		.meshIndex = meshIndex,
+		.state = State::NonResident,
+		.size = (sizeof(GpuVertex) + sizeof(GpuPosition)) * lod.vertexCount + VkDeviceSize(cacheEntry.indexSize) * lod.indexCount,
+		.lastVisibleFrame = 0,
+		.vertexRange = { 0, 0 },
+		.positionRange = { 0, 0 },
+		.indexRange = { 0, 0 },
+		.drawRange = {}
+	};
+	streamedCount_++;
+
+	return id;
+}
+
+void MeshStreamer::Unregister(int id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	Entry& entry = entries_[id];
+	streamedCount_--;
+
+	if (entry.state == State::Loading)
+	{
+		entry.state = State::Unregistered;
+		return;
+	}
+	if (entry.state == State::Resident)
+	{
+		FreeRanges(entry.vertexRange, entry.positionRange, entry.indexRange);
+		residentBytes_ -= entry.size;
+		residentCount_--;
+	}
+
+	entry.state = State::Free;
+	entry.cache.reset();
+	freeEntries_.push_back(id);
+}
+
+
+bool MeshStreamer::BeginFrame(const glm::mat4& viewProjection, const glm::vec3& cameraPosition)
+{
+	PROFILE_SCOPE("MeshStreamer::BeginFrame");
+
+	VkDeviceSize uploadedBytes = 0;
+	while (true)
+	{
+		Load load;
+		{
+			std::lock_guard<std::mutex> loadLock(loadMutex_);
+			if (finishedLoads_.empty())
+			{
+				break;
+			}
+			load = std::move(finishedLoads_.front());
+			finishedLoads_.pop_front();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		Entry& entry = entries_[load.id];
+		loadingBytes_ -= entry.size;
+		if (entry.state == State::Unregistered || load.succeeded == false)
+		{
+			if (load.succeeded)
+			{
+				FreeRanges(load.vertexRange, load.positionRange, load.indexRange);
+			}
+			residentBytes_ -= entry.size;
+
+			if (entry.state == State::Unregistered)
+			{
+				entry.state = State::Free;
+				entry.cache.reset();
+				freeEntries_.push_back(load.id);
+			}
+			else
+			{
+				// Geometry buffer is shared with the resident meshes, the budget is lowered to what fit so the load isn't retried every frame
+				entry.state = State::NonResident;
+				LowerBudget();
+			}
+			continue;
+		}
+
+		const MeshCacheEntry& cacheEntry = entry.cache->GetEntry(entry.meshIndex);
+		entry.state = State::Resident;
+		entry.vertexRange = load.vertexRange;
+		entry.positionRange = load.positionRange;
+		entry.indexRange = load.indexRange;
+		entry.drawRange = MeshDrawRange
+		{
+			.indexCount = cacheEntry.lods[MESH_LOD_FULL].indexCount,
+			.firstIndex = static_cast<uint32_t>(load.indexRange.offset / cacheEntry.indexSize),
+			.vertexOffset = static_cast<int32_t>(load.vertexRange.offset / sizeof(GpuVertex)),
+			.positionOffset = static_cast<int32_t>(load.positionRange.offset / sizeof(GpuPosition))
+		};
+		residentCount_++;
+		residencyChanged_ = true;
+		uploadedBytes += entry.size;
+	}
+
+	// Planes point inwards, the near plane is the -w <= z one so it holds for either depth range
+	const glm::mat4 m = glm::transpose(viewProjection);
+	frustumPlanes_[0] = m[3] + m[0];
+	frustumPlanes_[1] = m[3] - m[0];
+	frustumPlanes_[2] = m[3] + m[1];
+	frustumPlanes_[3] = m[3] - m[1];
+	frustumPlanes_[4] = m[3] + m[2];
+	frustumPlanes_[5] = m[3] - m[2];
+	for (glm::vec4& plane : frustumPlanes_)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	cameraPosition_ = cameraPosition;
+	frame_++;
+	requests_.clear();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	uploadedBytes_ = uploadedBytes;
+
+	return std::exchange(residencyChanged_, false);
+}
+
+bool MeshStreamer::Request(int id, const glm::mat4& transform, MeshDrawRange* drawRange)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	Entry& entry = entries_[id];
+	const glm::vec4& bounds = entry.cache->GetEntry(entry.meshIndex).bounds;
+
+	const glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(bounds), 1.0f));
+	const float scale = std::max(std::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))), glm::length(glm::vec3(transform[2])));
+	const float radius = bounds.w * scale;
+
+	bool visible = true;
+	for (const glm::vec4& plane : frustumPlanes_)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+		{
+			visible = false;
+			break;
+		}
+	}
+	if (visible)
+	{
+		entry.lastVisibleFrame = frame_;
+	}
+
+	if (entry.state == State::Resident)
+	{
+		*drawRange = entry.drawRange;
+		return true;
+	}
+
+	if (entry.state == State::NonResident && visible)
+	{
+		const float screenSize = radius / std::max(glm::length(center - cameraPosition_), 0.001f);
+		if (screenSize >= MIN_SCREEN_SIZE)
+		{
+			requests_.push_back(LoadRequest{ .priority = screenSize, .id = id });
+		}
+	}
+
+	return false;
+}
+
+void MeshStreamer::EndFrame()
+{
+	PROFILE_SCOPE("MeshStreamer::EndFrame");
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// Geometry freed since the budget was lowered goes back into it
+	if (pressureBudget_ != VK_WHOLE_SIZE)
+	{
+		const VkDeviceSize usedSize = geometryBuffer_->GetUsedSize();
+		if (usedSize < geometryUsedSize_)
+		{
+			pressureBudget_ += geometryUsedSize_ - usedSize;
+			if (pressureBudget_ >= budget_)
+			{
+				pressureBudget_ = VK_WHOLE_SIZE;
+				printf("Mesh streaming: geometry buffer has room again, budget restored to %.1f MB.\n", budget_ / (1024.0 * 1024.0));
+			}
+		}
+		geometryUsedSize_ = usedSize;
+	}
+	const VkDeviceSize budget = GetBudget();
+
+	// Budget may have been lowered, visible meshes go too then
+	while (residentBytes_ > budget && EvictLeastRecentlyVisible(true))
+	{
+	}
+
+	std::sort(requests_.begin(), requests_.end(), [](const LoadRequest& a, const LoadRequest& b) { return a.priority > b.priority; });
+
+	bool started = false;
+	for (const LoadRequest& request : requests_)
+	{
+		Entry& entry = entries_[request.id];
+		if (entry.state != State::NonResident || entry.size > budget)
+		{
+			continue;
+		}
+		// Loads queue up while the loader is behind, so the limit is on bytes in flight. A load always starts if nothing is in flight,
+		// bigger meshes than the limit would never load otherwise.
+		if (loadingBytes_ > 0 && loadingBytes_ + entry.size > MAX_UPLOAD_BYTES_PER_FRAME)
+		{
+			break;
+		}
+
+		bool fits = true;
+		while (residentBytes_ + entry.size > budget && fits)
+		{
+			fits = EvictLeastRecentlyVisible(false);
+		}
+		if (fits == false)
+		{
+			break;
+		}
+
+		entry.state = State::Loading;
+		residentBytes_ += entry.size;
+		loadingBytes_ += entry.size;
+
+		std::lock_guard<std::mutex> loadLock(loadMutex_);
+		pendingLoads_.push_back(Load
+		{
+			.id = request.id,
+			.cache = entry.cache,
+			.meshIndex = entry.meshIndex,
+			.succeeded = false,
+			.vertexRange = { 0, 0 },
+			.positionRange = { 0, 0 },
+			.indexRange = { 0, 0 }
+		});
+		started = true;
+	}
+
+	if (started)
+	{
+		loadCondition_.notify_one();
+	}
+}
+
+
+void MeshStreamer::SetBudget(VkDeviceSize budget)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	budget_ = budget;
+}
+
+MeshStreamingStatistics MeshStreamer::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return MeshStreamingStatistics
+	{
+		.residentBytes = residentBytes_,
+		.budget = GetBudget(),
+		.residentMeshCount = residentCount_,
+		.streamedMeshCount = streamedCount_,
+		.uploadedBytes = uploadedBytes_
+	};
+}
+
+
+void MeshStreamer::RunLoader()
+{
+	PROFILE_THREAD_NAME("Mesh streaming");
+
+	while (true)
+	{
+		Load load;
+		{
+			std::unique_lock<std::mutex> loadLock(loadMutex_);
+			loadCondition_.wait(loadLock, [this]() { return stopping_ || pendingLoads_.empty() == false; });
+			if (stopping_)
+			{
+				return;
+			}
+			load = std::move(pendingLoads_.front());
+			pendingLoads_.pop_front();
+		}
+
+		LoadMesh(load);
+
+		std::lock_guard<std::mutex> loadLock(loadMutex_);
+		finishedLoads_.push_back(std::move(load));
+	}
+}
+
+void MeshStreamer::LoadMesh(Load& load)
+{
+	PROFILE_SCOPE("LoadMesh");
+
+	const MeshCacheEntry& cacheEntry = load.cache->GetEntry(load.meshIndex);
+	const MeshCacheLod& lod = cacheEntry.lods[MESH_LOD_FULL];
+
+	// Pages of the mapped cache are read from disk here
+	try
+	{
+		load.vertexRange = geometryBuffer_->UploadVertices(load.cache->GetData(lod.vertexOffset), sizeof(GpuVertex) * lod.vertexCount, sizeof(GpuVertex),
+			transferQueue_, transferCommandPool_);
+		load.positionRange = geometryBuffer_->UploadPositions(load.cache->GetData(lod.positionOffset), sizeof(GpuPosition) * lod.vertexCount,
+			sizeof(GpuPosition), transferQueue_, transferCommandPool_);
+		load.indexRange = geometryBuffer_->UploadIndices(load.cache->GetData(lod.indexOffset), VkDeviceSize(cacheEntry.indexSize) * lod.indexCount,
+			cacheEntry.indexSize, transferQueue_, transferCommandPool_);
+		load.succeeded = true;
+	}
+	catch (const std::runtime_error&)
+	{
+		FreeRanges(load.vertexRange, load.positionRange, load.indexRange);
+		load.succeeded = false;
+	}
+}
+
+void MeshStreamer::FreeRanges(const GeometryRange& vertexRange, const GeometryRange& positionRange, const GeometryRange& indexRange)
+{
+	if (vertexRange.size > 0)
+	{
+		geometryBuffer_->FreeVertices(vertexRange);
+	}
+	if (positionRange.size > 0)
+	{
+		geometryBuffer_->FreePositions(positionRange);
+	}
+	if (indexRange.size > 0)
+	{
+		geometryBuffer_->FreeIndices(indexRange);
+	}
+}
+
+VkDeviceSize MeshStreamer::GetBudget() const
+{
+	return std::min(budget_, pressureBudget_);
+}
+
+void MeshStreamer::LowerBudget()
+{
+	if (residentBytes_ < GetBudget())
+	{
+		pressureBudget_ = residentBytes_;
+		printf("Mesh streaming: geometry buffer is full, budget lowered to %.1f MB until geometry is freed.\n", pressureBudget_ / (1024.0 * 1024.0));
+	}
+	geometryUsedSize_ = geometryBuffer_->GetUsedSize();
+}
+
+bool MeshStreamer::EvictLeastRecentlyVisible(bool includeVisible)
+{
+	Entry* leastRecent = nullptr;
+	for (Entry& entry : entries_)
+	{
+		if (entry.state == State::Resident && (includeVisible || entry.lastVisibleFrame < frame_) &&
+			(leastRecent == nullptr || entry.lastVisibleFrame < leastRecent->lastVisibleFrame))
+		{
+			leastRecent = &entry;
+		}
+	}
+	if (leastRecent == nullptr)
+	{
+		return false;
+	}
+
+	// Frames in flight may still draw it, the ranges go through the deletion queue
+	FreeRanges(leastRecent->vertexRange, leastRecent->positionRange, leastRecent->indexRange);
+	leastRecent->state = State::NonResident;
+	residentBytes_ -= leastRecent->size;
+	residentCount_--;
+	residencyChanged_ = true;
+
+	return true;
+}
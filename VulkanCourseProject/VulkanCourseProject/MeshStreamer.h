@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "GeometryBuffer.h"
+#include "MeshCache.h"
+
+
+// Where a mesh's indices and vertices are in the geometry buffer for one level of detail, what a draw command needs
+struct MeshDrawRange
+{
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	int32_t positionOffset;
+};
+
+struct MeshStreamingStatistics
+{
+	VkDeviceSize residentBytes; // Full levels of detail in the geometry buffer
+	VkDeviceSize budget; // Lowered while the geometry buffer is full
+	size_t residentMeshCount;
+	size_t streamedMeshCount;
+	VkDeviceSize uploadedBytes; // Since the last frame
+};
+
+// Residency manager for the full level of detail of streamed meshes, their coarse level of detail always stays in the geometry buffer.
+// Every frame the meshes drawn report in, the visible ones missing their full level of detail are loaded from the mapped mesh caches by
+// a loader thread, most screen covering first and no more than MAX_UPLOAD_BYTES_PER_FRAME in flight. Least recently visible meshes
+// are evicted to stay within the budget. When the geometry buffer runs full, the budget is lowered to what's resident and raised again
+// as geometry is freed.
+// Registration is thread-safe, the frame functions are called by the thread recording commands.
+class MeshStreamer
+{
+public:
+	static const VkDeviceSize MAX_UPLOAD_BYTES_PER_FRAME = 4 * 1024 * 1024;
+	static constexpr float MIN_SCREEN_SIZE = 0.02f; // Bounding sphere radius over distance, smaller meshes keep the coarse level of detail
+
+	// Takes ownership of the command pool, it's used by the loader thread only
+	MeshStreamer(GeometryBuffer* geometryBuffer, VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, VkDeviceSize budget);
+	~MeshStreamer();
+
+	MeshStreamer(const MeshStreamer&) = delete;
+	MeshStreamer& operator=(const MeshStreamer&) = delete;
+
+	// Returns the stream id of the mesh
+	int Register(const std::shared_ptr<const MeshCache>& cache, size_t meshIndex);
+	void Unregister(int id);
+
+	// Applies finished loads, the camera is used to prioritize the meshes reported until EndFrame.
+	// Returns true if a mesh switched its level of detail since the last call.
+	bool BeginFrame(const glm::mat4& viewProjection, const glm::vec3& cameraPosition);
+	// Returns true and the full level of detail if it's resident, otherwise requests it if the mesh is visible and big enough on screen
+	bool Request(int id, const glm::mat4& transform, MeshDrawRange* drawRange);
+	// Evicts and starts loads for this frame's requests
+	void EndFrame();
+
+	void SetBudget(VkDeviceSize budget);
+	MeshStreamingStatistics GetStatistics() const;
+
+private:
+	enum class State
+	{
+		Free,
+		NonResident,
+		Loading,
+		Resident,
+		Unregistered // Removed while loading, freed once the load ends
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const MeshCache> cache;
+		size_t meshIndex;
+		State state;
+		VkDeviceSize size; // Of the full level of detail in the geometry buffer
+		uint64_t lastVisibleFrame;
+		GeometryRange vertexRange;
+		GeometryRange positionRange;
+		GeometryRange indexRange;
+		MeshDrawRange drawRange;
+	};
+
+	struct LoadRequest
+	{
+		float priority;
+		int id;
+	};
+
+	struct Load
+	{
+		int id;
+		std::shared_ptr<const MeshCache> cache;
+		size_t meshIndex;
+		bool succeeded;
+		GeometryRange vertexRange;
+		GeometryRange positionRange;
+		GeometryRange indexRange;
+	};
+
+	GeometryBuffer* geometryBuffer_;
+	VkDevice device_;
+	VkQueue transferQueue_;
+	VkCommandPool transferCommandPool_;
+
+	mutable std::mutex mutex_; // Guards the entries and statistics
+	std::vector<Entry> entries_;
+	std::vector<int> freeEntries_;
+	VkDeviceSize budget_;
+	VkDeviceSize pressureBudget_; // VK_WHOLE_SIZE unless the geometry buffer ran full, the budget in use is the lower one
+	VkDeviceSize geometryUsedSize_; // Of the geometry buffer when the lowered budget was last raised
+	VkDeviceSize residentBytes_; // Loading meshes included
+	VkDeviceSize loadingBytes_; // Queued or being uploaded, loads started in a frame stop at MAX_UPLOAD_BYTES_PER_FRAME of these
+	size_t residentCount_;
+	size_t streamedCount_;
+	VkDeviceSize uploadedBytes_;
+	bool residencyChanged_;
+
+	// Touched by the recording thread only
+	uint64_t frame_;
+	glm::vec4 frustumPlanes_[6];
+	glm::vec3 cameraPosition_;
+	std::vector<LoadRequest> requests_; // Keeps its capacity, frames don't reach the heap
+
+	std::mutex loadMutex_; // Guards the queues below
+	std::condition_variable loadCondition_;
+	std::deque<Load> pendingLoads_;
+	std::deque<Load> finishedLoads_;
+	bool stopping_;
+	std::thread loaderThread_;
+
+	void RunLoader();
+	void LoadMesh(Load& load);
+	void FreeRanges(const GeometryRange& vertexRange, const GeometryRange& positionRange, const GeometryRange& indexRange);
+	// Everything below is called under mutex_
+	VkDeviceSize GetBudget() const;
+	void LowerBudget(); // To what's resident until geometry is freed
+	bool EvictLeastRecentlyVisible(bool includeVisible); // False if there was nothing to evict
+};
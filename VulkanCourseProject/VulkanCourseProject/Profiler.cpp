@@ -0,0 +1,196 @@
+#include "Profiler.h"
+
+#ifdef ENABLE_PROFILING
+
+#include <chrono>
+#include <cstdio>
+
+
+namespace
+{
+	thread_local void* currentThreadBuffer = nullptr;
+
+	int64_t getSteadyTime()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void writeEvent(FILE* file, bool& first, const ProfileEvent& event, size_t threadId)
+	{
+		fprintf(file, "%s\n{\"name\":\"", first ? "" : ",");
+		for (const char* c = event.name; *c != '\0'; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				fputc('\\', file);
+			}
+			fputc(*c, file);
+		}
+		fprintf(file, "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu}", event.start / 1000.0, event.duration / 1000.0, threadId);
+		first = false;
+	}
+}
+
+
+Profiler::Profiler() :
+	startTime_(getSteadyTime())
+{
+	gpuBuffer_.threadName = "GPU";
+}
+
+void Profiler::StartCapture(const std::string& filePath, uint32_t frameCount)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (IsCapturing() || frameCount == 0)
+	{
+		return;
+	}
+
+	filePath_ = filePath;
+	remainingFrames_ = frameCount;
+	capture_.fetch_add(1, std::memory_order_release);
+	capturing_ = true;
+}
+
+void Profiler::EndFrame()
+{
+	if (IsCapturing() == false)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (--remainingFrames_ > 0)
+	{
+		return;
+	}
+
+	capturing_ = false;
+	Export();
+}
+
+int64_t Profiler::GetTime() const
+{
+	return getSteadyTime() - startTime_;
+}
+
+void Profiler::AddEvent(const char* name, int64_t start, int64_t end)
+{
+	Record(GetThreadBuffer(), name, start, end);
+}
+
+void Profiler::AddGpuEvent(const char* name, int64_t start, int64_t end)
+{
+	if (IsCapturing())
+	{
+		Record(gpuBuffer_, name, start, end);
+	}
+}
+
+void Profiler::SetThreadName(const char* name)
+{
+	GetThreadBuffer().threadName = name;
+}
+
+const char* Profiler::InternName(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return names_.insert(name).first->c_str();
+}
+
+
+Profiler::ThreadBuffer& Profiler::GetThreadBuffer()
+{
+	if (currentThreadBuffer == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		threadBuffers_.push_back(std::make_unique<ThreadBuffer>());
+		currentThreadBuffer = threadBuffers_.back().get();
+	}
+
+	return *static_cast<ThreadBuffer*>(currentThreadBuffer);
+}
+
+void Profiler::Record(ThreadBuffer& buffer, const char* name, int64_t start, int64_t end)
+{
+	// Events of an earlier capture are dropped the first time the owning thread writes during a new one
+	const uint32_t capture = capture_.load(std::memory_order_acquire);
+	if (buffer.capture.load(std::memory_order_relaxed) != capture)
+	{
+		buffer.count.store(0, std::memory_order_relaxed);
+		buffer.capture.store(capture, std::memory_order_release);
+	}
+	if (buffer.events == nullptr)
+	{
+		buffer.events.reset(new ProfileEvent[THREAD_EVENT_CAPACITY]);
+	}
+
+	const size_t count = buffer.count.load(std::memory_order_relaxed);
+	if (count == THREAD_EVENT_CAPACITY)
+	{
+		return;
+	}
+
+	buffer.events[count] = ProfileEvent{ .name = name, .start = start, .duration = end - start };
+	buffer.count.store(count + 1, std::memory_order_release);
+}
+
+void Profiler::Export() const
+{
+	FILE* file = fopen(filePath_.c_str(), "w");
+	if (file == nullptr)
+	{
+		printf("Error: Failed to write trace to %s.\n", filePath_.c_str());
+		return;
+	}
+
+	const uint32_t capture = capture_.load(std::memory_order_acquire);
+	bool first = true;
+	size_t eventCount = 0;
+	fprintf(file, "{\"traceEvents\":[");
+
+	// GPU track is thread 0, CPU threads follow in the order they first recorded
+	std::vector<const ThreadBuffer*> buffers = { &gpuBuffer_ };
+	for (const std::unique_ptr<ThreadBuffer>& buffer : threadBuffers_)
+	{
+		buffers.push_back(buffer.get());
+	}
+
+	for (size_t threadId = 0; threadId < buffers.size(); threadId++)
+	{
+		const ThreadBuffer& buffer = *buffers[threadId];
+		if (buffer.threadName != nullptr)
+		{
+			fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}", first ? "" : ",", threadId,
+				buffer.threadName);
+			first = false;
+		}
+
+		if (buffer.capture.load(std::memory_order_acquire) != capture)
+		{
+			continue;
+		}
+		const size_t count = buffer.count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < count; i++)
+		{
+			writeEvent(file, first, buffer.events[i], threadId);
+		}
+		eventCount += count;
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	printf("Trace with %zu events written to %s\n", eventCount, filePath_.c_str());
+}
+
+
+Profiler& getProfiler()
+{
+	static Profiler profiler;
+
+	return profiler;
+}
+
+#endif
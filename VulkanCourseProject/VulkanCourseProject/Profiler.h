@@ -0,0 +1,122 @@
+#pragma once
+
+// CPU scopes and GPU timings exported as Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open.
+// Compiled in only when ENABLE_PROFILING is defined, otherwise the PROFILE_ macros expand to nothing.
+#ifdef ENABLE_PROFILING
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Name has to outlive the capture, e.g. a string literal
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+// Copies the name once per distinct string, for names built at runtime
+#define PROFILE_SCOPE_STRING(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(getProfiler().InternName(name))
+#define PROFILE_THREAD_NAME(name) getProfiler().SetThreadName(name)
+
+
+struct ProfileEvent
+{
+	const char* name;
+	int64_t start; // Nanoseconds since the profiler was created
+	int64_t duration;
+};
+
+// Records events into per-thread buffers without locking, one thread writes a buffer and the exporter only reads what was published.
+// A capture runs for a number of frames and is written to a file when the last one ends.
+class Profiler
+{
+public:
+	static const size_t THREAD_EVENT_CAPACITY = 16384; // Later events of a thread are dropped
+
+	Profiler();
+
+	// Capture starts right away, frameCount frames are captured before the trace is written to filePath
+	void StartCapture(const std::string& filePath, uint32_t frameCount);
+	bool IsCapturing() const;
+	void EndFrame();
+
+	int64_t GetTime() const;
+	void AddEvent(const char* name, int64_t start, int64_t end);
+	// Events on the GPU track, times already converted to the CPU clock
+	void AddGpuEvent(const char* name, int64_t start, int64_t end);
+
+	void SetThreadName(const char* name);
+	const char* InternName(const std::string& name);
+
+private:
+	struct ThreadBuffer
+	{
+		std::unique_ptr<ProfileEvent[]> events;
+		std::atomic<size_t> count = 0;
+		std::atomic<uint32_t> capture = 0; // Capture the events belong to, a thread clears its own buffer when a new one starts
+		const char* threadName = nullptr;
+	};
+
+	const int64_t startTime_;
+	std::atomic<bool> capturing_ = false;
+	std::atomic<uint32_t> capture_ = 0;
+	uint32_t remainingFrames_ = 0;
+	std::string filePath_;
+
+	std::mutex mutex_; // Guards the lists below, taken once per thread and per interned name
+	std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers_;
+	std::unordered_set<std::string> names_;
+	ThreadBuffer gpuBuffer_; // Written by the thread reading the query results
+
+	ThreadBuffer& GetThreadBuffer();
+	void Record(ThreadBuffer& buffer, const char* name, int64_t start, int64_t end);
+	void Export() const;
+};
+
+Profiler& getProfiler();
+
+// Measures the time until the end of the enclosing block
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name);
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name_;
+	int64_t start_;
+};
+
+
+inline bool Profiler::IsCapturing() const
+{
+	return capturing_.load(std::memory_order_relaxed);
+}
+
+inline ProfileScope::ProfileScope(const char* name) :
+	name_(name), start_(getProfiler().IsCapturing() ? getProfiler().GetTime() : -1)
+{
+}
+
+inline ProfileScope::~ProfileScope()
+{
+	if (start_ >= 0)
+	{
+		getProfiler().AddEvent(name_, start_, getProfiler().GetTime());
+	}
+}
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_SCOPE_STRING(name)
+#define PROFILE_THREAD_NAME(name)
+
+#endif
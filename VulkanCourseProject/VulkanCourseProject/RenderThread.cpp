@@ -0,0 +1,226 @@
+#include "RenderThread.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "VulkanRenderer.h"
+#include "Profiler.h"
+
+
+RenderThread::RenderThread(VulkanRenderer& renderer) :
+	renderer_(renderer),
+	nextModelHandle_(0)
+{
+	for (size_t i = 0; i < renderer_.GetModelCount(); i++)
+	{
+		const int handle = renderer_.GetModelHandle(i);
+		rendererModels_[handle] = handle;
+		nextModelHandle_ = std::max(nextModelHandle_, handle + 1);
+	}
+}
+
+RenderThread::~RenderThread()
+{
+	Stop();
+}
+
+void RenderThread::Start()
+{
+	if (thread_.joinable())
+	{
+		return;
+	}
+
+	PublishStatus();
+
+	running_ = true;
+	thread_ = std::thread([this]() { Run(); });
+}
+
+void RenderThread::Stop()
+{
+	running_ = false;
+	if (thread_.joinable())
+	{
+		thread_.join();
+	}
+}
+
+
+void RenderThread::UpdateModel(int model, const glm::mat4& transform)
+{
+	Push(SceneCommand{ .type = SceneCommand::Type::UpdateModel, .model = model, .transform = transform });
+}
+
+void RenderThread::UpdateModelNode(int model, int node, const glm::mat4& transform)
+{
+	Push(SceneCommand{ .type = SceneCommand::Type::UpdateModelNode, .model = model, .index = node, .transform = transform });
+}
+
+void RenderThread::PlayModelAnimation(int model, int animation, bool loop)
+{
+	Push(SceneCommand{ .type = SceneCommand::Type::PlayModelAnimation, .model = model, .index = animation, .loop = loop });
+}
+
+int RenderThread::LoadModel(const std::string& directory, const std::string& fileName)
+{
+	// Renderer handle is only known once the render thread adds the model, commands are translated when they are applied
+	const int handle = nextModelHandle_++;
+	Push(SceneCommand{ .type = SceneCommand::Type::LoadModel, .model = handle, .directory = directory, .fileName = fileName });
+
+	return handle;
+}
+
+void RenderThread::RemoveModel(int model)
+{
+	Push(SceneCommand{ .type = SceneCommand::Type::RemoveModel, .model = model });
+}
+
+void RenderThread::SetLights(std::vector<Light> lights)
+{
+	Push(SceneCommand{ .type = SceneCommand::Type::SetLights, .lights = std::move(lights) });
+}
+
+void RenderThread::SetCamera(const glm::mat4& view)
+{
+	Push(SceneCommand{ .type = SceneCommand::Type::SetCamera, .transform = view });
+}
+
+bool RenderThread::CanSubmitFrame() const
+{
+	return submittedFrames_.load(std::memory_order_relaxed) - appliedFrames_.load(std::memory_order_acquire) < MAX_QUEUED_FRAMES;
+}
+
+void RenderThread::SubmitFrame()
+{
+	Push(SceneCommand{ .type = SceneCommand::Type::EndFrame });
+	submittedFrames_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool RenderThread::IsModelReady(int model) const
+{
+	std::lock_guard<std::mutex> statusLock(statusMutex_);
+	auto readyModel = readyModels_.find(model);
+	return readyModel != readyModels_.end() && readyModel->second;
+}
+
+
+void RenderThread::Push(SceneCommand&& command)
+{
+	// Only full when the render thread is a whole draw behind, it drains the ring before every draw
+	while (commands_.TryPush(std::move(command)) == false)
+	{
+		if (IsRunning() == false)
+		{
+			return;
+		}
+		std::this_thread::yield();
+	}
+}
+
+void RenderThread::Run()
+{
+	PROFILE_THREAD_NAME("Render thread");
+
+	while (IsRunning())
+	{
+		appliedFrames_.fetch_add(ApplyCompletedFrames(), std::memory_order_release);
+
+		try
+		{
+			renderer_.Draw();
+		}
+		catch (const std::runtime_error& e)
+		{
+			printf("Error: %s\n", e.what());
+			running_ = false;
+		}
+
+		PublishStatus();
+	}
+}
+
+uint64_t RenderThread::ApplyCompletedFrames()
+{
+	PROFILE_SCOPE("ApplySceneCommands");
+
+	// Commands are held back until their frame is complete, all complete frames are applied in order before drawing
+	SceneCommand command;
+	uint64_t completedFrames = 0;
+	while (commands_.TryPop(command))
+	{
+		if (command.type != SceneCommand::Type::EndFrame)
+		{
+			pendingFrame_.push_back(std::move(command));
+			continue;
+		}
+
+		for (const SceneCommand& frameCommand : pendingFrame_)
+		{
+			Apply(frameCommand);
+		}
+		pendingFrame_.clear();
+		completedFrames++;
+	}
+
+	return completedFrames;
+}
+
+void RenderThread::Apply(const SceneCommand& command)
+{
+	switch (command.type)
+	{
+	case SceneCommand::Type::UpdateModel:
+		renderer_.UpdateModel(GetRendererModel(command.model), command.transform);
+		break;
+	case SceneCommand::Type::UpdateModelNode:
+		renderer_.UpdateModelNode(GetRendererModel(command.model), command.index, command.transform);
+		break;
+	case SceneCommand::Type::PlayModelAnimation:
+		renderer_.PlayModelAnimation(GetRendererModel(command.model), command.index, command.loop);
+		break;
+	case SceneCommand::Type::LoadModel:
+		try
+		{
+			rendererModels_[command.model] = renderer_.AddModel(command.directory, command.fileName);
+		}
+		catch (const std::runtime_error& e)
+		{
+			printf("Error: %s\n", e.what());
+		}
+		break;
+	case SceneCommand::Type::RemoveModel:
+		renderer_.RemoveModel(GetRendererModel(command.model));
+		rendererModels_.erase(command.model);
+		{
+			std::lock_guard<std::mutex> statusLock(statusMutex_);
+			readyModels_.erase(command.model);
+		}
+		break;
+	case SceneCommand::Type::SetLights:
+		renderer_.SetLights(command.lights);
+		break;
+	case SceneCommand::Type::SetCamera:
+		renderer_.SetCamera(command.transform);
+		break;
+	case SceneCommand::Type::EndFrame:
+		break;
+	}
+}
+
+int RenderThread::GetRendererModel(int model) const
+{
+	auto rendererModel = rendererModels_.find(model);
+
+	return rendererModel != rendererModels_.end() ? rendererModel->second : -1;
+}
+
+void RenderThread::PublishStatus()
+{
+	std::lock_guard<std::mutex> statusLock(statusMutex_);
+	for (const auto& [model, rendererModel] : rendererModels_)
+	{
+		readyModels_[model] = renderer_.IsModelReady(rendererModel);
+	}
+}
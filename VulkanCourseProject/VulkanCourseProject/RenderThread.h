@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include <glm/glm.hpp>
+
+#include "SpscRing.h"
+#include "Lighting.h"
+
+class VulkanRenderer;
+
+
+// Scene update sent from the application thread to the render thread
+struct SceneCommand
+{
+	enum class Type
+	{
+		UpdateModel,
+		UpdateModelNode,
+		PlayModelAnimation,
+		LoadModel,
+		RemoveModel,
+		SetLights,
+		SetCamera,
+		EndFrame
+	};
+
+	Type type;
+	int model;
+	int index; // Node or animation
+	bool loop;
+	glm::mat4 transform;
+	std::vector<Light> lights;
+	std::string directory;
+	std::string fileName;
+};
+
+// Runs VulkanRenderer::Draw on its own thread, so the application thread never waits for the GPU.
+// The application thread records scene updates between SubmitFrame calls, the render thread applies a frame's updates
+// only once the whole frame is submitted and always together, so every drawn frame shows a consistent scene.
+// While it runs the renderer must not be used from any other thread.
+class RenderThread
+{
+public:
+	static const size_t COMMAND_CAPACITY = 1024;
+	static const uint32_t MAX_QUEUED_FRAMES = 2; // Submitted frames the render thread hasn't picked up yet
+
+	explicit RenderThread(VulkanRenderer& renderer);
+	~RenderThread();
+
+	RenderThread(const RenderThread&) = delete;
+	RenderThread& operator=(const RenderThread&) = delete;
+
+	void Start();
+	void Stop();
+	bool IsRunning() const; // False once stopped or after the render thread failed
+
+	// Application thread
+	void UpdateModel(int model, const glm::mat4& transform);
+	void UpdateModelNode(int model, int node, const glm::mat4& transform);
+	void PlayModelAnimation(int model, int animation, bool loop = true);
+	// Handles of models loaded through the render thread are its own and known before the render thread sees the command,
+	// models the renderer had when the render thread was created keep their renderer handles
+	int LoadModel(const std::string& directory, const std::string& fileName);
+	void RemoveModel(int model);
+	void SetLights(std::vector<Light> lights);
+	void SetCamera(const glm::mat4& view);
+
+	// Closes the current frame, false if the render thread is already MAX_QUEUED_FRAMES behind and nothing was submitted
+	bool CanSubmitFrame() const;
+	void SubmitFrame();
+
+	// Published by the render thread after every drawn frame
+	bool IsModelReady(int model) const;
+
+private:
+	VulkanRenderer& renderer_;
+	std::thread thread_;
+	std::atomic<bool> running_ = false;
+
+	SpscRing<SceneCommand, COMMAND_CAPACITY> commands_;
+	std::vector<SceneCommand> pendingFrame_; // Render thread, commands of the frame that isn't fully submitted yet
+	int nextModelHandle_;
+	std::unordered_map<int, int> rendererModels_; // Render thread, renderer handle of every live model handle
+
+	std::atomic<uint64_t> submittedFrames_ = 0;
+	std::atomic<uint64_t> appliedFrames_ = 0;
+
+	mutable std::mutex statusMutex_;
+	std::unordered_map<int, bool> readyModels_;
+
+	void Push(SceneCommand&& command);
+	void Run();
+	uint64_t ApplyCompletedFrames();
+	void Apply(const SceneCommand& command);
+	int GetRendererModel(int model) const; // -1 once removed
+	void PublishStatus();
+};
+
+
+inline bool RenderThread::IsRunning() const
+{
+	return running_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,147 @@
+#include "SceneGraph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define SCENE_GRAPH_SSE
+#include <xmmintrin.h>
+#endif
+
+
+// result = parent * local, column-major like glm
+static void multiplyTransforms(const glm::mat4& parent, const glm::mat4& local, glm::mat4& result)
+{
+#ifdef SCENE_GRAPH_SSE
+	const float* a = &parent[0][0];
+	const float* b = &local[0][0];
+	float* r = &result[0][0];
+
+	const __m128 a0 = _mm_loadu_ps(a + 0);
+	const __m128 a1 = _mm_loadu_ps(a + 4);
+	const __m128 a2 = _mm_loadu_ps(a + 8);
+	const __m128 a3 = _mm_loadu_ps(a + 12);
+
+	// Every result column is a linear combination of the parent columns
+	for (int column = 0; column < 4; column++)
+	{
+		const float* bColumn = b + column * 4;
+
+		__m128 sum = _mm_mul_ps(a0, _mm_set1_ps(bColumn[0]));
+		sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(bColumn[1])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(bColumn[2])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(bColumn[3])));
+
+		_mm_storeu_ps(r + column * 4, sum);
+	}
+#else
+	result = parent * local;
+#endif
+}
+
+
+int SceneGraph::AddNode(int parent, const glm::mat4& localTransform, const std::string& name)
+{
+	const int node = static_cast<int>(parents_.size());
+
+	if (parent != NO_PARENT)
+	{
+		CheckNode(parent);
+
+		// Parent's subtree has to end at the new node to stay contiguous
+		if (parent + subtreeSizes_[parent] != node)
+		{
+			throw std::runtime_error("Scene graph nodes have to be added in depth-first order.");
+		}
+	}
+
+	for (int ancestor = parent; ancestor != NO_PARENT; ancestor = parents_[ancestor])
+	{
+		subtreeSizes_[ancestor]++;
+	}
+
+	parents_.push_back(parent);
+	subtreeSizes_.push_back(1);
+	localTransforms_.push_back(localTransform);
+	worldTransforms_.push_back(localTransform);
+	names_.push_back(name);
+	dirty_.push_back(true);
+	dirtyNodes_.push_back(node);
+
+	return node;
+}
+
+int SceneGraph::FindNode(const std::string& name) const
+{
+	auto foundName = std::find(names_.begin(), names_.end(), name);
+	if (foundName == names_.end())
+	{
+		return -1;
+	}
+
+	return static_cast<int>(foundName - names_.begin());
+}
+
+void SceneGraph::SetLocalTransform(int node, const glm::mat4& localTransform)
+{
+	CheckNode(node);
+
+	localTransforms_[node] = localTransform;
+
+	if (dirty_[node] == false)
+	{
+		dirty_[node] = true;
+		dirtyNodes_.push_back(node);
+	}
+}
+
+bool SceneGraph::UpdateWorldTransforms()
+{
+	if (dirtyNodes_.empty())
+	{
+		return false;
+	}
+
+	// Ascending order visits ancestors before descendants, a dirty node inside an already updated subtree is skipped
+	std::sort(dirtyNodes_.begin(), dirtyNodes_.end());
+
+	int updatedEnd = 0;
+	for (int dirtyNode : dirtyNodes_)
+	{
+		dirty_[dirtyNode] = false;
+
+		if (dirtyNode < updatedEnd)
+		{
+			continue;
+		}
+
+		const int subtreeEnd = dirtyNode + subtreeSizes_[dirtyNode];
+		for (int node = dirtyNode; node < subtreeEnd; node++)
+		{
+			const int parent = parents_[node];
+			if (parent == NO_PARENT)
+			{
+				worldTransforms_[node] = localTransforms_[node];
+			}
+			else
+			{
+				multiplyTransforms(worldTransforms_[parent], localTransforms_[node], worldTransforms_[node]);
+			}
+		}
+
+		updatedEnd = subtreeEnd;
+	}
+
+	dirtyNodes_.clear();
+
+	return true;
+}
+
+
+void SceneGraph::CheckNode(int node) const
+{
+	if (node < 0 || node >= static_cast<int>(parents_.size()))
+	{
+		throw std::runtime_error("Attempted to access invalid scene graph node.");
+	}
+}
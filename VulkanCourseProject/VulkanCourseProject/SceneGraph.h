@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+
+
+// Transform hierarchy stored as flat arrays in depth-first order: a parent always comes before its children
+// and every subtree occupies a contiguous index range, so a changed node only touches its own subtree.
+class SceneGraph
+{
+public:
+	static const int NO_PARENT = -1;
+
+	// Nodes have to be added depth-first, parent must be the last added node or one of its ancestors
+	int AddNode(int parent, const glm::mat4& localTransform, const std::string& name = "");
+
+	size_t GetNodeCount() const;
+	int GetParent(int node) const;
+	const std::string& GetName(int node) const;
+	int FindNode(const std::string& name) const; // First node with the name, -1 if there is none
+
+	const glm::mat4& GetLocalTransform(int node) const;
+	void SetLocalTransform(int node, const glm::mat4& localTransform);
+
+	// Valid after UpdateWorldTransforms
+	const glm::mat4& GetWorldTransform(int node) const;
+
+	// Recomputes world transforms of changed subtrees only, false if nothing changed
+	bool UpdateWorldTransforms();
+
+private:
+	std::vector<int> parents_;
+	std::vector<int> subtreeSizes_; // Including the node itself
+	std::vector<glm::mat4> localTransforms_;
+	std::vector<glm::mat4> worldTransforms_;
+	std::vector<std::string> names_;
+
+	std::vector<int> dirtyNodes_; // Nodes whose local transform changed since the last update
+	std::vector<bool> dirty_;
+
+	void CheckNode(int node) const;
+};
+
+
+inline size_t SceneGraph::GetNodeCount() const
+{
+	return parents_.size();
+}
+
+inline int SceneGraph::GetParent(int node) const
+{
+	CheckNode(node);
+	return parents_[node];
+}
+
+inline const std::string& SceneGraph::GetName(int node) const
+{
+	CheckNode(node);
+	return names_[node];
+}
+
+inline const glm::mat4& SceneGraph::GetLocalTransform(int node) const
+{
+	CheckNode(node);
+	return localTransforms_[node];
+}
+
+inline const glm::mat4& SceneGraph::GetWorldTransform(int node) const
+{
+	CheckNode(node);
+	return worldTransforms_[node];
+}
@@ -0,0 +1,55 @@
+#include "Shadow.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+
+ShadowCascades computeShadowCascades(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, const glm::vec3& sunDirection)
+{
+	ShadowCascades cascades;
+
+	const float shadowFar = std::min(farPlane, SHADOW_DISTANCE);
+	const glm::mat4 inverseView = glm::inverse(view);
+
+	// Frustum half extents per unit of view depth, projection may be flipped on Y
+	const float tanX = 1.0f / projection[0][0];
+	const float tanY = 1.0f / std::abs(projection[1][1]);
+
+	// Light space basis is fixed for a sun direction, texel snapping needs the grid not to rotate with the camera
+	const glm::vec3 up = std::abs(sunDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	const glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -sunDirection, up);
+
+	float sliceNear = nearPlane;
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		const float fraction = static_cast<float>(i + 1) / SHADOW_CASCADE_COUNT;
+		const float logarithmicSplit = nearPlane * std::pow(shadowFar / nearPlane, fraction);
+		const float uniformSplit = nearPlane + (shadowFar - nearPlane) * fraction;
+		const float sliceFar = SHADOW_SPLIT_LAMBDA * logarithmicSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+
+		// Slice is symmetric around the view axis, so the sphere center is on it and the radius doesn't change when the camera turns
+		const float centerDepth = 0.5f * (sliceNear + sliceFar);
+		const float nearCornerDistance = glm::length(glm::vec3(sliceNear * tanX, sliceNear * tanY, sliceNear - centerDepth));
+		const float farCornerDistance = glm::length(glm::vec3(sliceFar * tanX, sliceFar * tanY, sliceFar - centerDepth));
+		const float radius = std::ceil(std::max(nearCornerDistance, farCornerDistance) * 16.0f) / 16.0f;
+
+		glm::vec3 center = glm::vec3(lightView * inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+		const float texelSize = 2.0f * radius / SHADOW_MAP_SIZE;
+		center.x = std::floor(center.x / texelSize) * texelSize;
+		center.y = std::floor(center.y / texelSize) * texelSize;
+
+		// Light looks down its -Z, the near plane is pushed towards the sun to keep casters between it and the slice
+		const glm::mat4 lightProjection = glm::orthoRH_ZO(center.x - radius, center.x + radius, center.y - radius, center.y + radius,
+			-center.z - radius - SHADOW_CASTER_DISTANCE, -center.z + radius);
+
+		cascades.viewProjections[i] = lightProjection * lightView;
+		cascades.splits[i] = sliceFar;
+
+		sliceNear = sliceFar;
+	}
+
+	return cascades;
+}
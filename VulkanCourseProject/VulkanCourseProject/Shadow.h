@@ -0,0 +1,22 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+
+// Sun shadows are split into cascades covering consecutive depth ranges of the view frustum, each one rendered into a layer of one depth array
+const uint32_t SHADOW_CASCADE_COUNT = 4;
+const uint32_t SHADOW_MAP_SIZE = 2048;
+const float SHADOW_DISTANCE = 50.0f;        // Receivers further from the camera are not shadowed
+const float SHADOW_CASTER_DISTANCE = 100.0f; // How far towards the sun casters outside of a cascade are still caught
+const float SHADOW_SPLIT_LAMBDA = 0.75f;    // Blend between logarithmic (1) and uniform (0) split distances
+
+struct ShadowCascades
+{
+	glm::mat4 viewProjections[SHADOW_CASCADE_COUNT];
+	glm::vec4 splits; // View space depth at which each cascade ends
+};
+
+
+// Every cascade bounds its frustum slice with a sphere and is snapped to whole shadow map texels,
+// so its matrix only changes once the camera has moved by at least one texel
+ShadowCascades computeShadowCascades(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, const glm::vec3& sunDirection);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <utility>
+
+
+// Fixed capacity lock-free queue for exactly one producer thread and one consumer thread.
+// Indices only grow, the producer owns tail_ and the consumer owns head_, each only reads the other's index.
+template <typename T, size_t Capacity>
+class SpscRing
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+
+public:
+	// Producer side, false if the ring is full
+	bool TryPush(T&& value);
+
+	// Consumer side, false if the ring is empty
+	bool TryPop(T& value);
+
+	// Either side, exact only when called from the consumer while the producer is idle
+	size_t GetSize() const;
+
+private:
+	std::array<T, Capacity> slots_;
+
+	// On separate cache lines so the two threads don't invalidate each other's index on every operation
+	alignas(64) std::atomic<size_t> head_ = 0;
+	alignas(64) std::atomic<size_t> tail_ = 0;
+};
+
+
+template <typename T, size_t Capacity>
+inline bool SpscRing<T, Capacity>::TryPush(T&& value)
+{
+	const size_t tail = tail_.load(std::memory_order_relaxed);
+	if (tail - head_.load(std::memory_order_acquire) == Capacity)
+	{
+		return false;
+	}
+
+	slots_[tail & (Capacity - 1)] = std::move(value);
+	tail_.store(tail + 1, std::memory_order_release);
+
+	return true;
+}
+
+template <typename T, size_t Capacity>
+inline bool SpscRing<T, Capacity>::TryPop(T& value)
+{
+	const size_t head = head_.load(std::memory_order_relaxed);
+	if (head == tail_.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	value = std::move(slots_[head & (Capacity - 1)]);
+	head_.store(head + 1, std::memory_order_release);
+
+	return true;
+}
+
+template <typename T, size_t Capacity>
+inline size_t SpscRing<T, Capacity>::GetSize() const
+{
+	return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+}
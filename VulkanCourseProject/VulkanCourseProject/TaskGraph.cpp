@@ -0,0 +1,176 @@
+#include "TaskGraph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "Profiler.h"
+
+
+TaskGraph::TaskId TaskGraph::Add(const std::string& name, std::function<void()> function, const std::vector<TaskId>& dependencies)
+{
+	TaskId id = tasks_.size();
+
+	for (TaskId dependency : dependencies)
+	{
+		if (dependency >= id)
+		{
+			throw std::runtime_error("Task can only depend on previously added tasks.");
+		}
+
+		tasks_[dependency].dependents.push_back(id);
+	}
+
+	tasks_.push_back(Task
+	{
+		.name = name,
+		.function = std::move(function),
+		.dependencyCount = dependencies.size(),
+		.startTime = 0.0,
+		.endTime = 0.0,
+		.threadIndex = 0,
+		.finished = false
+	});
+
+	return id;
+}
+
+void TaskGraph::Run()
+{
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<TaskId> readyTasks;
+	std::vector<size_t> remainingDependencies(tasks_.size());
+	size_t finishedCount = 0;
+	size_t runningCount = 0;
+	std::exception_ptr error;
+
+	for (TaskId id = 0; id < tasks_.size(); id++)
+	{
+		remainingDependencies[id] = tasks_[id].dependencyCount;
+		if (remainingDependencies[id] == 0)
+		{
+			readyTasks.push_back(id);
+		}
+	}
+
+	const auto runStart = std::chrono::steady_clock::now();
+	auto elapsed = [&runStart]()
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+	};
+
+	auto worker = [&](size_t threadIndex)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true)
+		{
+			condition.wait(lock, [&]()
+			{
+				return readyTasks.empty() == false || finishedCount == tasks_.size() || (error && runningCount == 0);
+			});
+
+			if (readyTasks.empty())
+			{
+				return;
+			}
+
+			TaskId id = readyTasks.front();
+			readyTasks.pop_front();
+			runningCount++;
+			lock.unlock();
+
+			Task& task = tasks_[id];
+			std::exception_ptr taskError;
+
+			task.threadIndex = threadIndex;
+			task.startTime = elapsed();
+			try
+			{
+				PROFILE_SCOPE_STRING(task.name);
+				task.function();
+			}
+			catch (...)
+			{
+				taskError = std::current_exception();
+			}
+			task.endTime = elapsed();
+
+			lock.lock();
+			runningCount--;
+			finishedCount++;
+			task.finished = taskError == nullptr;
+
+			if (taskError && !error)
+			{
+				error = taskError;
+				readyTasks.clear();
+			}
+			else if (!error)
+			{
+				for (TaskId dependent : task.dependents)
+				{
+					if (--remainingDependencies[dependent] == 0)
+					{
+						readyTasks.push_back(dependent);
+					}
+				}
+			}
+
+			condition.notify_all();
+		}
+	};
+
+	// Calling thread takes part, so a chain of dependent tasks doesn't hop between threads
+	const size_t threadCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), tasks_.size()));
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threadCount; i++)
+	{
+		workers.emplace_back(worker, i);
+	}
+	worker(0);
+
+	for (std::thread& thread : workers)
+	{
+		thread.join();
+	}
+
+	totalTime_ = elapsed();
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+void TaskGraph::PrintTimeline(const std::string& title) const
+{
+	std::vector<const Task*> sortedTasks;
+	for (const Task& task : tasks_)
+	{
+		if (task.finished)
+		{
+			sortedTasks.push_back(&task);
+		}
+	}
+
+	std::sort(sortedTasks.begin(), sortedTasks.end(), [](const Task* a, const Task* b)
+	{
+		return a->startTime < b->startTime;
+	});
+
+	printf("%s: %.2f ms\n", title.c_str(), totalTime_);
+	for (const Task* task : sortedTasks)
+	{
+		printf("  %8.2f - %8.2f ms  (%7.2f ms)  thread %zu  %s\n", task->startTime, task->endTime, task->endTime - task->startTime,
+			task->threadIndex, task->name.c_str());
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional>
+
+
+// Runs tasks on worker threads as soon as all of their dependencies are finished and records when each one ran
+class TaskGraph
+{
+public:
+	using TaskId = size_t;
+
+	TaskId Add(const std::string& name, std::function<void()> function, const std::vector<TaskId>& dependencies = {});
+
+	// Rethrows the first exception thrown by a task, tasks depending on the failed one are not started
+	void Run();
+	void PrintTimeline(const std::string& title) const;
+
+private:
+	struct Task {
+		std::string name;
+		std::function<void()> function;
+		std::vector<TaskId> dependents;
+		size_t dependencyCount;
+		double startTime; // Milliseconds since Run
+		double endTime;
+		size_t threadIndex;
+		bool finished;
+	};
+	std::vector<Task> tasks_;
+	double totalTime_ = 0.0;
+};
@@ -0,0 +1,144 @@
+#include "TextureMipCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+
+namespace
+{
+	const uint32_t MIP_CACHE_MAGIC = 0x4350494D; // "MIPC"
+	const uint32_t MIP_CACHE_VERSION = 1;
+	const size_t MIP_CACHE_ALIGNMENT = 16; // Of every mip in the file
+	const uint32_t MAX_MIP_COUNT = 16;
+
+	struct MipCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t mipCount;
+		uint32_t padding;
+	};
+
+	// Box filter over 2x2 texels, the last row or column is repeated for odd sizes
+	std::vector<uint8_t> downsample(const std::vector<uint8_t>& texels, uint32_t width, uint32_t height, uint32_t mipWidth, uint32_t mipHeight)
+	{
+		std::vector<uint8_t> mipTexels(size_t(mipWidth) * mipHeight * 4);
+		for (uint32_t y = 0; y < mipHeight; y++)
+		{
+			const uint32_t y0 = std::min(y * 2, height - 1);
+			const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+			for (uint32_t x = 0; x < mipWidth; x++)
+			{
+				const uint32_t x0 = std::min(x * 2, width - 1);
+				const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					const uint32_t sum = texels[(size_t(y0) * width + x0) * 4 + c] + texels[(size_t(y0) * width + x1) * 4 + c] +
+						texels[(size_t(y1) * width + x0) * 4 + c] + texels[(size_t(y1) * width + x1) * 4 + c];
+					mipTexels[(size_t(y) * mipWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+				}
+			}
+		}
+
+		return mipTexels;
+	}
+}
+
+
+std::shared_ptr<TextureMipCache> TextureMipCache::Open(const std::string& sourcePath, const std::vector<char>& fileData)
+{
+	const std::string filePath = sourcePath + ".mipcache";
+
+	return openCacheFile(sourcePath, filePath, [&]() { return std::make_shared<TextureMipCache>(filePath); }, [&]() { return Bake(fileData); });
+}
+
+TextureMipCache::TextureMipCache(const std::string& filePath) :
+	file_(filePath), mips_(nullptr), mipCount_(0), tailMip_(0)
+{
+	if (file_.GetSize() < sizeof(MipCacheHeader))
+	{
+		throw std::runtime_error("Mip cache is truncated.");
+	}
+
+	const MipCacheHeader* header = reinterpret_cast<const MipCacheHeader*>(file_.GetData());
+	if (header->magic != MIP_CACHE_MAGIC || header->version != MIP_CACHE_VERSION || header->mipCount == 0 || header->mipCount > MAX_MIP_COUNT)
+	{
+		throw std::runtime_error("Mip cache is invalid.");
+	}
+	mipCount_ = header->mipCount;
+
+	if (file_.GetSize() < sizeof(MipCacheHeader) + sizeof(TextureMipLevel) * mipCount_)
+	{
+		throw std::runtime_error("Mip cache is truncated.");
+	}
+
+	mips_ = reinterpret_cast<const TextureMipLevel*>(file_.GetData() + sizeof(MipCacheHeader));
+	for (uint32_t i = 0; i < mipCount_; i++)
+	{
+		if (mips_[i].offset + uint64_t(mips_[i].width) * mips_[i].height * 4 > file_.GetSize())
+		{
+			throw std::runtime_error("Mip cache is truncated.");
+		}
+	}
+
+	while (tailMip_ + 1 < mipCount_ && std::max(mips_[tailMip_].width, mips_[tailMip_].height) > TEXTURE_TAIL_SIZE)
+	{
+		tailMip_++;
+	}
+}
+
+uint64_t TextureMipCache::GetSize(uint32_t firstMip) const
+{
+	uint64_t size = 0;
+	for (uint32_t i = firstMip; i < mipCount_; i++)
+	{
+		size += uint64_t(mips_[i].width) * mips_[i].height * 4;
+	}
+
+	return size;
+}
+
+
+std::vector<char> TextureMipCache::Bake(const std::vector<char>& fileData)
+{
+	int width, height;
+	VkDeviceSize imageSize;
+	stbi_uc* imageData = loadImageFromMemory(fileData, &width, &height, &imageSize);
+	std::vector<uint8_t> texels(imageData, imageData + imageSize);
+	stbi_image_free(imageData);
+
+	std::vector<TextureMipLevel> mips;
+	mips.push_back(TextureMipLevel{ .offset = 0, .width = static_cast<uint32_t>(width), .height = static_cast<uint32_t>(height) });
+	while ((mips.back().width > 1 || mips.back().height > 1) && mips.size() < MAX_MIP_COUNT)
+	{
+		mips.push_back(TextureMipLevel{ .offset = 0, .width = std::max(mips.back().width / 2, 1u), .height = std::max(mips.back().height / 2, 1u) });
+	}
+
+	std::vector<char> fileContent(sizeof(MipCacheHeader) + sizeof(TextureMipLevel) * mips.size(), 0);
+	for (size_t i = 0; i < mips.size(); i++)
+	{
+		if (i > 0)
+		{
+			texels = downsample(texels, mips[i - 1].width, mips[i - 1].height, mips[i].width, mips[i].height);
+		}
+
+		mips[i].offset = (fileContent.size() + MIP_CACHE_ALIGNMENT - 1) / MIP_CACHE_ALIGNMENT * MIP_CACHE_ALIGNMENT;
+		fileContent.resize(mips[i].offset + texels.size());
+		memcpy(fileContent.data() + mips[i].offset, texels.data(), texels.size());
+	}
+
+	const MipCacheHeader header
+	{
+		.magic = MIP_CACHE_MAGIC,
+		.version = MIP_CACHE_VERSION,
+		.mipCount = static_cast<uint32_t>(mips.size()),
+		.padding = 0
+	};
+	memcpy(fileContent.data(), &header, sizeof(header));
+	memcpy(fileContent.data() + sizeof(header), mips.data(), sizeof(TextureMipLevel) * mips.size());
+
+	return fileContent;
+}
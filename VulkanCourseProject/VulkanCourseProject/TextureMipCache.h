@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "MappedFile.h"
+
+
+const uint32_t TEXTURE_TAIL_SIZE = 64; // Mips this size or smaller stay resident, see TextureMipCache::GetTailMip
+
+// Where one mip level is in the cache file, RGBA8 texels with rows tightly packed
+struct TextureMipLevel
+{
+	uint64_t offset; // Bytes from the start of the file
+	uint32_t width;
+	uint32_t height;
+};
+
+// Full mip chain of a texture, decoded and downsampled once so mips can be streamed in without decoding the source file again.
+// The file sits next to the texture and is mapped, so only the mips which are streamed in are ever read from disk.
+class TextureMipCache
+{
+public:
+	// Maps <sourcePath>.mipcache, bakes it from the texture file's content first if it's missing, older than the texture file or invalid.
+	// Safe to call for the same texture from several loader threads.
+	static std::shared_ptr<TextureMipCache> Open(const std::string& sourcePath, const std::vector<char>& fileData);
+
+	explicit TextureMipCache(const std::string& filePath);
+
+	uint32_t GetMipCount() const;
+	uint32_t GetTailMip() const; // First mip no bigger than TEXTURE_TAIL_SIZE, 0 for small textures
+	const TextureMipLevel& GetMip(uint32_t mip) const;
+	const std::byte* GetData(uint64_t offset) const;
+	uint64_t GetSize(uint32_t firstMip) const; // Bytes of the mips from firstMip to the last one
+
+private:
+	MappedFile file_;
+	const TextureMipLevel* mips_;
+	uint32_t mipCount_;
+	uint32_t tailMip_;
+
+	static std::vector<char> Bake(const std::vector<char>& fileData); // Cache file content from the texture file's content
+};
+
+
+inline uint32_t TextureMipCache::GetMipCount() const
+{
+	return mipCount_;
+}
+
+inline uint32_t TextureMipCache::GetTailMip() const
+{
+	return tailMip_;
+}
+
+inline const TextureMipLevel& TextureMipCache::GetMip(uint32_t mip) const
+{
+	return mips_[mip];
+}
+
+inline const std::byte* TextureMipCache::GetData(uint64_t offset) const
+{
+	return file_.GetData() + offset;
+}
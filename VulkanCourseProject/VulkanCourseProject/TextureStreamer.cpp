@@ -0,0 +1,619 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "Profiler.h"
+#include "UniqueHandle.h"
+#include "Utilities.h"
+
+
+TextureStreamer::TextureStreamer(VkPhysicalDevice physicalDevice, VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
+	VkDeviceSize budget) :
+	physicalDevice_(physicalDevice), device_(device), transferQueue_(transferQueue), transferCommandPool_(transferCommandPool), evictionCallbackId_(-1),
+	heapIndex_(NO_HEAP), budget_(budget), pressureBudget_(VK_WHOLE_SIZE), residentBytes_(0), loadingBytes_(0), streamedCount_(0), uploadedBytes_(0), swappedBytes_(0), frame_(0), stopping_(false)
+{
+	loaderThread_ = std::thread([this]() { RunLoader(); });
+	evictionCallbackId_ = getMemoryTracker().AddEvictionCallback([this](uint32_t heapIndex, VkDeviceSize bytes) { return Evict(heapIndex, bytes); });
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	getMemoryTracker().RemoveEvictionCallback(evictionCallbackId_);
+
+	{
+		std::lock_guard<std::mutex> loadLock(loadMutex_);
+		stopping_ = true;
+	}
+	loadCondition_.notify_one();
+	loaderThread_.join();
+
+	// Images still in use belong to the renderer
+	for (const Load& load : finishedLoads_)
+	{
+		if (load.succeeded)
+		{
+			DestroyImage(load.image);
+		}
+	}
+
+	vkDestroyCommandPool(device_, transferCommandPool_, nullptr);
+}
+
+
+StreamedTextureImage TextureStreamer::CreateImage(const TextureMipCache& cache, uint32_t firstMip, VkCommandPool commandPool) const
+{
+	PROFILE_SCOPE("CreateStreamedTextureImage");
+
+	const uint32_t mipCount = cache.GetMipCount() - firstMip;
+	const VkDeviceSize size = cache.GetSize(firstMip);
+
+	VkBuffer rawStagingBuffer;
+	VkDeviceMemory rawStagingBufferMemory;
+	createBuffer(physicalDevice_, device_, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		MemoryCategory::Staging, &rawStagingBuffer, &rawStagingBufferMemory);
+	UniqueDeviceMemory stagingBufferMemory(device_, rawStagingBufferMemory);
+	UniqueBuffer stagingBuffer(device_, rawStagingBuffer);
+
+	// Pages of the mapped cache are read from disk here
+	std::vector<VkBufferImageCopy> copyRegions(mipCount);
+	std::byte* stagingData;
+	vkMapMemory(device_, stagingBufferMemory.Get(), 0, size, 0, reinterpret_cast<void**>(&stagingData));
+	VkDeviceSize offset = 0;
+	for (uint32_t i = 0; i < mipCount; i++)
+	{
+		const TextureMipLevel& mip = cache.GetMip(firstMip + i);
+		const VkDeviceSize mipSize = VkDeviceSize(mip.width) * mip.height * 4;
+		memcpy(stagingData + offset, cache.GetData(mip.offset), static_cast<size_t>(mipSize));
+
+		copyRegions[i] = VkBufferImageCopy
+		{
+			.bufferOffset = offset,
+			.bufferRowLength = 0,
+			.bufferImageHeight = 0,
+			.imageSubresource = VkImageSubresourceLayers
+			{
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = i,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.imageOffset = { 0, 0, 0 },
+			.imageExtent = { mip.width, mip.height, 1 }
+		};
+		offset += mipSize;
+	}
+	vkUnmapMemory(device_, stagingBufferMemory.Get());
+
+	const TextureMipLevel& baseMip = cache.GetMip(firstMip);
+	VkImageCreateInfo imageCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = VK_FORMAT_R8G8B8A8_UNORM,
+		.extent = VkExtent3D
+		{
+			.width = baseMip.width,
+			.height = baseMip.height,
+			.depth = 1
+		},
+		.mipLevels = mipCount,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+	};
+
+	VkImage rawImage;
+	VkResult result = vkCreateImage(device_, &imageCreateInfo, nullptr, &rawImage);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create an image.");
+	}
+	UniqueImage image(device_, rawImage);
+
+	VkMemoryRequirements imageMemoryRequirements;
+	vkGetImageMemoryRequirements(device_, image.Get(), &imageMemoryRequirements);
+
+	VkMemoryAllocateInfo imageMemoryAllocateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = imageMemoryRequirements.size,
+		.memoryTypeIndex = findMemoryTypeIndex(physicalDevice_, imageMemoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+	};
+
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice_, &memoryProperties);
+	heapIndex_ = memoryProperties.memoryTypes[imageMemoryAllocateInfo.memoryTypeIndex].heapIndex;
+
+	VkDeviceMemory rawImageMemory;
+	result = allocateDeviceMemory(device_, imageMemoryAllocateInfo, MemoryCategory::Textures, &rawImageMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate memory for an image.");
+	}
+	UniqueDeviceMemory imageMemory(device_, rawImageMemory);
+
+	vkBindImageMemory(device_, image.Get(), imageMemory.Get(), 0);
+
+	const VkImageSubresourceRange subresourceRange
+	{
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = mipCount,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+
+	VkImageMemoryBarrier imageMemoryBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_NONE,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = image.Get(),
+		.subresourceRange = subresourceRange
+	};
+
+	// All mips in one submission, transitionImageLayout and copyImageBuffer only cover the first one
+	VkCommandBuffer commandBuffer = beginCommandBuffer(device_, commandPool);
+	{
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.Get(), image.Get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+		imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+	}
+	endAndSubmitCommandBuffer(device_, commandPool, transferQueue_, commandBuffer);
+
+	VkImageViewCreateInfo imageViewCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = image.Get(),
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = VK_FORMAT_R8G8B8A8_UNORM,
+		.components = VkComponentMapping
+		{
+			.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.a = VK_COMPONENT_SWIZZLE_IDENTITY
+		},
+		.subresourceRange = subresourceRange
+	};
+
+	VkImageView imageView;
+	result = vkCreateImageView(device_, &imageViewCreateInfo, nullptr, &imageView);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create an image view.");
+	}
+
+	return StreamedTextureImage
+	{
+		.image = image.Release(),
+		.memory = imageMemory.Release(),
+		.view = imageView
+	};
+}
+
+void TextureStreamer::DestroyImage(const StreamedTextureImage& image) const
+{
+	vkDestroyImageView(device_, image.view, nullptr);
+	vkDestroyImage(device_, image.image, nullptr);
+	freeDeviceMemory(device_, image.memory, nullptr);
+}
+
+
+int TextureStreamer::Register(const std::shared_ptr<const TextureMipCache>& cache, int textureId, uint32_t alternateSlot)
+{
+	const uint32_t tailMip = cache->GetTailMip();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	int id;
+	if (freeEntries_.empty())
+	{
+		id = static_cast<int>(entries_.size());
+		entries_.emplace_back();
+	}
+	else
+	{
+		id = freeEntries_.back();
+		freeEntries_.pop_back();
+	}
+
+	entries_[id] = Entry
+	{
+		.cache = cache,
+		.textureId = textureId,
+		.state = State::Resident,
+		.unregistered = false,
+		.descriptorSlots = { static_cast<uint32_t>(textureId), alternateSlot },
+		.slotFirstMips = { tailMip, tailMip },
+		.currentSlot = 0,
+		.firstMip = tailMip,
+		.targetMip = tailMip,
+		.desiredMip = tailMip,
+		.lastUsedFrame = 0
+	};
+	streamedCount_++;
+
+	return id;
+}
+
+void TextureStreamer::Unregister(int id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	Entry& entry = entries_[id];
+	streamedCount_--;
+	residentBytes_ -= GetStreamedSize(entry, entry.state == State::Loading ? entry.targetMip : entry.firstMip);
+
+	if (entry.state == State::Loading || entry.state == State::Swapping)
+	{
+		entry.unregistered = true;
+		return;
+	}
+
+	FreeEntry(id);
+}
+
+
+void TextureStreamer::Update(const uint32_t* feedback)
+{
+	PROFILE_SCOPE("TextureStreamer::Update");
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	frame_++;
+	uploadedBytes_ = std::exchange(swappedBytes_, 0);
+
+	// Either slot may have been sampled, the replaced image is still in use by some of the frames
+	for (Entry& entry : entries_)
+	{
+		if (entry.state == State::Free || entry.unregistered)
+		{
+			continue;
+		}
+
+		int finestMip = INT_MAX;
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			const uint32_t lod = feedback[entry.descriptorSlots[i]];
+			if (lod != NO_FEEDBACK)
+			{
+				finestMip = std::min(finestMip, static_cast<int>(entry.slotFirstMips[i] + lod) - static_cast<int>(FEEDBACK_LOD_BIAS));
+			}
+		}
+		if (finestMip != INT_MAX)
+		{
+			entry.desiredMip = static_cast<uint32_t>(std::clamp(finestMip, 0, static_cast<int>(entry.cache->GetTailMip())));
+			entry.lastUsedFrame = frame_;
+		}
+	}
+
+	// Heap room below the eviction threshold goes back into a lowered budget, loads in flight aren't in the heap usage yet
+	if (pressureBudget_ != VK_WHOLE_SIZE && heapIndex_ != NO_HEAP)
+	{
+		const MemoryHeapBudget heap = getMemoryTracker().GetHeapBudget(heapIndex_);
+		const VkDeviceSize threshold = static_cast<VkDeviceSize>(heap.budget * MemoryTracker::EVICTION_THRESHOLD);
+		if (heap.usage + loadingBytes_ < threshold)
+		{
+			pressureBudget_ += threshold - heap.usage - loadingBytes_;
+			if (pressureBudget_ >= budget_)
+			{
+				pressureBudget_ = VK_WHOLE_SIZE;
+				printf("Texture streaming: device memory is available again, budget restored to %.1f MB.\n", budget_ / (1024.0 * 1024.0));
+			}
+		}
+	}
+	const VkDeviceSize budget = GetBudget();
+
+	// Budget may have been lowered, sampled textures drop mips too then
+	while (residentBytes_ > budget && EvictLeastRecentlyUsed(true))
+	{
+	}
+
+	requests_.clear();
+	for (size_t i = 0; i < entries_.size(); i++)
+	{
+		const Entry& entry = entries_[i];
+		if (entry.state == State::Resident && entry.unregistered == false && entry.lastUsedFrame == frame_ && entry.desiredMip < entry.firstMip)
+		{
+			requests_.push_back(LoadRequest{ .priority = static_cast<float>(entry.firstMip - entry.desiredMip), .id = static_cast<int>(i) });
+		}
+	}
+
+	std::sort(requests_.begin(), requests_.end(), [](const LoadRequest& a, const LoadRequest& b) { return a.priority > b.priority; });
+
+	// One mip at a time, textures sharpen progressively and a single texture can't take the whole upload limit
+	for (const LoadRequest& request : requests_)
+	{
+		const Entry& entry = entries_[request.id];
+		const uint32_t firstMip = entry.firstMip - 1;
+		if (GetStreamedSize(entry, firstMip) > budget)
+		{
+			continue;
+		}
+		// A load always starts if nothing is in flight, bigger images than the limit would never load otherwise
+		const VkDeviceSize uploadSize = entry.cache->GetSize(firstMip);
+		if (loadingBytes_ > 0 && loadingBytes_ + uploadSize > MAX_UPLOAD_BYTES_PER_FRAME)
+		{
+			break;
+		}
+
+		const VkDeviceSize growth = GetStreamedSize(entry, firstMip) - GetStreamedSize(entry, entry.firstMip);
+		bool fits = true;
+		while (residentBytes_ + growth > budget && fits)
+		{
+			fits = EvictLeastRecentlyUsed(false);
+		}
+		if (fits == false)
+		{
+			break;
+		}
+
+		StartLoad(request.id, firstMip);
+	}
+}
+
+bool TextureStreamer::TakeSwap(TextureSwap* swap)
+{
+	while (true)
+	{
+		Load load;
+		{
+			std::lock_guard<std::mutex> loadLock(loadMutex_);
+			if (finishedLoads_.empty())
+			{
+				return false;
+			}
+			load = std::move(finishedLoads_.front());
+			finishedLoads_.pop_front();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		Entry& entry = entries_[load.id];
+		loadingBytes_ -= load.cache->GetSize(load.firstMip);
+		if (entry.unregistered || load.succeeded == false)
+		{
+			// Never sampled, nothing to wait for
+			if (load.succeeded)
+			{
+				DestroyImage(load.image);
+			}
+
+			if (entry.unregistered)
+			{
+				FreeEntry(load.id);
+			}
+			else
+			{
+				// Device memory ran out, the budget is lowered to what fit so the load isn't retried every frame
+				residentBytes_ = residentBytes_ - GetStreamedSize(entry, entry.targetMip) + GetStreamedSize(entry, entry.firstMip);
+				entry.state = State::Resident;
+				LowerBudget("full");
+			}
+			continue;
+		}
+
+		const uint32_t slot = 1 - entry.currentSlot;
+		entry.state = State::Swapping;
+		entry.currentSlot = slot;
+		entry.slotFirstMips[slot] = load.firstMip;
+		entry.firstMip = load.firstMip;
+		swappedBytes_ += load.cache->GetSize(load.firstMip);
+
+		*swap = TextureSwap
+		{
+			.textureId = entry.textureId,
+			.descriptorSlot = entry.descriptorSlots[slot],
+			.image = load.image,
+			.streamId = load.id
+		};
+
+		return true;
+	}
+}
+
+void TextureStreamer::EndSwap(int id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	Entry& entry = entries_[id];
+	if (entry.unregistered)
+	{
+		FreeEntry(id);
+		return;
+	}
+
+	entry.state = State::Resident;
+}
+
+
+void TextureStreamer::SetBudget(VkDeviceSize budget)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	budget_ = budget;
+}
+
+TextureStreamingStatistics TextureStreamer::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	size_t fullDetailCount = 0;
+	for (const Entry& entry : entries_)
+	{
+		if (entry.state != State::Free && entry.unregistered == false && entry.firstMip == 0)
+		{
+			fullDetailCount++;
+		}
+	}
+
+	return TextureStreamingStatistics
+	{
+		.residentBytes = residentBytes_,
+		.budget = GetBudget(),
+		.fullDetailTextureCount = fullDetailCount,
+		.streamedTextureCount = streamedCount_,
+		.uploadedBytes = uploadedBytes_
+	};
+}
+
+
+void TextureStreamer::RunLoader()
+{
+	PROFILE_THREAD_NAME("Texture streaming");
+
+	while (true)
+	{
+		Load load;
+		{
+			std::unique_lock<std::mutex> loadLock(loadMutex_);
+			loadCondition_.wait(loadLock, [this]() { return stopping_ || pendingLoads_.empty() == false; });
+			if (stopping_)
+			{
+				return;
+			}
+			load = std::move(pendingLoads_.front());
+			pendingLoads_.pop_front();
+		}
+
+		try
+		{
+			load.image = CreateImage(*load.cache, load.firstMip, transferCommandPool_);
+			load.succeeded = true;
+		}
+		catch (const std::runtime_error&)
+		{
+			load.succeeded = false;
+		}
+
+		std::lock_guard<std::mutex> loadLock(loadMutex_);
+		finishedLoads_.push_back(std::move(load));
+	}
+}
+
+VkDeviceSize TextureStreamer::Evict(uint32_t heapIndex, VkDeviceSize bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (heapIndex != heapIndex_)
+	{
+		return 0;
+	}
+
+	const VkDeviceSize residentBytes = residentBytes_;
+	while (residentBytes - residentBytes_ < bytes && EvictLeastRecentlyUsed(false))
+	{
+	}
+	while (residentBytes - residentBytes_ < bytes && EvictLeastRecentlyUsed(true))
+	{
+	}
+
+	// The mips would be loaded again next frame otherwise
+	LowerBudget("low");
+
+	return residentBytes - residentBytes_;
+}
+
+
+VkDeviceSize TextureStreamer::GetBudget() const
+{
+	return std::min(budget_, pressureBudget_);
+}
+
+void TextureStreamer::LowerBudget(const char* reason)
+{
+	if (residentBytes_ < GetBudget())
+	{
+		pressureBudget_ = residentBytes_;
+		printf("Texture streaming: device memory is %s, budget lowered to %.1f MB until it frees up.\n", reason, pressureBudget_ / (1024.0 * 1024.0));
+	}
+}
+
+VkDeviceSize TextureStreamer::GetStreamedSize(const Entry& entry, uint32_t firstMip) const
+{
+	return entry.cache->GetSize(firstMip) - entry.cache->GetSize(entry.cache->GetTailMip());
+}
+
+void TextureStreamer::StartLoad(int id, uint32_t firstMip)
+{
+	Entry& entry = entries_[id];
+	residentBytes_ = residentBytes_ - GetStreamedSize(entry, entry.firstMip) + GetStreamedSize(entry, firstMip);
+	loadingBytes_ += entry.cache->GetSize(firstMip);
+	entry.state = State::Loading;
+	entry.targetMip = firstMip;
+
+	{
+		std::lock_guard<std::mutex> loadLock(loadMutex_);
+		pendingLoads_.push_back(Load
+		{
+			.id = id,
+			.cache = entry.cache,
+			.firstMip = firstMip,
+			.succeeded = false,
+			.image = {}
+		});
+	}
+	loadCondition_.notify_one();
+}
+
+bool TextureStreamer::EvictLeastRecentlyUsed(bool includeUsed)
+{
+	// Textures sampled coarser than they are resident give up their unused mips before other textures which are still sampled
+	int leastRecent = -1;
+	for (size_t i = 0; i < entries_.size(); i++)
+	{
+		const Entry& entry = entries_[i];
+		if (entry.state != State::Resident || entry.unregistered || entry.firstMip >= entry.cache->GetTailMip())
+		{
+			continue;
+		}
+		if (includeUsed == false && entry.lastUsedFrame == frame_ && entry.desiredMip <= entry.firstMip)
+		{
+			continue;
+		}
+		if (leastRecent < 0 || entry.lastUsedFrame < entries_[leastRecent].lastUsedFrame)
+		{
+			leastRecent = static_cast<int>(i);
+		}
+	}
+	if (leastRecent < 0)
+	{
+		return false;
+	}
+
+	// Frames in flight may still sample the current image, the smaller one replaces it the same way a bigger one would
+	const Entry& entry = entries_[leastRecent];
+	const uint32_t firstMip = entry.lastUsedFrame < frame_ ? entry.cache->GetTailMip() : std::max(entry.desiredMip, entry.firstMip + 1);
+	StartLoad(leastRecent, firstMip);
+
+	return true;
+}
+
+void TextureStreamer::FreeEntry(int id)
+{
+	Entry& entry = entries_[id];
+	entry.state = State::Free;
+	entry.unregistered = false;
+	entry.cache.reset();
+	freeEntries_.push_back(id);
+}
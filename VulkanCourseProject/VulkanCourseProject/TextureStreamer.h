@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "TextureMipCache.h"
+
+
+// Image with a view over all of its mips
+struct StreamedTextureImage
+{
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+};
+
+// Image with more or fewer mips of a texture, ready to replace the current one
+struct TextureSwap
+{
+	int textureId;
+	uint32_t descriptorSlot; // Not the one in use, frames in flight keep sampling the replaced image through the other
+	StreamedTextureImage image;
+	int streamId;
+};
+
+struct TextureStreamingStatistics
+{
+	VkDeviceSize residentBytes; // Mips finer than the tails
+	VkDeviceSize budget; // Lowered while the heap of the textures is short of memory
+	size_t fullDetailTextureCount;
+	size_t streamedTextureCount;
+	VkDeviceSize uploadedBytes; // Since the last frame
+};
+
+// Residency manager for the mips of streamed textures, mips up to TEXTURE_TAIL_SIZE always stay resident.
+// shader.frag writes the finest mip it sampled per texture descriptor into the feedback buffer. Every frame the textures sampled finer
+// than they are resident get one more mip, biggest shortfall first and no more than MAX_UPLOAD_BYTES_PER_FRAME in flight. Least recently
+// sampled textures, and textures sampled coarser than they are resident, drop mips to stay within the budget. When the memory tracker
+// asks for memory or an image doesn't fit, the budget is lowered to what's resident and raised again as the heap frees up.
+// Mips can't be added to an existing image, so a loader thread uploads the new mip range from the mapped mip cache into a new image and
+// the renderer swaps it in through the texture's second descriptor slot.
+// Registration is thread-safe, Update and TakeSwap are called by the thread recording commands.
+class TextureStreamer
+{
+public:
+	static const VkDeviceSize MAX_UPLOAD_BYTES_PER_FRAME = 16 * 1024 * 1024;
+	// Same as in shader.frag, feedback is the floor of the sampled level of detail relative to the first resident mip, plus the bias
+	static const uint32_t FEEDBACK_LOD_BIAS = 16;
+	static const uint32_t NO_FEEDBACK = 0xFFFFFFFF;
+
+	// Takes ownership of the command pool, it's used by the loader thread only
+	TextureStreamer(VkPhysicalDevice physicalDevice, VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, VkDeviceSize budget);
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// Uploads the mips from firstMip to the last one into a new image, the command pool has to belong to the calling thread
+	StreamedTextureImage CreateImage(const TextureMipCache& cache, uint32_t firstMip, VkCommandPool commandPool) const;
+	void DestroyImage(const StreamedTextureImage& image) const;
+
+	// Texture's image holds the tail mips and sits in the texture id's slot. Returns the stream id of the texture.
+	int Register(const std::shared_ptr<const TextureMipCache>& cache, int textureId, uint32_t alternateSlot);
+	void Unregister(int id);
+
+	// Reads the feedback of a finished frame, indexed by descriptor slot, then drops and requests mips
+	void Update(const uint32_t* feedback);
+	// Returns false once there are no finished images. The replaced image has to stay alive until the frames in flight are done with it,
+	// EndSwap is called then and the texture can be swapped again.
+	bool TakeSwap(TextureSwap* swap);
+	void EndSwap(int id);
+
+	void SetBudget(VkDeviceSize budget);
+	TextureStreamingStatistics GetStatistics() const;
+
+private:
+	static const uint32_t NO_HEAP = 0xFFFFFFFF;
+
+	enum class State
+	{
+		Free,
+		Resident,
+		Loading,
+		Swapping // Replaced image is still in use
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const TextureMipCache> cache;
+		int textureId;
+		State state;
+		bool unregistered; // Removed while loading or swapping, freed once that ends
+		uint32_t descriptorSlots[2]; // Texture id, then the alternate slot
+		uint32_t slotFirstMips[2]; // First mip of the image each slot was last written with, feedback is relative to it
+		uint32_t currentSlot;
+		uint32_t firstMip; // Of the image in use
+		uint32_t targetMip; // Of the image being loaded
+		uint32_t desiredMip; // Finest mip sampled when it was last sampled
+		uint64_t lastUsedFrame;
+	};
+
+	struct LoadRequest
+	{
+		float priority;
+		int id;
+	};
+
+	struct Load
+	{
+		int id;
+		std::shared_ptr<const TextureMipCache> cache;
+		uint32_t firstMip;
+		bool succeeded;
+		StreamedTextureImage image;
+	};
+
+	VkPhysicalDevice physicalDevice_;
+	VkDevice device_;
+	VkQueue transferQueue_;
+	VkCommandPool transferCommandPool_;
+	int evictionCallbackId_;
+	mutable std::atomic<uint32_t> heapIndex_; // All images are allocated from it, set by the first CreateImage
+
+	mutable std::mutex mutex_; // Guards the entries and statistics
+	std::vector<Entry> entries_;
+	std::vector<int> freeEntries_;
+	VkDeviceSize budget_;
+	VkDeviceSize pressureBudget_; // VK_WHOLE_SIZE unless memory ran short, the budget in use is the lower one
+	VkDeviceSize residentBytes_; // Loading mips included, replaced ones excluded
+	VkDeviceSize loadingBytes_; // Queued or being uploaded, loads started in a frame stop at MAX_UPLOAD_BYTES_PER_FRAME of these
+	size_t streamedCount_;
+	VkDeviceSize uploadedBytes_;
+	VkDeviceSize swappedBytes_; // Since the last Update
+	uint64_t frame_;
+	std::vector<LoadRequest> requests_; // Keeps its capacity, frames don't reach the heap
+
+	std::mutex loadMutex_; // Guards the queues below
+	std::condition_variable loadCondition_;
+	std::deque<Load> pendingLoads_;
+	std::deque<Load> finishedLoads_;
+	bool stopping_;
+	std::thread loaderThread_;
+
+	void RunLoader();
+	VkDeviceSize Evict(uint32_t heapIndex, VkDeviceSize bytes); // Memory tracker eviction callback
+	// Everything below is called under mutex_
+	VkDeviceSize GetBudget() const;
+	void LowerBudget(const char* reason); // To what's resident until the heap frees up
+	VkDeviceSize GetStreamedSize(const Entry& entry, uint32_t firstMip) const; // Bytes of the mips finer than the tail
+	void StartLoad(int id, uint32_t firstMip);
+	bool EvictLeastRecentlyUsed(bool includeUsed); // False if there was nothing to evict
+	void FreeEntry(int id);
+};
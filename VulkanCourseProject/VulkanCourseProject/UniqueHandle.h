@@ -0,0 +1,110 @@
+#pragma once
+
+#include <utility>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "MemoryTracker.h"
+
+
+// Owns a device-level Vulkan handle and destroys it when going out of scope, can only be moved
+template <typename Handle, auto Deleter>
+class UniqueHandle
+{
+public:
+	UniqueHandle();
+	UniqueHandle(VkDevice device, Handle handle);
+	UniqueHandle(UniqueHandle&& other) noexcept;
+	~UniqueHandle();
+
+	UniqueHandle(const UniqueHandle&) = delete;
+	UniqueHandle& operator=(const UniqueHandle&) = delete;
+	UniqueHandle& operator=(UniqueHandle&& other) noexcept;
+
+	Handle Get() const;
+	explicit operator bool() const;
+
+	Handle Release();
+	void Reset();
+
+private:
+	VkDevice device_;
+	Handle handle_;
+};
+
+using UniqueBuffer = UniqueHandle<VkBuffer, vkDestroyBuffer>;
+using UniqueImage = UniqueHandle<VkImage, vkDestroyImage>;
+using UniqueImageView = UniqueHandle<VkImageView, vkDestroyImageView>;
+using UniqueDeviceMemory = UniqueHandle<VkDeviceMemory, freeDeviceMemory>;
+
+
+template <typename Handle, auto Deleter>
+inline UniqueHandle<Handle, Deleter>::UniqueHandle() :
+	device_(VK_NULL_HANDLE),
+	handle_(VK_NULL_HANDLE)
+{
+}
+
+template <typename Handle, auto Deleter>
+inline UniqueHandle<Handle, Deleter>::UniqueHandle(VkDevice device, Handle handle) :
+	device_(device),
+	handle_(handle)
+{
+}
+
+template <typename Handle, auto Deleter>
+inline UniqueHandle<Handle, Deleter>::UniqueHandle(UniqueHandle&& other) noexcept :
+	device_(other.device_),
+	handle_(other.Release())
+{
+}
+
+template <typename Handle, auto Deleter>
+inline UniqueHandle<Handle, Deleter>::~UniqueHandle()
+{
+	Reset();
+}
+
+template <typename Handle, auto Deleter>
+inline UniqueHandle<Handle, Deleter>& UniqueHandle<Handle, Deleter>::operator=(UniqueHandle&& other) noexcept
+{
+	if (this != &other)
+	{
+		Reset();
+		device_ = other.device_;
+		handle_ = other.Release();
+	}
+
+	return *this;
+}
+
+
+template <typename Handle, auto Deleter>
+inline Handle UniqueHandle<Handle, Deleter>::Get() const
+{
+	return handle_;
+}
+
+template <typename Handle, auto Deleter>
+inline UniqueHandle<Handle, Deleter>::operator bool() const
+{
+	return handle_ != VK_NULL_HANDLE;
+}
+
+
+template <typename Handle, auto Deleter>
+inline Handle UniqueHandle<Handle, Deleter>::Release()
+{
+	return std::exchange(handle_, VK_NULL_HANDLE);
+}
+
+template <typename Handle, auto Deleter>
+inline void UniqueHandle<Handle, Deleter>::Reset()
+{
+	if (handle_ != VK_NULL_HANDLE)
+	{
+		Deleter(device_, handle_, nullptr);
+		handle_ = VK_NULL_HANDLE;
+	}
+}
@@ -1,5 +1,7 @@
 #include "Utilities.h"
 
+#include <filesystem>
+
 
 std::vector<char> readBinaryFile(const std::string& filename)
 {
@@ -21,6 +23,20 @@ std::vector<char> readBinaryFile(const std::string& filename)
 	return buffer;
 }
 
+void writeBinaryFile(const std::string& filename, const std::vector<char>& data)
+{
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+
+	if (file.is_open() == false)
+	{
+		throw std::runtime_error("Failed to open a file for writing.");
+	}
+
+	file.write(data.data(), data.size());
+
+	file.close();
+}
+
 stbi_uc* loadTexture(std::string fileName, int* width, int* height, VkDeviceSize* imageSize)
 {
 	std::string filePath = "../textures/" + fileName;
@@ -43,26 +59,85 @@ stbi_uc* loadImage(std::string filePath, int* width, int* height, VkDeviceSize*
 	return imageData;
 }
 
+stbi_uc* loadImageFromMemory(const std::vector<char>& fileData, int* width, int* height, VkDeviceSize* imageSize)
+{
+	int channels;
+	stbi_uc* imageData = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(fileData.data()), static_cast<int>(fileData.size()),
+		width, height, &channels, STBI_rgb_alpha);
+
+	if (!imageData)
+	{
+		throw std::runtime_error("Failed to decode a texture file.");
+	}
+
+	*imageSize = (*width) * (*height) * 4;
+
+	return imageData;
+}
+
+
+std::string getCanonicalPath(const std::string& filePath)
+{
+	std::error_code error;
+	std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(filePath, error);
+	if (error)
+	{
+		canonicalPath = std::filesystem::absolute(filePath).lexically_normal();
+	}
+
+	return canonicalPath.generic_string();
+}
+
+uint64_t hashBytes(const void* data, size_t size)
+{
+	// 64-bit FNV-1a
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
 
 uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, const uint32_t& allowedTypes, const VkMemoryPropertyFlags& propertyFlags)
 {
 	VkPhysicalDeviceMemoryProperties memoryProperties;
 	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
 
+	int fallbackIndex = -1;
 	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
 	{
-		if ((allowedTypes & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & propertyFlags))
+		if ((allowedTypes & (1 << i)) == 0 || (memoryProperties.memoryTypes[i].propertyFlags & propertyFlags) != propertyFlags)
+		{
+			continue;
+		}
+
+		if (getMemoryTracker().IsHeapOverBudget(i) == false)
 		{
 			return i;
 		}
+		if (fallbackIndex < 0)
+		{
+			fallbackIndex = static_cast<int>(i);
+		}
+	}
+
+	if (fallbackIndex < 0)
+	{
+		throw std::runtime_error("Failed to find a memory type index.");
 	}
 
-	throw std::runtime_error("Failed to find a memory type index.");
+	return static_cast<uint32_t>(fallbackIndex);
 }
 
 
 void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
-	VkMemoryPropertyFlags bufferProperties, VkBuffer* buffer, VkDeviceMemory* bufferMemory)
+	VkMemoryPropertyFlags bufferProperties, MemoryCategory category, VkBuffer* buffer, VkDeviceMemory* bufferMemory)
 {
 	VkBufferCreateInfo bufferCreateInfo
 	{
@@ -88,7 +163,7 @@ void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize
 		.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memoryRequirements.memoryTypeBits, bufferProperties)
 	};
 
-	result = vkAllocateMemory(device, &memoryAllocateInfo, nullptr, bufferMemory);
+	result = allocateDeviceMemory(device, memoryAllocateInfo, category, bufferMemory);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to allocate memory for vertex buffer.");
@@ -101,6 +176,14 @@ void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize
 	}
 }
 
+std::mutex& getQueueMutex()
+{
+	// Queues are externally synchronized, every submission and presentation goes through this lock
+	static std::mutex queueMutex;
+
+	return queueMutex;
+}
+
 VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool commandPool)
 {
 	VkCommandBufferAllocateInfo commandBufferAllocateInfo
@@ -136,23 +219,42 @@ void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool, VkQue
 		.pCommandBuffers = &commandBuffer
 	};
 
-	VkResult result = vkQueueSubmit(queue, 1, &transferSubmitInfo, VK_NULL_HANDLE);
+	VkFenceCreateInfo fenceCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+	};
+
+	VkFence fence;
+	VkResult result = vkCreateFence(device, &fenceCreateInfo, nullptr, &fence);
 	if (result != VK_SUCCESS)
 	{
+		throw std::runtime_error("Failed to create a fence.");
+	}
+
+	{
+		std::lock_guard<std::mutex> queueLock(getQueueMutex());
+		result = vkQueueSubmit(queue, 1, &transferSubmitInfo, fence);
+	}
+	if (result != VK_SUCCESS)
+	{
+		vkDestroyFence(device, fence, nullptr);
 		throw std::runtime_error("Failed to submit command to transfer queue.");
 	}
-	vkQueueWaitIdle(queue);
+
+	// Wait for this submission only, so other threads keep using the queue meanwhile
+	vkWaitForFences(device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	vkDestroyFence(device, fence, nullptr);
 
 	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
 
 void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, 
-	VkBuffer sourceBuffer, VkBuffer destinationBuffer, VkDeviceSize bufferSize)
+	VkBuffer sourceBuffer, VkBuffer destinationBuffer, VkDeviceSize bufferSize, VkDeviceSize destinationOffset)
 {
 	VkBufferCopy bufferCopyRegion
 	{
 		.srcOffset = 0,
-		.dstOffset = 0,
+		.dstOffset = destinationOffset,
 		.size = bufferSize
 	};
 
@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <mutex>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -11,9 +12,22 @@
 #define STB_IMAGE_STATIC
 #include "stb/stb_image.h"
 
+#include "MemoryTracker.h"
+
 
 const int MAX_FRAME_DRAWS = 2;
 const int MAX_OBJECTS = 32;
+const uint32_t MAX_TEXTURES = 65536; // Upper bound for the bindless texture array, device limits may lower it
+const uint32_t MAX_DRAWS = 16384; // Mesh draws per frame, each one gets an ObjectData entry and an indirect command
+
+const VkDeviceSize GEOMETRY_VERTEX_CAPACITY = 128 * 1024 * 1024;
+const VkDeviceSize GEOMETRY_POSITION_CAPACITY = 64 * 1024 * 1024;
+const VkDeviceSize GEOMETRY_INDEX_CAPACITY = 64 * 1024 * 1024;
+const VkDeviceSize GEOMETRY_SKIN_VERTEX_CAPACITY = 32 * 1024 * 1024;
+const uint32_t MAX_SKIN_JOINTS = 16384; // Joint matrices per frame, summed over all skinned mesh instances
+const int MODEL_HANDLE_SLOT_BITS = 16; // Low bits of a model handle select its slot, the bits above are the slot's generation
+const uint32_t MODEL_HANDLE_SLOT_MASK = (1u << MODEL_HANDLE_SLOT_BITS) - 1;
+const uint32_t MODEL_HANDLE_GENERATION_MASK = 0x7FFFFFFFu >> MODEL_HANDLE_SLOT_BITS; // Handles stay positive
 
 const std::vector<const char*> deviceExtensions = 
 {
@@ -48,32 +62,45 @@ struct SwapchainDetails
 	}
 };
 
-struct SwapchainImage
+// Written in front of the driver's pipeline cache data, the cache is only reused on the same device and driver
+struct PipelineCacheHeader
 {
-	VkImage image;
-	VkImageView imageView;
+	uint32_t magic;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t dataSize;
+	uint64_t dataHash;
 };
 
-struct Vertex
+struct SwapchainImage
 {
-	glm::vec3 position;
-	glm::vec3 color;
-	glm::vec2 texCoords;
+	VkImage image;
+	VkImageView imageView;
 };
 
 std::vector<char> readBinaryFile(const std::string& filename);
+void writeBinaryFile(const std::string& filename, const std::vector<char>& data);
 stbi_uc* loadTexture(std::string fileName, int* width, int* height, VkDeviceSize* imageSize);
 stbi_uc* loadImage(std::string filePath, int* width, int* height, VkDeviceSize* imageSize);
+stbi_uc* loadImageFromMemory(const std::vector<char>& fileData, int* width, int* height, VkDeviceSize* imageSize);
 
+std::string getCanonicalPath(const std::string& filePath);
+uint64_t hashBytes(const void* data, size_t size);
+
+// First allowed type with all property flags whose heap is within its budget, or the first one with all flags if every heap is full
 uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, const uint32_t& allowedTypes, const VkMemoryPropertyFlags& propertyFlags);
 
 void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
-	VkMemoryPropertyFlags bufferProperties, VkBuffer* buffer, VkDeviceMemory* bufferMemory);
+	VkMemoryPropertyFlags bufferProperties, MemoryCategory category, VkBuffer* buffer, VkDeviceMemory* bufferMemory);
+
+std::mutex& getQueueMutex();
 
 VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool commandPool);
 void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkCommandBuffer commandBuffer);
 void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, 
-	VkBuffer sourceBuffer, VkBuffer destinationBuffer, VkDeviceSize bufferSize);
+	VkBuffer sourceBuffer, VkBuffer destinationBuffer, VkDeviceSize bufferSize, VkDeviceSize destinationOffset = 0);
 void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, VkBuffer sourceBuffer, VkImage image, uint32_t width, uint32_t height);
 
 void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
@@ -0,0 +1,129 @@
+#include "VertexFormat.h"
+
+#include <limits>
+
+#include <glm/gtc/packing.hpp>
+
+
+static glm::vec2 encodeOctahedral(glm::vec3 normal)
+{
+	float length = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+	if (length == 0.0f)
+	{
+		return glm::vec2(0.0f, 0.0f);
+	}
+	normal /= length;
+
+	glm::vec2 encoded(normal.x, normal.y);
+	if (normal.z < 0.0f)
+	{
+		encoded = glm::vec2(
+			(1.0f - glm::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - glm::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f)
+		);
+	}
+
+	return encoded;
+}
+
+
+VertexQuantization computeVertexQuantization(const std::vector<Vertex>& vertices)
+{
+#ifdef VERTEX_FORMAT_COMPACT
+	if (vertices.empty())
+	{
+		return VertexQuantization{ glm::vec4(1.0f), glm::vec4(0.0f) };
+	}
+
+	glm::vec3 minPosition = vertices[0].position;
+	glm::vec3 maxPosition = vertices[0].position;
+	for (const Vertex& vertex : vertices)
+	{
+		minPosition = glm::min(minPosition, vertex.position);
+		maxPosition = glm::max(maxPosition, vertex.position);
+	}
+
+	glm::vec3 scale = (maxPosition - minPosition) * 0.5f;
+	scale = glm::max(scale, glm::vec3(std::numeric_limits<float>::min()));
+
+	return VertexQuantization
+	{
+		.positionScale = glm::vec4(scale, 1.0f),
+		.positionBias = glm::vec4((maxPosition + minPosition) * 0.5f, 0.0f)
+	};
+#else
+	return VertexQuantization{ glm::vec4(1.0f), glm::vec4(0.0f) };
+#endif
+}
+
+std::vector<GpuVertex> encodeVertices(const std::vector<Vertex>& vertices, const VertexQuantization& quantization)
+{
+	std::vector<GpuVertex> gpuVertices(vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const Vertex& vertex = vertices[i];
+
+#ifdef VERTEX_FORMAT_COMPACT
+		glm::vec3 position = (vertex.position - glm::vec3(quantization.positionBias)) / glm::vec3(quantization.positionScale);
+
+		gpuVertices[i] = GpuVertex
+		{
+			.positionXY = glm::packSnorm2x16(glm::vec2(position)),
+			.positionZW = glm::packSnorm2x16(glm::vec2(position.z, vertex.tangent.w < 0.0f ? -1.0f : 1.0f)),
+			.texCoords = glm::packHalf2x16(vertex.texCoords),
+			.normal = glm::packSnorm2x16(encodeOctahedral(vertex.normal)),
+			.tangent = glm::packSnorm2x16(encodeOctahedral(glm::vec3(vertex.tangent)))
+		};
+#else
+		gpuVertices[i] = GpuVertex
+		{
+			.position = vertex.position,
+			.normal = vertex.normal,
+			.texCoords = vertex.texCoords,
+			.tangent = vertex.tangent
+		};
+#endif
+	}
+
+	return gpuVertices;
+}
+
+std::vector<GpuPosition> extractPositions(const std::vector<GpuVertex>& gpuVertices)
+{
+	std::vector<GpuPosition> gpuPositions(gpuVertices.size());
+
+	for (size_t i = 0; i < gpuVertices.size(); i++)
+	{
+#ifdef VERTEX_FORMAT_COMPACT
+		gpuPositions[i] = GpuPosition{ .positionXY = gpuVertices[i].positionXY, .positionZW = gpuVertices[i].positionZW };
+#else
+		gpuPositions[i] = GpuPosition{ .position = gpuVertices[i].position };
+#endif
+	}
+
+	return gpuPositions;
+}
+
+std::vector<SkinVertex> encodeSkinVertices(const std::vector<Vertex>& vertices)
+{
+	std::vector<SkinVertex> skinVertices(vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const Vertex& vertex = vertices[i];
+
+		skinVertices[i] = SkinVertex
+		{
+			.position = vertex.position,
+			.texCoordU = vertex.texCoords.x,
+			.normal = vertex.normal,
+			.texCoordV = vertex.texCoords.y,
+			.tangent = vertex.tangent,
+			.joints = vertex.joints,
+			.weights = vertex.weights
+		};
+	}
+
+	return skinVertices;
+}
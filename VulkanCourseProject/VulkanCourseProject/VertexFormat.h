@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+
+// Vertex buffer layout is chosen at compile time, define VERTEX_FORMAT_FULL to upload uncompressed fp32 vertices.
+// Vertex shader pulls vertices from a storage buffer and decodes either layout, see ObjectData::vertexFormat.
+#ifndef VERTEX_FORMAT_FULL
+#define VERTEX_FORMAT_COMPACT
+#endif
+
+
+// Import-time vertex, full precision
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texCoords;
+	glm::vec4 tangent;                   // w is the bitangent sign
+	glm::uvec4 joints = glm::uvec4(0);  // Skin joint indices, only used by skinned meshes
+	glm::vec4 weights = glm::vec4(0.0f); // Sum up to 1 for skinned vertices
+};
+
+// Bind pose input of the skinning shader, 80 bytes, layout matches skinning.comp
+struct SkinVertex
+{
+	glm::vec3 position;
+	float texCoordU;
+	glm::vec3 normal;
+	float texCoordV;
+	glm::vec4 tangent;
+	glm::uvec4 joints;
+	glm::vec4 weights;
+};
+
+// Per-mesh position dequantization, position = encoded * scale + bias
+struct VertexQuantization
+{
+	glm::vec4 positionScale;
+	glm::vec4 positionBias;
+};
+
+#ifdef VERTEX_FORMAT_COMPACT
+
+// 20 bytes per vertex, only 32 bit members so the struct isn't padded to 8 byte alignment
+struct GpuVertex
+{
+	uint32_t positionXY; // R16G16_SNORM, relative to mesh bounds
+	uint32_t positionZW; // R16G16_SNORM, w is the bitangent sign
+	uint32_t texCoords;  // R16G16_SFLOAT
+	uint32_t normal;     // R16G16_SNORM, octahedral encoding
+	uint32_t tangent;    // R16G16_SNORM, octahedral encoding
+};
+
+// 8 bytes per vertex, same encoding as GpuVertex's position
+struct GpuPosition
+{
+	uint32_t positionXY;
+	uint32_t positionZW;
+};
+
+// Strides the shaders decode with
+static_assert(sizeof(GpuVertex) == 20, "shader.vert reads 5 words per compact vertex");
+static_assert(sizeof(GpuPosition) == 8, "depth.vert and shadow.vert read 2 words per compact position");
+
+const uint32_t GPU_VERTEX_FORMAT = 1; // Format id understood by shader.vert and depth.vert
+
+#else
+
+// 48 bytes per vertex
+struct GpuVertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texCoords;
+	glm::vec4 tangent;
+};
+
+// 12 bytes per vertex
+struct GpuPosition
+{
+	glm::vec3 position;
+};
+
+// Strides the shaders decode with
+static_assert(sizeof(GpuVertex) == 48, "shader.vert reads 12 words per full vertex");
+static_assert(sizeof(GpuPosition) == 12, "depth.vert and shadow.vert read 3 words per full position");
+
+const uint32_t GPU_VERTEX_FORMAT = 0; // Format id understood by shader.vert and depth.vert
+
+#endif
+
+// Skinning shader writes skinned meshes in the full layout regardless of GPU_VERTEX_FORMAT
+const uint32_t FULL_VERTEX_FORMAT = 0;
+const VkDeviceSize FULL_VERTEX_STRIDE = 48;
+const VkDeviceSize FULL_POSITION_STRIDE = 12;
+
+
+VertexQuantization computeVertexQuantization(const std::vector<Vertex>& vertices);
+std::vector<GpuVertex> encodeVertices(const std::vector<Vertex>& vertices, const VertexQuantization& quantization);
+// Position-only stream for the depth pre-pass, bit-identical to the full stream so both passes produce the same depth
+std::vector<GpuPosition> extractPositions(const std::vector<GpuVertex>& gpuVertices);
+std::vector<SkinVertex> encodeSkinVertices(const std::vector<Vertex>& vertices);
@@ -1,41 +1,121 @@
 #include "VulkanRenderer.h"
 
 #include <algorithm>
+#include <cmath>
 #include <set>
+#include <chrono>
+
+#include "Profiler.h"
+
+
+const char* const PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+const uint32_t PIPELINE_CACHE_MAGIC = 0x43505650; // "PVPC"
+
+// Indirect buffers hold MAX_DRAWS commands per group: 16 and 32 bit index draws of the color pass, then the same for the depth pre-pass,
+// static shadow casters and dynamic shadow casters
+const uint32_t INDIRECT_DRAW_GROUP_COUNT = 8;
+
+const uint32_t SKINNING_GROUP_SIZE = 64; // local_size_x of skinning.comp
+
+// Draws filled per job when building the frame's draw lists, small batches cost more in scheduling than they save
+const size_t DRAW_FILL_BATCH_SIZE = 64;
+
+// Where one mesh's commands go in the indirect buffers, its object index is its position in the frame's slot list
+struct DrawSlot
+{
+	uint32_t model;
+	uint32_t mesh;
+	uint32_t draw; // Within its index type group, same for the color and depth pre-pass draw
+	uint32_t shadowDraw; // Within its static or dynamic shadow group
+	uint32_t paletteOffset;
+	MeshDrawRange range; // Level of detail drawn this frame
+};
+
+// Timestamp queries of one swapchain image
+const uint32_t TIMESTAMP_FRAME_BEGIN = 0;
+const uint32_t TIMESTAMP_SHADOWS_BEGIN = 1;
+const uint32_t TIMESTAMP_SHADOWS_END = 2;
+const uint32_t TIMESTAMP_FRAME_END = 3;
+const uint32_t TIMESTAMP_COUNT = 4;
+
+const VkSampleCountFlagBits MAX_MSAA_SAMPLES = VK_SAMPLE_COUNT_4_BIT;
+
+const size_t FRAME_ARENA_SIZE = 1 << 20; // Starting size, an arena grows when a frame doesn't fit
+
+// Push constant of the composite subpass, layout matches second.frag
+struct CompositeConstants
+{
+	glm::vec4 renderArea; // Rendered width and height, output width and height
+	uint32_t fxaaEnabled;
+};
+
+// Depth range of the projection, light clusters are sliced between the planes
+const float CAMERA_NEAR_PLANE = 0.1f;
+const float CAMERA_FAR_PLANE = 1000.0f;
 
 
 int VulkanRenderer::Init(GLFWwindow* window)
 {
+	PROFILE_SCOPE("Init");
+
 	window_ = window;
 	try
 	{
-		CreateVkInstance();
-		CreateSurface(window);
-		GetPhysicalDevice();
+		// Steps only wait for the steps whose objects they use, e.g. pipeline compilation runs alongside asset loading
+		TaskGraph initGraph;
+
+		auto instance = initGraph.Add("CreateVkInstance", [this]() { CreateVkInstance(); });
+		auto surface = initGraph.Add("CreateSurface", [this, window]() { CreateSurface(window); }, { instance });
+		auto physicalDevice = initGraph.Add("GetPhysicalDevice", [this]() { GetPhysicalDevice(); }, { surface });
 		//AllocateDynamicBufferTransferSpace();
-		CreateLogicalDevice();
-		CreateSwapchain();
-		CreateRenderPass();
-		CreateDescriptorSetLayout();
-		CreatePushConstantRange();
-		CreateCraphicsPipeline();
-		CreateColorBufferImages();
-		CreateDepthBufferImages();
-		CreateFramebuffers();
-		CreateCommandPool();
-		CreateCommandBuffers();
-		CreateTextureSampler();
-		CreateUniformBuffers();
-		CreateDescriptorPools();
-		CreateDescriptorSets();
-		CreateInputDescriptorSets();
-		CreateSynchronization();
-
-		CreateAssets();
-
-		uboViewProjection_.projection = glm::perspective(glm::radians(45.0f), (float)swapchainExtent_.width / swapchainExtent_.height, 0.1f, 1000.0f);
+		auto logicalDevice = initGraph.Add("CreateLogicalDevice", [this]() { CreateLogicalDevice(); }, { physicalDevice });
+		auto swapchain = initGraph.Add("CreateSwapchain", [this]() { CreateSwapchain(); }, { logicalDevice });
+		auto renderPass = initGraph.Add("CreateRenderPass", [this]() { CreateRenderPass(); }, { swapchain });
+		auto descriptorSetLayout = initGraph.Add("CreateDescriptorSetLayout", [this]() { CreateDescriptorSetLayout(); }, { logicalDevice });
+		auto pipelineCache = initGraph.Add("CreatePipelineCache", [this]() { CreatePipelineCache(); }, { logicalDevice });
+		initGraph.Add("CreateCraphicsPipeline", [this]() { CreateCraphicsPipeline(); }, { renderPass, descriptorSetLayout, pipelineCache });
+		initGraph.Add("CreateSkinningPipeline", [this]() { CreateSkinningPipeline(); }, { descriptorSetLayout, pipelineCache });
+		initGraph.Add("CreateLightCullingPipeline", [this]() { CreateLightCullingPipeline(); }, { descriptorSetLayout, pipelineCache });
+		auto shadowMaps = initGraph.Add("CreateShadowMaps", [this]() { CreateShadowMaps(); }, { logicalDevice });
+		initGraph.Add("CreateShadowPipeline", [this]() { CreateShadowPipeline(); }, { shadowMaps, descriptorSetLayout, pipelineCache });
+		// Attachment formats are chosen by the render pass
+		auto colorBufferImages = initGraph.Add("CreateColorBufferImages", [this]() { CreateColorBufferImages(); }, { renderPass });
+		auto depthBufferImages = initGraph.Add("CreateDepthBufferImages", [this]() { CreateDepthBufferImages(); }, { renderPass });
+		auto msaaImages = initGraph.Add("CreateMsaaImages", [this]() { CreateMsaaImages(); }, { renderPass });
+		auto framebuffers = initGraph.Add("CreateFramebuffers", [this]() { CreateFramebuffers(); }, { renderPass, colorBufferImages, depthBufferImages, msaaImages });
+		auto commandPool = initGraph.Add("CreateCommandPool", [this]() { CreateCommandPool(); }, { logicalDevice });
+		initGraph.Add("CreateCommandBuffers", [this]() { CreateCommandBuffers(); }, { commandPool, framebuffers });
+		auto textureSampler = initGraph.Add("CreateTextureSampler", [this]() { CreateTextureSampler(); }, { logicalDevice });
+		auto uniformBuffers = initGraph.Add("CreateUniformBuffers", [this]() { CreateUniformBuffers(); }, { swapchain });
+		auto geometryBuffer = initGraph.Add("CreateGeometryBuffer", [this]() { CreateGeometryBuffer(); }, { logicalDevice });
+		auto meshStreamer = initGraph.Add("CreateMeshStreamer", [this]() { CreateMeshStreamer(); }, { geometryBuffer });
+		auto textureStreamer = initGraph.Add("CreateTextureStreamer", [this]() { CreateTextureStreamer(); }, { logicalDevice });
+		auto descriptorPools = initGraph.Add("CreateDescriptorPools", [this]() { CreateDescriptorPools(); }, { swapchain, uniformBuffers });
+		initGraph.Add("CreateDescriptorSets", [this]() { CreateDescriptorSets(); }, { descriptorPools, descriptorSetLayout, uniformBuffers, geometryBuffer, shadowMaps });
+		initGraph.Add("CreateInputDescriptorSets", [this]() { CreateInputDescriptorSets(); }, { descriptorPools, descriptorSetLayout, colorBufferImages, depthBufferImages, textureSampler });
+		auto textureDescriptorSet = initGraph.Add("CreateTextureDescriptorSet", [this]() { CreateTextureDescriptorSet(); }, { descriptorPools, descriptorSetLayout });
+		initGraph.Add("CreateSynchronization", [this]() { CreateSynchronization(); }, { logicalDevice });
+		initGraph.Add("CreateStatisticsQueryPool", [this]() { CreateStatisticsQueryPool(); }, { logicalDevice, swapchain });
+		initGraph.Add("CreateTimestampQueryPool", [this]() { CreateTimestampQueryPool(); }, { logicalDevice, swapchain });
+		auto placeholderTexture = initGraph.Add("CreatePlaceholderTexture", [this]() { CreatePlaceholderTexture(); }, { textureDescriptorSet, textureSampler });
+
+		initGraph.Add("CreateAssets", [this]() { CreateAssets(); }, { placeholderTexture, geometryBuffer, meshStreamer, textureStreamer });
+
+		initGraph.Run();
+		initGraph.PrintTimeline("Init timeline");
+
+		uboViewProjection_.projection = glm::perspective(glm::radians(45.0f), (float)swapchainExtent_.width / swapchainExtent_.height, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
 		uboViewProjection_.projection[1][1] *= -1.0f;
 		uboViewProjection_.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		lightingData_ = LightingData
+		{
+			.ambientColor = glm::vec4(0.1f, 0.1f, 0.1f, 0.0f),
+			.sunDirection = glm::vec4(glm::normalize(glm::vec3(0.5f, 1.0f, 0.75f)), 0.0f),
+			.sunColor = glm::vec4(0.8f, 0.8f, 0.75f, 0.0f),
+			.viewport = glm::vec4(swapchainExtent_.width, swapchainExtent_.height, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE),
+			.lightCount = 0
+		};
 	}
 	catch (const std::runtime_error &e)
 	{
@@ -48,72 +128,122 @@ int VulkanRenderer::Init(GLFWwindow* window)
 
 void VulkanRenderer::Deinit()
 {
+	for (PendingModel& pendingModel : pendingModels_)
+	{
+		pendingModel.model.wait();
+	}
+	CommitPendingAssets();
+
 	vkDeviceWaitIdle(mainDevice.logicalDevice);
 
 	//_aligned_free(modelTransferSpace_);
 
-	for (auto& model : models_)
+	for (const MeshModel& model : models_)
 	{
-		model.Destroy();
+		ReleaseModelTextures(model);
 	}
+	models_.clear();
+	modelHandles_.clear();
+	modelSlots_.clear();
+	freeModelSlots_.clear();
+	meshStreamer_.reset();
 
-	for (size_t i = 0; i < textureImages_.size(); i++)
+	for (size_t i = 0; i < textureCache_.size(); i++)
 	{
-		vkDestroyImageView(mainDevice.logicalDevice, textureImageViews_[i], nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, textureImages_[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, textureImagesMemory_[i], nullptr);
+		if (textureCache_[i].refCount > 0)
+		{
+			DestroyTexture(static_cast<int>(i));
+		}
 	}
 
+	// Device is idle, mesh ranges and textures released above don't have to wait for their frames
+	deletionQueue_.Flush();
+	geometryBuffer_.reset();
+	textureStreamer_.reset();
+
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, inputDescriptorPool_, nullptr);
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, samplerDescriptorPool_, nullptr);
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool_, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, skinningDescriptorSetLayout_, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, inputDescriptorSetLayout_, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, samplerDescriptorSetLayout_, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout_, nullptr);
 	for (size_t i = 0; i < swapchainImages_.size(); i++)
 	{
 		vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffer_[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, vpUniformBufferMemory_[i], nullptr);
 
 		//vkDestroyBuffer(mainDevice.logicalDevice, modelDynamicUniformBuffer_[i], nullptr);
 		//vkFreeMemory(mainDevice.logicalDevice, modelDynamicUniformBufferMemory_[i], nullptr);
-	}
 
-	vkDestroySampler(mainDevice.logicalDevice, textureSampler_, nullptr);
+		vkDestroyBuffer(mainDevice.logicalDevice, objectBuffers_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, objectBuffersMemory_[i], nullptr);
 
-	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
-	{
-		vkDestroySemaphore(mainDevice.logicalDevice, renderFinishedSemaphores_[i], nullptr);
-		vkDestroySemaphore(mainDevice.logicalDevice, imageAvailableSemaphores_[i], nullptr);
-		vkDestroyFence(mainDevice.logicalDevice, drawFences_[i], nullptr);
+		vkDestroyBuffer(mainDevice.logicalDevice, indirectBuffers_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, indirectBuffersMemory_[i], nullptr);
+
+		vkDestroyBuffer(mainDevice.logicalDevice, skinPaletteBuffers_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, skinPaletteBuffersMemory_[i], nullptr);
+
+		vkDestroyBuffer(mainDevice.logicalDevice, lightingUniformBuffers_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, lightingUniformBuffersMemory_[i], nullptr);
+		vkDestroyBuffer(mainDevice.logicalDevice, lightBuffers_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, lightBuffersMemory_[i], nullptr);
+		vkDestroyBuffer(mainDevice.logicalDevice, clusterBuffers_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, clusterBuffersMemory_[i], nullptr);
+
+		vkDestroyBuffer(mainDevice.logicalDevice, textureFeedbackBuffers_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, textureFeedbackBuffersMemory_[i], nullptr);
 	}
 
-	for (VkFramebuffer framebuffer : swapchainFramebuffers_)
+	if (statisticsQueryPool_ != VK_NULL_HANDLE)
 	{
-		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+		vkDestroyQueryPool(mainDevice.logicalDevice, statisticsQueryPool_, nullptr);
+	}
+	if (timestampQueryPool_ != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(mainDevice.logicalDevice, timestampQueryPool_, nullptr);
 	}
 
-	for (size_t i = 0; i < depthBufferImages_.size(); i++)
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
 	{
-		vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageViews_[i], nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, depthBufferImages_[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, depthBufferImagesMemory_[i], nullptr);
+		vkDestroyFramebuffer(mainDevice.logicalDevice, shadowCacheFramebuffers_[i], nullptr);
+		vkDestroyFramebuffer(mainDevice.logicalDevice, shadowMapFramebuffers_[i], nullptr);
+		vkDestroyImageView(mainDevice.logicalDevice, shadowCacheLayerViews_[i], nullptr);
+		vkDestroyImageView(mainDevice.logicalDevice, shadowMapLayerViews_[i], nullptr);
 	}
+	vkDestroyImageView(mainDevice.logicalDevice, shadowMapImageView_, nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, shadowCacheImage_, nullptr);
+	freeDeviceMemory(mainDevice.logicalDevice, shadowCacheImageMemory_, nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, shadowMapImage_, nullptr);
+	freeDeviceMemory(mainDevice.logicalDevice, shadowMapImageMemory_, nullptr);
+	vkDestroySampler(mainDevice.logicalDevice, shadowSampler_, nullptr);
+
+	vkDestroySampler(mainDevice.logicalDevice, compositeSampler_, nullptr);
+	vkDestroySampler(mainDevice.logicalDevice, textureSampler_, nullptr);
 
-	for (size_t i = 0; i < colorBufferImages_.size(); i++)
+	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
 	{
-		vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageViews_[i], nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, colorBufferImages_[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, colorBufferImagesMemory_[i], nullptr);
+		vkDestroySemaphore(mainDevice.logicalDevice, renderFinishedSemaphores_[i], nullptr);
+		vkDestroySemaphore(mainDevice.logicalDevice, imageAvailableSemaphores_[i], nullptr);
+		vkDestroyFence(mainDevice.logicalDevice, drawFences_[i], nullptr);
 	}
 
+	DestroySceneTargets();
+
 	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool_, nullptr);
 
-	vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline_, nullptr);
-	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline_, nullptr);
-	vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipelineLayout_, nullptr);
-	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout_, nullptr);
-	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass_, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, shadowPipeline_, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, lightCullingPipeline_, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, skinningPipeline_, nullptr);
+	SavePipelineCache();
+	vkDestroyPipelineCache(mainDevice.logicalDevice, pipelineCache_, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, shadowPipelineLayout_, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, lightCullingPipelineLayout_, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, skinningPipelineLayout_, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, shadowLoadRenderPass_, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, shadowCacheRenderPass_, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, shadowRenderPass_, nullptr);
 
 	for (SwapchainImage image : swapchainImages_)
 	{
@@ -129,12 +259,36 @@ void VulkanRenderer::Deinit()
 
 void VulkanRenderer::Draw()
 {
-	vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences_[currentFrame_], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	const size_t heapAllocationCount = getHeapAllocationCount();
+	PROFILE_SCOPE("Draw");
+
+	{
+		PROFILE_SCOPE("WaitForFence");
+		vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences_[currentFrame_], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
 	vkResetFences(mainDevice.logicalDevice, 1, &drawFences_[currentFrame_]);
+	frameArenas_[currentFrame_].Reset();
+	auto deletionStart = std::chrono::steady_clock::now();
+	deletionQueue_.Collect(frameNumbers_[currentFrame_]);
+	std::chrono::duration<double, std::milli> deletionTime = std::chrono::steady_clock::now() - deletionStart;
+	deletionTime_ = deletionTime.count();
+	getMemoryTracker().Update();
+
+	auto assetCommitStart = std::chrono::steady_clock::now();
+	CommitPendingAssets();
+	std::chrono::duration<double, std::milli> assetCommitTime = std::chrono::steady_clock::now() - assetCommitStart;
+	assetCommitTime_ = assetCommitTime.count();
+	UpdateAnimations();
+	UpdateShadowCascades();
 
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain_, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores_[currentFrame_], VK_NULL_HANDLE, &imageIndex);
+	{
+		PROFILE_SCOPE("AcquireImage");
+		vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain_, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores_[currentFrame_], VK_NULL_HANDLE, &imageIndex);
+	}
 
+	ReadStatistics(imageIndex);
+	UpdateTextureStreaming(imageIndex);
 	RecordCommands(imageIndex);
 	UpdateUniformBuffers(imageIndex);
 
@@ -155,11 +309,17 @@ void VulkanRenderer::Draw()
 		.pSignalSemaphores = &renderFinishedSemaphores_[currentFrame_]
 	};
 
+	std::unique_lock<std::mutex> queueLock(getQueueMutex());
+
+#ifdef ENABLE_PROFILING
+	frameSubmitTimes_[imageIndex] = getProfiler().GetTime();
+#endif
 	VkResult result = vkQueueSubmit(graphicsQueue_, 1, &submitInfo, drawFences_[currentFrame_]);
 	if (result != VK_SUCCESS) 
 	{
 		throw std::runtime_error("Failed to submit command buffer to queue.");
 	}
+	frameNumbers_[currentFrame_] = deletionQueue_.SubmitFrame();
 
 	VkPresentInfoKHR presentInfo
 	{
@@ -171,19 +331,28 @@ void VulkanRenderer::Draw()
 		.pImageIndices = &imageIndex
 	};
 
-	result = vkQueuePresentKHR(graphicsQueue_, &presentInfo);
+	{
+		PROFILE_SCOPE("Present");
+		result = vkQueuePresentKHR(graphicsQueue_, &presentInfo);
+	}
+	queueLock.unlock();
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to present image.");
 	}
 
 	currentFrame_ = (currentFrame_ + 1) % MAX_FRAME_DRAWS; 
+	frameHeapAllocationCount_ = getHeapAllocationCount() - heapAllocationCount;
+#ifdef ENABLE_PROFILING
+	getProfiler().EndFrame();
+#endif
 }
 
 
-void VulkanRenderer::UpdateModel(const int& index, const glm::mat4& model)
+void VulkanRenderer::UpdateModel(const int& handle, const glm::mat4& model)
 {
-	if (index < 0 || index >= models_.size())
+	const int index = GetModelIndex(handle);
+	if (index < 0)
 	{
 		return;
 	}
@@ -191,529 +360,1807 @@ void VulkanRenderer::UpdateModel(const int& index, const glm::mat4& model)
 	models_[index].SetModel({ model });
 }
 
+void VulkanRenderer::SetCamera(const glm::mat4& view)
+{
+	uboViewProjection_.view = view;
+}
 
-void VulkanRenderer::CreateVkInstance()
+int VulkanRenderer::FindModelNode(const int& model, const std::string& name) const
 {
-	VkApplicationInfo appInfo
+	const int index = GetModelIndex(model);
+	if (index < 0)
 	{
-		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-		.pApplicationName = "Vulkan application",
-		.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-		.pEngineName = "No engine",
-		.engineVersion = VK_MAKE_VERSION(0, 0, 0),
-		.apiVersion = VK_API_VERSION_1_3
-	};
+		return -1;
+	}
 
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	std::vector<const char*> instanceExtensions;
-	for (size_t i = 0; i < glfwExtensionCount; i++)
+	return models_[index].GetNodes().FindNode(name);
+}
+
+size_t VulkanRenderer::GetModelNodeCount(const int& model) const
+{
+	const int index = GetModelIndex(model);
+	if (index < 0)
 	{
-		instanceExtensions.push_back(glfwExtensions[i]);
+		return 0;
 	}
 
-	if (CheckInstanceExtensionSupport(instanceExtensions) == false)
+	return models_[index].GetNodes().GetNodeCount();
+}
+
+void VulkanRenderer::UpdateModelNode(const int& model, const int& node, const glm::mat4& transform)
+{
+	const int index = GetModelIndex(model);
+	if (index < 0 || node < 0)
 	{
-		throw std::runtime_error("Vk instance does not support required extensions.");
+		return;
 	}
-
-#ifdef _DEBUG
-	const std::vector<const char*> validationLayers = 
+	if (IsModelReady(model) == false)
 	{
-		"VK_LAYER_KHRONOS_validation"
-	};
-	if (CheckValidationLayerSupport(validationLayers) == false) 
+		printf("Error: Nodes of model %d can't be updated before it's loaded.\n", model);
+		return;
+	}
+	if (node >= models_[index].GetNodes().GetNodeCount())
 	{
-		throw std::runtime_error("Vk instance does not support required validation layers.");
+		return;
 	}
-#endif // !_DEBUG
 
-	VkInstanceCreateInfo createInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-		.pApplicationInfo = &appInfo,
-#ifndef _DEBUG
-		.enabledLayerCount = 0,
-		.ppEnabledLayerNames = nullptr,
-#else
-		.enabledLayerCount = static_cast<uint32_t>(validationLayers.size()),
-		.ppEnabledLayerNames = validationLayers.data(),
-#endif
-		.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size()),
-		.ppEnabledExtensionNames = instanceExtensions.data()
-	};
+	models_[index].GetNodes().SetLocalTransform(node, transform);
+}
 
-	VkResult result = vkCreateInstance(&createInfo, nullptr, &vkInsatance_);
-	if (result != VK_SUCCESS)
+size_t VulkanRenderer::GetModelAnimationCount(const int& model) const
+{
+	const int index = GetModelIndex(model);
+	if (index < 0)
 	{
-		throw std::runtime_error("Failed to create vk instance.");
+		return 0;
 	}
+
+	return models_[index].GetAnimationCount();
 }
 
-void VulkanRenderer::GetPhysicalDevice()
+void VulkanRenderer::PlayModelAnimation(const int& model, const int& animation, bool loop)
 {
-	uint32_t deviceCount = 0;
-	vkEnumeratePhysicalDevices(vkInsatance_, &deviceCount, nullptr);
-
-	if (deviceCount == 0)
+	const int index = GetModelIndex(model);
+	if (index < 0)
 	{
-		throw std::runtime_error("Can't find GPUs that support Vulkan instance.");
+		return;
 	}
-
-	std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
-	vkEnumeratePhysicalDevices(vkInsatance_, &deviceCount, physicalDevices.data());
-
-	for (const VkPhysicalDevice device : physicalDevices)
+	if (IsModelReady(model) == false)
 	{
-		if (CheckPhysicalDeviceSuitable(device))
-		{
-			mainDevice.physicalDevice = device;
-			break;
-		}
+		printf("Error: Animations of model %d can't be played before it's loaded.\n", model);
+		return;
+	}
+	if (animation >= static_cast<int>(models_[index].GetAnimationCount()))
+	{
+		return;
 	}
 
-	//VkPhysicalDeviceProperties properties;
-	//vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
-	//minUniformBufferOffset_ = properties.limits.minUniformBufferOffsetAlignment;
+	models_[index].PlayAnimation(animation, loop);
 }
 
-void VulkanRenderer::CreateLogicalDevice()
+void VulkanRenderer::SetLights(const std::vector<Light>& lights)
 {
-	QueueFamilyIndices indices = GetQueueFamilies(mainDevice.physicalDevice);
-	float priority = 1.0f;
-
-	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily };
-	for (const int queueFamilyIndex : queueFamilyIndices)
+	lights_ = lights;
+	if (lights_.size() > MAX_LIGHTS)
 	{
-		VkDeviceQueueCreateInfo queueCreateInfo
-		{
-			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-			.queueFamilyIndex = static_cast<uint32_t>(queueFamilyIndex),
-			.queueCount = 1,
-			.pQueuePriorities = &priority
-		};
-
-		queueCreateInfos.push_back(queueCreateInfo);
+		lights_.resize(MAX_LIGHTS);
 	}
+}
 
-	VkPhysicalDeviceFeatures deviceFeatures
-	{
-		.samplerAnisotropy = VK_TRUE
-	};
+void VulkanRenderer::SetAmbientLight(const glm::vec3& color)
+{
+	lightingData_.ambientColor = glm::vec4(color, 0.0f);
+}
 
-	VkDeviceCreateInfo deviceCreateInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
-		.pQueueCreateInfos = queueCreateInfos.data(),
-		.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
-		.ppEnabledExtensionNames = deviceExtensions.data(),
-		.pEnabledFeatures = &deviceFeatures
-	};
+void VulkanRenderer::SetSunLight(const glm::vec3& direction, const glm::vec3& color)
+{
+	lightingData_.sunDirection = glm::vec4(glm::normalize(direction), 0.0f);
+	lightingData_.sunColor = glm::vec4(color, 0.0f);
+}
 
-	VkResult result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
-	if (result != VK_SUCCESS)
+void VulkanRenderer::SetModelStatic(const int& model, bool isStatic)
+{
+	const int index = GetModelIndex(model);
+	if (index < 0 || models_[index].IsStatic() == isStatic)
 	{
-		throw std::runtime_error("Failed to create a logical device.");
+		return;
 	}
 
-	vkGetDeviceQueue(mainDevice.logicalDevice, static_cast<uint32_t>(indices.graphicsFamily), 0, &graphicsQueue_);
-	vkGetDeviceQueue(mainDevice.logicalDevice, static_cast<uint32_t>(indices.presentationFamily), 0, &presentationQueue_);
+	models_[index].SetStatic(isStatic);
+	shadowCacheDirty_ = true;
 }
 
-void VulkanRenderer::CreateSurface(GLFWwindow* window)
+void VulkanRenderer::SetShadowCacheEnabled(bool enabled)
 {
-	VkResult result = glfwCreateWindowSurface(vkInsatance_, window, nullptr, &surface_);
-	if (result != VK_SUCCESS)
+	// Static casters weren't kept up to date while the cache was off
+	if (enabled && shadowCacheEnabled_ == false)
 	{
-		throw std::runtime_error("Failed to create a surface.");
+		shadowCacheDirty_ = true;
 	}
+
+	shadowCacheEnabled_ = enabled;
 }
 
-void VulkanRenderer::CreateSwapchain()
+bool VulkanRenderer::IsShadowCacheEnabled() const
 {
-	SwapchainDetails swapchainDetails = GetSwapchainDetails(mainDevice.physicalDevice);
+	return shadowCacheEnabled_;
+}
 
-	VkSurfaceFormatKHR surfaceFormat = ChooseBestSurfaceFormat(swapchainDetails.formats);
-	VkPresentModeKHR presentMode = ChooseBestPresentationMode(swapchainDetails.presentationModes);
-	VkExtent2D extent = ChooseSwapExtent(swapchainDetails.surfaceCapabilities);
+void VulkanRenderer::SetDepthPrePassEnabled(bool enabled)
+{
+	depthPrePassEnabled_ = enabled;
+}
 
-	uint32_t imageCount = swapchainDetails.surfaceCapabilities.minImageCount + 1; // At least one extra image for allowing triple buffering for sure
-	if (swapchainDetails.surfaceCapabilities.maxImageCount > 0 &&  swapchainDetails.surfaceCapabilities.maxImageCount < imageCount)
-	{
-		imageCount = swapchainDetails.surfaceCapabilities.maxImageCount;
-	}
+bool VulkanRenderer::IsDepthPrePassEnabled() const
+{
+	return depthPrePassEnabled_;
+}
 
-	VkSwapchainCreateInfoKHR sawpChainCreateInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-		.surface = surface_,
-		.minImageCount = imageCount,
-		.imageFormat = surfaceFormat.format,
-		.imageColorSpace = surfaceFormat.colorSpace,
-		.imageExtent = extent,
-		.imageArrayLayers = 1,
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+bool VulkanRenderer::IsPipelineStatisticsSupported() const
+{
+	return pipelineStatisticsSupported_;
+}
 
-		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-		.queueFamilyIndexCount = 0,
-		.pQueueFamilyIndices = nullptr,
+uint64_t VulkanRenderer::GetFragmentInvocations() const
+{
+	return fragmentInvocations_;
+}
 
-		.preTransform = swapchainDetails.surfaceCapabilities.currentTransform,
-		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-		.clipped = VK_TRUE,
-		.oldSwapchain = VK_NULL_HANDLE
-	};
+uint64_t VulkanRenderer::GetStatisticsSampleCount() const
+{
+	return statisticsSampleCount_;
+}
 
-	QueueFamilyIndices indices = GetQueueFamilies(mainDevice.physicalDevice);
-	if (indices.graphicsFamily != indices.presentationFamily)
-	{
-		uint32_t queueFamiliIndices[] =
-		{
-			static_cast<uint32_t>(indices.graphicsFamily),
-			static_cast<uint32_t>(indices.presentationFamily)
-		};
+bool VulkanRenderer::IsTimestampSupported() const
+{
+	return timestampSupported_;
+}
 
-		sawpChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-		sawpChainCreateInfo.queueFamilyIndexCount = 2;
-		sawpChainCreateInfo.pQueueFamilyIndices = queueFamiliIndices;
-	}
+double VulkanRenderer::GetGpuFrameTime() const
+{
+	return gpuFrameTime_;
+}
 
-	VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice, &sawpChainCreateInfo, nullptr, &swapchain_);
-	if (result != VK_SUCCESS)
+size_t VulkanRenderer::GetFrameHeapAllocationCount() const
+{
+	return frameHeapAllocationCount_;
+}
+
+size_t VulkanRenderer::GetFrameArenaPeakUsage() const
+{
+	size_t peakUsage = 0;
+	for (const FrameArena& frameArena : frameArenas_)
 	{
-		throw std::runtime_error("Failed to create a swapchain.");
+		peakUsage = std::max(peakUsage, frameArena.GetPeakUsage());
 	}
 
-	swapchainImageFormat_ = surfaceFormat.format;
-	swapchainExtent_ = extent;
-
-	uint32_t swapchainImageCount;
-	vkGetSwapchainImagesKHR(mainDevice.logicalDevice, swapchain_, &swapchainImageCount, nullptr);
-	std::vector<VkImage> images(swapchainImageCount);
-	vkGetSwapchainImagesKHR(mainDevice.logicalDevice, swapchain_, &swapchainImageCount, images.data());
+	return peakUsage;
+}
+
+size_t VulkanRenderer::GetPendingDeletionCount() const
+{
+	return deletionQueue_.GetPendingCount();
+}
+
+double VulkanRenderer::GetDeletionTime() const
+{
+	return deletionTime_;
+}
+
+double VulkanRenderer::GetAssetCommitTime() const
+{
+	return assetCommitTime_;
+}
+
+void VulkanRenderer::SetMeshStreamingBudget(VkDeviceSize budget)
+{
+	meshStreamingBudget_ = budget;
+	if (meshStreamer_)
+	{
+		meshStreamer_->SetBudget(budget);
+	}
+}
+
+MeshStreamingStatistics VulkanRenderer::GetMeshStreamingStatistics() const
+{
+	return meshStreamer_ ? meshStreamer_->GetStatistics() : MeshStreamingStatistics{ .budget = meshStreamingBudget_ };
+}
+
+void VulkanRenderer::SetTextureStreamingBudget(VkDeviceSize budget)
+{
+	textureStreamingBudget_ = budget;
+	if (textureStreamer_)
+	{
+		textureStreamer_->SetBudget(budget);
+	}
+}
+
+TextureStreamingStatistics VulkanRenderer::GetTextureStreamingStatistics() const
+{
+	return textureStreamer_ ? textureStreamer_->GetStatistics() : TextureStreamingStatistics{ .budget = textureStreamingBudget_ };
+}
+
+double VulkanRenderer::GetShadowPassTime() const
+{
+	return shadowPassTime_;
+}
+
+uint64_t VulkanRenderer::GetTimestampSampleCount() const
+{
+	return timestampSampleCount_;
+}
+
+void VulkanRenderer::SetRenderScale(float scale)
+{
+	renderScale_ = std::clamp(scale, MIN_RENDER_SCALE, MAX_RENDER_SCALE);
+	dynamicResolution_.Reset(renderScale_);
+}
+
+float VulkanRenderer::GetRenderScale() const
+{
+	return renderScale_;
+}
+
+void VulkanRenderer::SetDynamicResolutionEnabled(bool enabled)
+{
+	dynamicResolutionEnabled_ = enabled && timestampSupported_;
+	dynamicResolution_.Reset(renderScale_);
+}
+
+bool VulkanRenderer::IsDynamicResolutionEnabled() const
+{
+	return dynamicResolutionEnabled_;
+}
+
+void VulkanRenderer::SetTargetFrameTime(double milliseconds)
+{
+	dynamicResolution_.SetTargetFrameTime(milliseconds);
+}
+
+void VulkanRenderer::SetAntiAliasingMode(AntiAliasingMode mode)
+{
+	if (mode == AntiAliasingMode::Msaa && IsMsaaSupported() == false)
+	{
+		return;
+	}
+
+	const VkSampleCountFlagBits previousSampleCount = GetSceneSampleCount();
+	antiAliasingMode_ = mode;
+	if (GetSceneSampleCount() != previousSampleCount)
+	{
+		RecreateSceneTargets();
+	}
+}
+
+AntiAliasingMode VulkanRenderer::GetAntiAliasingMode() const
+{
+	return antiAliasingMode_;
+}
+
+bool VulkanRenderer::IsMsaaSupported() const
+{
+	return msaaSampleCount_ != VK_SAMPLE_COUNT_1_BIT;
+}
+
+int VulkanRenderer::AddModel(const std::string& directory, const std::string& fileName)
+{
+	uint32_t slot;
+	if (freeModelSlots_.empty())
+	{
+		if (modelSlots_.size() > MODEL_HANDLE_SLOT_MASK)
+		{
+			throw std::runtime_error("Too many models.");
+		}
+		slot = static_cast<uint32_t>(modelSlots_.size());
+		modelSlots_.push_back(ModelSlot{ .index = -1, .generation = 0, .failed = false });
+	}
+	else
+	{
+		slot = freeModelSlots_.back();
+		freeModelSlots_.pop_back();
+	}
+	const int handle = static_cast<int>((modelSlots_[slot].generation << MODEL_HANDLE_SLOT_BITS) | slot);
+	modelSlots_[slot].failed = false;
+
+	// Empty model keeps the handle valid (and transform updatable) while loading
+	modelSlots_[slot].index = static_cast<int>(models_.size());
+	models_.push_back(MeshModel({}, {}, {}, SceneGraph()));
+	modelHandles_.push_back(handle);
+
+	// Each loader records its uploads into its own pool, command pools can't be shared between threads
+	VkCommandPool uploadCommandPool = CreateUploadCommandPool();
+
+	std::future<MeshModel> model = std::async(std::launch::async, [this, directory, fileName, uploadCommandPool]()
+	{
+		PROFILE_THREAD_NAME("Model loader");
+		PROFILE_SCOPE("LoadModel");
+
+		try
+		{
+			ModelData modelData = MeshModel::ImportModel(directory, fileName);
+			MeshModel model = MeshModel::CreateModel(modelData, this, uploadCommandPool);
+
+			vkDestroyCommandPool(mainDevice.logicalDevice, uploadCommandPool, nullptr);
+
+			return model;
+		}
+		catch (...)
+		{
+			vkDestroyCommandPool(mainDevice.logicalDevice, uploadCommandPool, nullptr);
+			throw;
+		}
+	});
+
+	pendingModels_.push_back(PendingModel
+	{
+		.handle = handle,
+		.model = std::move(model)
+	});
+
+	return handle;
+}
+
+void VulkanRenderer::RemoveModel(const int& handle)
+{
+	const int index = GetModelIndex(handle);
+	if (index < 0)
+	{
+		return;
+	}
+
+	if (models_[index].IsStatic())
+	{
+		shadowCacheDirty_ = true;
+	}
+	// Mesh destructors hand their geometry ranges to the deletion queue, textures left without users go there as well
+	ReleaseModelTextures(models_[index]);
+
+	const int lastIndex = static_cast<int>(models_.size()) - 1;
+	if (index != lastIndex)
+	{
+		models_[index] = std::move(models_[lastIndex]);
+		modelHandles_[index] = modelHandles_[lastIndex];
+		modelSlots_[modelHandles_[index] & MODEL_HANDLE_SLOT_MASK].index = index;
+	}
+	models_.pop_back();
+	modelHandles_.pop_back();
+
+	// Generation wraps around, a handle kept after its removal is only taken for a new model once its slot was reused that many times
+	const uint32_t slot = static_cast<uint32_t>(handle) & MODEL_HANDLE_SLOT_MASK;
+	modelSlots_[slot].index = -1;
+	modelSlots_[slot].generation = (modelSlots_[slot].generation + 1) & MODEL_HANDLE_GENERATION_MASK;
+	freeModelSlots_.push_back(slot);
+}
+
+bool VulkanRenderer::IsModelReady(const int& handle) const
+{
+	if (GetModelIndex(handle) < 0 || HasModelFailed(handle))
+	{
+		return false;
+	}
+
+	for (const PendingModel& pendingModel : pendingModels_)
+	{
+		if (pendingModel.handle == handle)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool VulkanRenderer::HasModelFailed(const int& handle) const
+{
+	return GetModelIndex(handle) >= 0 && modelSlots_[static_cast<uint32_t>(handle) & MODEL_HANDLE_SLOT_MASK].failed;
+}
+
+size_t VulkanRenderer::GetModelCount() const
+{
+	return models_.size();
+}
+
+int VulkanRenderer::GetModelHandle(size_t index) const
+{
+	return index < modelHandles_.size() ? modelHandles_[index] : -1;
+}
+
+
+void VulkanRenderer::CreateVkInstance()
+{
+	VkApplicationInfo appInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pApplicationName = "Vulkan application",
+		.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+		.pEngineName = "No engine",
+		.engineVersion = VK_MAKE_VERSION(0, 0, 0),
+		.apiVersion = VK_API_VERSION_1_3
+	};
+
+	uint32_t glfwExtensionCount = 0;
+	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	std::vector<const char*> instanceExtensions;
+	for (size_t i = 0; i < glfwExtensionCount; i++)
+	{
+		instanceExtensions.push_back(glfwExtensions[i]);
+	}
+
+	if (CheckInstanceExtensionSupport(instanceExtensions) == false)
+	{
+		throw std::runtime_error("Vk instance does not support required extensions.");
+	}
+
+#ifdef _DEBUG
+	const std::vector<const char*> validationLayers = 
+	{
+		"VK_LAYER_KHRONOS_validation"
+	};
+	if (CheckValidationLayerSupport(validationLayers) == false) 
+	{
+		throw std::runtime_error("Vk instance does not support required validation layers.");
+	}
+#endif // !_DEBUG
+
+	VkInstanceCreateInfo createInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+		.pApplicationInfo = &appInfo,
+#ifndef _DEBUG
+		.enabledLayerCount = 0,
+		.ppEnabledLayerNames = nullptr,
+#else
+		.enabledLayerCount = static_cast<uint32_t>(validationLayers.size()),
+		.ppEnabledLayerNames = validationLayers.data(),
+#endif
+		.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size()),
+		.ppEnabledExtensionNames = instanceExtensions.data()
+	};
+
+	VkResult result = vkCreateInstance(&createInfo, nullptr, &vkInsatance_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create vk instance.");
+	}
+}
+
+void VulkanRenderer::GetPhysicalDevice()
+{
+	uint32_t deviceCount = 0;
+	vkEnumeratePhysicalDevices(vkInsatance_, &deviceCount, nullptr);
+
+	if (deviceCount == 0)
+	{
+		throw std::runtime_error("Can't find GPUs that support Vulkan instance.");
+	}
+
+	std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
+	vkEnumeratePhysicalDevices(vkInsatance_, &deviceCount, physicalDevices.data());
+
+	for (const VkPhysicalDevice device : physicalDevices)
+	{
+		if (CheckPhysicalDeviceSuitable(device))
+		{
+			mainDevice.physicalDevice = device;
+			break;
+		}
+	}
+
+	//VkPhysicalDeviceProperties properties;
+	//vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
+	//minUniformBufferOffset_ = properties.limits.minUniformBufferOffsetAlignment;
+}
+
+void VulkanRenderer::CreateLogicalDevice()
+{
+	QueueFamilyIndices indices = GetQueueFamilies(mainDevice.physicalDevice);
+	float priority = 1.0f;
+
+	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+	std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily };
+	for (const int queueFamilyIndex : queueFamilyIndices)
+	{
+		VkDeviceQueueCreateInfo queueCreateInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = static_cast<uint32_t>(queueFamilyIndex),
+			.queueCount = 1,
+			.pQueuePriorities = &priority
+		};
+
+		queueCreateInfos.push_back(queueCreateInfo);
+	}
+
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &supportedFeatures);
+	pipelineStatisticsSupported_ = supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+
+	VkPhysicalDeviceFeatures deviceFeatures
+	{
+		.multiDrawIndirect = VK_TRUE,
+		.drawIndirectFirstInstance = VK_TRUE, // Object index is passed as first instance
+		.samplerAnisotropy = VK_TRUE,
+		.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery, // Optional, only used for fragment invocation counts
+		.fragmentStoresAndAtomics = VK_TRUE // Texture streaming feedback
+	};
+
+	// Bindless textures
+	VkPhysicalDeviceVulkan12Features vulkan12Features
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+		.shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+		.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+		.descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+		.descriptorBindingPartiallyBound = VK_TRUE,
+		.descriptorBindingVariableDescriptorCount = VK_TRUE,
+		.runtimeDescriptorArray = VK_TRUE
+	};
+
+	// Optional, heap budgets are estimated from the heap sizes without it
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+	const bool memoryBudgetSupported = std::any_of(availableExtensions.begin(), availableExtensions.end(),
+		[](const VkExtensionProperties& properties) { return strcmp(properties.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0; });
+
+	std::vector<const char*> enabledExtensions = deviceExtensions;
+	if (memoryBudgetSupported)
+	{
+		enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	}
+
+	VkDeviceCreateInfo deviceCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+		.pNext = &vulkan12Features,
+		.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
+		.pQueueCreateInfos = queueCreateInfos.data(),
+		.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()),
+		.ppEnabledExtensionNames = enabledExtensions.data(),
+		.pEnabledFeatures = &deviceFeatures
+	};
+
+	VkResult result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a logical device.");
+	}
+	getMemoryTracker().Init(mainDevice.physicalDevice, memoryBudgetSupported);
+
+	vkGetDeviceQueue(mainDevice.logicalDevice, static_cast<uint32_t>(indices.graphicsFamily), 0, &graphicsQueue_);
+	vkGetDeviceQueue(mainDevice.logicalDevice, static_cast<uint32_t>(indices.presentationFamily), 0, &presentationQueue_);
+
+	VkPhysicalDeviceDescriptorIndexingProperties descriptorIndexingProperties
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES
+	};
+	VkPhysicalDeviceProperties2 properties
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &descriptorIndexingProperties
+	};
+	vkGetPhysicalDeviceProperties2(mainDevice.physicalDevice, &properties);
+
+	// Optional, only used for GPU pass times
+	timestampSupported_ = properties.properties.limits.timestampComputeAndGraphics == VK_TRUE;
+	timestampPeriod_ = properties.properties.limits.timestampPeriod;
+
+	const VkSampleCountFlags sampleCounts = properties.properties.limits.framebufferColorSampleCounts & properties.properties.limits.framebufferDepthSampleCounts;
+	for (VkSampleCountFlagBits sampleCount = MAX_MSAA_SAMPLES; sampleCount > VK_SAMPLE_COUNT_1_BIT; sampleCount = static_cast<VkSampleCountFlagBits>(sampleCount >> 1))
+	{
+		if (sampleCounts & sampleCount)
+		{
+			msaaSampleCount_ = sampleCount;
+			break;
+		}
+	}
+
+	// Combined image samplers count against both sampler and sampled image limits
+	maxTextureCount_ = std::min({
+		MAX_TEXTURES,
+		descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+		descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+		descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSampledImages
+	});
+}
+
+void VulkanRenderer::CreateSurface(GLFWwindow* window)
+{
+	VkResult result = glfwCreateWindowSurface(vkInsatance_, window, nullptr, &surface_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a surface.");
+	}
+}
+
+void VulkanRenderer::CreateSwapchain()
+{
+	SwapchainDetails swapchainDetails = GetSwapchainDetails(mainDevice.physicalDevice);
+
+	VkSurfaceFormatKHR surfaceFormat = ChooseBestSurfaceFormat(swapchainDetails.formats);
+	VkPresentModeKHR presentMode = ChooseBestPresentationMode(swapchainDetails.presentationModes);
+	VkExtent2D extent = ChooseSwapExtent(swapchainDetails.surfaceCapabilities);
+
+	uint32_t imageCount = swapchainDetails.surfaceCapabilities.minImageCount + 1; // At least one extra image for allowing triple buffering for sure
+	if (swapchainDetails.surfaceCapabilities.maxImageCount > 0 &&  swapchainDetails.surfaceCapabilities.maxImageCount < imageCount)
+	{
+		imageCount = swapchainDetails.surfaceCapabilities.maxImageCount;
+	}
+
+	VkSwapchainCreateInfoKHR sawpChainCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+		.surface = surface_,
+		.minImageCount = imageCount,
+		.imageFormat = surfaceFormat.format,
+		.imageColorSpace = surfaceFormat.colorSpace,
+		.imageExtent = extent,
+		.imageArrayLayers = 1,
+		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+
+		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr,
+
+		.preTransform = swapchainDetails.surfaceCapabilities.currentTransform,
+		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+		.clipped = VK_TRUE,
+		.oldSwapchain = VK_NULL_HANDLE
+	};
+
+	QueueFamilyIndices indices = GetQueueFamilies(mainDevice.physicalDevice);
+	if (indices.graphicsFamily != indices.presentationFamily)
+	{
+		uint32_t queueFamiliIndices[] =
+		{
+			static_cast<uint32_t>(indices.graphicsFamily),
+			static_cast<uint32_t>(indices.presentationFamily)
+		};
+
+		sawpChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		sawpChainCreateInfo.queueFamilyIndexCount = 2;
+		sawpChainCreateInfo.pQueueFamilyIndices = queueFamiliIndices;
+	}
+
+	VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice, &sawpChainCreateInfo, nullptr, &swapchain_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a swapchain.");
+	}
+
+	swapchainImageFormat_ = surfaceFormat.format;
+	swapchainExtent_ = extent;
+
+	uint32_t swapchainImageCount;
+	vkGetSwapchainImagesKHR(mainDevice.logicalDevice, swapchain_, &swapchainImageCount, nullptr);
+	std::vector<VkImage> images(swapchainImageCount);
+	vkGetSwapchainImagesKHR(mainDevice.logicalDevice, swapchain_, &swapchainImageCount, images.data());
 
 	for (VkImage image : images)
 	{
-		SwapchainImage swapchainImage
+		SwapchainImage swapchainImage
+		{
+			.image = image,
+			.imageView = CreateImageView(image, swapchainImageFormat_, VK_IMAGE_ASPECT_COLOR_BIT)
+		};
+
+		swapchainImages_.push_back(swapchainImage);
+	}
+}
+
+void VulkanRenderer::CreateRenderPass()
+{
+	colorBufferImageFormat_ = ChooseSupportedFormat(
+		{ VK_FORMAT_R8G8B8A8_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	);
+
+	depthBufferImageFormat_ = ChooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+	);
+
+	// In MSAA mode subpass 0 renders into the multisampled attachments 3 and 4, which are resolved into the color and depth buffers
+	// at the end of the subpass. Samples are never stored, so on tiled GPUs they stay in tile memory.
+	const VkSampleCountFlagBits sampleCount = GetSceneSampleCount();
+	const bool multisampled = sampleCount != VK_SAMPLE_COUNT_1_BIT;
+
+	// Color attachment
+	VkAttachmentDescription2 colorAttachment
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2,
+		.format = colorBufferImageFormat_,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = multisampled ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	};
+	// Depth attachment
+	VkAttachmentDescription2 depthAttachment
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2,
+		.format = depthBufferImageFormat_,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = multisampled ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	};
+
+	// Multisampled color and depth attachments
+	VkAttachmentDescription2 msaaColorAttachment = colorAttachment;
+	msaaColorAttachment.samples = sampleCount;
+	msaaColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	VkAttachmentDescription2 msaaDepthAttachment = depthAttachment;
+	msaaDepthAttachment.samples = sampleCount;
+	msaaDepthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+
+	VkAttachmentReference2 colorAttachmentReference
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2,
+		.attachment = multisampled ? 3u : 1u,
+		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	};
+	VkAttachmentReference2 depthAttachmentReference
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2,
+		.attachment = multisampled ? 4u : 2u,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	};
+
+	VkAttachmentReference2 colorResolveReference
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2,
+		.attachment = 1,
+		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	};
+	VkAttachmentReference2 depthResolveReference
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2,
+		.attachment = 2,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	};
+	// Sample zero is the only depth resolve every device supports, the composite only reads depth for its debug view
+	VkSubpassDescriptionDepthStencilResolve depthStencilResolve
+	{
+		.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_DEPTH_STENCIL_RESOLVE,
+		.depthResolveMode = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT,
+		.stencilResolveMode = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT,
+		.pDepthStencilResolveAttachment = &depthResolveReference
+	};
+
+	// Swapchain color attachment
+	VkAttachmentDescription2 swapchainColorAttachment
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2,
+		.format = swapchainImageFormat_,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+	};
+
+	VkAttachmentReference2 swapchainColorAttachmentReference
+	{
+		.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2,
+		.attachment = 0,
+		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	};
+
+	std::vector<VkAttachmentReference2> inputReferences 
+	{ 
+		VkAttachmentReference2
+		{
+			.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2,
+			.attachment = 1,
+			.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT
+		},
+		VkAttachmentReference2
+		{
+			.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2,
+			.attachment = 2,
+			.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT
+		}
+	};
+
+	// Color attachment
+	//VkAttachmentDescription colorAttachment
+	//{
+	//	.format = swapchainImageFormat_,
+	//	.samples = VK_SAMPLE_COUNT_1_BIT,
+	//	.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+	//	.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	//	.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	//	.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	//	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	//	.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+	//};
+	//// Depth attachment
+	//VkAttachmentDescription depthAttachment
+	//{
+	//	.format = depthBufferImageFormat_,
+	//	.samples = VK_SAMPLE_COUNT_1_BIT,
+	//	.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+	//	.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	//	.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	//	.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	//	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	//	.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	//};
+	//std::vector<VkAttachmentDescription> renderPassAttachments { colorAttachment , depthAttachment };
+	//
+	//VkAttachmentReference colorAttachmentReference
+	//{
+	//	.attachment = 0,
+	//	.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	//};
+	//VkAttachmentReference depthAttachmentReference
+	//{
+	//	.attachment = 1,
+	//	.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	//};
+
+	std::vector<VkSubpassDescription2> subpassDescriptions
+	{
+		VkSubpassDescription2
+		{
+			.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2,
+			.pNext = multisampled ? &depthStencilResolve : nullptr,
+			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+			.colorAttachmentCount = 1,
+			.pColorAttachments = &colorAttachmentReference,
+			.pResolveAttachments = multisampled ? &colorResolveReference : nullptr,
+			.pDepthStencilAttachment = &depthAttachmentReference
+		},
+		VkSubpassDescription2
+		{
+			.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2,
+			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+			.inputAttachmentCount = static_cast<uint32_t>(inputReferences.size()),
+			.pInputAttachments = inputReferences.data(),
+			.colorAttachmentCount = 1,
+			.pColorAttachments = &swapchainColorAttachmentReference
+		}
+	};
+
+	std::vector<VkSubpassDependency2> subpassDependencies =
+	{
+		// Conversion form VK_IMAGE_LAYOUT_UNDEFINED to VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+		VkSubpassDependency2
+		{
+			.sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2,
+			.srcSubpass = VK_SUBPASS_EXTERNAL,
+			.dstSubpass = 0,
+			.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+			.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dependencyFlags = 0
+		},
+		// Color and depth resolves are also done in these stages
+		VkSubpassDependency2
+		{
+			.sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2,
+			.srcSubpass = 0,
+			.dstSubpass = 1,
+			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+			.dependencyFlags = 0
+		},
+		// Conversion form VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+		VkSubpassDependency2
+		{
+			.sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2,
+			.srcSubpass = 1,
+			.dstSubpass = VK_SUBPASS_EXTERNAL,
+			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+			.dependencyFlags = 0
+		}
+	};
+
+	std::vector<VkAttachmentDescription2> renderPassAttachments{ swapchainColorAttachment, colorAttachment , depthAttachment };
+	if (multisampled)
+	{
+		renderPassAttachments.push_back(msaaColorAttachment);
+		renderPassAttachments.push_back(msaaDepthAttachment);
+	}
+
+	VkRenderPassCreateInfo2 renderPassCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2,
+		.attachmentCount = static_cast<uint32_t>(renderPassAttachments.size()),
+		.pAttachments = renderPassAttachments.data(),
+		.subpassCount = static_cast<uint32_t>(subpassDescriptions.size()),
+		.pSubpasses = subpassDescriptions.data(),
+		.dependencyCount = static_cast<uint32_t>(subpassDependencies.size()),
+		.pDependencies = subpassDependencies.data()
+	};
+
+	VkResult result = vkCreateRenderPass2(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &renderPass_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a render pass.");
+	}
+}
+
+void VulkanRenderer::CreateDescriptorSetLayout()
+{
+	VkDescriptorSetLayoutBinding vpLayoutBinding
+	{
+		.binding = 0,
+		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	//VkDescriptorSetLayoutBinding modelLayoutBinding
+	//{
+	//	.binding = 1,
+	//	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	//	.descriptorCount = 1,
+	//	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+	//	.pImmutableSamplers = nullptr
+	//};
+	VkDescriptorSetLayoutBinding objectLayoutBinding
+	{
+		.binding = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	// Vertices are pulled from the geometry buffer by the vertex shader
+	VkDescriptorSetLayoutBinding vertexLayoutBinding
+	{
+		.binding = 2,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	VkDescriptorSetLayoutBinding positionLayoutBinding
+	{
+		.binding = 3,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	// Clustered lighting, light culling binds the same set to its compute pipeline. Shadow cascades are read by shadow.vert.
+	VkDescriptorSetLayoutBinding lightingLayoutBinding
+	{
+		.binding = 4,
+		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	VkDescriptorSetLayoutBinding lightLayoutBinding
+	{
+		.binding = 5,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	VkDescriptorSetLayoutBinding clusterLayoutBinding
+	{
+		.binding = 6,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	VkDescriptorSetLayoutBinding shadowMapLayoutBinding
+	{
+		.binding = 7,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	VkDescriptorSetLayoutBinding textureFeedbackLayoutBinding
+	{
+		.binding = 8,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pImmutableSamplers = nullptr
+	};
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings { vpLayoutBinding, objectLayoutBinding, vertexLayoutBinding, positionLayoutBinding,
+		lightingLayoutBinding, lightLayoutBinding, clusterLayoutBinding, shadowMapLayoutBinding, textureFeedbackLayoutBinding };
+
+	VkDescriptorSetLayoutCreateInfo vpDescriptorSetLayoutCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = static_cast<uint32_t>(layoutBindings.size()),
+		.pBindings = layoutBindings.data()
+	};
+
+	VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &vpDescriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a descriptor set.");
+	}
+
+
+	// Runtime-sized texture array, written while in use and only partially filled
+	VkDescriptorSetLayoutBinding samplerLayoutBinding
+	{
+		.binding = 0,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.descriptorCount = maxTextureCount_,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pImmutableSamplers = nullptr
+	};
+
+	// Elements are written while command buffers using the set are pending, which is fine as long as those don't use them
+	VkDescriptorBindingFlags samplerBindingFlags =
+		VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+		VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+		VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo samplerBindingFlagsCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+		.bindingCount = 1,
+		.pBindingFlags = &samplerBindingFlags
+	};
+
+	VkDescriptorSetLayoutCreateInfo samplerDescriptorSetLayoutCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = &samplerBindingFlagsCreateInfo,
+		.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+		.bindingCount = 1,
+		.pBindings = &samplerLayoutBinding
+	};
+
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &samplerDescriptorSetLayoutCreateInfo, nullptr, &samplerDescriptorSetLayout_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a descriptor set.");
+	}
+
+
+	// Sampled instead of read as input attachments, the composite reads other pixels than its own when upscaling
+	std::vector<VkDescriptorSetLayoutBinding> inputDescriptorSetLayoutBindings
+	{
+		// Color input binding
+		VkDescriptorSetLayoutBinding
 		{
-			.image = image,
-			.imageView = CreateImageView(image, swapchainImageFormat_, VK_IMAGE_ASPECT_COLOR_BIT)
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = nullptr
+		},
+		// Depth input binding
+		VkDescriptorSetLayoutBinding
+		{
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = nullptr
+		}
+	};
+
+	VkDescriptorSetLayoutCreateInfo inputDescriptorSetLayoutCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = static_cast<uint32_t>(inputDescriptorSetLayoutBindings.size()),
+		.pBindings = inputDescriptorSetLayoutBindings.data()
+	};
+
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &inputDescriptorSetLayoutCreateInfo, nullptr, &inputDescriptorSetLayout_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a descriptor set.");
+	}
+
+
+	// Joint palette and bind pose in, skinned vertices and positions out
+	std::vector<VkDescriptorSetLayoutBinding> skinningDescriptorSetLayoutBindings(4);
+	for (uint32_t i = 0; i < skinningDescriptorSetLayoutBindings.size(); i++)
+	{
+		skinningDescriptorSetLayoutBindings[i] = VkDescriptorSetLayoutBinding
+		{
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = nullptr
 		};
+	}
 
-		swapchainImages_.push_back(swapchainImage);
+	VkDescriptorSetLayoutCreateInfo skinningDescriptorSetLayoutCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = static_cast<uint32_t>(skinningDescriptorSetLayoutBindings.size()),
+		.pBindings = skinningDescriptorSetLayoutBindings.data()
+	};
+
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &skinningDescriptorSetLayoutCreateInfo, nullptr, &skinningDescriptorSetLayout_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a descriptor set.");
 	}
 }
 
-void VulkanRenderer::CreateRenderPass()
+void VulkanRenderer::CreatePipelineCache()
 {
-	colorBufferImageFormat_ = ChooseSupportedFormat(
-		{ VK_FORMAT_R8G8B8A8_UNORM },
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-	);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
 
-	depthBufferImageFormat_ = ChooseSupportedFormat(
-		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-	);
+	// Missing, foreign or corrupted cache file means a cold start with an empty cache
+	std::vector<char> initialData;
+	try
+	{
+		std::vector<char> fileData = readBinaryFile(PIPELINE_CACHE_FILE);
+
+		PipelineCacheHeader header;
+		if (fileData.size() >= sizeof(header))
+		{
+			memcpy(&header, fileData.data(), sizeof(header));
+
+			const char* data = fileData.data() + sizeof(header);
+			const size_t dataSize = fileData.size() - sizeof(header);
+
+			if (header.magic == PIPELINE_CACHE_MAGIC &&
+				header.vendorID == properties.vendorID &&
+				header.deviceID == properties.deviceID &&
+				header.driverVersion == properties.driverVersion &&
+				memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+				header.dataSize == dataSize &&
+				header.dataHash == hashBytes(data, dataSize))
+			{
+				initialData.assign(data, data + dataSize);
+			}
+		}
+	}
+	catch (const std::runtime_error&)
+	{
+	}
+
+	pipelineCacheLoaded_ = initialData.empty() == false;
+
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = initialData.size(),
+		.pInitialData = initialData.data()
+	};
+
+	VkResult result = vkCreatePipelineCache(mainDevice.logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a pipeline cache.");
+	}
+}
+
+void VulkanRenderer::SavePipelineCache()
+{
+	size_t dataSize;
+	VkResult result = vkGetPipelineCacheData(mainDevice.logicalDevice, pipelineCache_, &dataSize, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		printf("Error: Failed to get pipeline cache data.\n");
+		return;
+	}
+
+	std::vector<char> fileData(sizeof(PipelineCacheHeader) + dataSize);
+	char* data = fileData.data() + sizeof(PipelineCacheHeader);
+
+	result = vkGetPipelineCacheData(mainDevice.logicalDevice, pipelineCache_, &dataSize, data);
+	if (result != VK_SUCCESS)
+	{
+		printf("Error: Failed to get pipeline cache data.\n");
+		return;
+	}
+	fileData.resize(sizeof(PipelineCacheHeader) + dataSize);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
+
+	PipelineCacheHeader header
+	{
+		.magic = PIPELINE_CACHE_MAGIC,
+		.vendorID = properties.vendorID,
+		.deviceID = properties.deviceID,
+		.driverVersion = properties.driverVersion,
+		.dataSize = dataSize,
+		.dataHash = hashBytes(data, dataSize)
+	};
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	memcpy(fileData.data(), &header, sizeof(header));
+
+	try
+	{
+		writeBinaryFile(PIPELINE_CACHE_FILE, fileData);
+	}
+	catch (const std::runtime_error& e)
+	{
+		printf("Error: %s\n", e.what());
+	}
+}
+
+void VulkanRenderer::CreateCraphicsPipeline()
+{
+	std::vector<char> vertexShaderCode = readBinaryFile("../shaders/vert.spv");
+	std::vector<char> fragmentShaderCode = readBinaryFile("../shaders/frag.spv");
+
+	VkShaderModule vertexShaderModule = CreateShaderModule(vertexShaderCode);
+	VkShaderModule fragmentShaderModule = CreateShaderModule(fragmentShaderCode);
+
+	VkPipelineShaderStageCreateInfo vertexShaderCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.module = vertexShaderModule,
+		.pName = "main"
+	};
+	VkPipelineShaderStageCreateInfo fragmentShaderCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.module = fragmentShaderModule,
+		.pName = "main"
+	};
+
+	VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
+
+
+	// No vertex attributes, the vertex shader reads vertices from the geometry storage buffer
+	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = 0,
+		.pVertexBindingDescriptions = nullptr,
+		.vertexAttributeDescriptionCount = 0,
+		.pVertexAttributeDescriptions = nullptr
+	};
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+		.primitiveRestartEnable = VK_FALSE
+	};
+
+	VkViewport viewport
+	{
+		.x = 0,
+		.y = 0,
+		.width = static_cast<float>(swapchainExtent_.width),
+		.height = static_cast<float>(swapchainExtent_.height),
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f
+	};
+
+	VkRect2D scissor
+	{
+		.offset = VkOffset2D {.x = 0, .y = 0},
+		.extent = swapchainExtent_
+	};
+
+	VkPipelineViewportStateCreateInfo viewportStateCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.pViewports = &viewport,
+		.scissorCount = 1,
+		.pScissors = &scissor
+	};
+
+	// Subpass 0 renders at the current render scale, viewport and scissor are set when recording
+	std::vector<VkDynamicState> dynamicStateEnables
+	{
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
+
+	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size()),
+		.pDynamicStates = dynamicStateEnables.data()
+	};
+
+	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.depthClampEnable = VK_FALSE,
+		.rasterizerDiscardEnable = VK_FALSE,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = VK_CULL_MODE_BACK_BIT,
+		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+		.depthBiasEnable = VK_FALSE,
+		.lineWidth = 1.0f
+	};
+
+
+	VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = GetSceneSampleCount(),
+		.sampleShadingEnable = VK_FALSE
+	};
+
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilStateCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = VK_TRUE,
+		.depthWriteEnable = VK_TRUE,
+		.depthCompareOp = VK_COMPARE_OP_LESS,
+		.depthBoundsTestEnable = VK_FALSE,
+		.stencilTestEnable = VK_FALSE
+	};
+
+
+	// BlendingOp ( NewColor * SrcColorBlendFactor , OldColor * DstColorBlendFactor )
+	VkPipelineColorBlendAttachmentState colorBlendAttachmentState
+	{
+		.blendEnable = VK_TRUE,
+
+		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+		.colorBlendOp = VK_BLEND_OP_ADD,
+
+		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+		.alphaBlendOp = VK_BLEND_OP_ADD,
+
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+	};
+
+	VkPipelineColorBlendStateCreateInfo colorBlendingCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.logicOpEnable = VK_FALSE,
+		.attachmentCount = 1,
+		.pAttachments = &colorBlendAttachmentState
+	};
+
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts {descriptorSetLayout_, samplerDescriptorSetLayout_ };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size()),
+		.pSetLayouts = descriptorSetLayouts.data(),
+		.pushConstantRangeCount = 0,
+		.pPushConstantRanges = nullptr
+	};
 
-	// Color attachment
-	VkAttachmentDescription colorAttachment
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout_);
+	if (result != VK_SUCCESS)
 	{
-		.format = colorBufferImageFormat_,
-		.samples = VK_SAMPLE_COUNT_1_BIT,
-		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-		.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-	};
-	// Depth attachment
-	VkAttachmentDescription depthAttachment
+		throw std::runtime_error("Failed to create a pipeline layout.");
+	}
+
+	VkGraphicsPipelineCreateInfo graphicsPiplineCreateInfo
 	{
-		.format = depthBufferImageFormat_,
-		.samples = VK_SAMPLE_COUNT_1_BIT,
-		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-		.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.stageCount = 2,
+		.pStages = shaderStages,
+		.pVertexInputState = &vertexInputCreateInfo,
+		.pInputAssemblyState = &inputAssemblyCreateInfo,
+		.pViewportState = &viewportStateCreateInfo,
+		.pRasterizationState = &rasterizerCreateInfo,
+		.pMultisampleState = &multisamplingCreateInfo,
+		.pDepthStencilState = &depthStencilStateCreateInfo,
+		.pColorBlendState = &colorBlendingCreateInfo,
+		.pDynamicState = &dynamicStateCreateInfo,
+		.layout = pipelineLayout_,
+		.renderPass = renderPass_,
+		.subpass = 0,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1
 	};
 
-	VkAttachmentReference colorAttachmentReference
+	// Depth pre-pass variant: positions only and no fragment shader, depth is all it writes
+	std::vector<char> depthShaderCode = readBinaryFile("../shaders/depth_vert.spv");
+	VkShaderModule depthShaderModule = CreateShaderModule(depthShaderCode);
+
+	VkPipelineShaderStageCreateInfo depthShaderCreateInfo
 	{
-		.attachment = 1,
-		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.module = depthShaderModule,
+		.pName = "main"
 	};
-	VkAttachmentReference depthAttachmentReference
+
+	VkPipelineColorBlendAttachmentState depthOnlyBlendAttachmentState
 	{
-		.attachment = 2,
-		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+		.blendEnable = VK_FALSE,
+		.colorWriteMask = 0
 	};
 
-	// Swapchain color attachment
-	VkAttachmentDescription swapchainColorAttachment
+	VkPipelineColorBlendStateCreateInfo depthOnlyBlendingCreateInfo = colorBlendingCreateInfo;
+	depthOnlyBlendingCreateInfo.pAttachments = &depthOnlyBlendAttachmentState;
+
+	VkGraphicsPipelineCreateInfo depthPrePassPipelineCreateInfo = graphicsPiplineCreateInfo;
+	depthPrePassPipelineCreateInfo.stageCount = 1;
+	depthPrePassPipelineCreateInfo.pStages = &depthShaderCreateInfo;
+	depthPrePassPipelineCreateInfo.pColorBlendState = &depthOnlyBlendingCreateInfo;
+
+	// Color pass after the pre-pass only shades the visible surface, depth is already final
+	VkPipelineDepthStencilStateCreateInfo depthEqualStateCreateInfo = depthStencilStateCreateInfo;
+	depthEqualStateCreateInfo.depthWriteEnable = VK_FALSE;
+	depthEqualStateCreateInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+
+	VkGraphicsPipelineCreateInfo depthEqualPipelineCreateInfo = graphicsPiplineCreateInfo;
+	depthEqualPipelineCreateInfo.pDepthStencilState = &depthEqualStateCreateInfo;
+
+	std::vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos { graphicsPiplineCreateInfo, depthPrePassPipelineCreateInfo, depthEqualPipelineCreateInfo };
+	std::vector<VkPipeline> pipelines(pipelineCreateInfos.size());
+
+	auto pipelineCreationStart = std::chrono::steady_clock::now();
+
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, pipelineCache_, static_cast<uint32_t>(pipelineCreateInfos.size()),
+		pipelineCreateInfos.data(), nullptr, pipelines.data());
+	if (result != VK_SUCCESS)
 	{
-		.format = swapchainImageFormat_,
-		.samples = VK_SAMPLE_COUNT_1_BIT,
-		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-	};
+		throw std::runtime_error("Failed to create a graphics pipeline.");
+	}
+
+	std::chrono::duration<double, std::milli> pipelineCreationTime = std::chrono::steady_clock::now() - pipelineCreationStart;
+
+	graphicsPipeline_ = pipelines[0];
+	depthPrePassPipeline_ = pipelines[1];
+	depthEqualPipeline_ = pipelines[2];
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, depthShaderModule, nullptr);
+	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+
+
+	vertexShaderCode = readBinaryFile("../shaders/second_vert.spv");
+	fragmentShaderCode = readBinaryFile("../shaders/second_frag.spv");
+
+	vertexShaderModule = CreateShaderModule(vertexShaderCode);
+	fragmentShaderModule = CreateShaderModule(fragmentShaderCode);
 
-	VkAttachmentReference swapchainColorAttachmentReference
+	vertexShaderCreateInfo.module = vertexShaderModule;
+	fragmentShaderCreateInfo.module = fragmentShaderModule;
+
+	VkPipelineShaderStageCreateInfo secondShaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
+
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
+	vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
+	vertexInputCreateInfo.pVertexAttributeDescriptions = nullptr;
+
+	depthStencilStateCreateInfo.depthWriteEnable = VK_FALSE;
+	multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	// Rendered and output size, the composite maps its pixels onto the rendered part of the attachments
+	VkPushConstantRange renderAreaPushConstantRange
 	{
-		.attachment = 0,
-		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.offset = 0,
+		.size = sizeof(CompositeConstants)
 	};
 
-	std::vector<VkAttachmentReference> inputReferences 
-	{ 
-		VkAttachmentReference
-		{
-			.attachment = 1,
-			.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		},
-		VkAttachmentReference
-		{
-			.attachment = 2,
-			.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		}
+	VkPipelineLayoutCreateInfo secondPipelineLayoutCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &inputDescriptorSetLayout_,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &renderAreaPushConstantRange
 	};
 
-	// Color attachment
-	//VkAttachmentDescription colorAttachment
-	//{
-	//	.format = swapchainImageFormat_,
-	//	.samples = VK_SAMPLE_COUNT_1_BIT,
-	//	.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-	//	.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-	//	.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-	//	.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-	//	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-	//	.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-	//};
-	//// Depth attachment
-	//VkAttachmentDescription depthAttachment
-	//{
-	//	.format = depthBufferImageFormat_,
-	//	.samples = VK_SAMPLE_COUNT_1_BIT,
-	//	.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-	//	.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-	//	.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-	//	.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-	//	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-	//	.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-	//};
-	//std::vector<VkAttachmentDescription> renderPassAttachments { colorAttachment , depthAttachment };
-	//
-	//VkAttachmentReference colorAttachmentReference
-	//{
-	//	.attachment = 0,
-	//	.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-	//};
-	//VkAttachmentReference depthAttachmentReference
-	//{
-	//	.attachment = 1,
-	//	.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-	//};
+	result = vkCreatePipelineLayout(mainDevice.logicalDevice, &secondPipelineLayoutCreateInfo, nullptr, &secondPipelineLayout_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a pipeline layout.");
+	}
+
+	graphicsPiplineCreateInfo.pStages = secondShaderStages;
+	graphicsPiplineCreateInfo.layout = secondPipelineLayout_;
+	graphicsPiplineCreateInfo.subpass = 1;
 
-	std::vector<VkSubpassDescription> subpassDescriptions
+	pipelineCreationStart = std::chrono::steady_clock::now();
+
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, pipelineCache_, 1, &graphicsPiplineCreateInfo, nullptr, &secondPipeline_);
+	if (result != VK_SUCCESS)
 	{
-		VkSubpassDescription
-		{
-			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-			.colorAttachmentCount = 1,
-			.pColorAttachments = &colorAttachmentReference,
-			.pDepthStencilAttachment = &depthAttachmentReference
-		},
-		VkSubpassDescription
-		{
-			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-			.inputAttachmentCount = static_cast<uint32_t>(inputReferences.size()),
-			.pInputAttachments = inputReferences.data(),
-			.colorAttachmentCount = 1,
-			.pColorAttachments = &swapchainColorAttachmentReference
-		}
+		throw std::runtime_error("Failed to create a graphics pipeline.");
+	}
+
+	pipelineCreationTime += std::chrono::steady_clock::now() - pipelineCreationStart;
+	printf("Pipeline creation: %.2f ms (%s start)\n", pipelineCreationTime.count(), pipelineCacheLoaded_ ? "warm" : "cold");
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+}
+
+void VulkanRenderer::CreateSkinningPipeline()
+{
+	std::vector<char> computeShaderCode = readBinaryFile("../shaders/skinning_comp.spv");
+	VkShaderModule computeShaderModule = CreateShaderModule(computeShaderCode);
+
+	VkPushConstantRange pushConstantRange
+	{
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(SkinningDispatch)
 	};
 
-	std::vector<VkSubpassDependency> subpassDependencies =
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
 	{
-		// Conversion form VK_IMAGE_LAYOUT_UNDEFINED to VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-		VkSubpassDependency
-		{
-			.srcSubpass = VK_SUBPASS_EXTERNAL,
-			.dstSubpass = 0,
-			.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-			.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-			.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-			.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-			//.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT
-			.dependencyFlags = 0
-		},
-		// Conversion form VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-		VkSubpassDependency
-		{
-			.srcSubpass = 0,
-			.dstSubpass = 1,
-			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-			.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-			//.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT
-			.dependencyFlags = 0
-		},
-		VkSubpassDependency
-		{
-			.srcSubpass = 1,
-			.dstSubpass = VK_SUBPASS_EXTERNAL,
-			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-			.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-			.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-			//.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT
-			.dependencyFlags = 0
-		}
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &skinningDescriptorSetLayout_,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &pushConstantRange
 	};
 
-	std::vector<VkAttachmentDescription> renderPassAttachments{ swapchainColorAttachment, colorAttachment , depthAttachment };
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &skinningPipelineLayout_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a pipeline layout.");
+	}
 
-	VkRenderPassCreateInfo renderPassCreateInfo
+	VkComputePipelineCreateInfo computePipelineCreateInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-		.attachmentCount = static_cast<uint32_t>(renderPassAttachments.size()),
-		.pAttachments = renderPassAttachments.data(),
-		.subpassCount = static_cast<uint32_t>(subpassDescriptions.size()),
-		.pSubpasses = subpassDescriptions.data(),
-		.dependencyCount = static_cast<uint32_t>(subpassDependencies.size()),
-		.pDependencies = subpassDependencies.data()
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage = VkPipelineShaderStageCreateInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = computeShaderModule,
+			.pName = "main"
+		},
+		.layout = skinningPipelineLayout_,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1
 	};
 
-	VkResult result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &renderPass_);
+	result = vkCreateComputePipelines(mainDevice.logicalDevice, pipelineCache_, 1, &computePipelineCreateInfo, nullptr, &skinningPipeline_);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create a render pass.");
+		throw std::runtime_error("Failed to create a compute pipeline.");
 	}
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, computeShaderModule, nullptr);
 }
 
-void VulkanRenderer::CreateDescriptorSetLayout()
+void VulkanRenderer::CreateLightCullingPipeline()
 {
-	VkDescriptorSetLayoutBinding vpLayoutBinding
-	{
-		.binding = 0,
-		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-		.descriptorCount = 1,
-		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-		.pImmutableSamplers = nullptr
-	};
-	//VkDescriptorSetLayoutBinding modelLayoutBinding
-	//{
-	//	.binding = 1,
-	//	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-	//	.descriptorCount = 1,
-	//	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-	//	.pImmutableSamplers = nullptr
-	//};
-	std::vector<VkDescriptorSetLayoutBinding> layoutBindings { vpLayoutBinding/*, modelLayoutBinding*/ };
+	std::vector<char> computeShaderCode = readBinaryFile("../shaders/light_culling_comp.spv");
+	VkShaderModule computeShaderModule = CreateShaderModule(computeShaderCode);
 
-	VkDescriptorSetLayoutCreateInfo vpDescriptorSetLayoutCreateInfo
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-		.bindingCount = static_cast<uint32_t>(layoutBindings.size()),
-		.pBindings = layoutBindings.data()
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &descriptorSetLayout_,
+		.pushConstantRangeCount = 0,
+		.pPushConstantRanges = nullptr
 	};
 
-	VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &vpDescriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout_);
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &lightCullingPipelineLayout_);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create a descriptor set.");
+		throw std::runtime_error("Failed to create a pipeline layout.");
 	}
 
-
-	VkDescriptorSetLayoutBinding samplerLayoutBinding
-	{
-		.binding = 0,
-		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.descriptorCount = 1,
-		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-		.pImmutableSamplers = nullptr
-	};
-
-	VkDescriptorSetLayoutCreateInfo samplerDescriptorSetLayoutCreateInfo
+	VkComputePipelineCreateInfo computePipelineCreateInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-		.bindingCount = 1,
-		.pBindings = &samplerLayoutBinding
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage = VkPipelineShaderStageCreateInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = computeShaderModule,
+			.pName = "main"
+		},
+		.layout = lightCullingPipelineLayout_,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1
 	};
 
-	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &samplerDescriptorSetLayoutCreateInfo, nullptr, &samplerDescriptorSetLayout_);
+	result = vkCreateComputePipelines(mainDevice.logicalDevice, pipelineCache_, 1, &computePipelineCreateInfo, nullptr, &lightCullingPipeline_);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create a descriptor set.");
+		throw std::runtime_error("Failed to create a compute pipeline.");
 	}
 
+	vkDestroyShaderModule(mainDevice.logicalDevice, computeShaderModule, nullptr);
+}
 
-	std::vector<VkDescriptorSetLayoutBinding> inputDescriptorSetLayoutBindings
+void VulkanRenderer::CreateShadowMaps()
+{
+	shadowMapImageFormat_ = ChooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT
+	);
+
+	// Render passes differ only in what happens to the layer before and after the casters are drawn
+	auto createRenderPass = [this](VkAttachmentLoadOp loadOp, VkImageLayout initialLayout, VkImageLayout finalLayout,
+		VkPipelineStageFlags previousStages, VkAccessFlags previousAccess, VkPipelineStageFlags nextStages, VkAccessFlags nextAccess)
 	{
-		// Color input binding
-		VkDescriptorSetLayoutBinding
+		VkAttachmentDescription depthAttachment
 		{
-			.binding = 0,
-			.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-			.pImmutableSamplers = nullptr
-		},
-		// Depth input binding
-		VkDescriptorSetLayoutBinding
+			.format = shadowMapImageFormat_,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = loadOp,
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = initialLayout,
+			.finalLayout = finalLayout
+		};
+
+		VkAttachmentReference depthAttachmentReference
 		{
-			.binding = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-			.pImmutableSamplers = nullptr
+			.attachment = 0,
+			.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+		};
+
+		VkSubpassDescription subpassDescription
+		{
+			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+			.colorAttachmentCount = 0,
+			.pDepthStencilAttachment = &depthAttachmentReference
+		};
+
+		const VkPipelineStageFlags depthStages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		std::vector<VkSubpassDependency> subpassDependencies
+		{
+			VkSubpassDependency
+			{
+				.srcSubpass = VK_SUBPASS_EXTERNAL,
+				.dstSubpass = 0,
+				.srcStageMask = previousStages,
+				.dstStageMask = depthStages,
+				.srcAccessMask = previousAccess,
+				.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				.dependencyFlags = 0
+			},
+			VkSubpassDependency
+			{
+				.srcSubpass = 0,
+				.dstSubpass = VK_SUBPASS_EXTERNAL,
+				.srcStageMask = depthStages,
+				.dstStageMask = nextStages,
+				.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				.dstAccessMask = nextAccess,
+				.dependencyFlags = 0
+			}
+		};
+
+		VkRenderPassCreateInfo renderPassCreateInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+			.attachmentCount = 1,
+			.pAttachments = &depthAttachment,
+			.subpassCount = 1,
+			.pSubpasses = &subpassDescription,
+			.dependencyCount = static_cast<uint32_t>(subpassDependencies.size()),
+			.pDependencies = subpassDependencies.data()
+		};
+
+		VkRenderPass renderPass;
+		VkResult result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &renderPass);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a render pass.");
 		}
+
+		return renderPass;
 	};
 
-	VkDescriptorSetLayoutCreateInfo inputDescriptorSetLayoutCreateInfo
+	// Previous frame may still be sampling the shadow map, the cache may still be copied from
+	shadowRenderPass_ = createRenderPass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	shadowCacheRenderPass_ = createRenderPass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	shadowLoadRenderPass_ = createRenderPass(VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	shadowMapImage_ = CreateImage(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, shadowMapImageFormat_, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Attachments, &shadowMapImageMemory_, SHADOW_CASCADE_COUNT);
+	shadowCacheImage_ = CreateImage(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, shadowMapImageFormat_, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Attachments, &shadowCacheImageMemory_, SHADOW_CASCADE_COUNT);
+
+	shadowMapImageView_ = CreateImageView(shadowMapImage_, shadowMapImageFormat_, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, SHADOW_CASCADE_COUNT);
+
+	// Render passes only differ in load operations and layouts, so all of them are compatible with these framebuffers
+	shadowMapLayerViews_.resize(SHADOW_CASCADE_COUNT);
+	shadowMapFramebuffers_.resize(SHADOW_CASCADE_COUNT);
+	shadowCacheLayerViews_.resize(SHADOW_CASCADE_COUNT);
+	shadowCacheFramebuffers_.resize(SHADOW_CASCADE_COUNT);
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		shadowMapLayerViews_[i] = CreateImageView(shadowMapImage_, shadowMapImageFormat_, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D, i, 1);
+		shadowCacheLayerViews_[i] = CreateImageView(shadowCacheImage_, shadowMapImageFormat_, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D, i, 1);
+
+		VkFramebufferCreateInfo framebufferCreateInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+			.renderPass = shadowRenderPass_,
+			.attachmentCount = 1,
+			.pAttachments = &shadowMapLayerViews_[i],
+			.width = SHADOW_MAP_SIZE,
+			.height = SHADOW_MAP_SIZE,
+			.layers = 1
+		};
+
+		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &shadowMapFramebuffers_[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a famebuffer.");
+		}
+
+		framebufferCreateInfo.pAttachments = &shadowCacheLayerViews_[i];
+		result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &shadowCacheFramebuffers_[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a famebuffer.");
+		}
+	}
+
+	// Hardware depth comparison with bilinear filtering, outside of a cascade nothing is shadowed
+	VkSamplerCreateInfo samplerCreateInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-		.bindingCount = static_cast<uint32_t>(inputDescriptorSetLayoutBindings.size()),
-		.pBindings = inputDescriptorSetLayoutBindings.data()
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+		.mipLodBias = 0.0f,
+		.anisotropyEnable = VK_FALSE,
+		.maxAnisotropy = 1,
+		.compareEnable = VK_TRUE,
+		.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
+		.minLod = 0.0f,
+		.maxLod = 0.0f,
+		.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+		.unnormalizedCoordinates = VK_FALSE,
 	};
 
-	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &inputDescriptorSetLayoutCreateInfo, nullptr, &inputDescriptorSetLayout_);
+	VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &shadowSampler_);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create a descriptor set.");
+		throw std::runtime_error("Failed to create a shadow map sampler.");
 	}
 }
 
-void VulkanRenderer::CreatePushConstantRange()
-{
-	pushConstantRange_ = VkPushConstantRange
-	{
-		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-		.offset = 0,
-		.size = sizeof(Model)
-	};
-}
-
-void VulkanRenderer::CreateCraphicsPipeline()
+void VulkanRenderer::CreateShadowPipeline()
 {
-	std::vector<char> vertexShaderCode = readBinaryFile("../shaders/vert.spv");
-	std::vector<char> fragmentShaderCode = readBinaryFile("../shaders/frag.spv");
-
+	// Depth only, positions are pulled from the position stream like in the depth pre-pass
+	std::vector<char> vertexShaderCode = readBinaryFile("../shaders/shadow_vert.spv");
 	VkShaderModule vertexShaderModule = CreateShaderModule(vertexShaderCode);
-	VkShaderModule fragmentShaderModule = CreateShaderModule(fragmentShaderCode);
 
 	VkPipelineShaderStageCreateInfo vertexShaderCreateInfo
 	{
@@ -722,58 +2169,14 @@ void VulkanRenderer::CreateCraphicsPipeline()
 		.module = vertexShaderModule,
 		.pName = "main"
 	};
-	VkPipelineShaderStageCreateInfo fragmentShaderCreateInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-		.module = fragmentShaderModule,
-		.pName = "main"
-	};
-
-	VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
-
-
-	uint32_t binding = 0;
-
-	VkVertexInputBindingDescription bindingDescription
-	{
-		.binding = binding,
-		.stride = sizeof(Vertex),
-		.inputRate = VK_VERTEX_INPUT_RATE_VERTEX
-	};
-
-	std::vector<VkVertexInputAttributeDescription> attributeDescriptions =
-	{
-		VkVertexInputAttributeDescription
-		{
-			.location = 0,
-			.binding = binding,
-			.format = VK_FORMAT_R32G32B32_SFLOAT,
-			.offset = offsetof(Vertex, position)
-		},
-		VkVertexInputAttributeDescription
-		{
-			.location = 1,
-			.binding = binding,
-			.format = VK_FORMAT_R32G32B32_SFLOAT,
-			.offset = offsetof(Vertex, color)
-		},
-		VkVertexInputAttributeDescription
-		{
-			.location = 2,
-			.binding = binding,
-			.format = VK_FORMAT_R32G32_SFLOAT,
-			.offset = offsetof(Vertex, texCoords)
-		}
-	};
 
 	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-		.vertexBindingDescriptionCount = 1,
-		.pVertexBindingDescriptions = &bindingDescription,
-		.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size()),
-		.pVertexAttributeDescriptions = attributeDescriptions.data()
+		.vertexBindingDescriptionCount = 0,
+		.pVertexBindingDescriptions = nullptr,
+		.vertexAttributeDescriptionCount = 0,
+		.pVertexAttributeDescriptions = nullptr
 	};
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo
@@ -787,8 +2190,8 @@ void VulkanRenderer::CreateCraphicsPipeline()
 	{
 		.x = 0,
 		.y = 0,
-		.width = static_cast<float>(swapchainExtent_.width),
-		.height = static_cast<float>(swapchainExtent_.height),
+		.width = static_cast<float>(SHADOW_MAP_SIZE),
+		.height = static_cast<float>(SHADOW_MAP_SIZE),
 		.minDepth = 0.0f,
 		.maxDepth = 1.0f
 	};
@@ -796,7 +2199,7 @@ void VulkanRenderer::CreateCraphicsPipeline()
 	VkRect2D scissor
 	{
 		.offset = VkOffset2D {.x = 0, .y = 0},
-		.extent = swapchainExtent_
+		.extent = VkExtent2D {.width = SHADOW_MAP_SIZE, .height = SHADOW_MAP_SIZE }
 	};
 
 	VkPipelineViewportStateCreateInfo viewportStateCreateInfo
@@ -808,21 +2211,7 @@ void VulkanRenderer::CreateCraphicsPipeline()
 		.pScissors = &scissor
 	};
 
-
-	//std::vector<VkDynamicState> dynamicStateEnables
-	//{
-	//	VK_DYNAMIC_STATE_VIEWPORT,
-	//	VK_DYNAMIC_STATE_SCISSOR
-	//};
-	//
-	//VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo
-	//{
-	//	.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-	//	.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size()),
-	//	.pDynamicStates = dynamicStateEnables.data()
-	//};
-
-
+	// Light projection isn't flipped on Y like the camera one, so the winding is mirrored. Bias keeps lit surfaces from shadowing themselves.
 	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
@@ -830,12 +2219,14 @@ void VulkanRenderer::CreateCraphicsPipeline()
 		.rasterizerDiscardEnable = VK_FALSE,
 		.polygonMode = VK_POLYGON_MODE_FILL,
 		.cullMode = VK_CULL_MODE_BACK_BIT,
-		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-		.depthBiasEnable = VK_FALSE,
+		.frontFace = VK_FRONT_FACE_CLOCKWISE,
+		.depthBiasEnable = VK_TRUE,
+		.depthBiasConstantFactor = 1.25f,
+		.depthBiasClamp = 0.0f,
+		.depthBiasSlopeFactor = 1.75f,
 		.lineWidth = 1.0f
 	};
 
-
 	VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
@@ -843,7 +2234,6 @@ void VulkanRenderer::CreateCraphicsPipeline()
 		.sampleShadingEnable = VK_FALSE
 	};
 
-
 	VkPipelineDepthStencilStateCreateInfo depthStencilStateCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
@@ -854,43 +2244,32 @@ void VulkanRenderer::CreateCraphicsPipeline()
 		.stencilTestEnable = VK_FALSE
 	};
 
-
-	// BlendingOp ( NewColor * SrcColorBlendFactor , OldColor * DstColorBlendFactor )
-	VkPipelineColorBlendAttachmentState colorBlendAttachmentState
-	{
-		.blendEnable = VK_TRUE,
-
-		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-		.colorBlendOp = VK_BLEND_OP_ADD,
-
-		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-		.alphaBlendOp = VK_BLEND_OP_ADD,
-
-		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
-	};
-
 	VkPipelineColorBlendStateCreateInfo colorBlendingCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
 		.logicOpEnable = VK_FALSE,
-		.attachmentCount = 1,
-		.pAttachments = &colorBlendAttachmentState
+		.attachmentCount = 0,
+		.pAttachments = nullptr
 	};
 
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts {descriptorSetLayout_, samplerDescriptorSetLayout_ };
+	// Cascade index
+	VkPushConstantRange pushConstantRange
+	{
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = sizeof(uint32_t)
+	};
 
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-		.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size()),
-		.pSetLayouts = descriptorSetLayouts.data(),
+		.setLayoutCount = 1,
+		.pSetLayouts = &descriptorSetLayout_,
 		.pushConstantRangeCount = 1,
-		.pPushConstantRanges = &pushConstantRange_
+		.pPushConstantRanges = &pushConstantRange
 	};
 
-	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout_);
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &shadowPipelineLayout_);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create a pipeline layout.");
@@ -899,8 +2278,8 @@ void VulkanRenderer::CreateCraphicsPipeline()
 	VkGraphicsPipelineCreateInfo graphicsPiplineCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-		.stageCount = 2,
-		.pStages = shaderStages,
+		.stageCount = 1,
+		.pStages = &vertexShaderCreateInfo,
 		.pVertexInputState = &vertexInputCreateInfo,
 		.pInputAssemblyState = &inputAssemblyCreateInfo,
 		.pViewportState = &viewportStateCreateInfo,
@@ -909,68 +2288,20 @@ void VulkanRenderer::CreateCraphicsPipeline()
 		.pDepthStencilState = &depthStencilStateCreateInfo,
 		.pColorBlendState = &colorBlendingCreateInfo,
 		.pDynamicState = nullptr,
-		.layout = pipelineLayout_,
-		.renderPass = renderPass_,
+		.layout = shadowPipelineLayout_,
+		.renderPass = shadowRenderPass_,
 		.subpass = 0,
 		.basePipelineHandle = VK_NULL_HANDLE,
 		.basePipelineIndex = -1
 	};
 
-	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &graphicsPiplineCreateInfo, nullptr, &graphicsPipeline_);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create a graphics pipeline.");
-	}
-
-	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
-	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
-
-
-	vertexShaderCode = readBinaryFile("../shaders/second_vert.spv");
-	fragmentShaderCode = readBinaryFile("../shaders/second_frag.spv");
-
-	vertexShaderModule = CreateShaderModule(vertexShaderCode);
-	fragmentShaderModule = CreateShaderModule(fragmentShaderCode);
-
-	vertexShaderCreateInfo.module = vertexShaderModule;
-	fragmentShaderCreateInfo.module = fragmentShaderModule;
-
-	VkPipelineShaderStageCreateInfo secondShaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
-
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
-	vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
-	vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
-	vertexInputCreateInfo.pVertexAttributeDescriptions = nullptr;
-
-	depthStencilStateCreateInfo.depthWriteEnable = VK_FALSE;
-
-	VkPipelineLayoutCreateInfo secondPipelineLayoutCreateInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-		.setLayoutCount = 1,
-		.pSetLayouts = &inputDescriptorSetLayout_,
-		.pushConstantRangeCount = 0,
-		.pPushConstantRanges = nullptr
-	};
-
-	result = vkCreatePipelineLayout(mainDevice.logicalDevice, &secondPipelineLayoutCreateInfo, nullptr, &secondPipelineLayout_);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create a pipeline layout.");
-	}
-
-	graphicsPiplineCreateInfo.pStages = secondShaderStages;
-	graphicsPiplineCreateInfo.layout = secondPipelineLayout_;
-	graphicsPiplineCreateInfo.subpass = 1;
-
-	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &graphicsPiplineCreateInfo, nullptr, &secondPipeline_);
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, pipelineCache_, 1, &graphicsPiplineCreateInfo, nullptr, &shadowPipeline_);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create a graphics pipeline.");
 	}
 
 	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
-	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
 }
 
 void VulkanRenderer::CreateColorBufferImages()
@@ -995,8 +2326,9 @@ void VulkanRenderer::CreateColorBufferImages()
 			swapchainExtent_.height,
 			colorBufferImageFormat_,
 			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			MemoryCategory::Attachments,
 			&colorBufferImagesMemory_[i]
 		);
 
@@ -1011,7 +2343,7 @@ void VulkanRenderer::CreateDepthBufferImages()
 		depthBufferImageFormat_ = ChooseSupportedFormat(
 			{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
 			VK_IMAGE_TILING_OPTIMAL,
-			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
 		);
 	}
 
@@ -1026,8 +2358,9 @@ void VulkanRenderer::CreateDepthBufferImages()
 			swapchainExtent_.height,
 			depthBufferImageFormat_,
 			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			MemoryCategory::Attachments,
 			&depthBufferImagesMemory_[i]
 		);
 
@@ -1035,6 +2368,66 @@ void VulkanRenderer::CreateDepthBufferImages()
 	}
 }
 
+void VulkanRenderer::CreateMsaaImages()
+{
+	const VkSampleCountFlagBits sampleCount = GetSceneSampleCount();
+	if (sampleCount == VK_SAMPLE_COUNT_1_BIT)
+	{
+		return;
+	}
+
+	// Samples only live during the render pass, lazily allocated memory lets tiled GPUs skip backing them at all
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(mainDevice.physicalDevice, &memoryProperties);
+	VkMemoryPropertyFlags memoryFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+		{
+			memoryFlags = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+			break;
+		}
+	}
+
+	msaaColorImages_.resize(swapchainImages_.size());
+	msaaColorImagesMemory_.resize(swapchainImages_.size());
+	msaaColorImageViews_.resize(swapchainImages_.size());
+	msaaDepthImages_.resize(swapchainImages_.size());
+	msaaDepthImagesMemory_.resize(swapchainImages_.size());
+	msaaDepthImageViews_.resize(swapchainImages_.size());
+
+	for (size_t i = 0; i < swapchainImages_.size(); i++)
+	{
+		msaaColorImages_[i] = CreateImage(
+			swapchainExtent_.width,
+			swapchainExtent_.height,
+			colorBufferImageFormat_,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			memoryFlags,
+			MemoryCategory::Attachments,
+			&msaaColorImagesMemory_[i],
+			1,
+			sampleCount
+		);
+		msaaColorImageViews_[i] = CreateImageView(msaaColorImages_[i], colorBufferImageFormat_, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		msaaDepthImages_[i] = CreateImage(
+			swapchainExtent_.width,
+			swapchainExtent_.height,
+			depthBufferImageFormat_,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			memoryFlags,
+			MemoryCategory::Attachments,
+			&msaaDepthImagesMemory_[i],
+			1,
+			sampleCount
+		);
+		msaaDepthImageViews_[i] = CreateImageView(msaaDepthImages_[i], depthBufferImageFormat_, VK_IMAGE_ASPECT_DEPTH_BIT);
+	}
+}
+
 void VulkanRenderer::CreateFramebuffers()
 {
 	swapchainFramebuffers_.resize(swapchainImages_.size());
@@ -1047,6 +2440,11 @@ void VulkanRenderer::CreateFramebuffers()
 			colorBufferImageViews_[i],
 			depthBufferImageViews_[i]
 		};
+		if (msaaColorImageViews_.empty() == false)
+		{
+			attachments.push_back(msaaColorImageViews_[i]);
+			attachments.push_back(msaaDepthImageViews_[i]);
+		}
 
 		VkFramebufferCreateInfo framebufferCreateInfo
 		{
@@ -1109,6 +2507,12 @@ void VulkanRenderer::CreateSynchronization()
 	imageAvailableSemaphores_.resize(MAX_FRAME_DRAWS);
 	renderFinishedSemaphores_.resize(MAX_FRAME_DRAWS);
 	drawFences_.resize(MAX_FRAME_DRAWS);
+	frameNumbers_.resize(MAX_FRAME_DRAWS, 0);
+
+	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
+	{
+		frameArenas_.emplace_back(FRAME_ARENA_SIZE);
+	}
 
 	VkSemaphoreCreateInfo semaphoreCreateInfo
 	{
@@ -1140,40 +2544,181 @@ void VulkanRenderer::CreateUniformBuffers()
 {
 	VkDeviceSize vpBuffersSize = sizeof(UboViewProjection);
 	//VkDeviceSize modelBuffersSize = modelUniformAlignment_ * MAX_OBJECTS;
+	VkDeviceSize objectBuffersSize = sizeof(ObjectData) * MAX_DRAWS;
+	VkDeviceSize indirectBuffersSize = sizeof(VkDrawIndexedIndirectCommand) * MAX_DRAWS * INDIRECT_DRAW_GROUP_COUNT;
+	VkDeviceSize skinPaletteBuffersSize = sizeof(glm::mat4) * MAX_SKIN_JOINTS;
+	VkDeviceSize lightBuffersSize = sizeof(Light) * MAX_LIGHTS;
+	VkDeviceSize clusterBuffersSize = sizeof(uint32_t) * CLUSTER_COUNT * (1 + MAX_CLUSTER_LIGHTS); // Light count, then light indices
+	VkDeviceSize textureFeedbackBuffersSize = sizeof(uint32_t) * maxTextureCount_;
 
 	vpUniformBuffer_.resize(swapchainImages_.size());
 	vpUniformBufferMemory_.resize(swapchainImages_.size());
 	//modelDynamicUniformBuffer_.resize(swapchainImages_.size());
 	//modelDynamicUniformBufferMemory_.resize(swapchainImages_.size());
+	objectBuffers_.resize(swapchainImages_.size());
+	objectBuffersMemory_.resize(swapchainImages_.size());
+	objectBuffersData_.resize(swapchainImages_.size());
+	indirectBuffers_.resize(swapchainImages_.size());
+	indirectBuffersMemory_.resize(swapchainImages_.size());
+	indirectBuffersData_.resize(swapchainImages_.size());
+	skinPaletteBuffers_.resize(swapchainImages_.size());
+	skinPaletteBuffersMemory_.resize(swapchainImages_.size());
+	skinPaletteBuffersData_.resize(swapchainImages_.size());
+	lightingUniformBuffers_.resize(swapchainImages_.size());
+	lightingUniformBuffersMemory_.resize(swapchainImages_.size());
+	lightingUniformBuffersData_.resize(swapchainImages_.size());
+	lightBuffers_.resize(swapchainImages_.size());
+	lightBuffersMemory_.resize(swapchainImages_.size());
+	lightBuffersData_.resize(swapchainImages_.size());
+	clusterBuffers_.resize(swapchainImages_.size());
+	clusterBuffersMemory_.resize(swapchainImages_.size());
+	textureFeedbackBuffers_.resize(swapchainImages_.size());
+	textureFeedbackBuffersMemory_.resize(swapchainImages_.size());
+	textureFeedbackBuffersData_.resize(swapchainImages_.size());
 
 	for (size_t i = 0; i < swapchainImages_.size(); i++)
 	{
 		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBuffersSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vpUniformBuffer_[i], &vpUniformBufferMemory_[i]);
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniforms, &vpUniformBuffer_[i], &vpUniformBufferMemory_[i]);
 
 		//createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelBuffersSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 		//	VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &modelDynamicUniformBuffer_[i], &modelDynamicUniformBufferMemory_[i]);
+
+		// Rewritten every frame, so they stay mapped
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, objectBuffersSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniforms, &objectBuffers_[i], &objectBuffersMemory_[i]);
+		vkMapMemory(mainDevice.logicalDevice, objectBuffersMemory_[i], 0, objectBuffersSize, 0, reinterpret_cast<void**>(&objectBuffersData_[i]));
+
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, indirectBuffersSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniforms, &indirectBuffers_[i], &indirectBuffersMemory_[i]);
+		vkMapMemory(mainDevice.logicalDevice, indirectBuffersMemory_[i], 0, indirectBuffersSize, 0, reinterpret_cast<void**>(&indirectBuffersData_[i]));
+
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, skinPaletteBuffersSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniforms, &skinPaletteBuffers_[i], &skinPaletteBuffersMemory_[i]);
+		vkMapMemory(mainDevice.logicalDevice, skinPaletteBuffersMemory_[i], 0, skinPaletteBuffersSize, 0, reinterpret_cast<void**>(&skinPaletteBuffersData_[i]));
+
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, sizeof(LightingData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniforms, &lightingUniformBuffers_[i], &lightingUniformBuffersMemory_[i]);
+		vkMapMemory(mainDevice.logicalDevice, lightingUniformBuffersMemory_[i], 0, sizeof(LightingData), 0, reinterpret_cast<void**>(&lightingUniformBuffersData_[i]));
+
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, lightBuffersSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniforms, &lightBuffers_[i], &lightBuffersMemory_[i]);
+		vkMapMemory(mainDevice.logicalDevice, lightBuffersMemory_[i], 0, lightBuffersSize, 0, reinterpret_cast<void**>(&lightBuffersData_[i]));
+
+		// Only touched by the GPU
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, clusterBuffersSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Uniforms, &clusterBuffers_[i], &clusterBuffersMemory_[i]);
+
+		// Read and reset by the CPU every frame
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, textureFeedbackBuffersSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniforms, &textureFeedbackBuffers_[i], &textureFeedbackBuffersMemory_[i]);
+		vkMapMemory(mainDevice.logicalDevice, textureFeedbackBuffersMemory_[i], 0, textureFeedbackBuffersSize, 0, reinterpret_cast<void**>(&textureFeedbackBuffersData_[i]));
+		std::fill_n(textureFeedbackBuffersData_[i], maxTextureCount_, TextureStreamer::NO_FEEDBACK);
+	}
+}
+
+void VulkanRenderer::CreateGeometryBuffer()
+{
+	geometryBuffer_ = std::make_unique<GeometryBuffer>(mainDevice.physicalDevice, mainDevice.logicalDevice, deletionQueue_,
+		GEOMETRY_VERTEX_CAPACITY, GEOMETRY_POSITION_CAPACITY, GEOMETRY_INDEX_CAPACITY, GEOMETRY_SKIN_VERTEX_CAPACITY);
+}
+
+void VulkanRenderer::CreateMeshStreamer()
+{
+	meshStreamer_ = std::make_unique<MeshStreamer>(geometryBuffer_.get(), mainDevice.logicalDevice, graphicsQueue_, CreateUploadCommandPool(),
+		meshStreamingBudget_);
+}
+
+void VulkanRenderer::CreateTextureStreamer()
+{
+	textureStreamer_ = std::make_unique<TextureStreamer>(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue_, CreateUploadCommandPool(),
+		textureStreamingBudget_);
+}
+
+void VulkanRenderer::CreateStatisticsQueryPool()
+{
+	if (pipelineStatisticsSupported_ == false)
+	{
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = static_cast<uint32_t>(swapchainImages_.size()),
+		.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+	};
+
+	VkResult result = vkCreateQueryPool(mainDevice.logicalDevice, &queryPoolCreateInfo, nullptr, &statisticsQueryPool_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a query pool.");
+	}
+
+	statisticsQueriesWritten_.resize(swapchainImages_.size(), false);
+}
+
+void VulkanRenderer::CreateTimestampQueryPool()
+{
+	// Written every frame, with or without timestamp support
+	frameRenderScales_.resize(swapchainImages_.size(), MAX_RENDER_SCALE);
+#ifdef ENABLE_PROFILING
+	frameSubmitTimes_.resize(swapchainImages_.size(), 0);
+#endif
+
+	if (timestampSupported_ == false)
+	{
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = static_cast<uint32_t>(swapchainImages_.size() * TIMESTAMP_COUNT)
+	};
+
+	VkResult result = vkCreateQueryPool(mainDevice.logicalDevice, &queryPoolCreateInfo, nullptr, &timestampQueryPool_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a query pool.");
 	}
+
+	timestampQueriesWritten_.resize(swapchainImages_.size(), false);
 }
 
 void VulkanRenderer::CreateDescriptorPools()
 {
+	// View projection and lighting data
 	VkDescriptorPoolSize vpDescriptorPoolSize
 	{
 		.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-		.descriptorCount = static_cast<uint32_t>(vpUniformBuffer_.size())
+		.descriptorCount = static_cast<uint32_t>(vpUniformBuffer_.size() * 2)
 	};
 	//VkDescriptorPoolSize modelDescriptorPoolSize
 	//{
 	//	.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 	//	.descriptorCount = static_cast<uint32_t>(modelDynamicUniformBuffer_.size())
 	//};
-	std::vector<VkDescriptorPoolSize> poolSizes { vpDescriptorPoolSize/*, modelDescriptorPoolSize*/ };
+	// Object buffer, geometry vertex and position buffers, lights, clusters and texture feedback, then the four buffers of the skinning set
+	VkDescriptorPoolSize storageDescriptorPoolSize
+	{
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = static_cast<uint32_t>(objectBuffers_.size() * (6 + 4))
+	};
+	// Shadow map
+	VkDescriptorPoolSize shadowMapDescriptorPoolSize
+	{
+		.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.descriptorCount = static_cast<uint32_t>(swapchainImages_.size())
+	};
+	std::vector<VkDescriptorPoolSize> poolSizes { vpDescriptorPoolSize, storageDescriptorPoolSize, shadowMapDescriptorPoolSize };
 
 	VkDescriptorPoolCreateInfo vpDescriptorPoolCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.maxSets = static_cast<uint32_t>(swapchainImages_.size()),
+		.maxSets = static_cast<uint32_t>(swapchainImages_.size() * 2),
 		.poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
 		.pPoolSizes = poolSizes.data()
 	};
@@ -1188,13 +2733,14 @@ void VulkanRenderer::CreateDescriptorPools()
 	VkDescriptorPoolSize samplerDescriptorPoolSize
 	{
 		.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.descriptorCount = MAX_OBJECTS
+		.descriptorCount = maxTextureCount_
 	};
 
 	VkDescriptorPoolCreateInfo samplerDescriptorPoolCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.maxSets = MAX_OBJECTS,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+		.maxSets = 1,
 		.poolSizeCount = 1,
 		.pPoolSizes = &samplerDescriptorPoolSize
 	};
@@ -1210,13 +2756,13 @@ void VulkanRenderer::CreateDescriptorPools()
 		// Color attachment
 		VkDescriptorPoolSize
 		{
-			.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 			.descriptorCount = static_cast<uint32_t>(colorBufferImageViews_.size())
 		},
 		// Depth attachment
 		VkDescriptorPoolSize
 		{
-			.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 			.descriptorCount = static_cast<uint32_t>(depthBufferImageViews_.size())
 		}
 	};
@@ -1270,6 +2816,24 @@ void VulkanRenderer::CreateDescriptorSets()
 		//	.offset = 0,
 		//	.range = modelUniformAlignment_
 		//};
+		VkDescriptorBufferInfo objectBufferInfo
+		{
+			.buffer = objectBuffers_[i],
+			.offset = 0,
+			.range = VK_WHOLE_SIZE
+		};
+		VkDescriptorBufferInfo vertexBufferInfo
+		{
+			.buffer = geometryBuffer_->GetVertexBuffer(),
+			.offset = 0,
+			.range = VK_WHOLE_SIZE
+		};
+		VkDescriptorBufferInfo positionBufferInfo
+		{
+			.buffer = geometryBuffer_->GetPositionBuffer(),
+			.offset = 0,
+			.range = VK_WHOLE_SIZE
+		};
 
 		VkWriteDescriptorSet vpSetWrite
 		{
@@ -1291,7 +2855,138 @@ void VulkanRenderer::CreateDescriptorSets()
 		//	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 		//	.pBufferInfo = &modelBufferInfo
 		//};
-		std::vector<VkWriteDescriptorSet> writeDescriptorSets { vpSetWrite/*, modelSetWrite*/ };
+		VkWriteDescriptorSet objectSetWrite
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = descriptorSets_[i],
+			.dstBinding = 1,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &objectBufferInfo
+		};
+		VkWriteDescriptorSet vertexSetWrite
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = descriptorSets_[i],
+			.dstBinding = 2,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &vertexBufferInfo
+		};
+		VkWriteDescriptorSet positionSetWrite
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = descriptorSets_[i],
+			.dstBinding = 3,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &positionBufferInfo
+		};
+		VkDescriptorBufferInfo lightingBufferInfos[]
+		{
+			VkDescriptorBufferInfo { .buffer = lightingUniformBuffers_[i], .offset = 0, .range = sizeof(LightingData) },
+			VkDescriptorBufferInfo { .buffer = lightBuffers_[i], .offset = 0, .range = VK_WHOLE_SIZE },
+			VkDescriptorBufferInfo { .buffer = clusterBuffers_[i], .offset = 0, .range = VK_WHOLE_SIZE }
+		};
+
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets { vpSetWrite, objectSetWrite, vertexSetWrite, positionSetWrite };
+		for (uint32_t j = 0; j < std::size(lightingBufferInfos); j++)
+		{
+			writeDescriptorSets.push_back(VkWriteDescriptorSet
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = descriptorSets_[i],
+				.dstBinding = 4 + j,
+				.dstArrayElement = 0,
+				.descriptorCount = 1,
+				.descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				.pBufferInfo = &lightingBufferInfos[j]
+			});
+		}
+
+		VkDescriptorImageInfo shadowMapImageInfo
+		{
+			.sampler = shadowSampler_,
+			.imageView = shadowMapImageView_,
+			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		};
+		writeDescriptorSets.push_back(VkWriteDescriptorSet
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = descriptorSets_[i],
+			.dstBinding = 7,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.pImageInfo = &shadowMapImageInfo
+		});
+
+		VkDescriptorBufferInfo textureFeedbackBufferInfo
+		{
+			.buffer = textureFeedbackBuffers_[i],
+			.offset = 0,
+			.range = VK_WHOLE_SIZE
+		};
+		writeDescriptorSets.push_back(VkWriteDescriptorSet
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = descriptorSets_[i],
+			.dstBinding = 8,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &textureFeedbackBufferInfo
+		});
+
+		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	}
+
+
+	std::vector<VkDescriptorSetLayout> skinningDescriptorSetLayouts(swapchainImages_.size(), skinningDescriptorSetLayout_);
+
+	VkDescriptorSetAllocateInfo skinningDescriptorSetAllocateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = descriptorPool_,
+		.descriptorSetCount = static_cast<uint32_t>(swapchainImages_.size()),
+		.pSetLayouts = skinningDescriptorSetLayouts.data()
+	};
+
+	skinningDescriptorSets_.resize(swapchainImages_.size());
+
+	result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &skinningDescriptorSetAllocateInfo, skinningDescriptorSets_.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate descriptor sets.");
+	}
+
+	for (size_t i = 0; i < skinningDescriptorSets_.size(); i++)
+	{
+		VkDescriptorBufferInfo bufferInfos[]
+		{
+			VkDescriptorBufferInfo { .buffer = skinPaletteBuffers_[i], .offset = 0, .range = VK_WHOLE_SIZE },
+			VkDescriptorBufferInfo { .buffer = geometryBuffer_->GetSkinVertexBuffer(), .offset = 0, .range = VK_WHOLE_SIZE },
+			VkDescriptorBufferInfo { .buffer = geometryBuffer_->GetVertexBuffer(), .offset = 0, .range = VK_WHOLE_SIZE },
+			VkDescriptorBufferInfo { .buffer = geometryBuffer_->GetPositionBuffer(), .offset = 0, .range = VK_WHOLE_SIZE }
+		};
+
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets(std::size(bufferInfos));
+		for (uint32_t j = 0; j < writeDescriptorSets.size(); j++)
+		{
+			writeDescriptorSets[j] = VkWriteDescriptorSet
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = skinningDescriptorSets_[i],
+				.dstBinding = j,
+				.dstArrayElement = 0,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				.pBufferInfo = &bufferInfos[j]
+			};
+		}
 
 		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
 	}
@@ -1314,76 +3009,250 @@ void VulkanRenderer::CreateInputDescriptorSets()
 	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocateInfo, inputDescriptorSets_.data());
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to allocate input attachments descriptor sets.");
+		throw std::runtime_error("Failed to allocate input attachments descriptor sets.");
+	}
+
+	for (size_t i = 0; i < inputDescriptorSets_.size(); i++)
+	{
+		VkDescriptorImageInfo colorAttachmentDescriptorInfo
+		{
+			.sampler = compositeSampler_,
+			.imageView = colorBufferImageViews_[i],
+			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		};
+		VkWriteDescriptorSet colorWriteDescriptorSet
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = inputDescriptorSets_[i],
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.pImageInfo = &colorAttachmentDescriptorInfo
+		};
+
+		VkDescriptorImageInfo depthAttachmentDescriptorInfo
+		{
+			.sampler = compositeSampler_,
+			.imageView = depthBufferImageViews_[i],
+			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		};
+		VkWriteDescriptorSet depthWriteDescriptorSet
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = inputDescriptorSets_[i],
+			.dstBinding = 1,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.pImageInfo = &depthAttachmentDescriptorInfo
+		};
+
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets { colorWriteDescriptorSet, depthWriteDescriptorSet };
+
+		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	}
+}
+
+void VulkanRenderer::CreateTextureSampler()
+{
+	VkSamplerCreateInfo samplerCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.mipLodBias = 0.0f,
+		.anisotropyEnable = VK_TRUE,
+		.maxAnisotropy = 16,
+		.minLod = 0.0f,
+		.maxLod = VK_LOD_CLAMP_NONE, // Streamed textures have mips, the others have a single one
+		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+		.unnormalizedCoordinates = VK_FALSE,
+	};
+
+	VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &textureSampler_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a texture sampler.");
+	}
+
+	// Upscaling filter of the composite, clamped so the rendered part of the attachments doesn't blend with the rest
+	VkSamplerCreateInfo compositeSamplerCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.mipLodBias = 0.0f,
+		.anisotropyEnable = VK_FALSE,
+		.maxAnisotropy = 1,
+		.minLod = 0.0f,
+		.maxLod = 0.0f,
+		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+		.unnormalizedCoordinates = VK_FALSE,
+	};
+
+	result = vkCreateSampler(mainDevice.logicalDevice, &compositeSamplerCreateInfo, nullptr, &compositeSampler_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a composite sampler.");
+	}
+}
+
+void VulkanRenderer::CreateTextureDescriptorSet()
+{
+	VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountAllocateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+		.descriptorSetCount = 1,
+		.pDescriptorCounts = &maxTextureCount_
+	};
+
+	VkDescriptorSetAllocateInfo descriptorSetAllocateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = &variableCountAllocateInfo,
+		.descriptorPool = samplerDescriptorPool_,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &samplerDescriptorSetLayout_
+	};
+
+	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocateInfo, &textureDescriptorSet_);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate texture descriptor set.");
+	}
+}
+
+void VulkanRenderer::CreatePlaceholderTexture()
+{
+	// 1x1 white texture, drawn instead of textures which are not loaded yet
+	const stbi_uc whitePixel[4] = { 255, 255, 255, 255 };
+
+	placeholderTextureId_ = AllocateTextureSlot();
+
+	// Own pool, graphics command pool may be in use by other init steps
+	VkCommandPool uploadCommandPool = CreateUploadCommandPool();
+
+	VkDeviceMemory textureImageMemory;
+	VkImage textureImage;
+	try
+	{
+		textureImage = CreateTextureImage(whitePixel, 1, 1, uploadCommandPool, &textureImageMemory);
+	}
+	catch (...)
+	{
+		vkDestroyCommandPool(mainDevice.logicalDevice, uploadCommandPool, nullptr);
+		throw;
+	}
+	vkDestroyCommandPool(mainDevice.logicalDevice, uploadCommandPool, nullptr);
+
+	textureImagesMemory_[placeholderTextureId_] = UniqueDeviceMemory(mainDevice.logicalDevice, textureImageMemory);
+	textureImages_[placeholderTextureId_] = UniqueImage(mainDevice.logicalDevice, textureImage);
+
+	VkImageView textureImageView = CreateImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+	textureImageViews_[placeholderTextureId_] = UniqueImageView(mainDevice.logicalDevice, textureImageView);
+
+	CreateTextureDescriptor(placeholderTextureId_, textureImageView);
+
+	textureCache_[placeholderTextureId_].refCount = 1;
+}
+
+void VulkanRenderer::DestroySceneTargets()
+{
+	for (VkFramebuffer framebuffer : swapchainFramebuffers_)
+	{
+		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+	}
+
+	for (size_t i = 0; i < msaaColorImages_.size(); i++)
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, msaaDepthImageViews_[i], nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, msaaDepthImages_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, msaaDepthImagesMemory_[i], nullptr);
+		vkDestroyImageView(mainDevice.logicalDevice, msaaColorImageViews_[i], nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, msaaColorImages_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, msaaColorImagesMemory_[i], nullptr);
+	}
+	msaaColorImages_.clear();
+	msaaColorImagesMemory_.clear();
+	msaaColorImageViews_.clear();
+	msaaDepthImages_.clear();
+	msaaDepthImagesMemory_.clear();
+	msaaDepthImageViews_.clear();
+
+	for (size_t i = 0; i < depthBufferImages_.size(); i++)
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageViews_[i], nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, depthBufferImages_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, depthBufferImagesMemory_[i], nullptr);
 	}
 
-	for (size_t i = 0; i < inputDescriptorSets_.size(); i++)
+	for (size_t i = 0; i < colorBufferImages_.size(); i++)
 	{
-		VkDescriptorImageInfo colorAttachmentDescriptorInfo
-		{
-			.sampler = VK_NULL_HANDLE,
-			.imageView = colorBufferImageViews_[i],
-			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		};
-		VkWriteDescriptorSet colorWriteDescriptorSet
-		{
-			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-			.dstSet = inputDescriptorSets_[i],
-			.dstBinding = 0,
-			.dstArrayElement = 0,
-			.descriptorCount = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-			.pImageInfo = &colorAttachmentDescriptorInfo
-		};
+		vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageViews_[i], nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, colorBufferImages_[i], nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, colorBufferImagesMemory_[i], nullptr);
+	}
 
-		VkDescriptorImageInfo depthAttachmentDescriptorInfo
-		{
-			.sampler = VK_NULL_HANDLE,
-			.imageView = depthBufferImageViews_[i],
-			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		};
-		VkWriteDescriptorSet depthWriteDescriptorSet
-		{
-			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-			.dstSet = inputDescriptorSets_[i],
-			.dstBinding = 1,
-			.dstArrayElement = 0,
-			.descriptorCount = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-			.pImageInfo = &depthAttachmentDescriptorInfo
-		};
+	vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline_, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, depthEqualPipeline_, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, depthPrePassPipeline_, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline_, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipelineLayout_, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout_, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass_, nullptr);
+}
 
-		std::vector<VkWriteDescriptorSet> writeDescriptorSets { colorWriteDescriptorSet, depthWriteDescriptorSet };
+void VulkanRenderer::RecreateSceneTargets()
+{
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
 
-		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
-	}
+	DestroySceneTargets();
+
+	CreateRenderPass();
+	CreateColorBufferImages();
+	CreateDepthBufferImages();
+	CreateMsaaImages();
+	CreateFramebuffers();
+	CreateCraphicsPipeline();
+
+	// Composite sets point at the recreated color and depth buffers
+	vkResetDescriptorPool(mainDevice.logicalDevice, inputDescriptorPool_, 0);
+	CreateInputDescriptorSets();
 }
 
-void VulkanRenderer::CreateTextureSampler()
+VkSampleCountFlagBits VulkanRenderer::GetSceneSampleCount() const
 {
-	VkSamplerCreateInfo samplerCreateInfo
+	return antiAliasingMode_ == AntiAliasingMode::Msaa ? msaaSampleCount_ : VK_SAMPLE_COUNT_1_BIT;
+}
+
+VkCommandPool VulkanRenderer::CreateUploadCommandPool()
+{
+	QueueFamilyIndices queueFamilyIndices = GetQueueFamilies(mainDevice.physicalDevice);
+
+	VkCommandPoolCreateInfo commandPoolCreateInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-		.magFilter = VK_FILTER_LINEAR,
-		.minFilter = VK_FILTER_LINEAR,
-		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-		.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-		.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-		.mipLodBias = 0.0f,
-		.anisotropyEnable = VK_TRUE,
-		.maxAnisotropy = 16,
-		.minLod = 0.0f,
-		.maxLod = 0.0f,
-		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
-		.unnormalizedCoordinates = VK_FALSE,
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = static_cast<uint32_t>(queueFamilyIndices.graphicsFamily)
 	};
 
-	VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &textureSampler_);
+	VkCommandPool commandPool;
+	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &commandPoolCreateInfo, nullptr, &commandPool);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create a texture sampler.");
+		throw std::runtime_error("Failed to create an upload command pool.");
 	}
+
+	return commandPool;
 }
 
 
@@ -1507,7 +3376,29 @@ bool VulkanRenderer::CheckPhysicalDeviceSuitable(VkPhysicalDevice device)
 		return false;
 	}
 
-	if (features.samplerAnisotropy == VK_FALSE)
+	if (features.samplerAnisotropy == VK_FALSE || features.multiDrawIndirect == VK_FALSE || features.drawIndirectFirstInstance == VK_FALSE ||
+		features.fragmentStoresAndAtomics == VK_FALSE)
+	{
+		return false;
+	}
+
+	VkPhysicalDeviceVulkan12Features vulkan12Features
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+	};
+	VkPhysicalDeviceFeatures2 features2
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &vulkan12Features
+	};
+	vkGetPhysicalDeviceFeatures2(device, &features2);
+
+	if (vulkan12Features.runtimeDescriptorArray == VK_FALSE ||
+		vulkan12Features.descriptorBindingPartiallyBound == VK_FALSE ||
+		vulkan12Features.descriptorBindingVariableDescriptorCount == VK_FALSE ||
+		vulkan12Features.descriptorBindingSampledImageUpdateAfterBind == VK_FALSE ||
+		vulkan12Features.descriptorBindingUpdateUnusedWhilePending == VK_FALSE ||
+		vulkan12Features.shaderSampledImageArrayNonUniformIndexing == VK_FALSE)
 	{
 		return false;
 	}
@@ -1518,12 +3409,18 @@ bool VulkanRenderer::CheckPhysicalDeviceSuitable(VkPhysicalDevice device)
 
 void VulkanRenderer::RecordCommands(uint32_t imageIndex)
 {
+	PROFILE_SCOPE("RecordCommands");
+
 	VkCommandBufferBeginInfo commandBufferBeginInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
 	};
 
-	std::vector<VkClearValue> clearValues
+	FrameArena& frameArena = frameArenas_[currentFrame_];
+
+	// Room for the multisampled attachments
+	FrameVector<VkClearValue> clearValues = makeFrameVector<VkClearValue>(frameArena, 5);
+	clearValues.assign(
 	{
 		//VkClearValue
 		//{
@@ -1544,85 +3441,628 @@ void VulkanRenderer::RecordCommands(uint32_t imageIndex)
 				.depth = 1.0f
 			}
 		}
-	};
+	});
+	// Multisampled attachments are cleared instead of their resolve targets
+	if (GetSceneSampleCount() != VK_SAMPLE_COUNT_1_BIT)
+	{
+		clearValues.push_back(clearValues[1]);
+		clearValues.push_back(clearValues[2]);
+	}
 
 	VkRenderPassBeginInfo renderPassBeginInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-		.renderPass = renderPass_,
-		.renderArea = VkRect2D
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.renderPass = renderPass_,
+		.renderArea = VkRect2D
+		{
+			.offset = VkOffset2D { 0, 0 },
+			.extent = swapchainExtent_
+		},
+		.clearValueCount = static_cast<uint32_t>(clearValues.size()),
+		.pClearValues = clearValues.data()
+	};
+
+	renderPassBeginInfo.framebuffer = swapchainFramebuffers_[imageIndex];
+
+	const VkCommandBuffer& commandBuffer = commandBuffers_[imageIndex];
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording a command buffer.");
+	}
+
+	if (statisticsQueryPool_ != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, statisticsQueryPool_, imageIndex, 1);
+		statisticsQueriesWritten_[imageIndex] = true;
+	}
+	if (timestampQueryPool_ != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, timestampQueryPool_, imageIndex * TIMESTAMP_COUNT, TIMESTAMP_COUNT);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool_, imageIndex * TIMESTAMP_COUNT + TIMESTAMP_FRAME_BEGIN);
+		timestampQueriesWritten_[imageIndex] = true;
+	}
+
+	// Light clusters are tiled over the rendered part of the attachments
+	const VkExtent2D renderExtent = GetRenderExtent();
+	frameRenderScales_[imageIndex] = renderScale_;
+	lightingData_.viewport.x = static_cast<float>(renderExtent.width);
+	lightingData_.viewport.y = static_cast<float>(renderExtent.height);
+
+	// Draws are grouped by index type, pre-pass and shadow draws are the same except they index into the position stream
+	ObjectData* objects = objectBuffersData_[imageIndex];
+	VkDrawIndexedIndirectCommand* shortDraws = indirectBuffersData_[imageIndex];
+	VkDrawIndexedIndirectCommand* longDraws = shortDraws + MAX_DRAWS;
+	VkDrawIndexedIndirectCommand* shortDepthDraws = shortDraws + MAX_DRAWS * 2;
+	VkDrawIndexedIndirectCommand* longDepthDraws = shortDraws + MAX_DRAWS * 3;
+	VkDrawIndexedIndirectCommand* staticShadowDraws[] = { shortDraws + MAX_DRAWS * 4, shortDraws + MAX_DRAWS * 5 };
+	VkDrawIndexedIndirectCommand* dynamicShadowDraws[] = { shortDraws + MAX_DRAWS * 6, shortDraws + MAX_DRAWS * 7 };
+	uint32_t objectCount = 0;
+	uint32_t shortDrawCount = 0;
+	uint32_t longDrawCount = 0;
+	uint32_t staticShadowDrawCounts[] = { 0, 0 };
+	uint32_t dynamicShadowDrawCounts[] = { 0, 0 };
+
+	// Skinned meshes get one dispatch each, its output is then read by every pass
+	glm::mat4* palettes = skinPaletteBuffersData_[imageIndex];
+	uint32_t paletteSize = 0;
+	size_t meshCount = 0;
+	for (const MeshModel& model : models_)
+	{
+		meshCount += model.GetMeshCount();
+	}
+	const size_t maxDrawCount = std::min<size_t>(meshCount, MAX_DRAWS);
+	FrameVector<SkinningDispatch> skinningDispatches = makeFrameVector<SkinningDispatch>(frameArena, maxDrawCount);
+
+	// Streamed meshes are drawn at full detail where it's resident, cached static shadows are redrawn when a level of detail switches
+	if (meshStreamer_->BeginFrame(uboViewProjection_.projection * uboViewProjection_.view, glm::vec3(glm::inverse(uboViewProjection_.view)[3])))
+	{
+		shadowCacheDirty_ = true;
+	}
+
+	{
+		std::lock_guard<std::mutex> textureLock(textureMutex_);
+
+		// Slots are handed out in model order first, then the buffers are filled in parallel since every draw knows where it goes
+		FrameVector<DrawSlot> drawSlots = makeFrameVector<DrawSlot>(frameArena, maxDrawCount);
+		size_t droppedMeshCount = 0;
+		for (size_t j = 0; j < models_.size(); j++)
+		{
+			const MeshModel& model = models_[j];
+
+			for (size_t k = 0; k < model.GetMeshCount(); k++)
+			{
+				// Object and indirect buffers are full
+				if (objectCount == MAX_DRAWS)
+				{
+					droppedMeshCount++;
+					continue;
+				}
+
+				const Mesh& mesh = model.GetMesh(k);
+				MeshDrawRange drawRange = mesh.GetDrawRange();
+				if (mesh.GetStreamId() >= 0)
+				{
+					meshStreamer_->Request(mesh.GetStreamId(), model.GetMeshTransform(k), &drawRange);
+				}
+				if (drawRange.indexCount == 0)
+				{
+					continue;
+				}
+
+				uint32_t paletteOffset = 0;
+				if (mesh.IsSkinned())
+				{
+					// Without palette space the mesh would be drawn with last frame's vertices
+					const uint32_t jointCount = model.GetSkinJointCount(k);
+					if (paletteSize + jointCount > MAX_SKIN_JOINTS)
+					{
+						continue;
+					}
+
+					paletteOffset = paletteSize;
+					skinningDispatches.push_back(SkinningDispatch
+					{
+						.paletteOffset = paletteSize,
+						.sourceOffset = mesh.GetSkinVertexOffset(),
+						.vertexOffset = static_cast<uint32_t>(mesh.GetVertexOffset()),
+						.positionOffset = static_cast<uint32_t>(mesh.GetPositionOffset()),
+						.vertexCount = static_cast<uint32_t>(mesh.GetVertexCount())
+					});
+					paletteSize += jointCount;
+				}
+
+				// Skinned meshes move with their animation even if the model itself stays
+				const size_t indexTypeGroup = mesh.GetIndexType() == VK_INDEX_TYPE_UINT16 ? 0 : 1;
+				const bool staticShadow = model.IsStatic() && mesh.IsSkinned() == false;
+
+				drawSlots.push_back(DrawSlot
+				{
+					.model = static_cast<uint32_t>(j),
+					.mesh = static_cast<uint32_t>(k),
+					.draw = indexTypeGroup == 0 ? shortDrawCount++ : longDrawCount++,
+					.shadowDraw = staticShadow ? staticShadowDrawCounts[indexTypeGroup]++ : dynamicShadowDrawCounts[indexTypeGroup]++,
+					.paletteOffset = paletteOffset,
+					.range = drawRange
+				});
+				objectCount++;
+			}
+		}
+		if (droppedMeshCount > 0 && drawLimitReported_ == false)
+		{
+			printf("Error: Draw limit of %u reached, %zu meshes aren't drawn.\n", MAX_DRAWS, droppedMeshCount);
+			drawLimitReported_ = true;
+		}
+
+		getJobSystem().ParallelFor(drawSlots.size(), DRAW_FILL_BATCH_SIZE, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const DrawSlot& slot = drawSlots[i];
+				const MeshModel& model = models_[slot.model];
+				const Mesh& mesh = model.GetMesh(slot.mesh);
+
+				if (mesh.IsSkinned())
+				{
+					std::copy_n(model.GetSkinPalette(slot.mesh), model.GetSkinJointCount(slot.mesh), palettes + slot.paletteOffset);
+				}
+
+				objects[i] = ObjectData
+				{
+					.model = model.GetMeshTransform(slot.mesh),
+					.quantization = mesh.GetVertexQuantization(),
+					.textureIndex = GetTextureIndex(mesh.GetTextureId()),
+					.normalTextureIndex = GetNormalTextureIndex(mesh.GetNormalTextureId()),
+					.vertexFormat = mesh.GetVertexFormat()
+				};
+
+				VkDrawIndexedIndirectCommand draw
+				{
+					.indexCount = slot.range.indexCount,
+					.instanceCount = 1,
+					.firstIndex = slot.range.firstIndex,
+					.vertexOffset = slot.range.vertexOffset,
+					.firstInstance = static_cast<uint32_t>(i)
+				};
+				VkDrawIndexedIndirectCommand depthDraw = draw;
+				depthDraw.vertexOffset = slot.range.positionOffset;
+
+				const size_t indexTypeGroup = mesh.GetIndexType() == VK_INDEX_TYPE_UINT16 ? 0 : 1;
+				if (indexTypeGroup == 0)
+				{
+					shortDepthDraws[slot.draw] = depthDraw;
+					shortDraws[slot.draw] = draw;
+				}
+				else
+				{
+					longDepthDraws[slot.draw] = depthDraw;
+					longDraws[slot.draw] = draw;
+				}
+
+				if (model.IsStatic() && mesh.IsSkinned() == false)
+				{
+					staticShadowDraws[indexTypeGroup][slot.shadowDraw] = depthDraw;
+				}
+				else
+				{
+					dynamicShadowDraws[indexTypeGroup][slot.shadowDraw] = depthDraw;
+				}
+			}
+		});
+	}
+
+	// Ranges evicted here are still drawn by this frame, they are freed through the deletion queue
+	meshStreamer_->EndFrame();
+
+	RecordSkinning(commandBuffer, imageIndex, skinningDispatches);
+	RecordLightCulling(commandBuffer, imageIndex);
+
+	if (timestampQueryPool_ != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool_, imageIndex * TIMESTAMP_COUNT + TIMESTAMP_SHADOWS_BEGIN);
+	}
+	RecordShadows(commandBuffer, imageIndex, staticShadowDrawCounts[0], staticShadowDrawCounts[1], dynamicShadowDrawCounts[0], dynamicShadowDrawCounts[1]);
+	if (timestampQueryPool_ != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool_, imageIndex * TIMESTAMP_COUNT + TIMESTAMP_SHADOWS_END);
+	}
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	{
+		// Bound once, draws find their ObjectData through the first instance index
+		//uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment_) * j;
+		//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout_, 0, 1, &descriptorSets_[imageIndex], 1, &dynamicOffset);
+		VkDescriptorSet descriptorSetGroup[] = { descriptorSets_[imageIndex], textureDescriptorSet_ };
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout_, 0, 2, descriptorSetGroup, 0, nullptr);
+
+		VkViewport viewport
+		{
+			.x = 0.0f,
+			.y = 0.0f,
+			.width = static_cast<float>(renderExtent.width),
+			.height = static_cast<float>(renderExtent.height),
+			.minDepth = 0.0f,
+			.maxDepth = 1.0f
+		};
+		VkRect2D scissor
+		{
+			.offset = VkOffset2D { 0, 0 },
+			.extent = renderExtent
+		};
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		const bool statisticsQueried = statisticsQueryPool_ != VK_NULL_HANDLE;
+		if (statisticsQueried)
+		{
+			vkCmdBeginQuery(commandBuffer, statisticsQueryPool_, imageIndex, 0);
+		}
+
+		if (depthPrePassEnabled_)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePassPipeline_);
+			DrawIndirectGroups(commandBuffer, imageIndex, 2, shortDrawCount, longDrawCount);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthEqualPipeline_);
+		}
+		else
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline_);
+		}
+		DrawIndirectGroups(commandBuffer, imageIndex, 0, shortDrawCount, longDrawCount);
+
+		if (statisticsQueried)
+		{
+			vkCmdEndQuery(commandBuffer, statisticsQueryPool_, imageIndex);
+		}
+
+		vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline_);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout_, 0, 1, &inputDescriptorSets_[imageIndex], 0, nullptr);
+
+		// Composite covers the whole output and upscales the rendered part
+		viewport.width = static_cast<float>(swapchainExtent_.width);
+		viewport.height = static_cast<float>(swapchainExtent_.height);
+		scissor.extent = swapchainExtent_;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		const CompositeConstants compositeConstants
+		{
+			.renderArea = glm::vec4(renderExtent.width, renderExtent.height, swapchainExtent_.width, swapchainExtent_.height),
+			.fxaaEnabled = antiAliasingMode_ == AntiAliasingMode::Fxaa ? 1u : 0u
+		};
+		vkCmdPushConstants(commandBuffer, secondPipelineLayout_, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(CompositeConstants), &compositeConstants);
+		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+	}
+	vkCmdEndRenderPass(commandBuffer);
+
+	// Texture feedback is read on the host once this image comes around again
+	VkMemoryBarrier textureFeedbackBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT
+	};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &textureFeedbackBarrier, 0, nullptr, 0, nullptr);
+
+	if (timestampQueryPool_ != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool_, imageIndex * TIMESTAMP_COUNT + TIMESTAMP_FRAME_END);
+	}
+
+	result = vkEndCommandBuffer(commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to stop recording a command buffer.");
+	}
+}
+
+void VulkanRenderer::RecordSkinning(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FrameVector<SkinningDispatch>& dispatches)
+{
+	if (dispatches.empty())
+	{
+		return;
+	}
+
+	// Output ranges may still be read by the previous frame's vertex shaders
+	VkMemoryBarrier readBeforeWriteBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT
+	};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &readBeforeWriteBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinningPipeline_);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinningPipelineLayout_, 0, 1, &skinningDescriptorSets_[imageIndex], 0, nullptr);
+
+	for (const SkinningDispatch& dispatch : dispatches)
+	{
+		vkCmdPushConstants(commandBuffer, skinningPipelineLayout_, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SkinningDispatch), &dispatch);
+		vkCmdDispatch(commandBuffer, (dispatch.vertexCount + SKINNING_GROUP_SIZE - 1) / SKINNING_GROUP_SIZE, 1, 1);
+	}
+
+	VkMemoryBarrier writeBeforeReadBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+	};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0,
+		1, &writeBeforeReadBarrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanRenderer::RecordLightCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	// Cluster lists of this image may still be read by its previous frame
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullingPipeline_);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullingPipelineLayout_, 0, 1, &descriptorSets_[imageIndex], 0, nullptr);
+	vkCmdDispatch(commandBuffer, (CLUSTER_COUNT + LIGHT_CULLING_GROUP_SIZE - 1) / LIGHT_CULLING_GROUP_SIZE, 1, 1);
+
+	VkMemoryBarrier writeBeforeReadBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+	};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		1, &writeBeforeReadBarrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanRenderer::RecordShadows(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t staticShortDrawCount, uint32_t staticLongDrawCount,
+	uint32_t dynamicShortDrawCount, uint32_t dynamicLongDrawCount)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline_);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout_, 0, 1, &descriptorSets_[imageIndex], 0, nullptr);
+
+	VkClearValue clearValue
+	{
+		.depthStencil = VkClearDepthStencilValue
+		{
+			.depth = 1.0f
+		}
+	};
+
+	auto drawCascade = [&](VkRenderPass renderPass, VkFramebuffer framebuffer, uint32_t cascade, bool staticCasters, bool dynamicCasters)
+	{
+		VkRenderPassBeginInfo renderPassBeginInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+			.renderPass = renderPass,
+			.framebuffer = framebuffer,
+			.renderArea = VkRect2D
+			{
+				.offset = VkOffset2D { 0, 0 },
+				.extent = VkExtent2D { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE }
+			},
+			.clearValueCount = 1,
+			.pClearValues = &clearValue
+		};
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdPushConstants(commandBuffer, shadowPipelineLayout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &cascade);
+		if (staticCasters)
+		{
+			DrawIndirectGroups(commandBuffer, imageIndex, 4, staticShortDrawCount, staticLongDrawCount);
+		}
+		if (dynamicCasters)
+		{
+			DrawIndirectGroups(commandBuffer, imageIndex, 6, dynamicShortDrawCount, dynamicLongDrawCount);
+		}
+		vkCmdEndRenderPass(commandBuffer);
+	};
+
+	if (shadowCacheEnabled_ == false)
+	{
+		for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			drawCascade(shadowRenderPass_, shadowMapFramebuffers_[i], i, true, true);
+		}
+		return;
+	}
+
+	// Cached layers stay valid as long as neither the static casters nor the cascade moved
+	const bool cacheDirty = shadowCacheDirty_.exchange(false);
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		if (cacheDirty || cachedCascadeViewProjections_[i] != lightingData_.cascadeViewProjections[i])
+		{
+			drawCascade(shadowCacheRenderPass_, shadowCacheFramebuffers_[i], i, true, false);
+			cachedCascadeViewProjections_[i] = lightingData_.cascadeViewProjections[i];
+		}
+	}
+
+	// Previous frame may still be sampling the shadow map, its content is replaced entirely
+	VkImageMemoryBarrier copyBarrier
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = shadowMapImage_,
+		.subresourceRange = VkImageSubresourceRange
+		{
+			.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = SHADOW_CASCADE_COUNT
+		}
+	};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &copyBarrier);
+
+	VkImageCopy copyRegion
+	{
+		.srcSubresource = VkImageSubresourceLayers
 		{
-			.offset = VkOffset2D { 0, 0 },
-			.extent = swapchainExtent_
+			.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = SHADOW_CASCADE_COUNT
 		},
-		.clearValueCount = static_cast<uint32_t>(clearValues.size()),
-		.pClearValues = clearValues.data()
+		.srcOffset = VkOffset3D { 0, 0, 0 },
+		.dstSubresource = VkImageSubresourceLayers
+		{
+			.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = SHADOW_CASCADE_COUNT
+		},
+		.dstOffset = VkOffset3D { 0, 0, 0 },
+		.extent = VkExtent3D { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1 }
 	};
+	vkCmdCopyImage(commandBuffer, shadowCacheImage_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadowMapImage_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
 
-	renderPassBeginInfo.framebuffer = swapchainFramebuffers_[imageIndex];
-
-	const VkCommandBuffer& commandBuffer = commandBuffers_[imageIndex];
-	VkResult result = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-	if (result != VK_SUCCESS)
+	// Also moves the layers to the sampled layout when there is nothing dynamic to draw
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
 	{
-		throw std::runtime_error("Failed to start recording a command buffer.");
+		drawCascade(shadowLoadRenderPass_, shadowMapFramebuffers_[i], i, false, true);
 	}
+}
 
-	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+void VulkanRenderer::DrawIndirectGroups(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t firstGroup, uint32_t shortDrawCount, uint32_t longDrawCount)
+{
+	const VkDeviceSize groupSize = sizeof(VkDrawIndexedIndirectCommand) * MAX_DRAWS;
+
+	if (shortDrawCount > 0)
+	{
+		vkCmdBindIndexBuffer(commandBuffer, geometryBuffer_->GetIndexBuffer(), 0, VK_INDEX_TYPE_UINT16);
+		vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers_[imageIndex], groupSize * firstGroup, shortDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	if (longDrawCount > 0)
 	{
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline_);
+		vkCmdBindIndexBuffer(commandBuffer, geometryBuffer_->GetIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers_[imageIndex], groupSize * (firstGroup + 1), longDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
 
-		for (size_t j = 0; j < models_.size(); j++)
+void VulkanRenderer::ReadStatistics(uint32_t imageIndex)
+{
+	// Queries are from the previous use of this image, skipped if the GPU isn't done with them yet.
+	// Each result is followed by its availability, unavailable results aren't written and would otherwise read as the previous frame's.
+	if (statisticsQueryPool_ != VK_NULL_HANDLE && statisticsQueriesWritten_[imageIndex])
+	{
+		uint64_t fragmentInvocations[2];
+		VkResult result = vkGetQueryPoolResults(mainDevice.logicalDevice, statisticsQueryPool_, imageIndex, 1, sizeof(fragmentInvocations), fragmentInvocations,
+			sizeof(fragmentInvocations), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		if (result == VK_SUCCESS && fragmentInvocations[1] != 0)
 		{
-			const MeshModel& model = models_[j];
+			fragmentInvocations_ = fragmentInvocations[0];
+			statisticsSampleCount_++;
+		}
+	}
+
+	if (timestampQueryPool_ != VK_NULL_HANDLE && timestampQueriesWritten_[imageIndex])
+	{
+		uint64_t timestampResults[TIMESTAMP_COUNT][2];
+		VkResult result = vkGetQueryPoolResults(mainDevice.logicalDevice, timestampQueryPool_, imageIndex * TIMESTAMP_COUNT, TIMESTAMP_COUNT, sizeof(timestampResults),
+			timestampResults, sizeof(timestampResults[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		uint64_t timestamps[TIMESTAMP_COUNT];
+		bool available = result == VK_SUCCESS;
+		for (uint32_t i = 0; i < TIMESTAMP_COUNT; i++)
+		{
+			timestamps[i] = timestampResults[i][0];
+			available = available && timestampResults[i][1] != 0;
+		}
+		if (available)
+		{
+			timestampSampleCount_++;
 
-			vkCmdPushConstants(commandBuffer, pipelineLayout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Model), &model.GetModel());
+			const double millisecondsPerTick = static_cast<double>(timestampPeriod_) / 1000000.0;
+			shadowPassTime_ = (timestamps[TIMESTAMP_SHADOWS_END] - timestamps[TIMESTAMP_SHADOWS_BEGIN]) * millisecondsPerTick;
+			gpuFrameTime_ = (timestamps[TIMESTAMP_FRAME_END] - timestamps[TIMESTAMP_FRAME_BEGIN]) * millisecondsPerTick;
 
-			for (size_t k = 0; k < model.GetMeshCount(); k++)
+#ifdef ENABLE_PROFILING
+			// Without calibrated timestamps a GPU frame is placed at its submission, or right after the previous GPU frame if that ended later.
+			// Durations and order are exact, the offset to the CPU scopes is not
+			const int64_t gpuFrameStart = std::max(frameSubmitTimes_[imageIndex], lastGpuFrameEnd_);
+			auto toProfilerTime = [&](uint32_t query)
 			{
-				const Mesh& mesh = model.GetMesh(k);
+				return gpuFrameStart + static_cast<int64_t>((timestamps[query] - timestamps[TIMESTAMP_FRAME_BEGIN]) * static_cast<double>(timestampPeriod_));
+			};
+			lastGpuFrameEnd_ = toProfilerTime(TIMESTAMP_FRAME_END);
+			getProfiler().AddGpuEvent("GPU frame", gpuFrameStart, lastGpuFrameEnd_);
+			getProfiler().AddGpuEvent("GPU shadows", toProfilerTime(TIMESTAMP_SHADOWS_BEGIN), toProfilerTime(TIMESTAMP_SHADOWS_END));
+#endif
 
-				VkBuffer vertexBuffers[] = { mesh.GetVertexBuffer() };
-				VkDeviceSize offsets[] = { 0 };
-				vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-
-				vkCmdBindIndexBuffer(commandBuffer, mesh.GetIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-				std::vector<VkDescriptorSet> descriptorSetGroup{ descriptorSets_[imageIndex], samplerDescriptorSets_[mesh.GetTextureId()] };
-				//uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment_) * j;
-				//vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout_, 0, 1, &descriptorSets_[imageIndex], 1, &dynamicOffset);
-				vkCmdBindDescriptorSets(
-					commandBuffer,
-					VK_PIPELINE_BIND_POINT_GRAPHICS,
-					pipelineLayout_,
-					0,
-					static_cast<uint32_t>(descriptorSetGroup.size()),
-					descriptorSetGroup.data(),
-					0,
-					nullptr
-				);
-
-				vkCmdDrawIndexed(commandBuffer, mesh.GetIndexCount(), 1, 0, 0, 0);
+			// Timing belongs to the scale that frame was recorded with, not to the current one
+			if (dynamicResolutionEnabled_)
+			{
+				renderScale_ = dynamicResolution_.Update(gpuFrameTime_, frameRenderScales_[imageIndex]);
 			}
 		}
-
-		vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
-
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline_);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout_, 0, 1, &inputDescriptorSets_[imageIndex], 0, nullptr);
-		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 	}
-	vkCmdEndRenderPass(commandBuffer);
+}
 
-	result = vkEndCommandBuffer(commandBuffer);
-	if (result != VK_SUCCESS)
+void VulkanRenderer::UpdateTextureStreaming(uint32_t imageIndex)
+{
+	// Feedback is from the previous use of this image, which is finished. Slots allocated since were never written.
+	uint32_t* feedback = textureFeedbackBuffersData_[imageIndex];
+	size_t slotCount;
 	{
-		throw std::runtime_error("Failed to stop recording a command buffer.");
+		std::lock_guard<std::mutex> textureLock(textureMutex_);
+		slotCount = textureImages_.size();
 	}
+
+	textureStreamer_->Update(feedback);
+	std::fill_n(feedback, slotCount, TextureStreamer::NO_FEEDBACK);
+}
+
+VkExtent2D VulkanRenderer::GetRenderExtent() const
+{
+	return VkExtent2D
+	{
+		.width = std::max(1u, static_cast<uint32_t>(std::lround(swapchainExtent_.width * renderScale_))),
+		.height = std::max(1u, static_cast<uint32_t>(std::lround(swapchainExtent_.height * renderScale_)))
+	};
+}
+
+void VulkanRenderer::UpdateAnimations()
+{
+	PROFILE_SCOPE("UpdateAnimations");
+
+	const double drawTime = glfwGetTime();
+	const float deltaTime = lastDrawTime_ > 0.0 ? static_cast<float>(drawTime - lastDrawTime_) : 0.0f;
+	lastDrawTime_ = drawTime;
+
+	// Models don't share nodes, so keyframe sampling and joint palettes run on worker threads
+	getJobSystem().ParallelFor(models_.size(), 1, [this, deltaTime](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			MeshModel& model = models_[i];
+			model.UpdateAnimation(deltaTime);
+			if (model.UpdateTransforms() && model.IsStatic())
+			{
+				shadowCacheDirty_ = true;
+			}
+		}
+	});
+}
+
+void VulkanRenderer::UpdateShadowCascades()
+{
+	const ShadowCascades cascades = computeShadowCascades(uboViewProjection_.view, uboViewProjection_.projection, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE,
+		glm::vec3(lightingData_.sunDirection));
+
+	std::copy(std::begin(cascades.viewProjections), std::end(cascades.viewProjections), lightingData_.cascadeViewProjections);
+	lightingData_.cascadeSplits = cascades.splits;
 }
 
 void VulkanRenderer::UpdateUniformBuffers(uint32_t imageIndex)
 {
+	PROFILE_SCOPE("UpdateUniformBuffers");
+
 	void* data;
 
 	vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory_[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
@@ -1639,11 +4079,117 @@ void VulkanRenderer::UpdateUniformBuffers(uint32_t imageIndex)
 	memcpy(data, modelTransferSpace_, modelUniformAlignment_ * meshes_.size());
 	vkUnmapMemory(mainDevice.logicalDevice, modelDynamicUniformBufferMemory_[imageIndex]);
 	*/
+
+	lightingData_.lightCount = static_cast<uint32_t>(lights_.size());
+	*lightingUniformBuffersData_[imageIndex] = lightingData_;
+	std::copy(lights_.begin(), lights_.end(), lightBuffersData_[imageIndex]);
 }
 
 void VulkanRenderer::CreateAssets()
 {
-	models_.push_back(MeshModel::LoadModel("scooter", "scene.gltf", this));
+	AddModel("scooter", "scene.gltf");
+}
+
+void VulkanRenderer::CommitPendingAssets()
+{
+	PROFILE_SCOPE("CommitPendingAssets");
+
+	{
+		std::lock_guard<std::mutex> textureLock(textureMutex_);
+
+		for (int textureId : texturesAwaitingDescriptor_)
+		{
+			CreateTextureDescriptor(textureId, textureImageViews_[textureId].Get());
+		}
+		texturesAwaitingDescriptor_.clear();
+
+		// Streamed images go into the texture's slot which isn't in use, the replaced image is released once the frames in flight are done with it
+		TextureSwap swap;
+		while (textureStreamer_->TakeSwap(&swap))
+		{
+			const int replacedSlot = textureDescriptorSlots_[swap.textureId];
+			textureImagesMemory_[swap.descriptorSlot] = UniqueDeviceMemory(mainDevice.logicalDevice, swap.image.memory);
+			textureImages_[swap.descriptorSlot] = UniqueImage(mainDevice.logicalDevice, swap.image.image);
+			textureImageViews_[swap.descriptorSlot] = UniqueImageView(mainDevice.logicalDevice, swap.image.view);
+			CreateTextureDescriptor(swap.descriptorSlot, swap.image.view);
+			textureDescriptorSlots_[swap.textureId] = swap.descriptorSlot;
+
+			VkImageView imageView = textureImageViews_[replacedSlot].Release();
+			VkImage image = textureImages_[replacedSlot].Release();
+			VkDeviceMemory imageMemory = textureImagesMemory_[replacedSlot].Release();
+			const int streamId = swap.streamId;
+
+			deletionQueue_.Push([this, streamId, imageView, image, imageMemory]()
+			{
+				vkDestroyImageView(mainDevice.logicalDevice, imageView, nullptr);
+				vkDestroyImage(mainDevice.logicalDevice, image, nullptr);
+				freeDeviceMemory(mainDevice.logicalDevice, imageMemory, nullptr);
+
+				textureStreamer_->EndSwap(streamId);
+			});
+		}
+	}
+
+	for (auto pendingModel = pendingModels_.begin(); pendingModel != pendingModels_.end();)
+	{
+		if (pendingModel->model.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			pendingModel++;
+			continue;
+		}
+
+		try
+		{
+			MeshModel model = pendingModel->model.get();
+
+			// Removed while loading, nothing was drawn with it
+			const int index = GetModelIndex(pendingModel->handle);
+			if (index < 0)
+			{
+				ReleaseModelTextures(model);
+			}
+			else
+			{
+				model.SetModel(models_[index].GetModel());
+				model.SetStatic(models_[index].IsStatic());
+				if (model.IsStatic())
+				{
+					shadowCacheDirty_ = true;
+				}
+				models_[index] = std::move(model);
+			}
+		}
+		catch (const std::runtime_error& e)
+		{
+			printf("Error: %s\n", e.what());
+
+			if (GetModelIndex(pendingModel->handle) >= 0)
+			{
+				modelSlots_[static_cast<uint32_t>(pendingModel->handle) & MODEL_HANDLE_SLOT_MASK].failed = true;
+			}
+		}
+
+		pendingModel = pendingModels_.erase(pendingModel);
+	}
+}
+
+int VulkanRenderer::GetModelIndex(int handle) const
+{
+	const uint32_t slot = static_cast<uint32_t>(handle) & MODEL_HANDLE_SLOT_MASK;
+	if (handle < 0 || slot >= modelSlots_.size() || modelSlots_[slot].generation != static_cast<uint32_t>(handle) >> MODEL_HANDLE_SLOT_BITS)
+	{
+		return -1;
+	}
+
+	return modelSlots_[slot].index;
+}
+
+void VulkanRenderer::ReleaseModelTextures(const MeshModel& model)
+{
+	for (int textureId : model.GetTextureIds())
+	{
+		ReleaseTexture(textureId);
+	}
 }
 
 
@@ -1661,7 +4207,8 @@ QueueFamilyIndices VulkanRenderer::GetQueueFamilies(VkPhysicalDevice device)
 	{
 		const VkQueueFamilyProperties queueFamily = queueFamilyProperties[i];
 
-		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		// Skinning dispatches are recorded into the graphics command buffers
+		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT && queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)
 		{
 			indices.graphicsFamily = i;
 		}
@@ -1788,7 +4335,8 @@ VkFormat VulkanRenderer::ChooseSupportedFormat(const std::vector<VkFormat>& form
 }
 
 
-VkImage VulkanRenderer::CreateImage(const uint32_t width, const uint32_t height, const VkFormat format, const VkImageTiling tiling, const VkImageUsageFlags useFlags, const VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory)
+VkImage VulkanRenderer::CreateImage(const uint32_t width, const uint32_t height, const VkFormat format, const VkImageTiling tiling, const VkImageUsageFlags useFlags, const VkMemoryPropertyFlags propFlags, const MemoryCategory category, VkDeviceMemory* imageMemory, const uint32_t arrayLayers,
+	const VkSampleCountFlagBits samples)
 {
 	VkImageCreateInfo imageCreateInfo
 	{
@@ -1802,8 +4350,8 @@ VkImage VulkanRenderer::CreateImage(const uint32_t width, const uint32_t height,
 			.depth = 1
 		},
 		.mipLevels = 1,
-		.arrayLayers = 1,
-		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.arrayLayers = arrayLayers,
+		.samples = samples,
 		.tiling = tiling,
 		.usage = useFlags,
 		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
@@ -1827,7 +4375,7 @@ VkImage VulkanRenderer::CreateImage(const uint32_t width, const uint32_t height,
 		.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, imageMemoryRequirements.memoryTypeBits, propFlags)
 	};
 
-	result = vkAllocateMemory(mainDevice.logicalDevice, &imageMemoryAllocateInfo, nullptr, imageMemory);
+	result = allocateDeviceMemory(mainDevice.logicalDevice, imageMemoryAllocateInfo, category, imageMemory);
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to allocate memory for an image.");
@@ -1838,13 +4386,13 @@ VkImage VulkanRenderer::CreateImage(const uint32_t width, const uint32_t height,
 	return image;
 }
 
-VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageViewType viewType, uint32_t baseArrayLayer, uint32_t layerCount)
 {
 	VkImageViewCreateInfo imageViewCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
 		.image = image,
-		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.viewType = viewType,
 		.format = format,
 		.components = VkComponentMapping
 		{
@@ -1858,8 +4406,8 @@ VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format, VkIm
 			.aspectMask = aspectFlags,
 			.baseMipLevel = 0,
 			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1
+			.baseArrayLayer = baseArrayLayer,
+			.layerCount = layerCount
 		}
 	};
 	
@@ -1900,70 +4448,63 @@ void VulkanRenderer::AllocateDynamicBufferTransferSpace()
 	//modelTransferSpace_ = (Model*)_aligned_malloc(modelUniformAlignment_ * MAX_OBJECTS, modelUniformAlignment_);
 }
 
-int VulkanRenderer::CreateTextureImage(std::string fileName, bool textureFolderUsed)
+int VulkanRenderer::AllocateTextureSlot()
 {
-	int width, height;
-	VkDeviceSize imageSize;
-
-	stbi_uc* imageData;
-	if (textureFolderUsed)
+	if (freeTextureSlots_.empty() == false)
 	{
-		imageData = loadTexture(fileName, &width, &height, &imageSize);
+		int textureId = freeTextureSlots_.back();
+		freeTextureSlots_.pop_back();
+		textureDescriptorSlots_[textureId] = textureId;
+
+		return textureId;
 	}
-	else
+
+	if (textureImages_.size() >= maxTextureCount_)
 	{
-		imageData = loadImage(fileName, &width, &height, &imageSize);
+		throw std::runtime_error("Texture limit reached.");
 	}
 
+	textureImages_.emplace_back();
+	textureImagesMemory_.emplace_back();
+	textureImageViews_.emplace_back();
+	textureDescriptorsWritten_.push_back(false);
+	textureDescriptorSlots_.push_back(static_cast<int>(textureImages_.size() - 1));
+	textureCache_.push_back(TextureCacheEntry{});
+
+	return static_cast<int>(textureImages_.size() - 1);
+}
+
+VkImage VulkanRenderer::CreateTextureImage(const stbi_uc* imageData, int width, int height, VkCommandPool commandPool, VkDeviceMemory* imageMemory)
+{
+	VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
+
 	VkBuffer imageStagingBuffer;
 	VkDeviceMemory imageStagingBufferMemory;
 	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &imageStagingBuffer, &imageStagingBufferMemory);
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging, &imageStagingBuffer, &imageStagingBufferMemory);
 
 	void* data;
 	vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
 	memcpy(data, imageData, static_cast<size_t>(imageSize));
 	vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
 
-	stbi_image_free(imageData);
-
-	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
-	textureImage = CreateImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &textureImageMemory);
-
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue_, graphicsCommandPool_, textureImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	VkImage textureImage = CreateImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Textures, imageMemory);
 
-	copyImageBuffer(mainDevice.logicalDevice, graphicsQueue_, graphicsCommandPool_, imageStagingBuffer, textureImage, width, height);
+	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue_, commandPool, textureImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue_, graphicsCommandPool_, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	copyImageBuffer(mainDevice.logicalDevice, graphicsQueue_, commandPool, imageStagingBuffer, textureImage, width, height);
 
-	textureImages_.push_back(textureImage);
-	textureImagesMemory_.push_back(textureImageMemory);
+	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue_, commandPool, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 	vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+	freeDeviceMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
 
-	return textureImages_.size() - 1;
+	return textureImage;
 }
 
-int VulkanRenderer::CreateTextureDescriptor(VkImageView textureImage)
+void VulkanRenderer::CreateTextureDescriptor(int textureId, VkImageView textureImage)
 {
-	VkDescriptorSetAllocateInfo descriptorSetAllocateInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = samplerDescriptorPool_,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &samplerDescriptorSetLayout_
-	};
-
-	VkDescriptorSet descriptorSet;
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocateInfo, &descriptorSet);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate texture descriptor set.");
-	}
-
 	VkDescriptorImageInfo descriptorImageInfo
 	{
 		.sampler = textureSampler_,
@@ -1974,28 +4515,296 @@ int VulkanRenderer::CreateTextureDescriptor(VkImageView textureImage)
 	VkWriteDescriptorSet descriptorWrite
 	{
 		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-		.dstSet = descriptorSet,
-		.dstArrayElement = 0,
+		.dstSet = textureDescriptorSet_,
+		.dstBinding = 0,
+		.dstArrayElement = static_cast<uint32_t>(textureId),
 		.descriptorCount = 1,
 		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 		.pImageInfo = &descriptorImageInfo
 	};
 
+	// Binding is UPDATE_UNUSED_WHILE_PENDING, elements which frames in flight don't sample can be written while they are pending.
+	// New textures, recycled slots and the streamer's alternate slots are all unused by those frames.
 	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
 
-	samplerDescriptorSets_.push_back(descriptorSet);
+	textureDescriptorsWritten_[textureId] = true;
+}
+
+uint32_t VulkanRenderer::GetTextureIndex(int textureId) const
+{
+	// Texture is still being loaded
+	if (textureDescriptorsWritten_[textureId] == false)
+	{
+		return static_cast<uint32_t>(placeholderTextureId_);
+	}
+
+	return static_cast<uint32_t>(textureDescriptorSlots_[textureId]);
+}
+
+uint32_t VulkanRenderer::GetNormalTextureIndex(int textureId) const
+{
+	// Vertex normal is used until the normal map is loaded, the white placeholder isn't a valid normal
+	if (textureId < 0 || textureDescriptorsWritten_[textureId] == false)
+	{
+		return NO_TEXTURE_INDEX;
+	}
+
+	return static_cast<uint32_t>(textureDescriptorSlots_[textureId]);
+}
+
+int VulkanRenderer::AcquireTexture(const std::string& filePath, VkCommandPool commandPool)
+{
+	const std::string canonicalPath = getCanonicalPath(filePath);
+
+	// Same file was already requested
+	{
+		std::unique_lock<std::mutex> textureLock(textureMutex_);
+
+		auto pathEntry = texturePathCache_.find(canonicalPath);
+		if (pathEntry != texturePathCache_.end())
+		{
+			return ShareTexture(textureLock, pathEntry->second);
+		}
+	}
+
+	std::vector<char> fileData = readBinaryFile(filePath);
+	const uint64_t contentHash = hashBytes(fileData.data(), fileData.size());
+
+	// Texture with the same hash and size is compared byte for byte before it's shared, a hash collision mustn't alias two textures
+	std::string candidatePath;
+	{
+		std::lock_guard<std::mutex> textureLock(textureMutex_);
+
+		auto hashEntry = textureHashCache_.find(contentHash);
+		if (hashEntry != textureHashCache_.end() && textureCache_[hashEntry->second].contentSize == fileData.size())
+		{
+			candidatePath = textureCache_[hashEntry->second].paths.front();
+		}
+	}
+	bool candidateMatches = false;
+	if (candidatePath.empty() == false)
+	{
+		try
+		{
+			candidateMatches = readBinaryFile(candidatePath) == fileData;
+		}
+		catch (const std::runtime_error&)
+		{
+			// Candidate file is gone, the texture is loaded on its own
+		}
+	}
+
+	int textureId;
+	{
+		std::unique_lock<std::mutex> textureLock(textureMutex_);
+
+		// Another loader could have requested the same file while this one was reading it
+		auto pathEntry = texturePathCache_.find(canonicalPath);
+		if (pathEntry != texturePathCache_.end())
+		{
+			return ShareTexture(textureLock, pathEntry->second);
+		}
+
+		// Different file with the same content was already loaded, unless the candidate was released meanwhile
+		auto hashEntry = textureHashCache_.find(contentHash);
+		if (candidateMatches && hashEntry != textureHashCache_.end() &&
+			std::ranges::find(textureCache_[hashEntry->second].paths, candidatePath) != textureCache_[hashEntry->second].paths.end())
+		{
+			const int sharedTextureId = hashEntry->second;
+			textureCache_[sharedTextureId].paths.push_back(canonicalPath);
+			texturePathCache_[canonicalPath] = sharedTextureId;
+
+			return ShareTexture(textureLock, sharedTextureId);
+		}
+
+		textureId = AllocateTextureSlot();
+		textureCache_[textureId] = TextureCacheEntry
+		{
+			.paths = { canonicalPath },
+			.contentHash = contentHash,
+			.contentSize = fileData.size(),
+			.refCount = 1,
+			.loading = true
+		};
+		texturePathCache_[canonicalPath] = textureId;
+		textureHashCache_.try_emplace(contentHash, textureId); // Colliding texture keeps the entry
+	}
+
+	// Decode and upload without holding the lock, the slot is drawn with placeholder until its descriptor is created
+	try
+	{
+		UniqueDeviceMemory textureImageMemory;
+		UniqueImage textureImage;
+		UniqueImageView textureImageView;
+
+		// Streamed textures start with their tail mips, the finer ones come in once the feedback asks for them
+		std::shared_ptr<TextureMipCache> mipCache;
+		if (textureStreamingBudget_ > 0)
+		{
+			mipCache = TextureMipCache::Open(filePath, fileData);
+
+			StreamedTextureImage streamedImage = textureStreamer_->CreateImage(*mipCache, mipCache->GetTailMip(), commandPool);
+			textureImageMemory = UniqueDeviceMemory(mainDevice.logicalDevice, streamedImage.memory);
+			textureImage = UniqueImage(mainDevice.logicalDevice, streamedImage.image);
+			textureImageView = UniqueImageView(mainDevice.logicalDevice, streamedImage.view);
+		}
+		else
+		{
+			int width, height;
+			VkDeviceSize imageSize;
+			stbi_uc* imageData = loadImageFromMemory(fileData, &width, &height, &imageSize);
+
+			VkDeviceMemory rawTextureImageMemory;
+			VkImage rawTextureImage;
+			try
+			{
+				rawTextureImage = CreateTextureImage(imageData, width, height, commandPool, &rawTextureImageMemory);
+			}
+			catch (...)
+			{
+				stbi_image_free(imageData);
+				throw;
+			}
+			stbi_image_free(imageData);
+
+			textureImageMemory = UniqueDeviceMemory(mainDevice.logicalDevice, rawTextureImageMemory);
+			textureImage = UniqueImage(mainDevice.logicalDevice, rawTextureImage);
+			textureImageView = UniqueImageView(mainDevice.logicalDevice,
+				CreateImageView(textureImage.Get(), VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT));
+		}
+
+		std::lock_guard<std::mutex> textureLock(textureMutex_);
+		textureImages_[textureId] = std::move(textureImage);
+		textureImagesMemory_[textureId] = std::move(textureImageMemory);
+		textureImageViews_[textureId] = std::move(textureImageView);
+
+		// Textures no bigger than the tail have nothing to stream
+		if (mipCache && mipCache->GetTailMip() > 0)
+		{
+			TextureCacheEntry& entry = textureCache_[textureId];
+			entry.alternateSlot = AllocateTextureSlot();
+			entry.streamId = textureStreamer_->Register(mipCache, textureId, static_cast<uint32_t>(entry.alternateSlot));
+		}
+		texturesAwaitingDescriptor_.push_back(textureId);
+		textureCache_[textureId].loading = false;
+		textureLoadedCondition_.notify_all();
+	}
+	catch (...)
+	{
+		// Loaders waiting for the upload fail too, later requests load the file again
+		{
+			std::lock_guard<std::mutex> textureLock(textureMutex_);
+
+			TextureCacheEntry& entry = textureCache_[textureId];
+			for (const std::string& path : entry.paths)
+			{
+				texturePathCache_.erase(path);
+			}
+			entry.paths.clear();
+			auto hashEntry = textureHashCache_.find(entry.contentHash);
+			if (hashEntry != textureHashCache_.end() && hashEntry->second == textureId)
+			{
+				textureHashCache_.erase(hashEntry);
+			}
+			entry.loading = false;
+			entry.failed = true;
+		}
+		textureLoadedCondition_.notify_all();
+
+		ReleaseTexture(textureId);
+		throw;
+	}
+
+	return textureId;
+}
+
+int VulkanRenderer::ShareTexture(std::unique_lock<std::mutex>& textureLock, int textureId)
+{
+	// Reference is taken first, the entry stays put while waiting
+	textureCache_[textureId].refCount++;
+	textureLoadedCondition_.wait(textureLock, [this, textureId]() { return textureCache_[textureId].loading == false; });
+
+	if (textureCache_[textureId].failed)
+	{
+		textureCache_[textureId].refCount--;
+		if (textureCache_[textureId].refCount == 0)
+		{
+			DestroyTexture(textureId);
+		}
+		throw std::runtime_error("Failed to load a texture another loader was uploading.");
+	}
 
-	return samplerDescriptorSets_.size() - 1;
+	return textureId;
 }
 
 int VulkanRenderer::CreateTexture(std::string fileName, bool textureFolderUsed)
 {
-	int textureImageIndex = CreateTextureImage(fileName, textureFolderUsed);
+	const std::string filePath = textureFolderUsed ? "../textures/" + fileName : fileName;
+
+	return AcquireTexture(filePath, graphicsCommandPool_);
+}
+
+void VulkanRenderer::ReleaseTexture(int textureId)
+{
+	std::lock_guard<std::mutex> textureLock(textureMutex_);
+
+	if (textureId < 0 || textureId >= textureCache_.size() || textureCache_[textureId].refCount <= 0)
+	{
+		return;
+	}
+
+	textureCache_[textureId].refCount--;
+	if (textureCache_[textureId].refCount == 0)
+	{
+		DestroyTexture(textureId);
+	}
+}
+
+void VulkanRenderer::DestroyTexture(int textureId)
+{
+	TextureCacheEntry& entry = textureCache_[textureId];
+	for (const std::string& path : entry.paths)
+	{
+		texturePathCache_.erase(path);
+	}
+	auto hashEntry = textureHashCache_.find(entry.contentHash);
+	if (hashEntry != textureHashCache_.end() && hashEntry->second == textureId)
+	{
+		textureHashCache_.erase(hashEntry);
+	}
+	std::erase(texturesAwaitingDescriptor_, textureId);
 
-	VkImageView imageView = CreateImageView(textureImages_[textureImageIndex], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-	textureImageViews_.push_back(imageView);
+	// Image being loaded is destroyed by the streamer, a pending swap still ends through the deletion queue
+	if (entry.streamId >= 0)
+	{
+		textureStreamer_->Unregister(entry.streamId);
+	}
+	const int alternateSlot = entry.alternateSlot;
+	entry = TextureCacheEntry{};
 
-	int descriptorIndex = CreateTextureDescriptor(imageView);
+	ReleaseTextureSlot(textureId);
+	if (alternateSlot >= 0)
+	{
+		ReleaseTextureSlot(alternateSlot);
+	}
+}
 
-	return descriptorIndex;
+void VulkanRenderer::ReleaseTextureSlot(int slot)
+{
+	// Descriptor is left stale, partially bound array elements which aren't used don't need to be valid.
+	// Frames in flight may still sample the texture, so the objects and the slot are only released once they are finished
+	textureDescriptorsWritten_[slot] = false;
+	VkImageView imageView = textureImageViews_[slot].Release();
+	VkImage image = textureImages_[slot].Release();
+	VkDeviceMemory imageMemory = textureImagesMemory_[slot].Release();
+
+	deletionQueue_.Push([this, slot, imageView, image, imageMemory]()
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, imageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, image, nullptr);
+		freeDeviceMemory(mainDevice.logicalDevice, imageMemory, nullptr);
+
+		std::lock_guard<std::mutex> textureLock(textureMutex_);
+		freeTextureSlots_.push_back(slot);
+	});
 }
@@ -3,16 +3,41 @@
 #include <stdexcept>
 #include <vector>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
 
 #include <glm/gtc/matrix_transform.hpp>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
 #include "Utilities.h"
+#include "UniqueHandle.h"
+#include "TaskGraph.h"
+#include "JobSystem.h"
+#include "FrameArena.h"
+#include "DeletionQueue.h"
+#include "GeometryBuffer.h"
 #include "Mesh.h"
 #include "MeshModel.h"
+#include "MeshStreamer.h"
+#include "TextureStreamer.h"
+#include "Lighting.h"
+#include "Shadow.h"
+#include "DynamicResolution.h"
 
 
+// Scene antialiasing. MSAA resolves at the end of the scene subpass, FXAA is applied by the composite subpass.
+enum class AntiAliasingMode
+{
+	None,
+	Fxaa,
+	Msaa
+};
+
 class VulkanRenderer
 {
 	friend MeshModel;
@@ -23,10 +48,96 @@ public:
 
 	void Draw();
 
-	void UpdateModel(const int& index, const glm::mat4& model);
+	void UpdateModel(const int& handle, const glm::mat4& model);
+	void SetCamera(const glm::mat4& view);
+
+	// Nodes of a model's transform hierarchy, node 0 is the root moved by UpdateModel.
+	// Node indices are known once the model is ready, transforms are local to the parent node.
+	// Node updates and animation playback are rejected with an error while the model is loading, they aren't replayed once it's ready.
+	int FindModelNode(const int& model, const std::string& name) const;
+	size_t GetModelNodeCount(const int& model) const;
+	void UpdateModelNode(const int& model, const int& node, const glm::mat4& transform);
+
+	// Skeletal animation clips of a model, playback advances with the frame time
+	size_t GetModelAnimationCount(const int& model) const;
+	void PlayModelAnimation(const int& model, const int& animation, bool loop = true);
+
+	// Point and spot lights are binned into view space clusters every frame, a fragment only shades with its cluster's lights
+	void SetLights(const std::vector<Light>& lights);
+	void SetAmbientLight(const glm::vec3& color);
+	void SetSunLight(const glm::vec3& direction, const glm::vec3& color);
+
+	// Static models are kept in cached sun shadow maps, which are only redrawn when a static model or a cascade changes.
+	// Everything else is drawn into the shadow maps every frame.
+	void SetModelStatic(const int& model, bool isStatic);
+	void SetShadowCacheEnabled(bool enabled);
+	bool IsShadowCacheEnabled() const;
+
+	// Depth-only pass over positions first, then the color pass shades only fragments with equal depth
+	void SetDepthPrePassEnabled(bool enabled);
+	bool IsDepthPrePassEnabled() const;
+
+	// Fragment shader invocations of the scene subpass in the most recent finished frame.
+	// The sample count goes up with every frame whose result was read, frames not finished in time keep the previous value.
+	bool IsPipelineStatisticsSupported() const;
+	uint64_t GetFragmentInvocations() const;
+	uint64_t GetStatisticsSampleCount() const;
+
+	// GPU time of the whole frame and of the shadow passes in the most recent finished frame, sampled like the statistics above
+	bool IsTimestampSupported() const;
+	double GetGpuFrameTime() const; // Milliseconds
+	double GetShadowPassTime() const; // Milliseconds
+	uint64_t GetTimestampSampleCount() const;
+
+	// Scene is rendered into the top left part of the attachments and upscaled to the window by the composite subpass.
+	// With dynamic resolution the scale follows the measured GPU frame time, which needs timestamp support.
+	void SetRenderScale(float scale);
+	float GetRenderScale() const;
+	void SetDynamicResolutionEnabled(bool enabled);
+	bool IsDynamicResolutionEnabled() const;
+	void SetTargetFrameTime(double milliseconds);
+
+	// Heap allocations made during the last Draw, on any thread. Transient frame data comes from per frame arenas, so this is zero once
+	// the arenas have grown to fit and nothing is loading
+	size_t GetFrameHeapAllocationCount() const;
+	size_t GetFrameArenaPeakUsage() const; // Bytes
+	// Freed meshes and textures waiting for the frames which could still use them
+	size_t GetPendingDeletionCount() const;
+	// CPU time the last Draw spent on freeing resources released frames ago and on committing finished loads
+	double GetDeletionTime() const; // Milliseconds
+	double GetAssetCommitTime() const; // Milliseconds
+
+	// Static meshes of models added afterwards are baked into a mapped cache next to the model file and drawn at a coarse level of detail
+	// until their full detail is streamed in, within this many bytes of the geometry buffer. 0 turns streaming off for models added afterwards.
+	// Can be set before Init to stream the initial assets.
+	void SetMeshStreamingBudget(VkDeviceSize budget);
+	MeshStreamingStatistics GetMeshStreamingStatistics() const;
+
+	// Textures loaded afterwards are baked into a mapped mip cache next to the texture file and loaded with their mips up to TEXTURE_TAIL_SIZE.
+	// Finer mips are streamed in as the fragment shader samples them, within this many bytes of device memory. 0 turns streaming off for
+	// textures loaded afterwards. Can be set before Init to stream the initial assets.
+	void SetTextureStreamingBudget(VkDeviceSize budget);
+	TextureStreamingStatistics GetTextureStreamingStatistics() const;
+
+	// Switching in or out of MSAA waits for the GPU and rebuilds the scene attachments and pipelines, FXAA is switched per frame
+	void SetAntiAliasingMode(AntiAliasingMode mode);
+	AntiAliasingMode GetAntiAliasingMode() const;
+	bool IsMsaaSupported() const;
+
+	// Returns a model handle immediately, the model is loaded and uploaded on another thread and drawn once it's committed at a frame boundary.
+	// Handles stay valid until the model is removed, handles of removed models are rejected by every call taking one.
+	int AddModel(const std::string& directory, const std::string& fileName);
+	// Meshes and textures are freed once the frames in flight are finished with them, a model still loading is dropped when it arrives
+	void RemoveModel(const int& handle);
+	bool IsModelReady(const int& handle) const;
+	// Model failed to load and stays empty, the handle has to be removed like any other
+	bool HasModelFailed(const int& handle) const;
+	size_t GetModelCount() const;
+	int GetModelHandle(size_t index) const; // Handle of every live model for index 0 to GetModelCount() - 1, in no particular order
 
 private:
 	int currentFrame_ = 0;
+	double lastDrawTime_ = 0.0;
 
 	GLFWwindow* window_;
 	VkInstance vkInsatance_;
@@ -53,12 +164,24 @@ private:
 	std::vector<VkDeviceMemory> depthBufferImagesMemory_;
 	std::vector<VkImageView> depthBufferImageViews_;
 
+	// Multisampled scene attachments, only created in MSAA mode and never stored
+	std::vector<VkImage> msaaColorImages_;
+	std::vector<VkDeviceMemory> msaaColorImagesMemory_;
+	std::vector<VkImageView> msaaColorImageViews_;
+	std::vector<VkImage> msaaDepthImages_;
+	std::vector<VkDeviceMemory> msaaDepthImagesMemory_;
+	std::vector<VkImageView> msaaDepthImageViews_;
+
+	AntiAliasingMode antiAliasingMode_ = AntiAliasingMode::None;
+	VkSampleCountFlagBits msaaSampleCount_ = VK_SAMPLE_COUNT_1_BIT; // Highest supported up to MAX_MSAA_SAMPLES
+
 	VkSampler textureSampler_;
+	VkSampler compositeSampler_; // Reads the scaled scene attachments in the composite subpass
 
 	VkDescriptorSetLayout descriptorSetLayout_;
 	VkDescriptorSetLayout samplerDescriptorSetLayout_;
 	VkDescriptorSetLayout inputDescriptorSetLayout_;
-	VkPushConstantRange pushConstantRange_;
+	VkDescriptorSetLayout skinningDescriptorSetLayout_;
 
 	std::vector<VkBuffer> vpUniformBuffer_;
 	std::vector<VkDeviceMemory> vpUniformBufferMemory_;
@@ -70,17 +193,112 @@ private:
 	//size_t modelUniformAlignment_;
 	//Model* modelTransferSpace_;
 
+	// Per swapchain image, filled while recording commands and kept mapped
+	std::vector<VkBuffer> objectBuffers_;
+	std::vector<VkDeviceMemory> objectBuffersMemory_;
+	std::vector<ObjectData*> objectBuffersData_;
+	std::vector<VkBuffer> indirectBuffers_;
+	std::vector<VkDeviceMemory> indirectBuffersMemory_;
+	std::vector<VkDrawIndexedIndirectCommand*> indirectBuffersData_;
+	bool drawLimitReported_ = false; // Meshes past MAX_DRAWS aren't drawn, reported the first time it happens
+
+	// Per swapchain image joint matrices, skinned vertices are written into the geometry buffer by a compute pass before the render pass
+	std::vector<VkBuffer> skinPaletteBuffers_;
+	std::vector<VkDeviceMemory> skinPaletteBuffersMemory_;
+	std::vector<glm::mat4*> skinPaletteBuffersData_;
+
+	// Per swapchain image clustered lighting input, cluster light lists are written by the light culling pass
+	std::vector<VkBuffer> lightingUniformBuffers_;
+	std::vector<VkDeviceMemory> lightingUniformBuffersMemory_;
+	std::vector<LightingData*> lightingUniformBuffersData_;
+	std::vector<VkBuffer> lightBuffers_;
+	std::vector<VkDeviceMemory> lightBuffersMemory_;
+	std::vector<Light*> lightBuffersData_;
+	std::vector<VkBuffer> clusterBuffers_;
+	std::vector<VkDeviceMemory> clusterBuffersMemory_;
+
+	// Per swapchain image finest sampled mip per texture descriptor, written by shader.frag and read back once the image comes around again
+	std::vector<VkBuffer> textureFeedbackBuffers_;
+	std::vector<VkDeviceMemory> textureFeedbackBuffersMemory_;
+	std::vector<uint32_t*> textureFeedbackBuffersData_;
+
+	std::vector<Light> lights_;
+	LightingData lightingData_;
+
+	// Sun shadow cascades, one layer each. Static casters are kept in the cache image and copied over before dynamic casters are drawn.
+	VkFormat shadowMapImageFormat_;
+	VkImage shadowMapImage_;
+	VkDeviceMemory shadowMapImageMemory_;
+	VkImageView shadowMapImageView_; // All layers, sampled by shader.frag
+	std::vector<VkImageView> shadowMapLayerViews_;
+	std::vector<VkFramebuffer> shadowMapFramebuffers_;
+	VkImage shadowCacheImage_;
+	VkDeviceMemory shadowCacheImageMemory_;
+	std::vector<VkImageView> shadowCacheLayerViews_;
+	std::vector<VkFramebuffer> shadowCacheFramebuffers_;
+	VkSampler shadowSampler_;
+	VkRenderPass shadowRenderPass_;      // Clears, all casters are drawn
+	VkRenderPass shadowCacheRenderPass_; // Clears, static casters only, ends as copy source
+	VkRenderPass shadowLoadRenderPass_;  // Continues the copied cache with dynamic casters
+
+	glm::mat4 cachedCascadeViewProjections_[SHADOW_CASCADE_COUNT]; // Cascades the cache was drawn with
+	bool shadowCacheEnabled_ = true;
+	std::atomic<bool> shadowCacheDirty_ = true; // Static set changed, every cached cascade is redrawn
+
+	bool depthPrePassEnabled_ = false;
+
+	bool pipelineStatisticsSupported_ = false;
+	VkQueryPool statisticsQueryPool_ = VK_NULL_HANDLE; // One query per swapchain image
+	std::vector<bool> statisticsQueriesWritten_;
+	uint64_t fragmentInvocations_ = 0;
+	uint64_t statisticsSampleCount_ = 0;
+
+	bool timestampSupported_ = false;
+	float timestampPeriod_ = 0.0f; // Nanoseconds per tick
+	VkQueryPool timestampQueryPool_ = VK_NULL_HANDLE; // TIMESTAMP_COUNT queries per swapchain image
+	std::vector<bool> timestampQueriesWritten_;
+	double gpuFrameTime_ = 0.0;
+	double shadowPassTime_ = 0.0;
+	uint64_t timestampSampleCount_ = 0;
+
+	float renderScale_ = MAX_RENDER_SCALE;
+	std::vector<float> frameRenderScales_; // Per swapchain image, scale its last frame was recorded with
+#ifdef ENABLE_PROFILING
+	std::vector<int64_t> frameSubmitTimes_; // Per swapchain image, profiler time its last frame was submitted at
+	int64_t lastGpuFrameEnd_ = 0;
+#endif
+	bool dynamicResolutionEnabled_ = false;
+	DynamicResolution dynamicResolution_{ 1000.0 / 60.0 };
+
+	std::unique_ptr<GeometryBuffer> geometryBuffer_; // Shared by all meshes, has to outlive them
+	std::unique_ptr<MeshStreamer> meshStreamer_; // Outlives the meshes, is outlived by the geometry buffer
+	std::atomic<VkDeviceSize> meshStreamingBudget_ = 0;
+	std::unique_ptr<TextureStreamer> textureStreamer_; // Outlives the textures and the deletion queue entries of their swaps
+	std::atomic<VkDeviceSize> textureStreamingBudget_ = 0;
+
 	VkDescriptorPool descriptorPool_;
 	VkDescriptorPool samplerDescriptorPool_;
 	VkDescriptorPool inputDescriptorPool_;
 	std::vector<VkDescriptorSet> descriptorSets_;
-	std::vector<VkDescriptorSet> samplerDescriptorSets_;
+	VkDescriptorSet textureDescriptorSet_; // Bindless, indexed by texture id
 	std::vector<VkDescriptorSet> inputDescriptorSets_;
+	std::vector<VkDescriptorSet> skinningDescriptorSets_;
+
+	VkPipelineCache pipelineCache_;
+	bool pipelineCacheLoaded_;
 
 	VkPipeline graphicsPipeline_;
+	VkPipeline depthPrePassPipeline_;
+	VkPipeline depthEqualPipeline_;
 	VkPipelineLayout pipelineLayout_;
 	VkPipeline secondPipeline_;
 	VkPipelineLayout secondPipelineLayout_;
+	VkPipeline skinningPipeline_;
+	VkPipelineLayout skinningPipelineLayout_;
+	VkPipeline lightCullingPipeline_;
+	VkPipelineLayout lightCullingPipelineLayout_;
+	VkPipeline shadowPipeline_;
+	VkPipelineLayout shadowPipelineLayout_;
 	VkRenderPass renderPass_;
 
 	VkCommandPool graphicsCommandPool_;
@@ -91,12 +309,56 @@ private:
 	std::vector<VkSemaphore> imageAvailableSemaphores_;
 	std::vector<VkSemaphore> renderFinishedSemaphores_;
 	std::vector<VkFence> drawFences_;
-
-	std::vector<VkImage> textureImages_;
-	std::vector<VkDeviceMemory> textureImagesMemory_;
-	std::vector<VkImageView> textureImageViews_;
-
-	std::vector<MeshModel> models_;
+	std::vector<FrameArena> frameArenas_; // Per frame in flight, reset once its fence signals
+	std::vector<uint64_t> frameNumbers_; // Per frame in flight, deletion queue number of the frame last submitted with its fence
+	DeletionQueue deletionQueue_;
+	size_t frameHeapAllocationCount_ = 0;
+	double deletionTime_ = 0.0;
+	double assetCommitTime_ = 0.0;
+
+	std::vector<UniqueImage> textureImages_;
+	std::vector<UniqueDeviceMemory> textureImagesMemory_;
+	std::vector<UniqueImageView> textureImageViews_;
+	std::vector<bool> textureDescriptorsWritten_;
+	std::vector<int> textureDescriptorSlots_; // Per texture id, streamed textures alternate between their id's slot and a second one
+	uint32_t maxTextureCount_;
+
+	// Textures are shared between all users requesting the same file (by path or by content)
+	struct TextureCacheEntry {
+		std::vector<std::string> paths;
+		uint64_t contentHash;
+		size_t contentSize;
+		int refCount;
+		int streamId = -1; // Streamed textures only
+		int alternateSlot = -1;
+		bool loading = false; // Being uploaded by the loader which requested it first
+		bool failed = false; // Upload failed, loaders waiting for it throw as well
+	};
+	std::vector<TextureCacheEntry> textureCache_;
+	std::vector<int> freeTextureSlots_;
+	std::unordered_map<std::string, int> texturePathCache_;
+	std::unordered_map<uint64_t, int> textureHashCache_;
+	std::vector<int> texturesAwaitingDescriptor_;
+	int placeholderTextureId_;
+	std::mutex textureMutex_; // Guards all texture containers above, textures are created from loader threads
+	std::condition_variable textureLoadedCondition_; // Notified when an upload finishes or fails
+
+	struct PendingModel {
+		int handle;
+		std::future<MeshModel> model;
+	};
+	std::vector<PendingModel> pendingModels_;
+
+	// Handle slots point at the model's current index, a slot's generation changes when its model is removed
+	struct ModelSlot {
+		int index; // -1 while free
+		uint32_t generation;
+		bool failed; // Load threw, the model stays empty
+	};
+	std::vector<ModelSlot> modelSlots_;
+	std::vector<uint32_t> freeModelSlots_;
+	std::vector<MeshModel> models_; // Dense for drawing, a removed model's place is taken by the last one
+	std::vector<int> modelHandles_; // Handle of each model in models_
 
 	struct UboViewProjection {
 		glm::mat4 projection;
@@ -110,19 +372,36 @@ private:
 	void CreateSwapchain();
 	void CreateRenderPass();
 	void CreateDescriptorSetLayout();
-	void CreatePushConstantRange();
+	void CreatePipelineCache();
+	void SavePipelineCache();
 	void CreateCraphicsPipeline();
+	void CreateSkinningPipeline();
+	void CreateLightCullingPipeline();
+	void CreateShadowMaps();
+	void CreateShadowPipeline();
 	void CreateColorBufferImages();
 	void CreateDepthBufferImages();
+	void CreateMsaaImages();
 	void CreateFramebuffers();
 	void CreateCommandPool();
 	void CreateCommandBuffers();
 	void CreateSynchronization();
 	void CreateUniformBuffers();
+	void CreateGeometryBuffer();
+	void CreateMeshStreamer();
+	void CreateTextureStreamer();
+	void CreateStatisticsQueryPool();
+	void CreateTimestampQueryPool();
 	void CreateDescriptorPools();
 	void CreateDescriptorSets();
 	void CreateInputDescriptorSets();
+	void CreateTextureDescriptorSet();
 	void CreateTextureSampler();
+	void CreatePlaceholderTexture();
+	VkCommandPool CreateUploadCommandPool();
+	void DestroySceneTargets();
+	void RecreateSceneTargets();
+	VkSampleCountFlagBits GetSceneSampleCount() const;
 
 	bool CheckInstanceExtensionSupport(std::vector<const char*> extensions);
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
@@ -130,9 +409,22 @@ private:
 	bool CheckValidationLayerSupport(std::vector<const char*> layers);
 	bool CheckPhysicalDeviceSuitable(VkPhysicalDevice device);
 
+	void UpdateAnimations();
 	void RecordCommands(uint32_t imageIndex);
+	VkExtent2D GetRenderExtent() const;
+	void RecordSkinning(VkCommandBuffer commandBuffer, uint32_t imageIndex, const FrameVector<SkinningDispatch>& dispatches);
+	void RecordLightCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	void RecordShadows(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t staticShortDrawCount, uint32_t staticLongDrawCount,
+		uint32_t dynamicShortDrawCount, uint32_t dynamicLongDrawCount);
+	void DrawIndirectGroups(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t firstGroup, uint32_t shortDrawCount, uint32_t longDrawCount);
+	void ReadStatistics(uint32_t imageIndex);
+	void UpdateTextureStreaming(uint32_t imageIndex);
+	void UpdateShadowCascades();
 	void UpdateUniformBuffers(uint32_t imageIndex);
 	void CreateAssets();
+	void CommitPendingAssets();
+	int GetModelIndex(int handle) const; // -1 for removed and invalid handles
+	void ReleaseModelTextures(const MeshModel& model);
 
 	QueueFamilyIndices GetQueueFamilies(VkPhysicalDevice device);
 	SwapchainDetails GetSwapchainDetails(VkPhysicalDevice device);
@@ -143,13 +435,23 @@ private:
 	VkFormat ChooseSupportedFormat(const std::vector<VkFormat>& formats, const VkImageTiling tiling, const VkFormatFeatureFlags featureFlags);
 
 	VkImage CreateImage(const uint32_t width, const uint32_t height, const VkFormat format, const VkImageTiling tiling, 
-		const VkImageUsageFlags useFlags, const VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory);
-	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
+		const VkImageUsageFlags useFlags, const VkMemoryPropertyFlags propFlags, const MemoryCategory category, VkDeviceMemory* imageMemory, const uint32_t arrayLayers = 1,
+		const VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
+	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
+		VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D, uint32_t baseArrayLayer = 0, uint32_t layerCount = 1);
 	VkShaderModule CreateShaderModule(const std::vector<char>& code);
 
 	void AllocateDynamicBufferTransferSpace();
 
-	int CreateTextureImage(std::string fileName, bool textureFolderUsed);
-	int CreateTextureDescriptor(VkImageView textureImage);
+	int AllocateTextureSlot();
+	VkImage CreateTextureImage(const stbi_uc* imageData, int width, int height, VkCommandPool commandPool, VkDeviceMemory* imageMemory);
+	void CreateTextureDescriptor(int textureId, VkImageView textureImage);
+	uint32_t GetTextureIndex(int textureId) const;
+	uint32_t GetNormalTextureIndex(int textureId) const;
+	int AcquireTexture(const std::string& filePath, VkCommandPool commandPool);
+	int ShareTexture(std::unique_lock<std::mutex>& textureLock, int textureId); // Waits for the upload, throws if it failed
 	int CreateTexture(std::string fileName, bool textureFolderUsed = true);
+	void ReleaseTexture(int textureId);
+	void DestroyTexture(int textureId);
+	void ReleaseTextureSlot(int slot);
 };
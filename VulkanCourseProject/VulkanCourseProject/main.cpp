@@ -1,5 +1,11 @@
 #include <iostream>
 #include <string>
+#include <memory>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -9,24 +15,201 @@
 #include <glm/glm.hpp>
 
 #include "VulkanRenderer.h"
+#include "RenderThread.h"
+#include "JobSystem.h"
+#include "Profiler.h"
 
 
 bool isVulkanompatible();
 GLFWwindow* createWindow(const int width = 800, const int height = 600, std::string name = "Vulkan window");
+std::vector<Light> createLightRing(size_t count, float radius, float angle);
+void runJobSystemBenchmark(); // Per-job overhead and parallel for scaling, needs no window
+void runModelImportBenchmark(); // Heap allocations and time of importing a model into its mesh data, needs no window
+void runSceneGraphBenchmark(); // Incremental world transform updates of a big random hierarchy, needs no window
+int formatMemoryUsage(char* text, size_t size); // Returns the length like snprintf
 
-int main()
+// Renders the same camera sweep with the depth pre-pass off and on and compares fragment shader invocations
+class DepthPrePassBenchmark
 {
+public:
+	static const int WARMUP_FRAMES = 10; // Covers the frames in flight before query results come back
+	static const int MEASURED_FRAMES = 360;
+
+	explicit DepthPrePassBenchmark(VulkanRenderer& renderer);
+
+	bool IsFinished() const;
+	float GetAngle() const;
+	void Step();
+
+private:
+	VulkanRenderer& renderer_;
+	bool originalPrePassEnabled_;
+	int pass_;
+	int frame_;
+	uint64_t lastSampleCount_; // Frames whose queries weren't finished in time don't give a new sample
+	uint64_t invocations_[2];
+	int sampleCounts_[2];
+};
+
+// Surrounds the rotating model with static copies and compares the GPU time of the shadow passes with and without the static caster cache
+class ShadowCacheBenchmark
+{
+public:
+	static const int WARMUP_FRAMES = 10;
+	static const int MEASURED_FRAMES = 360;
+	static const int STATIC_MODEL_COUNT = 8;
+
+	explicit ShadowCacheBenchmark(VulkanRenderer& renderer);
+
+	bool IsReady() const; // All static copies are loaded
+	bool IsFinished() const;
+	float GetAngle() const;
+	void Step();
+
+private:
+	VulkanRenderer& renderer_;
+	bool originalCacheEnabled_;
+	std::vector<int> staticModels_;
+	int pass_;
+	int frame_;
+	uint64_t lastSampleCount_;
+	double shadowPassTimes_[2];
+	int sampleCounts_[2];
+};
+
+// Renders the same camera sweep in every antialiasing mode and compares GPU frame times
+class AntiAliasingBenchmark
+{
+public:
+	static const int WARMUP_FRAMES = 10; // Also covers the device wait when MSAA attachments are rebuilt
+	static const int MEASURED_FRAMES = 360;
+	static const int MODE_COUNT = 3;
+
+	explicit AntiAliasingBenchmark(VulkanRenderer& renderer);
+
+	bool IsFinished() const;
+	float GetAngle() const;
+	void Step();
+
+private:
+	static const AntiAliasingMode MODES[MODE_COUNT];
+	static const char* const MODE_NAMES[MODE_COUNT];
+
+	VulkanRenderer& renderer_;
+	AntiAliasingMode originalMode_;
+	int pass_;
+	int frame_;
+	uint64_t lastSampleCount_;
+	double frameTimes_[MODE_COUNT];
+	int sampleCounts_[MODE_COUNT];
+};
+
+// Keeps a few model loads in flight and removes the oldest loaded model whenever another one is in, loads and deferred frees shouldn't
+// show up in the frame time distribution
+class ModelChurnBenchmark
+{
+public:
+	static const int WARMUP_FRAMES = 10;
+	static const int MEASURED_FRAMES = 1800;
+	static const int LIVE_MODEL_COUNT = 16; // Loaded models on the ring
+	static const int MAX_LOADS_IN_FLIGHT = 4;
+
+	explicit ModelChurnBenchmark(VulkanRenderer& renderer);
+
+	bool IsFinished() const;
+	void Step(double frameTime); // Milliseconds, the whole frame the step follows
+
+private:
+	static void PrintTimes(const char* name, std::vector<double>& times); // Sorts them
+
+	VulkanRenderer& renderer_;
+	std::vector<int> loadingModels_;
+	std::deque<int> loadedModels_;
+	int frame_;
+	int addedModelCount_;
+	int failedModelCount_;
+	size_t pendingDeletionCount_; // After the last step, the draw since then freed something if it went down
+	std::vector<double> frameTimes_;
+	std::vector<double> commitTimes_; // Draws which committed a loaded model
+	std::vector<double> removalTimes_; // RemoveModel calls
+	std::vector<double> deletionTimes_; // Draws which freed removed models
+};
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-jobs")
+	{
+		runJobSystemBenchmark();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-model-import")
+	{
+		runModelImportBenchmark();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-scene-graph")
+	{
+		runSceneGraphBenchmark();
+		return EXIT_SUCCESS;
+	}
+
 	if (isVulkanompatible() == false)
 	{
 		return EXIT_FAILURE;
 	}
 
+	// Chrome trace of the first frames including init, e.g. --trace trace.json --trace-frames 100, F12 captures again at any time
+	std::string tracePath = "trace.json";
+	uint32_t traceFrameCount = 300;
+	bool traceStartup = false;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) == "--trace")
+		{
+			tracePath = argv[i + 1];
+			traceStartup = true;
+		}
+		if (std::string(argv[i]) == "--trace-frames")
+		{
+			traceFrameCount = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+		}
+	}
+#ifdef ENABLE_PROFILING
+	PROFILE_THREAD_NAME("Main thread");
+	if (traceStartup)
+	{
+		getProfiler().StartCapture(tracePath, traceFrameCount);
+	}
+#else
+	if (traceStartup)
+	{
+		printf("Profiling: compiled out, define ENABLE_PROFILING to record traces.\n");
+	}
+#endif
+
 	glfwInit();
 
 	GLFWwindow* window = createWindow();
 
 	VulkanRenderer renderer;
 
+	// Vertex cache efficiency of each model before and after optimization, printed once per loaded model, set before the first one loads
+	MeshModel::SetShowOptimizationStatistics(std::find(argv + 1, argv + argc, std::string("--show-mesh-statistics")) != argv + argc);
+
+	// Full detail of static meshes is streamed within a budget in MB, e.g. --mesh-streaming 32, the first run bakes the mesh caches.
+	// Texture mips are streamed the same way, e.g. --texture-streaming 256, the first run bakes the mip caches.
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) == "--mesh-streaming")
+		{
+			renderer.SetMeshStreamingBudget(std::stoull(argv[i + 1]) * 1024 * 1024);
+		}
+		if (std::string(argv[i]) == "--texture-streaming")
+		{
+			renderer.SetTextureStreamingBudget(std::stoull(argv[i + 1]) * 1024 * 1024);
+		}
+	}
+
 	if (renderer.Init(window) == EXIT_FAILURE)
 	{
 		return EXIT_FAILURE;
@@ -35,11 +218,90 @@ int main()
 	float angle = 0.0f;
 	float lastTime = 0.0f;
 	float deltaTime = 0.0f;
+	bool animationStarted = false;
 
-	while (glfwWindowShouldClose(window) == false)
+	// Light count can be raised to check that shading cost stays flat, e.g. --lights 4096
+	size_t lightCount = 64;
+	// Heap allocations of the last drawn frame are shown in the title, zero once loading is done
+	const bool showAllocations = std::find(argv + 1, argv + argc, std::string("--show-allocations")) != argv + argc;
+	// Largest device local heap against its budget and what the renderer uses it for
+	const bool showMemory = std::find(argv + 1, argv + argc, std::string("--show-memory")) != argv + argc;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) == "--lights")
+		{
+			lightCount = std::stoul(argv[i + 1]);
+		}
+		// Render scale follows the GPU frame time to hold the target, e.g. --target-frame-time 8.3
+		if (std::string(argv[i]) == "--target-frame-time")
+		{
+			renderer.SetTargetFrameTime(std::stod(argv[i + 1]));
+			renderer.SetDynamicResolutionEnabled(true);
+			if (renderer.IsDynamicResolutionEnabled() == false)
+			{
+				printf("Dynamic resolution: timestamp queries are not supported.\n");
+			}
+		}
+		// Antialiasing mode, one of none, fxaa or msaa
+		if (std::string(argv[i]) == "--aa")
+		{
+			const std::string mode = argv[i + 1];
+			renderer.SetAntiAliasingMode(mode == "msaa" ? AntiAliasingMode::Msaa : mode == "fxaa" ? AntiAliasingMode::Fxaa : AntiAliasingMode::None);
+			if (mode == "msaa" && renderer.IsMsaaSupported() == false)
+			{
+				printf("Antialiasing: MSAA is not supported.\n");
+			}
+		}
+	}
+
+	std::unique_ptr<DepthPrePassBenchmark> depthPrePassBenchmark;
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-depth-prepass")
+	{
+		depthPrePassBenchmark = std::make_unique<DepthPrePassBenchmark>(renderer);
+	}
+	std::unique_ptr<ShadowCacheBenchmark> shadowCacheBenchmark;
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-shadows")
+	{
+		shadowCacheBenchmark = std::make_unique<ShadowCacheBenchmark>(renderer);
+	}
+	std::unique_ptr<AntiAliasingBenchmark> antiAliasingBenchmark;
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-aa")
+	{
+		antiAliasingBenchmark = std::make_unique<AntiAliasingBenchmark>(renderer);
+	}
+	std::unique_ptr<ModelChurnBenchmark> modelChurnBenchmark;
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-model-churn")
+	{
+		modelChurnBenchmark = std::make_unique<ModelChurnBenchmark>(renderer);
+	}
+
+	// Drawing moves to its own thread and scene updates are sent through its command ring, benchmarks step the renderer directly
+	std::unique_ptr<RenderThread> renderThread;
+	const bool benchmarkRequested = depthPrePassBenchmark || shadowCacheBenchmark || antiAliasingBenchmark || modelChurnBenchmark;
+	if (benchmarkRequested == false && std::find(argv + 1, argv + argc, std::string("--render-thread")) != argv + argc)
+	{
+		renderThread = std::make_unique<RenderThread>(renderer);
+		renderThread->Start();
+	}
+
+	while (glfwWindowShouldClose(window) == false && (renderThread == nullptr || renderThread->IsRunning()))
 	{
 		glfwPollEvents();
 
+#ifdef ENABLE_PROFILING
+		if (glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS)
+		{
+			getProfiler().StartCapture(tracePath, traceFrameCount);
+		}
+#endif
+
+		// Simulation stays at most a couple of frames ahead of drawing, input is still handled while waiting
+		if (renderThread && renderThread->CanSubmitFrame() == false)
+		{
+			glfwWaitEventsTimeout(0.001);
+			continue;
+		}
+
 		float now = glfwGetTime();
 		float deltaTime = now - lastTime;
 		lastTime = now;
@@ -50,14 +312,113 @@ int main()
 			angle -= 360.0f;
 		}
 
+		// Benchmark waits for the model and drives the rotation itself, so both runs see the same frames
+		const bool benchmarkRunning = depthPrePassBenchmark && depthPrePassBenchmark->IsFinished() == false && renderer.IsModelReady(0);
+		if (benchmarkRunning)
+		{
+			angle = depthPrePassBenchmark->GetAngle();
+		}
+		const bool shadowBenchmarkRunning = shadowCacheBenchmark && shadowCacheBenchmark->IsFinished() == false && renderer.IsModelReady(0) &&
+			shadowCacheBenchmark->IsReady();
+		if (shadowBenchmarkRunning)
+		{
+			angle = shadowCacheBenchmark->GetAngle();
+		}
+		const bool antiAliasingBenchmarkRunning = antiAliasingBenchmark && antiAliasingBenchmark->IsFinished() == false && renderer.IsModelReady(0);
+		if (antiAliasingBenchmarkRunning)
+		{
+			angle = antiAliasingBenchmark->GetAngle();
+		}
+		const bool modelChurnBenchmarkRunning = modelChurnBenchmark && modelChurnBenchmark->IsFinished() == false;
+
 		glm::mat4 transform = glm::mat4(1.0f);
 		transform = glm::rotate(transform, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
 		transform = glm::scale(transform, glm::vec3(0.01f));
+		if (renderThread)
+		{
+			renderThread->UpdateModel(0, transform);
+			renderThread->SetLights(createLightRing(lightCount, 2.0f, -glm::radians(angle) * 2.0f));
+			if (animationStarted == false && renderThread->IsModelReady(0))
+			{
+				renderThread->PlayModelAnimation(0, 0);
+				animationStarted = true;
+			}
+			renderThread->SubmitFrame();
+			continue;
+		}
+
 		renderer.UpdateModel(0, transform);
+		renderer.SetLights(createLightRing(lightCount, 2.0f, -glm::radians(angle) * 2.0f));
+
+		// First clip plays once the model is in, skipped while benchmarking so all runs draw the same pose
+		if (animationStarted == false && depthPrePassBenchmark == nullptr && shadowCacheBenchmark == nullptr && antiAliasingBenchmark == nullptr &&
+			renderer.IsModelReady(0))
+		{
+			renderer.PlayModelAnimation(0, 0);
+			animationStarted = true;
+		}
 
 		renderer.Draw();
+
+		if (renderer.IsDynamicResolutionEnabled() || showAllocations || showMemory)
+		{
+			char title[512];
+			int length = snprintf(title, sizeof(title), "Vulkan window");
+			if (renderer.IsDynamicResolutionEnabled())
+			{
+				length += snprintf(title + length, sizeof(title) - length, " - %.0f%% scale, %.2f ms GPU", renderer.GetRenderScale() * 100.0f,
+					renderer.GetGpuFrameTime());
+			}
+			if (showAllocations)
+			{
+				length += snprintf(title + length, sizeof(title) - length, " - %zu heap allocations per frame, %zu KB frame arena",
+					renderer.GetFrameHeapAllocationCount(), renderer.GetFrameArenaPeakUsage() / 1024);
+			}
+			if (showMemory)
+			{
+				length += formatMemoryUsage(title + length, sizeof(title) - length);
+
+				const MeshStreamingStatistics streaming = renderer.GetMeshStreamingStatistics();
+				if (streaming.budget > 0)
+				{
+					length += snprintf(title + length, sizeof(title) - length, ", %zu of %zu meshes streamed in, %.1f of %.0f MB",
+						streaming.residentMeshCount, streaming.streamedMeshCount, streaming.residentBytes / (1024.0 * 1024.0),
+						streaming.budget / (1024.0 * 1024.0));
+				}
+
+				const TextureStreamingStatistics textureStreaming = renderer.GetTextureStreamingStatistics();
+				if (textureStreaming.budget > 0)
+				{
+					length += snprintf(title + length, sizeof(title) - length, ", %zu of %zu textures at full detail, %.1f of %.0f MB",
+						textureStreaming.fullDetailTextureCount, textureStreaming.streamedTextureCount, textureStreaming.residentBytes / (1024.0 * 1024.0),
+						textureStreaming.budget / (1024.0 * 1024.0));
+				}
+			}
+			glfwSetWindowTitle(window, title);
+		}
+
+		if (benchmarkRunning)
+		{
+			depthPrePassBenchmark->Step();
+		}
+		if (shadowBenchmarkRunning)
+		{
+			shadowCacheBenchmark->Step();
+		}
+		if (antiAliasingBenchmarkRunning)
+		{
+			antiAliasingBenchmark->Step();
+		}
+		if (modelChurnBenchmarkRunning)
+		{
+			modelChurnBenchmark->Step(deltaTime * 1000.0);
+		}
 	}
 
+	if (renderThread)
+	{
+		renderThread->Stop();
+	}
 	renderer.Deinit();
 
 	glfwDestroyWindow(window);
@@ -87,3 +448,562 @@ GLFWwindow* createWindow(const int width, const int height, std::string name)
 
 	return glfwCreateWindow(width, height, name.c_str(), nullptr, nullptr);
 }
+
+
+std::vector<Light> createLightRing(size_t count, float radius, float angle)
+{
+	std::vector<Light> lights;
+	lights.reserve(count);
+
+	// Alternating point and spot lights on a ring around the model, hue changes along the ring
+	for (size_t i = 0; i < count; i++)
+	{
+		const float phase = static_cast<float>(i) / count;
+		const float lightAngle = angle + glm::two_pi<float>() * phase;
+		const glm::vec3 position(radius * glm::cos(lightAngle), 0.5f + 0.5f * glm::sin(phase * 7.0f * glm::two_pi<float>()), radius * glm::sin(lightAngle));
+		const glm::vec3 color = glm::clamp(glm::abs(glm::fract(phase + glm::vec3(0.0f, 2.0f / 3.0f, 1.0f / 3.0f)) * 6.0f - 3.0f) - 1.0f, 0.0f, 1.0f);
+
+		if (i % 2 == 0)
+		{
+			lights.push_back(makePointLight(position, 1.5f, color));
+		}
+		else
+		{
+			lights.push_back(makeSpotLight(position, -position, 3.0f, glm::radians(15.0f), glm::radians(25.0f), color * 2.0f));
+		}
+	}
+
+	return lights;
+}
+
+int formatMemoryUsage(char* text, size_t size)
+{
+	const MemoryTracker& memoryTracker = getMemoryTracker();
+	const double MB = 1024.0 * 1024.0;
+
+	MemoryHeapBudget heap{};
+	for (uint32_t i = 0; i < memoryTracker.GetHeapCount(); i++)
+	{
+		const MemoryHeapBudget candidate = memoryTracker.GetHeapBudget(i);
+		if (candidate.deviceLocal && candidate.size > heap.size)
+		{
+			heap = candidate;
+		}
+	}
+
+	return snprintf(text, size, " - %.0f of %.0f MB%s, meshes %.0f, textures %.0f, attachments %.0f, uniforms %.0f, staging %.0f MB", heap.usage / MB,
+		heap.budget / MB, memoryTracker.IsBudgetExtensionEnabled() ? "" : " (estimated budget)",
+		memoryTracker.GetCategoryUsage(MemoryCategory::Meshes) / MB, memoryTracker.GetCategoryUsage(MemoryCategory::Textures) / MB,
+		memoryTracker.GetCategoryUsage(MemoryCategory::Attachments) / MB, memoryTracker.GetCategoryUsage(MemoryCategory::Uniforms) / MB,
+		memoryTracker.GetCategoryUsage(MemoryCategory::Staging) / MB);
+}
+
+void runJobSystemBenchmark()
+{
+	const size_t EMPTY_JOB_COUNT = 100000;
+	const size_t ELEMENT_COUNT = 1 << 22;
+	const size_t ELEMENT_BATCH_SIZE = 4096;
+	const int REPEATS = 5;
+
+	auto elapsed = [](std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	// Empty jobs only measure scheduling: pushing, stealing and counting down
+	JobSystem& jobSystem = getJobSystem();
+	{
+		JobCounter counter;
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < EMPTY_JOB_COUNT; i++)
+		{
+			jobSystem.Run([]() {}, counter);
+		}
+		jobSystem.Wait(counter);
+		printf("Empty jobs: %.1f ns per job, %zu threads\n", elapsed(start) * 1e6 / EMPTY_JOB_COUNT, jobSystem.GetThreadCount());
+	}
+	{
+		const auto start = std::chrono::steady_clock::now();
+		jobSystem.ParallelFor(EMPTY_JOB_COUNT, 1, [](size_t, size_t) {});
+		printf("Empty parallel for batches: %.1f ns per batch\n", elapsed(start) * 1e6 / EMPTY_JOB_COUNT);
+	}
+
+	// Same arithmetic over the same data with a growing number of threads, best of a few runs each
+	std::vector<float> values(ELEMENT_COUNT);
+	double singleThreadTime = 0.0;
+	for (size_t threadCount = 1; threadCount <= jobSystem.GetThreadCount(); threadCount++)
+	{
+		JobSystem scaledJobSystem(threadCount - 1);
+
+		double bestTime = 0.0;
+		for (int repeat = 0; repeat < REPEATS; repeat++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			scaledJobSystem.ParallelFor(values.size(), ELEMENT_BATCH_SIZE, [&values](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					values[i] = std::sqrt(static_cast<float>(i)) * std::sin(static_cast<float>(i));
+				}
+			});
+			const double time = elapsed(start);
+			bestTime = repeat == 0 ? time : std::min(bestTime, time);
+		}
+
+		if (threadCount == 1)
+		{
+			singleThreadTime = bestTime;
+		}
+		printf("Parallel for, %zu threads: %.2f ms, speedup %.2fx\n", threadCount, bestTime, singleThreadTime / bestTime);
+	}
+}
+
+void runModelImportBenchmark()
+{
+	const int REPEATS = 5;
+
+	// Counter covers every thread, nothing else runs here. The first import also warms up the job system and the file cache.
+	for (int repeat = 0; repeat < REPEATS; repeat++)
+	{
+		const size_t allocationCount = getHeapAllocationCount();
+		const auto start = std::chrono::steady_clock::now();
+		ModelData modelData = MeshModel::ImportModel("scooter", "scene.gltf");
+		const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+		const size_t importAllocationCount = getHeapAllocationCount() - allocationCount;
+
+		size_t vertexCount = 0;
+		for (const MeshData& meshData : modelData.meshes)
+		{
+			vertexCount += meshData.vertices.size();
+		}
+		printf("Model import %d: %.2f ms, %zu heap allocations, %zu meshes, %zu vertices\n", repeat, time.count(), importAllocationCount,
+			modelData.meshes.size(), vertexCount);
+	}
+}
+
+void runSceneGraphBenchmark()
+{
+	const int NODE_COUNT = 100000;
+	const int MOVED_NODE_COUNT = 4; // Like a few animated nodes of a model
+	const int UPDATE_COUNT = 10000;
+
+	auto elapsed = [](std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	// Random tree built depth-first, every node hangs off the last added node or one of its ancestors
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+	auto randomTransform = [&]()
+	{
+		return glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(offset(random), offset(random), offset(random))), offset(random),
+			glm::vec3(0.0f, 1.0f, 0.0f));
+	};
+
+	SceneGraph graph;
+	std::vector<int> ancestors;
+	ancestors.push_back(graph.AddNode(SceneGraph::NO_PARENT, glm::mat4(1.0f)));
+	for (int i = 1; i < NODE_COUNT; i++)
+	{
+		const size_t depth = std::uniform_int_distribution<size_t>(0, ancestors.size() - 1)(random);
+		ancestors.resize(depth + 1);
+		ancestors.push_back(graph.AddNode(ancestors.back(), randomTransform()));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	graph.UpdateWorldTransforms();
+	printf("Scene graph, %d nodes, full update: %.3f ms\n", NODE_COUNT, elapsed(start));
+
+	// Nodes are picked up front, only setting the transforms and the update are timed
+	std::vector<int> movedNodes(size_t(UPDATE_COUNT) * MOVED_NODE_COUNT);
+	std::uniform_int_distribution<int> node(1, NODE_COUNT - 1);
+	for (int& movedNode : movedNodes)
+	{
+		movedNode = node(random);
+	}
+	const glm::mat4 transform = randomTransform();
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < UPDATE_COUNT; i++)
+	{
+		for (int j = 0; j < MOVED_NODE_COUNT; j++)
+		{
+			graph.SetLocalTransform(movedNodes[size_t(i) * MOVED_NODE_COUNT + j], transform);
+		}
+		graph.UpdateWorldTransforms();
+	}
+	printf("Scene graph, %d nodes moved: %.3f us per update\n", MOVED_NODE_COUNT, elapsed(start) * 1000.0 / UPDATE_COUNT);
+
+	// Checked against a plain traversal, parents come before their children
+	std::vector<glm::mat4> worldTransforms(NODE_COUNT);
+	float maxError = 0.0f;
+	for (int i = 0; i < NODE_COUNT; i++)
+	{
+		const int parent = graph.GetParent(i);
+		worldTransforms[i] = parent == SceneGraph::NO_PARENT ? graph.GetLocalTransform(i) : worldTransforms[parent] * graph.GetLocalTransform(i);
+		for (int column = 0; column < 4; column++)
+		{
+			const glm::vec4 error = glm::abs(worldTransforms[i][column] - graph.GetWorldTransform(i)[column]);
+			maxError = std::max(maxError, std::max(std::max(error.x, error.y), std::max(error.z, error.w)));
+		}
+	}
+	printf("Scene graph, largest difference to a full traversal: %g\n", maxError);
+}
+
+
+DepthPrePassBenchmark::DepthPrePassBenchmark(VulkanRenderer& renderer) :
+	renderer_(renderer),
+	originalPrePassEnabled_(renderer.IsDepthPrePassEnabled()),
+	pass_(0),
+	frame_(0),
+	lastSampleCount_(0),
+	invocations_{ 0, 0 },
+	sampleCounts_{ 0, 0 }
+{
+	if (renderer_.IsPipelineStatisticsSupported() == false)
+	{
+		printf("Depth pre-pass benchmark: pipeline statistics queries are not supported.\n");
+		pass_ = 2;
+		return;
+	}
+
+	renderer_.SetDepthPrePassEnabled(false);
+}
+
+bool DepthPrePassBenchmark::IsFinished() const
+{
+	return pass_ >= 2;
+}
+
+float DepthPrePassBenchmark::GetAngle() const
+{
+	return 360.0f * std::max(frame_ - WARMUP_FRAMES, 0) / MEASURED_FRAMES;
+}
+
+void DepthPrePassBenchmark::Step()
+{
+	const uint64_t sampleCount = renderer_.GetStatisticsSampleCount();
+	if (frame_ >= WARMUP_FRAMES && sampleCount != lastSampleCount_)
+	{
+		invocations_[pass_] += renderer_.GetFragmentInvocations();
+		sampleCounts_[pass_]++;
+	}
+	lastSampleCount_ = sampleCount;
+
+	frame_++;
+	if (frame_ < WARMUP_FRAMES + MEASURED_FRAMES)
+	{
+		return;
+	}
+
+	frame_ = 0;
+	pass_++;
+
+	if (pass_ == 1)
+	{
+		renderer_.SetDepthPrePassEnabled(true);
+		return;
+	}
+
+	const double averageWithout = static_cast<double>(invocations_[0]) / std::max(sampleCounts_[0], 1);
+	const double averageWith = static_cast<double>(invocations_[1]) / std::max(sampleCounts_[1], 1);
+	printf("Depth pre-pass benchmark, fragment shader invocations per frame:\n");
+	printf("  pre-pass off: %12.0f\n", averageWithout);
+	printf("  pre-pass on:  %12.0f (%.1f%%)\n", averageWith, averageWithout > 0.0 ? 100.0 * averageWith / averageWithout : 0.0);
+
+	renderer_.SetDepthPrePassEnabled(originalPrePassEnabled_);
+}
+
+
+ShadowCacheBenchmark::ShadowCacheBenchmark(VulkanRenderer& renderer) :
+	renderer_(renderer),
+	originalCacheEnabled_(renderer.IsShadowCacheEnabled()),
+	pass_(0),
+	frame_(0),
+	lastSampleCount_(0),
+	shadowPassTimes_{ 0.0, 0.0 },
+	sampleCounts_{ 0, 0 }
+{
+	if (renderer_.IsTimestampSupported() == false)
+	{
+		printf("Shadow cache benchmark: timestamp queries are not supported.\n");
+		pass_ = 2;
+		return;
+	}
+
+	// Transforms are set once, a static model moving would invalidate the cache every frame
+	for (int i = 0; i < STATIC_MODEL_COUNT; i++)
+	{
+		const float modelAngle = glm::two_pi<float>() * i / STATIC_MODEL_COUNT;
+
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * glm::cos(modelAngle), 0.0f, 3.0f * glm::sin(modelAngle)));
+		transform = glm::rotate(transform, -modelAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+		transform = glm::scale(transform, glm::vec3(0.01f));
+
+		const int model = renderer_.AddModel("scooter", "scene.gltf");
+		renderer_.UpdateModel(model, transform);
+		renderer_.SetModelStatic(model, true);
+		staticModels_.push_back(model);
+	}
+
+	renderer_.SetShadowCacheEnabled(true);
+}
+
+bool ShadowCacheBenchmark::IsReady() const
+{
+	return std::all_of(staticModels_.begin(), staticModels_.end(), [this](int model) { return renderer_.IsModelReady(model); });
+}
+
+bool ShadowCacheBenchmark::IsFinished() const
+{
+	return pass_ >= 2;
+}
+
+float ShadowCacheBenchmark::GetAngle() const
+{
+	return 360.0f * std::max(frame_ - WARMUP_FRAMES, 0) / MEASURED_FRAMES;
+}
+
+void ShadowCacheBenchmark::Step()
+{
+	const uint64_t sampleCount = renderer_.GetTimestampSampleCount();
+	if (frame_ >= WARMUP_FRAMES && sampleCount != lastSampleCount_)
+	{
+		shadowPassTimes_[pass_] += renderer_.GetShadowPassTime();
+		sampleCounts_[pass_]++;
+	}
+	lastSampleCount_ = sampleCount;
+
+	frame_++;
+	if (frame_ < WARMUP_FRAMES + MEASURED_FRAMES)
+	{
+		return;
+	}
+
+	frame_ = 0;
+	pass_++;
+
+	if (pass_ == 1)
+	{
+		renderer_.SetShadowCacheEnabled(false);
+		return;
+	}
+
+	const double averageCached = shadowPassTimes_[0] / std::max(sampleCounts_[0], 1);
+	const double averageUncached = shadowPassTimes_[1] / std::max(sampleCounts_[1], 1);
+	printf("Shadow cache benchmark, GPU time of the shadow passes per frame (%d static models):\n", STATIC_MODEL_COUNT);
+	printf("  cache off: %8.3f ms\n", averageUncached);
+	printf("  cache on:  %8.3f ms (%.1f%%)\n", averageCached, averageUncached > 0.0 ? 100.0 * averageCached / averageUncached : 0.0);
+
+	renderer_.SetShadowCacheEnabled(originalCacheEnabled_);
+}
+
+
+const AntiAliasingMode AntiAliasingBenchmark::MODES[MODE_COUNT] = { AntiAliasingMode::None, AntiAliasingMode::Fxaa, AntiAliasingMode::Msaa };
+const char* const AntiAliasingBenchmark::MODE_NAMES[MODE_COUNT] = { "none", "FXAA", "MSAA" };
+
+AntiAliasingBenchmark::AntiAliasingBenchmark(VulkanRenderer& renderer) :
+	renderer_(renderer),
+	originalMode_(renderer.GetAntiAliasingMode()),
+	pass_(0),
+	frame_(0),
+	lastSampleCount_(0),
+	frameTimes_{ 0.0, 0.0, 0.0 },
+	sampleCounts_{ 0, 0, 0 }
+{
+	if (renderer_.IsTimestampSupported() == false)
+	{
+		printf("Antialiasing benchmark: timestamp queries are not supported.\n");
+		pass_ = MODE_COUNT;
+		return;
+	}
+
+	renderer_.SetAntiAliasingMode(MODES[0]);
+}
+
+bool AntiAliasingBenchmark::IsFinished() const
+{
+	return pass_ >= MODE_COUNT;
+}
+
+float AntiAliasingBenchmark::GetAngle() const
+{
+	return 360.0f * std::max(frame_ - WARMUP_FRAMES, 0) / MEASURED_FRAMES;
+}
+
+void AntiAliasingBenchmark::Step()
+{
+	const uint64_t sampleCount = renderer_.GetTimestampSampleCount();
+	if (frame_ >= WARMUP_FRAMES && sampleCount != lastSampleCount_)
+	{
+		frameTimes_[pass_] += renderer_.GetGpuFrameTime();
+		sampleCounts_[pass_]++;
+	}
+	lastSampleCount_ = sampleCount;
+
+	frame_++;
+	if (frame_ < WARMUP_FRAMES + MEASURED_FRAMES)
+	{
+		return;
+	}
+
+	frame_ = 0;
+	pass_++;
+
+	// Modes the device can't do are skipped
+	while (pass_ < MODE_COUNT && MODES[pass_] == AntiAliasingMode::Msaa && renderer_.IsMsaaSupported() == false)
+	{
+		pass_++;
+	}
+	if (pass_ < MODE_COUNT)
+	{
+		renderer_.SetAntiAliasingMode(MODES[pass_]);
+		return;
+	}
+
+	const double averageNone = frameTimes_[0] / std::max(sampleCounts_[0], 1);
+	printf("Antialiasing benchmark, GPU time per frame:\n");
+	for (int i = 0; i < MODE_COUNT; i++)
+	{
+		if (MODES[i] == AntiAliasingMode::Msaa && renderer_.IsMsaaSupported() == false)
+		{
+			printf("  %-5s  not supported\n", MODE_NAMES[i]);
+			continue;
+		}
+
+		const double average = frameTimes_[i] / std::max(sampleCounts_[i], 1);
+		printf("  %-5s %8.3f ms (%+.3f ms)\n", MODE_NAMES[i], average, average - averageNone);
+	}
+
+	renderer_.SetAntiAliasingMode(originalMode_);
+}
+
+
+ModelChurnBenchmark::ModelChurnBenchmark(VulkanRenderer& renderer) :
+	renderer_(renderer),
+	frame_(0),
+	addedModelCount_(0),
+	failedModelCount_(0),
+	pendingDeletionCount_(0)
+{
+	frameTimes_.reserve(MEASURED_FRAMES);
+	commitTimes_.reserve(MEASURED_FRAMES);
+	removalTimes_.reserve(MEASURED_FRAMES);
+	deletionTimes_.reserve(MEASURED_FRAMES);
+}
+
+bool ModelChurnBenchmark::IsFinished() const
+{
+	return frame_ >= WARMUP_FRAMES + MEASURED_FRAMES;
+}
+
+void ModelChurnBenchmark::Step(double frameTime)
+{
+	const bool measured = frame_ >= WARMUP_FRAMES;
+	if (measured)
+	{
+		frameTimes_.push_back(frameTime);
+	}
+
+	// Loads which finished were committed by the draw before this step, failed ones are dropped
+	bool committed = false;
+	for (auto model = loadingModels_.begin(); model != loadingModels_.end();)
+	{
+		if (renderer_.HasModelFailed(*model))
+		{
+			renderer_.RemoveModel(*model);
+			failedModelCount_++;
+		}
+		else if (renderer_.IsModelReady(*model))
+		{
+			loadedModels_.push_back(*model);
+			committed = true;
+		}
+		else
+		{
+			model++;
+			continue;
+		}
+
+		model = loadingModels_.erase(model);
+	}
+	if (measured && committed)
+	{
+		commitTimes_.push_back(renderer_.GetAssetCommitTime());
+	}
+	if (measured && renderer_.GetPendingDeletionCount() < pendingDeletionCount_)
+	{
+		deletionTimes_.push_back(renderer_.GetDeletionTime());
+	}
+
+	// Oldest loaded model out once another one is in
+	while (loadedModels_.size() > LIVE_MODEL_COUNT)
+	{
+		auto removalStart = std::chrono::steady_clock::now();
+		renderer_.RemoveModel(loadedModels_.front());
+		std::chrono::duration<double, std::milli> removalTime = std::chrono::steady_clock::now() - removalStart;
+		if (measured)
+		{
+			removalTimes_.push_back(removalTime.count());
+		}
+		loadedModels_.pop_front();
+	}
+	pendingDeletionCount_ = renderer_.GetPendingDeletionCount();
+
+	if (loadingModels_.size() < MAX_LOADS_IN_FLIGHT)
+	{
+		const int ringSize = LIVE_MODEL_COUNT + MAX_LOADS_IN_FLIGHT;
+		const float modelAngle = glm::two_pi<float>() * (addedModelCount_ % ringSize) / ringSize;
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * glm::cos(modelAngle), 0.0f, 3.0f * glm::sin(modelAngle)));
+		transform = glm::scale(transform, glm::vec3(0.01f));
+
+		const int model = renderer_.AddModel("scooter", "scene.gltf");
+		renderer_.UpdateModel(model, transform);
+		loadingModels_.push_back(model);
+		addedModelCount_++;
+	}
+
+	frame_++;
+	if (IsFinished() == false)
+	{
+		return;
+	}
+
+	for (int model : loadingModels_)
+	{
+		renderer_.RemoveModel(model);
+	}
+	loadingModels_.clear();
+	for (int model : loadedModels_)
+	{
+		renderer_.RemoveModel(model);
+	}
+	loadedModels_.clear();
+
+	printf("Model churn benchmark, %d models added and %zu removed after loading (%d frames, %d loads failed):\n", addedModelCount_,
+		removalTimes_.size(), MEASURED_FRAMES, failedModelCount_);
+	PrintTimes("frame time", frameTimes_);
+	PrintTimes("commit in draw", commitTimes_);
+	PrintTimes("RemoveModel", removalTimes_);
+	PrintTimes("deferred free in draw", deletionTimes_);
+	printf("  pending deletions: %zu\n", renderer_.GetPendingDeletionCount());
+}
+
+void ModelChurnBenchmark::PrintTimes(const char* name, std::vector<double>& times)
+{
+	if (times.empty())
+	{
+		printf("  %-22s no samples\n", name);
+		return;
+	}
+
+	std::sort(times.begin(), times.end());
+	double totalTime = 0.0;
+	for (double time : times)
+	{
+		totalTime += time;
+	}
+	printf("  %-22s average %8.3f ms, median %8.3f ms, p99 %8.3f ms, max %8.3f ms (%zu samples)\n", name, totalTime / times.size(),
+		times[times.size() / 2], times[times.size() * 99 / 100], times.back(), times.size());
+}
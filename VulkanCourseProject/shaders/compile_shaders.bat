@@ -1,5 +1,9 @@
 C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V shader.frag
+C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -o depth_vert.spv -V depth.vert
+C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -o shadow_vert.spv -V shadow.vert
+C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -o skinning_comp.spv -V skinning.comp
+C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -o light_culling_comp.spv -V light_culling.comp
 C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -o second_vert.spv -V second.vert
 C:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -o second_frag.spv -V second.frag
 pause
\ No newline at end of file
@@ -0,0 +1,52 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform UboViewProjection {
+	mat4 projection;
+	mat4 view;
+} uboViewProjection;
+
+// Same layout as in shader.vert
+struct ObjectData {
+	mat4 model;
+	vec4 positionScale;
+	vec4 positionBias;
+	uint textureIndex;
+	uint normalTextureIndex;
+	uint vertexFormat;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Objects {
+	ObjectData objects[];
+};
+
+// Position-only stream, indexed with the pre-pass vertex offsets
+layout(std430, set = 0, binding = 3) readonly buffer Positions {
+	uint positionWords[];
+};
+
+// Color pass depth-tests with EQUAL, both passes have to compute bit-identical positions
+invariant gl_Position;
+
+const uint VERTEX_FORMAT_COMPACT = 1;
+
+void main()
+{
+	ObjectData object = objects[gl_InstanceIndex];
+
+	vec3 position;
+	if (object.vertexFormat == VERTEX_FORMAT_COMPACT)
+	{
+		uint base = gl_VertexIndex * 2;
+		position = vec3(unpackSnorm2x16(positionWords[base + 0]), unpackSnorm2x16(positionWords[base + 1]).x);
+	}
+	else
+	{
+		uint base = gl_VertexIndex * 3;
+		position = uintBitsToFloat(uvec3(positionWords[base + 0], positionWords[base + 1], positionWords[base + 2]));
+	}
+
+	position = position * object.positionScale.xyz + object.positionBias.xyz;
+	// Same operation order as shader.vert
+	vec4 worldPosition = object.model * vec4(position, 1.0);
+	gl_Position = uboViewProjection.projection * (uboViewProjection.view * worldPosition);
+}
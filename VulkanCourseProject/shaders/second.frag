@@ -1,7 +1,14 @@
 #version 450
 
-layout(input_attachment_index = 0, binding = 0) uniform subpassInput inputColor;
-layout(input_attachment_index = 1, binding = 1) uniform subpassInput inputDepth;
+// Scene is rendered into the top left part of the attachments, sampled instead of loaded to upscale it to the output
+layout(binding = 0) uniform sampler2D inputColor;
+layout(binding = 1) uniform sampler2D inputDepth;
+
+layout(push_constant) uniform Composite
+{
+	vec4 renderArea; // Rendered width and height, output width and height
+	uint fxaaEnabled;
+} pushConstants;
 
 layout(location = 0) out vec4 outColor;
 
@@ -9,16 +16,76 @@ int borderCoord = 400;
 float lowerBound = 0.95;
 float upperBound = 1.0;
 
+// FXAA tuning, edges with a local contrast below the thresholds are left as they are
+const float FXAA_EDGE_THRESHOLD = 0.125;
+const float FXAA_EDGE_THRESHOLD_MIN = 0.0312;
+const float FXAA_REDUCE_MUL = 1.0 / 8.0;
+const float FXAA_REDUCE_MIN = 1.0 / 128.0;
+const float FXAA_SPAN_MAX = 8.0;
+
+vec2 renderSize;
+vec2 attachmentSize;
+
+// Bilinear sample at a position in rendered pixels, clamped so the filter never reaches pixels outside the rendered area
+vec4 sampleColor(vec2 renderCoord)
+{
+	vec2 uv = clamp(renderCoord, vec2(0.5), renderSize - 0.5) / attachmentSize;
+	return textureLod(inputColor, uv, 0.0);
+}
+
+float luma(vec4 color)
+{
+	return dot(color.rgb, vec3(0.299, 0.587, 0.114));
+}
+
+// Blurs along the edge direction estimated from the luma of the four diagonal neighbours
+vec4 fxaa(vec2 renderCoord)
+{
+	vec4 colorM = sampleColor(renderCoord);
+	float lumaNW = luma(sampleColor(renderCoord + vec2(-1.0, -1.0)));
+	float lumaNE = luma(sampleColor(renderCoord + vec2(1.0, -1.0)));
+	float lumaSW = luma(sampleColor(renderCoord + vec2(-1.0, 1.0)));
+	float lumaSE = luma(sampleColor(renderCoord + vec2(1.0, 1.0)));
+	float lumaM = luma(colorM);
+
+	float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+	float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+	if (lumaMax - lumaMin < max(FXAA_EDGE_THRESHOLD_MIN, lumaMax * FXAA_EDGE_THRESHOLD))
+	{
+		return colorM;
+	}
+
+	vec2 direction = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+	float directionReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * FXAA_REDUCE_MUL, FXAA_REDUCE_MIN);
+	float inverseDirectionMin = 1.0 / (min(abs(direction.x), abs(direction.y)) + directionReduce);
+	direction = clamp(direction * inverseDirectionMin, vec2(-FXAA_SPAN_MAX), vec2(FXAA_SPAN_MAX));
+
+	vec4 colorA = 0.5 * (sampleColor(renderCoord + direction * (1.0 / 3.0 - 0.5)) + sampleColor(renderCoord + direction * (2.0 / 3.0 - 0.5)));
+	vec4 colorB = colorA * 0.5 + 0.25 * (sampleColor(renderCoord - direction * 0.5) + sampleColor(renderCoord + direction * 0.5));
+
+	// The wider blend is rejected when it picked up colors from across the edge
+	float lumaB = luma(colorB);
+	return lumaB < lumaMin || lumaB > lumaMax ? colorA : colorB;
+}
+
 void main()
 {
+	renderSize = pushConstants.renderArea.xy;
+	attachmentSize = pushConstants.renderArea.zw;
+	vec2 renderCoord = gl_FragCoord.xy * renderSize / attachmentSize;
+
 	if (gl_FragCoord.x > borderCoord)
 	{
-		float depth = subpassLoad(inputDepth).r;
+		float depth = texelFetch(inputDepth, ivec2(renderCoord), 0).r;
 		float depthScaled = 1.0 - ((depth - lowerBound) / (upperBound - lowerBound));
 		outColor = vec4(depthScaled, 0.0, 0.0, 1.0);
 	}
+	else if (pushConstants.fxaaEnabled != 0)
+	{
+		outColor = fxaa(renderCoord);
+	}
 	else
 	{
-		outColor = subpassLoad(inputColor).rgba;
+		outColor = sampleColor(renderCoord);
 	}
 }
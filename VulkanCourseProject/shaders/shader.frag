@@ -1,14 +1,165 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(location = 0) in vec3 fragColor;
+// Occluded fragments don't report texture feedback
+layout(early_fragment_tests) in;
+
+layout(location = 0) in vec3 fragNormal;
 layout(location = 1) in vec2 texCoords;
+layout(location = 2) flat in uint textureIndex;
+layout(location = 3) in vec4 fragTangent;
+layout(location = 4) in vec3 fragPosition;
+layout(location = 5) flat in uint normalTextureIndex;
+layout(location = 6) in float fragViewDepth;
+
+layout(set = 0, binding = 4) uniform LightingData {
+	vec4 ambientColor;
+	vec4 sunDirection;
+	vec4 sunColor;
+	vec4 viewport; // Width, height, near and far plane
+	uint lightCount;
+	mat4 cascadeViewProjections[4]; // World to shadow map
+	vec4 cascadeSplits; // View depth at which each cascade ends
+} lighting;
+
+// Position w is the range, color w and direction w are cosines of the inner and outer cone angles
+struct Light {
+	vec4 position;
+	vec4 color;
+	vec4 direction;
+};
+
+layout(std430, set = 0, binding = 5) readonly buffer Lights {
+	Light lights[];
+};
+
+// Per cluster: light count, then MAX_CLUSTER_LIGHTS light indices
+layout(std430, set = 0, binding = 6) readonly buffer Clusters {
+	uint clusterLights[];
+};
 
-layout(set = 1, binding = 0) uniform sampler2D textureSampler;
+// Sun shadow cascades, one per layer
+layout(set = 0, binding = 7) uniform sampler2DArrayShadow shadowMap;
+
+// Per texture descriptor: finest level of detail sampled, reset by the CPU after reading
+layout(std430, set = 0, binding = 8) buffer TextureFeedback {
+	uint textureFeedback[];
+};
+
+// Bindless, only loaded textures are written
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 
 layout(location = 0) out vec4 outColor;
 
+// Same as in Lighting.h
+const uint CLUSTER_COUNT_X = 16;
+const uint CLUSTER_COUNT_Y = 9;
+const uint CLUSTER_COUNT_Z = 24;
+const uint MAX_CLUSTER_LIGHTS = 128;
+
+// Same as in Shadow.h
+const uint SHADOW_CASCADE_COUNT = 4;
+
+const uint NO_TEXTURE_INDEX = 0xFFFFFFFF;
+
+// Same as in TextureStreamer.h, levels of detail finer than the first mip are negative
+const float TEXTURE_FEEDBACK_LOD_BIAS = 16.0;
+
+uint getCluster()
+{
+	uvec2 tile = uvec2(gl_FragCoord.xy * vec2(CLUSTER_COUNT_X, CLUSTER_COUNT_Y) / lighting.viewport.xy);
+	tile = min(tile, uvec2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+
+	// Exponential slices, each one is as deep as it is wide on screen
+	float near = lighting.viewport.z;
+	float far = lighting.viewport.w;
+	uint slice = uint(max(log(fragViewDepth / near) / log(far / near) * CLUSTER_COUNT_Z, 0.0));
+	slice = min(slice, CLUSTER_COUNT_Z - 1);
+
+	return (slice * CLUSTER_COUNT_Y + tile.y) * CLUSTER_COUNT_X + tile.x;
+}
+
+float getSunShadow()
+{
+	uint cascade = 0;
+	while (cascade < SHADOW_CASCADE_COUNT && fragViewDepth > lighting.cascadeSplits[cascade])
+	{
+		cascade++;
+	}
+	if (cascade == SHADOW_CASCADE_COUNT)
+	{
+		return 1.0;
+	}
+
+	// Light projection isn't flipped, shadow map rows go the same way as NDC
+	vec4 shadowPosition = lighting.cascadeViewProjections[cascade] * vec4(fragPosition, 1.0);
+	vec2 shadowCoords = shadowPosition.xy * 0.5 + 0.5;
+
+	// Comparison is filtered over the 2x2 nearest texels
+	return texture(shadowMap, vec4(shadowCoords, float(cascade), shadowPosition.z));
+}
+
+void writeTextureFeedback(uint index, float lod)
+{
+	atomicMin(textureFeedback[index], uint(clamp(floor(lod) + TEXTURE_FEEDBACK_LOD_BIAS, 0.0, 31.0)));
+}
+
 void main()
 {
-	outColor = texture(textureSampler, texCoords);
+	// Differs between draws of one indirect call
+	vec4 albedo = texture(textures[nonuniformEXT(textureIndex)], texCoords);
+
+	// Queried outside of branches, derivatives are undefined in non-uniform control flow
+	uint feedbackNormalIndex = normalTextureIndex != NO_TEXTURE_INDEX ? normalTextureIndex : textureIndex;
+	float albedoLod = textureQueryLod(textures[nonuniformEXT(textureIndex)], texCoords).y;
+	float normalLod = textureQueryLod(textures[nonuniformEXT(feedbackNormalIndex)], texCoords).y;
+
+	// One pixel in four reports, that's plenty to find the finest level and keeps the atomics down
+	uvec2 pixel = uvec2(gl_FragCoord.xy);
+	if (((pixel.x ^ pixel.y) & 3u) == 0u)
+	{
+		writeTextureFeedback(textureIndex, albedoLod);
+		if (normalTextureIndex != NO_TEXTURE_INDEX)
+		{
+			writeTextureFeedback(normalTextureIndex, normalLod);
+		}
+	}
+
+	vec3 normal = normalize(fragNormal);
+	if (normalTextureIndex != NO_TEXTURE_INDEX)
+	{
+		vec3 tangent = normalize(fragTangent.xyz - normal * dot(normal, fragTangent.xyz));
+		vec3 bitangent = cross(normal, tangent) * fragTangent.w;
+		vec3 tangentNormal = texture(textures[nonuniformEXT(normalTextureIndex)], texCoords).xyz * 2.0 - 1.0;
+		normal = normalize(mat3(tangent, bitangent, normal) * tangentNormal);
+	}
+
+	vec3 radiance = lighting.ambientColor.rgb + lighting.sunColor.rgb * max(dot(normal, lighting.sunDirection.xyz), 0.0) * getSunShadow();
+
+	uint clusterBase = getCluster() * (MAX_CLUSTER_LIGHTS + 1);
+	uint clusterLightCount = clusterLights[clusterBase];
+	for (uint i = 0; i < clusterLightCount; i++)
+	{
+		Light light = lights[clusterLights[clusterBase + 1 + i]];
+
+		vec3 toLight = light.position.xyz - fragPosition;
+		float distance = length(toLight);
+		float range = light.position.w;
+		if (distance >= range)
+		{
+			continue;
+		}
+
+		vec3 direction = toLight / distance;
+
+		// Inverse square falloff windowed to reach zero at the range
+		float window = clamp(1.0 - pow(distance / range, 4.0), 0.0, 1.0);
+		float attenuation = window * window / (distance * distance + 1.0);
+		float cone = smoothstep(light.direction.w, light.color.w, dot(-direction, light.direction.xyz));
+
+		radiance += light.color.rgb * max(dot(normal, direction), 0.0) * attenuation * cone;
+	}
+
+	outColor = vec4(albedo.rgb * radiance, albedo.a);
 }
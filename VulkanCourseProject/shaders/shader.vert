@@ -1,30 +1,92 @@
 #version 450
 
-layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aColor;
-layout(location = 2) in vec2 aTexCoords;
-
 layout(set = 0, binding = 0) uniform UboViewProjection {
 	mat4 projection;
 	mat4 view;
 } uboViewProjection;
 
-// Not used
-layout(set = 0, binding = 1) uniform UboModel {
+// Indexed by the draw's first instance
+struct ObjectData {
 	mat4 model;
-} uboModel;
+	vec4 positionScale;
+	vec4 positionBias;
+	uint textureIndex;
+	uint normalTextureIndex;
+	uint vertexFormat;
+};
 
-layout (push_constant) uniform PushModel {
-	mat4 model;
-} pushModel;
+layout(std430, set = 0, binding = 1) readonly buffer Objects {
+	ObjectData objects[];
+};
+
+// Whole geometry buffer, vertices are pulled manually
+layout(std430, set = 0, binding = 2) readonly buffer Vertices {
+	uint vertexWords[];
+};
 
-layout(location = 0) out vec3 fragColor;
+// Lighting is done in world space
+layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 texCoords;
+layout(location = 2) flat out uint textureIndex;
+layout(location = 3) out vec4 fragTangent;
+layout(location = 4) out vec3 fragPosition;
+layout(location = 5) flat out uint normalTextureIndex;
+layout(location = 6) out float fragViewDepth;
+
+// Must match depth.vert exactly for the EQUAL depth test after the pre-pass
+invariant gl_Position;
+
+const uint VERTEX_FORMAT_FULL = 0;
+const uint VERTEX_FORMAT_COMPACT = 1;
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float t = max(-normal.z, 0.0);
+	normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+
+	return normalize(normal);
+}
 
 void main()
 {
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(aPosition, 1.0);
+	ObjectData object = objects[gl_InstanceIndex];
+
+	vec3 position;
+	vec3 normal;
+	vec2 uv;
+	vec4 tangent;
+	if (object.vertexFormat == VERTEX_FORMAT_COMPACT)
+	{
+		// 20 bytes: snorm16 xyz position relative to mesh bounds with bitangent sign in w, half uv, snorm16 octahedral normal and tangent
+		uint base = gl_VertexIndex * 5;
+		vec2 positionZW = unpackSnorm2x16(vertexWords[base + 1]);
+		position = vec3(unpackSnorm2x16(vertexWords[base + 0]), positionZW.x);
+		uv = unpackHalf2x16(vertexWords[base + 2]);
+		normal = decodeOctahedral(unpackSnorm2x16(vertexWords[base + 3]));
+		tangent = vec4(decodeOctahedral(unpackSnorm2x16(vertexWords[base + 4])), positionZW.y);
+	}
+	else
+	{
+		// 48 bytes: fp32 position, normal, uv and tangent
+		uint base = gl_VertexIndex * 12;
+		position = uintBitsToFloat(uvec3(vertexWords[base + 0], vertexWords[base + 1], vertexWords[base + 2]));
+		normal = uintBitsToFloat(uvec3(vertexWords[base + 3], vertexWords[base + 4], vertexWords[base + 5]));
+		uv = uintBitsToFloat(uvec2(vertexWords[base + 6], vertexWords[base + 7]));
+		tangent = uintBitsToFloat(uvec4(vertexWords[base + 8], vertexWords[base + 9], vertexWords[base + 10], vertexWords[base + 11]));
+	}
+
+	position = position * object.positionScale.xyz + object.positionBias.xyz;
+	vec4 worldPosition = object.model * vec4(position, 1.0);
+	vec4 viewPosition = uboViewProjection.view * worldPosition;
+	gl_Position = uboViewProjection.projection * viewPosition;
 
-	fragColor = aColor;
-	texCoords = aTexCoords;
+	// Model matrices are expected to scale uniformly, normalized in the fragment shader
+	fragNormal = mat3(object.model) * normal;
+	fragTangent = vec4(mat3(object.model) * tangent.xyz, tangent.w);
+	fragPosition = worldPosition.xyz;
+	fragViewDepth = -viewPosition.z;
+	texCoords = uv;
+	textureIndex = object.textureIndex;
+	normalTextureIndex = object.normalTextureIndex;
 }